@@ -0,0 +1,118 @@
+#include "bus_trace.h"
+#include <stdlib.h>
+#include <string.h>
+
+static bus_trace_record_t ring[BUS_TRACE_DEPTH];
+static uint32_t head = 0;       // Total records written, the ring index is head % BUS_TRACE_DEPTH
+static uint32_t scratch[BUS_TRACE_DEPTH];
+
+void bus_trace_init(void) {
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    head = 0;
+    memset(ring, 0, sizeof(ring));
+}
+
+uint32_t bus_trace_now(void) {
+    return DWT->CYCCNT;
+}
+
+void bus_trace_record(const bus_trace_span_t* span, uint8_t device, uint8_t op, uint32_t bytes) {
+    uint32_t end = bus_trace_now();
+#if defined(__ARM_ARCH)
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+#endif
+    bus_trace_record_t* record = &ring[head % BUS_TRACE_DEPTH];
+    head++;
+#if defined(__ARM_ARCH)
+    __set_PRIMASK(primask);
+#endif
+    record->start = span->start;
+    record->end = end;
+    record->cs_cycles = span->cs_low ? (span->cs_high - span->cs_low) : 0;
+    record->bytes = (bytes > 0xFFFF) ? 0xFFFF : (uint16_t)bytes;
+    record->device = device;
+    record->op = op;
+}
+
+static uint32_t window_size(void) {
+    return (head < BUS_TRACE_DEPTH) ? head : BUS_TRACE_DEPTH;
+}
+
+static const bus_trace_record_t* window_record(uint32_t index) {
+    return &ring[(head - window_size() + index) % BUS_TRACE_DEPTH];
+}
+
+uint32_t bus_trace_read(bus_trace_record_t* records, uint32_t max) {
+    if (records == NULL) return 0;
+    uint32_t count = window_size();
+    if (count > max) count = max;
+    for (uint32_t i = 0; i < count; i++) records[i] = *window_record(window_size() - count + i);
+    return count;
+}
+
+static int compare_cycles(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+static uint32_t busy_cycles(const bus_trace_record_t* record) {
+    return record->cs_cycles ? record->cs_cycles : (record->end - record->start);
+}
+
+int bus_trace_get_stats(bus_trace_summary_t* summary, bus_trace_op_stats_t* ops, uint32_t max_ops, uint32_t* op_count) {
+    if (summary == NULL) return -1;
+    memset(summary, 0, sizeof(*summary));
+    if (op_count != NULL) *op_count = 0;
+    uint32_t count = window_size();
+    summary->records = count;
+    summary->dropped = head - count;
+    if (count == 0) return 0;
+
+    uint64_t busy = 0;
+    uint32_t window_start = window_record(0)->start;
+    uint32_t window_end = window_start;
+    for (uint32_t i = 0; i < count; i++) {
+        const bus_trace_record_t* record = window_record(i);
+        if (record->bytes != 0) busy += busy_cycles(record);   // A latch holds RCLK, not the bus
+        if ((int32_t)(record->end - window_end) > 0) window_end = record->end;
+    }
+    summary->window_cycles = window_end - window_start;
+    if (summary->window_cycles != 0) {
+        float seconds = (float)summary->window_cycles / (float)SystemCoreClock;
+        summary->transactions_per_second = (float)count / seconds;
+        summary->utilisation = (float)busy / (float)summary->window_cycles;
+    }
+    if (ops == NULL) return 0;
+
+    // One pass per device / operation pair, call latencies gathered and sorted for the percentiles
+    uint32_t found = 0;
+    for (uint32_t i = 0; (i < count) && (found < max_ops); i++) {
+        const bus_trace_record_t* first = window_record(i);
+        uint8_t seen = 0;
+        for (uint32_t j = 0; j < found; j++) {
+            if ((ops[j].device == first->device) && (ops[j].op == first->op)) seen = 1;
+        }
+        if (seen) continue;
+
+        bus_trace_op_stats_t* op = &ops[found++];
+        memset(op, 0, sizeof(*op));
+        op->device = first->device;
+        op->op = first->op;
+        for (uint32_t j = i; j < count; j++) {
+            const bus_trace_record_t* record = window_record(j);
+            if ((record->device != op->device) || (record->op != op->op)) continue;
+            scratch[op->count++] = record->end - record->start;
+            op->bytes += record->bytes;
+            op->busy_cycles += busy_cycles(record);
+        }
+        qsort(scratch, op->count, sizeof(scratch[0]), &compare_cycles);
+        op->p50_cycles = scratch[(op->count - 1) / 2];
+        op->p99_cycles = scratch[((op->count - 1) * 99) / 100];
+        op->max_cycles = scratch[op->count - 1];
+    }
+    if (op_count != NULL) *op_count = found;
+    return 0;
+}
@@ -0,0 +1,123 @@
+#ifndef BUS_TRACE_H_
+#define BUS_TRACE_H_
+
+#include "main.h"
+#include <stdint.h>
+
+/*
+ * Bus transaction tracing for the drivers. Build everything with BUS_TRACE_ENABLE defined to record every
+ * transport call; without it the driver hooks compile to nothing and this file is not needed.
+ * Times are DWT->CYCCNT cycles (the virtual clock on the host build).
+ */
+
+// Ring buffer size in records, a power of 2. Statistics cover the records still in the ring
+#ifndef BUS_TRACE_DEPTH
+#define BUS_TRACE_DEPTH 256
+#endif
+
+// Distinct device / operation pairs reported by bus_trace_get_stats
+#ifndef BUS_TRACE_MAX_OPS
+#define BUS_TRACE_MAX_OPS 32
+#endif
+
+#if (BUS_TRACE_DEPTH & (BUS_TRACE_DEPTH - 1)) != 0
+#error "BUS_TRACE_DEPTH must be a power of 2"
+#endif
+
+#define BUS_TRACE_ICM42688 1
+#define BUS_TRACE_SN74HC595 2
+#define BUS_TRACE_W25Q64JV 3
+
+// SN74HC595 operations, the other drivers record the opcode or the R/W + register byte
+#define BUS_TRACE_OP_SHIFT 0x00
+#define BUS_TRACE_OP_LATCH 0x01
+
+typedef struct {
+    uint32_t start;         // Transport call entered
+    uint32_t end;           // Transport call returned
+    uint32_t cs_cycles;     // CS held low (RCLK high for a latch), 0 without a chip select
+    uint16_t bytes;
+    uint8_t device;
+    uint8_t op;
+} bus_trace_record_t;
+
+typedef struct {
+    uint32_t start;
+    uint32_t cs_low;
+    uint32_t cs_high;
+} bus_trace_span_t;
+
+typedef struct {
+    uint8_t device;
+    uint8_t op;
+    uint32_t count;
+    uint32_t bytes;
+    uint32_t p50_cycles;
+    uint32_t p99_cycles;
+    uint32_t max_cycles;
+    uint64_t busy_cycles;   // CS hold time, or call time without a chip select
+} bus_trace_op_stats_t;
+
+typedef struct {
+    uint32_t records;       // Records in the window
+    uint32_t dropped;       // Overwritten since bus_trace_init
+    uint32_t window_cycles; // First start to last end
+    float transactions_per_second;
+    float utilisation;      // Busy time of records that clock bytes / window, 0 to 1 per bus
+} bus_trace_summary_t;
+
+#ifdef BUS_TRACE_ENABLE
+#define BUS_TRACE_BEGIN(span) bus_trace_span_t span = {bus_trace_now(), 0, 0}
+#define BUS_TRACE_CS_LOW(span) (span).cs_low = bus_trace_now()
+#define BUS_TRACE_CS_HIGH(span) (span).cs_high = bus_trace_now()
+#define BUS_TRACE_END(span, device, op, bytes) bus_trace_record(&(span), (device), (op), (bytes))
+#else
+#define BUS_TRACE_BEGIN(span)
+#define BUS_TRACE_CS_LOW(span)
+#define BUS_TRACE_CS_HIGH(span)
+#define BUS_TRACE_END(span, device, op, bytes)
+#endif
+
+/**
+ * @brief Enable the cycle counter and clear the ring
+ */
+void bus_trace_init(void);
+
+/**
+ * @brief Current cycle count
+ */
+uint32_t bus_trace_now(void);
+
+/**
+ * @brief Add a record, called by the driver hooks. Safe from interrupts
+ *
+ * @param span          Start and CS times, cs_low = 0 when there is no chip select
+ * @param device        BUS_TRACE_ICM42688, BUS_TRACE_SN74HC595 or BUS_TRACE_W25Q64JV
+ * @param op            Opcode, register or BUS_TRACE_OP_*
+ * @param bytes         Bytes clocked, including command and address
+ */
+void bus_trace_record(const bus_trace_span_t* span, uint8_t device, uint8_t op, uint32_t bytes);
+
+/**
+ * @brief Copy out the records in the ring, oldest first
+ *
+ * @param records       Return data
+ * @param max           Size of records
+ *
+ * @return Number of records copied
+ */
+uint32_t bus_trace_read(bus_trace_record_t* records, uint32_t max);
+
+/**
+ * @brief Transactions per second, utilisation and per operation p50 / p99 call latency over the ring
+ *
+ * @param summary       Return data
+ * @param ops           Return data, one entry per device / operation pair, may be NULL
+ * @param max_ops       Size of ops
+ * @param op_count      Number of entries written to ops, may be NULL
+ *
+ * @return 0 or -1
+ */
+int bus_trace_get_stats(bus_trace_summary_t* summary, bus_trace_op_stats_t* ops, uint32_t max_ops, uint32_t* op_count);
+
+#endif /* BUS_TRACE_H_ */
@@ -0,0 +1,78 @@
+#ifndef STM32_DRIVERS_POLICIES_HPP_
+#define STM32_DRIVERS_POLICIES_HPP_
+
+#include "main.h"
+#include <stdint.h>
+
+/*
+ * Transport and pin types for the header-only C++ drivers (icm_42688.hpp, SN74HC595.hpp, W25Q64JV.hpp), shared
+ * so an application using more than one driver gets a single definition of each.
+ */
+
+// Blocking HAL transfers on a CubeMX SPI handle, e.g. HalSpi<hspi1>
+template <SPI_HandleTypeDef& Handle>
+struct HalSpi {
+    static HAL_StatusTypeDef transmit(const uint8_t* data, uint16_t size) {
+        return HAL_SPI_Transmit(&Handle, const_cast<uint8_t*>(data), size, HAL_MAX_DELAY);
+    }
+
+    static HAL_StatusTypeDef receive(uint8_t* data, uint16_t size) {
+        return HAL_SPI_Receive(&Handle, data, size, HAL_MAX_DELAY);
+    }
+};
+
+// GPIOx from CubeMX is a cast of an address and cannot be a template argument, these wrap it in a type
+#define STM32_DRIVERS_GPIO_PORT(x) \
+    struct GpioPort##x { \
+        static GPIO_TypeDef* get() { return GPIO##x; } \
+    }
+#ifdef GPIOA
+STM32_DRIVERS_GPIO_PORT(A);
+#endif
+#ifdef GPIOB
+STM32_DRIVERS_GPIO_PORT(B);
+#endif
+#ifdef GPIOC
+STM32_DRIVERS_GPIO_PORT(C);
+#endif
+#ifdef GPIOD
+STM32_DRIVERS_GPIO_PORT(D);
+#endif
+#ifdef GPIOE
+STM32_DRIVERS_GPIO_PORT(E);
+#endif
+#ifdef GPIOF
+STM32_DRIVERS_GPIO_PORT(F);
+#endif
+#ifdef GPIOG
+STM32_DRIVERS_GPIO_PORT(G);
+#endif
+#ifdef GPIOH
+STM32_DRIVERS_GPIO_PORT(H);
+#endif
+#ifdef GPIOI
+STM32_DRIVERS_GPIO_PORT(I);
+#endif
+#undef STM32_DRIVERS_GPIO_PORT
+
+// Output pin, e.g. GpioPin<GpioPortB, GPIO_PIN_0>. A single BSRR store on the target
+template <typename Port, uint16_t Pin>
+struct GpioPin {
+    static void set() {
+#if defined(__ARM_ARCH)
+        Port::get()->BSRR = Pin;
+#else
+        HAL_GPIO_WritePin(Port::get(), Pin, GPIO_PIN_SET);
+#endif
+    }
+
+    static void reset() {
+#if defined(__ARM_ARCH)
+        Port::get()->BSRR = static_cast<uint32_t>(Pin) << 16;
+#else
+        HAL_GPIO_WritePin(Port::get(), Pin, GPIO_PIN_RESET);
+#endif
+    }
+};
+
+#endif /* STM32_DRIVERS_POLICIES_HPP_ */
@@ -1,5 +1,15 @@
 #include "icm_42688.h"
 #include "icm_42688_registers.h"
+#include <string.h>
+
+#ifdef BUS_TRACE_ENABLE
+#include "bus_trace.h"
+#else
+#define BUS_TRACE_BEGIN(span)
+#define BUS_TRACE_CS_LOW(span)
+#define BUS_TRACE_CS_HIGH(span)
+#define BUS_TRACE_END(span, device, op, bytes)
+#endif
 
 #define CALIBRARION_SAMPLES 200
 
@@ -7,9 +17,52 @@ int icm_42688_config(icm_42688_cfg_t* hw_cfg, void* comms_handle, GPIO_TypeDef*
     hw_cfg->comms_handle = comms_handle;
     hw_cfg->gpio_port = gpio_port;
     hw_cfg->gpio_pin = gpio_pin;
+    hw_cfg->fifo_count = 0;
+    memset(hw_cfg->tx_buffer, 0xFF, sizeof(hw_cfg->tx_buffer));    // Clocked out after the command, ignored by the chip
+#ifdef SPI_BUS_ENABLE
+    hw_cfg->bus = NULL;
+#endif
+    return 0;
+}
+
+#ifdef SPI_BUS_ENABLE
+int icm_42688_set_bus(icm_42688_cfg_t* hw_cfg, spi_bus_t* bus, spi_bus_device_t* device, uint8_t priority) {
+    if (!hw_cfg) return -1;
+    if ((bus != NULL) && (device == NULL)) return -1;
+    hw_cfg->bus = bus;
+    hw_cfg->bus_device = device;
+    hw_cfg->bus_priority = priority;
     return 0;
 }
 
+// Register access through the arbiter, the first byte is R/W + register and the data follows
+static int bus_transfer(icm_42688_cfg_t* hw_cfg, uint8_t header, const uint8_t* tx_data, uint8_t* rx_data, uint8_t no_bytes) {
+    spi_bus_transaction_t transaction;
+    if (spi_bus_transaction_setup(&transaction, hw_cfg->bus_device, &header, 1, tx_data, rx_data, no_bytes) != 0) return -1;
+    transaction.priority = hw_cfg->bus_priority;
+
+    BUS_TRACE_BEGIN(trace);
+    int status = spi_bus_transfer(hw_cfg->bus, &transaction);
+    BUS_TRACE_END(trace, BUS_TRACE_ICM42688, header, no_bytes + 1);
+    return status;
+}
+
+int icm_42688_submit_fifo_read(icm_42688_cfg_t* hw_cfg, spi_bus_transaction_t* transaction, uint8_t* data, uint16_t size,
+                               uint32_t deadline, spi_bus_callback complete, void* context) {
+    if (!hw_cfg) return -1;
+    if (hw_cfg->bus == NULL) return -1;
+    if ((data == NULL) || (size < 3)) return -1;
+
+    uint8_t header = 0x80 | INT_STATUS;
+    if (spi_bus_transaction_setup(transaction, hw_cfg->bus_device, &header, 1, NULL, data, size) != 0) return -1;
+    transaction->priority = hw_cfg->bus_priority;
+    transaction->deadline = deadline;
+    transaction->complete = complete;
+    transaction->context = context;
+    return spi_bus_submit(hw_cfg->bus, transaction);
+}
+#endif
+
 static int cs_high(icm_42688_cfg_t* hw_cfg) { 
     if (hw_cfg->gpio_port == NULL) return -1;
     HAL_GPIO_WritePin(hw_cfg->gpio_port, hw_cfg->gpio_pin, GPIO_PIN_SET);
@@ -27,37 +80,55 @@ static void build_spi_message(uint8_t* message, uint8_t read_write, uint8_t reg,
     if (read_write == 0) message[1] = data;
 }
 
-static int spi_read_data(icm_42688_cfg_t* hw_cfg, uint8_t reg, uint8_t* rx_data, uint8_t no_bytes) { 
-    if (no_bytes < 2) return -1;    // Minimum 2 bytes
-    uint8_t tx_buf[no_bytes + 1];
-    uint8_t rx_buf[no_bytes + 1];
-
-    // Fill tx_data with data that will not affect chip
-    for (int i = 0; i <= no_bytes; i++) tx_buf[i] = 0xFF;
-    build_spi_message(tx_buf, 1, reg, 0);
+// Returns the data in hw_cfg->rx_buffer, valid until the next transfer, or NULL
+static uint8_t* spi_read_data(icm_42688_cfg_t* hw_cfg, uint8_t reg, uint8_t no_bytes) { 
+    if ((no_bytes < 1) || (no_bytes >= ICM_42688_BUFFER_SIZE)) return NULL;
+    uint8_t* rx_data = &hw_cfg->rx_buffer[1];     // First byte is clocked out during the address
+#ifdef SPI_BUS_ENABLE
+    if (hw_cfg->bus != NULL) {
+        if (bus_transfer(hw_cfg, 0x80 | (reg & 0x7F), NULL, rx_data, no_bytes) != 0) return NULL;
+        return rx_data;
+    }
+#endif
+    build_spi_message(hw_cfg->tx_buffer, 1, reg, 0);
 
+    BUS_TRACE_BEGIN(trace);
     cs_low(hw_cfg);
-    HAL_StatusTypeDef status = HAL_SPI_TransmitReceive(hw_cfg->comms_handle, tx_buf, rx_buf, no_bytes + 1, HAL_MAX_DELAY);
+    BUS_TRACE_CS_LOW(trace);
+    HAL_StatusTypeDef status = HAL_SPI_TransmitReceive(hw_cfg->comms_handle, hw_cfg->tx_buffer, hw_cfg->rx_buffer, no_bytes + 1, HAL_MAX_DELAY);
     cs_high(hw_cfg);
-    if (status != HAL_OK) return -1;
-    
-    for(int i = 1; i < no_bytes; i++) { 
-        rx_data[i - 1] = rx_buf[i];
-    }
-    return 0;
+    BUS_TRACE_CS_HIGH(trace);
+    BUS_TRACE_END(trace, BUS_TRACE_ICM42688, hw_cfg->tx_buffer[0], no_bytes + 1);
+    if (status != HAL_OK) return NULL;
+    return rx_data;
 }
 
 int icm_42688_read_reg(icm_42688_cfg_t* hw_cfg, uint8_t reg, uint8_t* rx_data) { 
-    return spi_read_data(hw_cfg, reg, rx_data, 1);  // In future will use function pointer to allow for i2c comms
+    uint8_t* data = spi_read_data(hw_cfg, reg, 1);  // In future will use function pointer to allow for i2c comms
+    if (data == NULL) return -1;
+    rx_data[0] = data[0];
+    return 0;
 }
 
 static int spi_write_data(icm_42688_cfg_t* hw_cfg, uint8_t reg, uint8_t data) { 
-    uint8_t tx_data[2] = {0xFF, 0xFF};
+    uint8_t* tx_data = hw_cfg->tx_buffer;
     build_spi_message(tx_data, 0, reg, data);
+#ifdef SPI_BUS_ENABLE
+    if (hw_cfg->bus != NULL) {
+        int bus_status = bus_transfer(hw_cfg, tx_data[0], &tx_data[1], NULL, 1);
+        tx_data[1] = 0xFF;
+        return bus_status;
+    }
+#endif
 
+    BUS_TRACE_BEGIN(trace);
     cs_low(hw_cfg);
+    BUS_TRACE_CS_LOW(trace);
     HAL_StatusTypeDef status = HAL_SPI_Transmit(hw_cfg->comms_handle, tx_data, 2, HAL_MAX_DELAY);
     cs_high(hw_cfg);
+    BUS_TRACE_CS_HIGH(trace);
+    BUS_TRACE_END(trace, BUS_TRACE_ICM42688, tx_data[0], 2);
+    tx_data[1] = 0xFF;      // Back to a dummy byte for the next read
     if (status != HAL_OK) return -1;
     return 0;
 }
@@ -66,6 +137,32 @@ int icm_42688_write_reg(icm_42688_cfg_t* hw_cfg, uint8_t reg, uint8_t data) {
     return spi_write_data(hw_cfg, reg, data);  // In future will use function pointer to allow for i2c comms
 }
 
+int icm_42688_write_regs(icm_42688_cfg_t* hw_cfg, uint8_t reg, const uint8_t* data, uint8_t size) {
+    if (!hw_cfg) return -1;
+    if ((data == NULL) || (size < 1) || (size >= ICM_42688_BUFFER_SIZE)) return -1;
+    uint8_t* tx_data = hw_cfg->tx_buffer;
+    build_spi_message(tx_data, 0, reg, 0);
+    memcpy(&tx_data[1], data, size);
+    int status = 0;
+#ifdef SPI_BUS_ENABLE
+    if (hw_cfg->bus != NULL) {
+        status = bus_transfer(hw_cfg, tx_data[0], &tx_data[1], NULL, size);
+        memset(&tx_data[1], 0xFF, size);
+        return status;
+    }
+#endif
+
+    BUS_TRACE_BEGIN(trace);
+    cs_low(hw_cfg);
+    BUS_TRACE_CS_LOW(trace);
+    if (HAL_SPI_Transmit(hw_cfg->comms_handle, tx_data, size + 1, HAL_MAX_DELAY) != HAL_OK) status = -1;
+    cs_high(hw_cfg);
+    BUS_TRACE_CS_HIGH(trace);
+    BUS_TRACE_END(trace, BUS_TRACE_ICM42688, tx_data[0], size + 1);
+    memset(&tx_data[1], 0xFF, size);    // Back to dummy bytes for the next read
+    return status;
+}
+
 int icm_42688_set_bank(icm_42688_cfg_t* hw_cfg, uint8_t bank) { 
     if (bank > 4) return -1; // Invalid selection
     return icm_42688_write_reg(hw_cfg, REG_BANK_SEL, (bank & 0x07));
@@ -73,9 +170,9 @@ int icm_42688_set_bank(icm_42688_cfg_t* hw_cfg, uint8_t bank) {
 
 int icm_42688_read_mod_write(icm_42688_cfg_t* hw_cfg, uint8_t bits_mask, uint8_t reg, uint8_t data, uint8_t lsb_address) { 
     // Ex: write to bits [5:4]. bits_mask = 0b11, data = 0bxx, lsb_address = 4.
-    uint8_t rx_data[2];
+    uint8_t rx_data[1];
     if (icm_42688_read_reg(hw_cfg, reg, rx_data) != 0) return -1;
-    uint8_t transfer_data = (rx_data[1] & ~(bits_mask << lsb_address)) | (data << lsb_address);
+    uint8_t transfer_data = (rx_data[0] & ~(bits_mask << lsb_address)) | (data << lsb_address);
     if (icm_42688_write_reg(hw_cfg, reg, transfer_data) != 0) return -1;
     return 0;
 }
@@ -128,8 +225,8 @@ int icm_42688_set_gyro_odr(icm_42688_cfg_t* hw_cfg, uint8_t out_data_rate) {
 
 int icm_42688_read_accel_xyz(icm_42688_cfg_t* hw_cfg, int16_t* xyz_data) { 
     if (icm_42688_set_bank(hw_cfg, 0) != 0) return -1;
-    uint8_t rx_data[6];
-    if (spi_read_data(hw_cfg, ACCEL_DATA_X1, rx_data, 6) != 0) return -1;
+    uint8_t* rx_data = spi_read_data(hw_cfg, ACCEL_DATA_X1, 6);
+    if (rx_data == NULL) return -1;
     xyz_data[0] = (int16_t)((rx_data[0] << 8) | rx_data[1]);
     xyz_data[1] = (int16_t)((rx_data[2] << 8) | rx_data[3]);
     xyz_data[2] = (int16_t)((rx_data[4] << 8) | rx_data[5]);
@@ -138,8 +235,8 @@ int icm_42688_read_accel_xyz(icm_42688_cfg_t* hw_cfg, int16_t* xyz_data) {
 
 int icm_42688_read_gyro_xyz(icm_42688_cfg_t* hw_cfg, int16_t* xyz_data) { 
     if (icm_42688_set_bank(hw_cfg, 0) != 0) return -1;
-    uint8_t rx_data[6];
-    if (spi_read_data(hw_cfg, GYRO_DATA_X1, rx_data, 6) != 0) return -1;
+    uint8_t* rx_data = spi_read_data(hw_cfg, GYRO_DATA_X1, 6);
+    if (rx_data == NULL) return -1;
     xyz_data[0] = (int16_t)((rx_data[0] << 8) | rx_data[1]);
     xyz_data[1] = (int16_t)((rx_data[2] << 8) | rx_data[3]);
     xyz_data[2] = (int16_t)((rx_data[4] << 8) | rx_data[5]);
@@ -231,12 +328,31 @@ int icm_42688_set_user_offset(icm_42688_cfg_t* hw_cfg, uint8_t accel, uint8_t gy
     return 0;
 }
 
+int icm_42688_set_clkin(icm_42688_cfg_t* hw_cfg, uint8_t enable) {
+    // INTF_CONFIG5 [2:1] PIN9_FUNCTION -> 00 INT2, 10 CLKIN
+    if (icm_42688_set_bank(hw_cfg, 1) != 0) return -1;
+    if (icm_42688_read_mod_write(hw_cfg, 0b11, INTF_CONFIG5, enable ? 0b10 : 0b00, 1) != 0) return -1;
+    if (icm_42688_set_bank(hw_cfg, 0) != 0) return -1;
+    return 0;
+}
+
+int icm_42688_set_rtc_mode(icm_42688_cfg_t* hw_cfg, uint8_t enable, uint8_t clkdiv) {
+    if (enable) {
+        if (icm_42688_set_bank(hw_cfg, 3) != 0) return -1;
+        if (icm_42688_write_reg(hw_cfg, CLKDIV, clkdiv & 0x7F) != 0) return -1;
+    }
+    // INTF_CONFIG1 [2] RTC_MODE -> 1 RTC clock input required
+    if (icm_42688_set_bank(hw_cfg, 0) != 0) return -1;
+    if (icm_42688_read_mod_write(hw_cfg, 0b1, INTF_CONFIG1, enable ? 1 : 0, 2) != 0) return -1;
+    return 0;
+}
+
 int icm_42688_config_fifo_register(icm_42688_cfg_t* hw_cfg, uint8_t packet_structure) { 
     hw_cfg->packet_no = packet_structure;
     icm_42688_set_bank(hw_cfg, 0); // Bank 0 data
 
     // Configure FIFO mode, [7:6] -> 01 Stream-to-FIFO Mode
-    if (icm_42688_write_reg(hw_cfg, FIFO_CONFIG, 0x01) != 0) return -1;
+    if (icm_42688_write_reg(hw_cfg, FIFO_CONFIG, 0x40) != 0) return -1;
 
     // Configure data in FIFO
     uint8_t data = 0;
@@ -269,8 +385,8 @@ int icm_42688_read_fifo(icm_42688_cfg_t* hw_cfg, int8_t* gyro_data, int8_t* acce
         if (accel_data == NULL) return -1;
         if (temp_data == NULL) return -1;
 
-        uint8_t rx_data[8];
-        if (spi_read_data(hw_cfg, FIFO_DATA, rx_data, 8) != 0) return -1;
+        uint8_t* rx_data = spi_read_data(hw_cfg, FIFO_DATA, 8);
+        if (rx_data == NULL) return -1;
         for (int i = 1; i < 7; i++) { 
             accel_data[i - 1] = rx_data[i];
         }
@@ -279,8 +395,8 @@ int icm_42688_read_fifo(icm_42688_cfg_t* hw_cfg, int8_t* gyro_data, int8_t* acce
         if (gyro_data == NULL) return -1;
         if (temp_data == NULL) return -1;
 
-        uint8_t rx_data[8];
-        if (spi_read_data(hw_cfg, FIFO_DATA, rx_data, 8) != 0) return -1;
+        uint8_t* rx_data = spi_read_data(hw_cfg, FIFO_DATA, 8);
+        if (rx_data == NULL) return -1;
         for (int i = 1; i < 7; i++) { 
             gyro_data[i - 1] = rx_data[i];
         }
@@ -290,8 +406,8 @@ int icm_42688_read_fifo(icm_42688_cfg_t* hw_cfg, int8_t* gyro_data, int8_t* acce
         if (gyro_data == NULL) return -1;
         if (temp_data == NULL) return -1;
 
-        uint8_t rx_data[16];
-        if (spi_read_data(hw_cfg, FIFO_DATA, rx_data, 16) != 0) return -1;
+        uint8_t* rx_data = spi_read_data(hw_cfg, FIFO_DATA, 16);
+        if (rx_data == NULL) return -1;
         for (int i = 1; i < 7; i++) { 
             accel_data[i - 1] = rx_data[i];
         }
@@ -299,8 +415,9 @@ int icm_42688_read_fifo(icm_42688_cfg_t* hw_cfg, int8_t* gyro_data, int8_t* acce
             gyro_data[i - 7] = rx_data[i];
         }
         temp_data[0] = rx_data[13];
-        for (int i = 14; i < 16; i++) { 
-            gyro_data[i - 14] = rx_data[i];
+        if (time_data != NULL) { 
+            time_data[0] = rx_data[14];
+            time_data[1] = rx_data[15];
         }
     } else if (hw_cfg->packet_no == 4) { 
         if (accel_data == NULL) return -1;
@@ -308,8 +425,8 @@ int icm_42688_read_fifo(icm_42688_cfg_t* hw_cfg, int8_t* gyro_data, int8_t* acce
         if (temp_data == NULL) return -1;
         if (extened_data == NULL) return -1;
 
-        uint8_t rx_data[20];
-        if (spi_read_data(hw_cfg, FIFO_DATA, rx_data, 20) != 0) return -1;
+        uint8_t* rx_data = spi_read_data(hw_cfg, FIFO_DATA, 20);
+        if (rx_data == NULL) return -1;
         for (int i = 1; i < 7; i++) { 
             accel_data[i - 1] = rx_data[i];
         }
@@ -317,12 +434,13 @@ int icm_42688_read_fifo(icm_42688_cfg_t* hw_cfg, int8_t* gyro_data, int8_t* acce
             gyro_data[i - 7] = rx_data[i];
         }
         temp_data[0] = rx_data[13];
-        temp_data[0] = rx_data[14];
-        for (int i = 15; i < 17; i++) { 
-            gyro_data[i - 15] = rx_data[i];
+        temp_data[1] = rx_data[14];
+        if (time_data != NULL) { 
+            time_data[0] = rx_data[15];
+            time_data[1] = rx_data[16];
         }
         for (int i = 17; i < 20; i++) { 
-            gyro_data[i - 17] = rx_data[i];
+            extened_data[i - 17] = rx_data[i];
         }
     } else {
         return -1;
@@ -330,10 +448,72 @@ int icm_42688_read_fifo(icm_42688_cfg_t* hw_cfg, int8_t* gyro_data, int8_t* acce
     return 0;
 }
 
+uint8_t icm_42688_fifo_packet_size(icm_42688_cfg_t* hw_cfg) {
+    if (!hw_cfg) return 0;
+    switch (hw_cfg->packet_no) {
+        case 1:
+        case 2:
+        return 8;
+        case 3:
+        return 16;
+        case 4:
+        return 20;
+        default:
+        return 0;
+    }
+}
+
+int icm_42688_read_fifo_batch(icm_42688_cfg_t* hw_cfg, uint8_t* data, uint16_t max_size, uint16_t* size) {
+    if (!hw_cfg) return -1;
+    if ((data == NULL) || (size == NULL)) return -1;
+    uint8_t packet_size = icm_42688_fifo_packet_size(hw_cfg);
+    if (packet_size == 0) return -1; // FIFO unconfigured
+    *size = 0;
+
+    if (icm_42688_set_bank(hw_cfg, 0) != 0) return -1; // Bank 0 data
+
+    // Byte count, big endian at reset (INTF_CONFIG0)
+    uint8_t* count_data = spi_read_data(hw_cfg, FIFO_COUNTH, 2);
+    if (count_data == NULL) return -1;
+    uint16_t count = (uint16_t)((count_data[0] << 8) | count_data[1]);
+    hw_cfg->fifo_count = count;
+    if (count > max_size) count = max_size;
+    count -= count % packet_size;  // Whole packets only, the rest stays for the next batch
+    if (count == 0) return 0;
+
+    // FIFO_DATA does not auto increment, one burst drains every packet
+    uint8_t header = 0x80 | FIFO_DATA;
+#ifdef SPI_BUS_ENABLE
+    if (hw_cfg->bus != NULL) {
+        spi_bus_transaction_t transaction;
+        if (spi_bus_transaction_setup(&transaction, hw_cfg->bus_device, &header, 1, NULL, data, count) != 0) return -1;
+        transaction.priority = hw_cfg->bus_priority;
+        BUS_TRACE_BEGIN(trace);
+        int bus_status = spi_bus_transfer(hw_cfg->bus, &transaction);
+        BUS_TRACE_END(trace, BUS_TRACE_ICM42688, header, count + 1);
+        if (bus_status != 0) return -1;
+        *size = count;
+        return 0;
+    }
+#endif
+
+    BUS_TRACE_BEGIN(trace);
+    cs_low(hw_cfg);
+    BUS_TRACE_CS_LOW(trace);
+    HAL_StatusTypeDef status = HAL_SPI_Transmit(hw_cfg->comms_handle, &header, 1, HAL_MAX_DELAY);
+    if (status == HAL_OK) status = HAL_SPI_Receive(hw_cfg->comms_handle, data, count, HAL_MAX_DELAY);
+    cs_high(hw_cfg);
+    BUS_TRACE_CS_HIGH(trace);
+    BUS_TRACE_END(trace, BUS_TRACE_ICM42688, header, count + 1);
+    if (status != HAL_OK) return -1;
+    *size = count;
+    return 0;
+}
+
 int icm_42688_test_comms(icm_42688_cfg_t* hw_cfg) { 
     if (icm_42688_reset_device(hw_cfg) == -1) return -1;
-    uint8_t rx_data[1];
-    if (spi_read_data(hw_cfg, WHO_AM_I, rx_data, 1) == -1) return -1;
+    uint8_t* rx_data = spi_read_data(hw_cfg, WHO_AM_I, 1);
+    if (rx_data == NULL) return -1;
     if (rx_data[0] != 0x47) return -1;
     return 0;
 }
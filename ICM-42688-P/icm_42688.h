@@ -3,14 +3,31 @@
 
 #include "main.h"
 #include <stdint.h>
+#ifdef SPI_BUS_ENABLE
+#include "spi_bus.h"
+#endif
+
+// Longest register or FIFO read in one transfer plus the command byte, one 32 byte D-cache line
+#ifndef ICM_42688_BUFFER_SIZE
+#define ICM_42688_BUFFER_SIZE 32
+#endif
 
 typedef struct {
+    // Transfer buffers first and 32 byte aligned so DMA (shared bus) never shares a D-cache line with the settings
+    uint8_t tx_buffer[ICM_42688_BUFFER_SIZE] __attribute__((aligned(32)));  // Command byte, then 0xFF from config
+    uint8_t rx_buffer[ICM_42688_BUFFER_SIZE] __attribute__((aligned(32)));  // Data decoded in place from index 1
     void* comms_handle;
     GPIO_TypeDef* gpio_port;
     uint16_t gpio_pin;
     uint8_t packet_no;
+    uint16_t fifo_count;        // FIFO_COUNT as read by the last icm_42688_read_fifo_batch
     int16_t accel_calibration[3];
     int16_t gyro_calibration[3];
+#ifdef SPI_BUS_ENABLE
+    spi_bus_t* bus;             // NULL for direct HAL calls
+    spi_bus_device_t* bus_device;
+    uint8_t bus_priority;
+#endif
 } icm_42688_cfg_t;
 
 /**
@@ -57,6 +74,18 @@ int icm_42688_read_reg(icm_42688_cfg_t* hw_cfg, uint8_t reg, uint8_t* rx_data);
  */
 int icm_42688_write_reg(icm_42688_cfg_t* hw_cfg, uint8_t reg, uint8_t data);
 
+/**
+ * @brief Write consecutive registers in one transfer, the address increments after each byte
+ *
+ * @param hw_cfg        Driver configuration structure
+ * @param reg           First register to write
+ * @param data          Register values
+ * @param size          Number of registers, up to ICM_42688_BUFFER_SIZE - 1
+ *
+ * @return 0 or -1
+ */
+int icm_42688_write_regs(icm_42688_cfg_t* hw_cfg, uint8_t reg, const uint8_t* data, uint8_t size);
+
 /**
  * @brief Modify only part of a register
  *
@@ -197,6 +226,29 @@ int icm_42688_calibrate_gyro(icm_42688_cfg_t* hw_cfg);
  */
 int icm_42688_set_user_offset(icm_42688_cfg_t* hw_cfg, uint8_t accel, uint8_t gyro);
 
+/**
+ * @brief Select the function of pin 9: CLKIN for an external reference clock, or INT2 (INTF_CONFIG5, bank 1)
+ *
+ * @param hw_cfg    Driver configuration structure
+ * @param enable    Set to 1 for CLKIN, 0 for INT2
+ *
+ * @return 0 or -1
+ */
+int icm_42688_set_clkin(icm_42688_cfg_t* hw_cfg, uint8_t enable);
+
+/**
+ * @brief Run the sensor from the clock on CLKIN (RTC_MODE in INTF_CONFIG1), so sample and timestamp timing
+ * follow that clock instead of the internal oscillator. Select CLKIN with icm_42688_set_clkin and start the
+ * clock first
+ *
+ * @param hw_cfg    Driver configuration structure
+ * @param enable    Set to 1 to use CLKIN, 0 for the internal oscillator
+ * @param clkdiv    Value for CLKDIV (bank 3) for the CLKIN frequency, written when enabling
+ *
+ * @return 0 or -1
+ */
+int icm_42688_set_rtc_mode(icm_42688_cfg_t* hw_cfg, uint8_t enable, uint8_t clkdiv);
+
 /**
  * @brief Configure FIFO buffer according to predefined packet structure
  *
@@ -213,13 +265,70 @@ int icm_42688_config_fifo_register(icm_42688_cfg_t* hw_cfg, uint8_t packet_struc
  * @param hw_cfg        Driver configuration structure
  * @param gyro_data     Gyroscope return data, pass NULL if none
  * @param accel_data    Accelerometer return data, pass NULL if none
- * @param temp_data     Temperature return data, pass NULL if none
+ * @param temp_data     Temperature return data, pass NULL if none (2 bytes for packet 4)
+ * @param time_data     Timestamp return data (2 bytes, packets 3 and 4), pass NULL if none
  * @param extened_data  Extended return data, pass NULL if none
  *
  * @return 0 or -1
  */
 int icm_42688_read_fifo(icm_42688_cfg_t* hw_cfg, int8_t* gyro_data, int8_t* accel_data, int8_t* temp_data, int8_t* time_data, int8_t* extened_data);
 
+/**
+ * @brief Size of one FIFO packet for the configured packet structure
+ *
+ * @param hw_cfg        Driver configuration structure
+ *
+ * @return 8, 16 or 20 bytes, 0 if the FIFO is unconfigured
+ */
+uint8_t icm_42688_fifo_packet_size(icm_42688_cfg_t* hw_cfg);
+
+/**
+ * @brief Drain whole FIFO packets in one burst: the byte count from FIFO_COUNTH / FIFO_COUNTL, then FIFO_DATA.
+ * Packets are left raw (header, big endian data) for the caller to decode
+ *
+ * @param hw_cfg        Driver configuration structure
+ * @param data          Return data, packets back to back
+ * @param max_size      Size of data, packets that do not fit stay in the FIFO
+ * @param size          Return data, bytes read (a multiple of the packet size, 0 if the FIFO is empty). The count
+ *                      the FIFO reported is kept in hw_cfg->fifo_count
+ *
+ * @return 0 or -1
+ */
+int icm_42688_read_fifo_batch(icm_42688_cfg_t* hw_cfg, uint8_t* data, uint16_t max_size, uint16_t* size);
+
+#ifdef SPI_BUS_ENABLE
+/**
+ * @brief Send all register access through a shared SPI bus arbiter instead of the HAL. The device's chip select
+ * is driven by the bus
+ *
+ * @param hw_cfg        Driver configuration structure
+ * @param bus           Bus the device is on, NULL to go back to direct HAL calls
+ * @param device        Chip select and SPI mode for the ICM-42688-P (mode 0 or 3, 24MHz max)
+ * @param priority      SPI_BUS_PRIORITY_* for register access and FIFO reads
+ *
+ * @return 0 or -1
+ */
+int icm_42688_set_bus(icm_42688_cfg_t* hw_cfg, spi_bus_t* bus, spi_bus_device_t* device, uint8_t priority);
+
+/**
+ * @brief Queue a FIFO read on the bus and return, for use from the INT1 interrupt. One burst from INT_STATUS
+ * reads and clears the interrupt status, the FIFO count and then size - 3 bytes of FIFO data, as FIFO_DATA does
+ * not auto increment. Bank 0 must be selected, which it is after every other driver call
+ *
+ * @param hw_cfg        Driver configuration structure
+ * @param transaction   Bus transaction, must stay valid until it completes
+ * @param data          Return data: INT_STATUS, FIFO_COUNTH, FIFO_COUNTL, FIFO packets
+ * @param size          Bytes to read, 3 plus the FIFO bytes wanted
+ * @param deadline      Cycle count to finish by, 0 for none
+ * @param complete      Called from the DMA interrupt when the data is in, may be NULL
+ * @param context       Passed to complete
+ *
+ * @return 0 or -1
+ */
+int icm_42688_submit_fifo_read(icm_42688_cfg_t* hw_cfg, spi_bus_transaction_t* transaction, uint8_t* data, uint16_t size,
+                               uint32_t deadline, spi_bus_callback complete, void* context);
+#endif
+
 /**
  * @brief Read from the WHO_AM_I register, and compare with expected value
  *
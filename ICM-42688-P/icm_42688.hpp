@@ -0,0 +1,171 @@
+#ifndef ICM_42688_HPP_
+#define ICM_42688_HPP_
+
+#include "main.h"
+#include <stdint.h>
+#include "stm32_drivers_policies.hpp"
+#include "icm_42688_registers.h"
+
+/*
+ * Header-only C++ driver for fixed hardware. The SPI transport, chip select and FIFO packet format are template
+ * arguments, so a register access is the HAL transfer between two pin writes with no configuration checks, the
+ * register bank is only written when it changes and the FIFO drains in one burst. icm_42688.h stays the API for
+ * C code and for anything chosen at run time (shared bus, tracing).
+ *
+ * Icm42688<HalSpi<hspi1>, GpioPin<GpioPortB, GPIO_PIN_0>, 3> imu;
+ * imu.configure_device();
+ * imu.configure_fifo();
+ */
+
+template <typename Spi, typename Cs, uint8_t Packet = 3>
+class Icm42688 {
+    static_assert((Packet >= 1) && (Packet <= 4), "FIFO packet structure 1 to 4");
+
+public:
+    static constexpr uint16_t packet_size = (Packet <= 2) ? 8 : ((Packet == 3) ? 16 : 20);
+
+    typedef struct {
+        int16_t accel[3];       // Packets 1, 3 and 4
+        int16_t gyro[3];        // Packets 2, 3 and 4
+        int16_t temp;           // Raw, 8 bits in packets 1 to 3
+        uint16_t time;          // Packets 3 and 4
+    } sample_t;
+
+    /**
+     * @brief Burst read from consecutive registers (or FIFO_DATA)
+     *
+     * @param reg           First register
+     * @param data          Return data
+     * @param size          Bytes to read
+     *
+     * @return 0 or -1
+     */
+    int read(uint8_t reg, uint8_t* data, uint16_t size) {
+        const uint8_t header = 0x80 | (reg & 0x7F);
+        Cs::reset();
+        HAL_StatusTypeDef status = Spi::transmit(&header, 1);
+        if (status == HAL_OK) status = Spi::receive(data, size);
+        Cs::set();
+        return (status == HAL_OK) ? 0 : -1;
+    }
+
+    int read_reg(uint8_t reg, uint8_t* data) {
+        return read(reg, data, 1);
+    }
+
+    int write_reg(uint8_t reg, uint8_t data) {
+        const uint8_t message[2] = {static_cast<uint8_t>(reg & 0x7F), data};
+        Cs::reset();
+        HAL_StatusTypeDef status = Spi::transmit(message, 2);
+        Cs::set();
+        return (status == HAL_OK) ? 0 : -1;
+    }
+
+    int set_bank(uint8_t bank) {
+        if (bank > 4) return -1;
+        if (bank == bank_) return 0;
+        if (write_reg(REG_BANK_SEL, bank) != 0) return -1;
+        bank_ = bank;
+        return 0;
+    }
+
+    int reset_device() {
+        bank_ = 0xFF;
+        if (set_bank(0) != 0) return -1;
+        return write_reg(DEVICE_CONFIG, 0x01);
+    }
+
+    // Reset, then accelerometer and gyroscope on in low noise mode
+    int configure_device() {
+        if (reset_device() != 0) return -1;
+        HAL_Delay(1);
+        if (write_reg(PWR_MGMT0, 0x0F) != 0) return -1;
+        HAL_Delay(45);
+        return 0;
+    }
+
+    int read_accel_xyz(int16_t* xyz) {
+        uint8_t raw[6];
+        if (set_bank(0) != 0) return -1;
+        if (read(ACCEL_DATA_X1, raw, 6) != 0) return -1;
+        decode_xyz(raw, xyz);
+        return 0;
+    }
+
+    int read_gyro_xyz(int16_t* xyz) {
+        uint8_t raw[6];
+        if (set_bank(0) != 0) return -1;
+        if (read(GYRO_DATA_X1, raw, 6) != 0) return -1;
+        decode_xyz(raw, xyz);
+        return 0;
+    }
+
+    // Stream-to-FIFO with the packet structure of the template
+    int configure_fifo() {
+        if (set_bank(0) != 0) return -1;
+        if (write_reg(FIFO_CONFIG, 0x40) != 0) return -1;
+        return write_reg(FIFO_CONFIG1, fifo_config1);
+    }
+
+    /**
+     * @brief Bytes in the FIFO, FIFO_COUNTH and FIFO_COUNTL in one read
+     *
+     * @param count         Return data
+     *
+     * @return 0 or -1
+     */
+    int fifo_count(uint16_t* count) {
+        uint8_t raw[2];
+        if (set_bank(0) != 0) return -1;
+        if (read(FIFO_COUNTH, raw, 2) != 0) return -1;
+        *count = static_cast<uint16_t>((raw[0] << 8) | raw[1]);
+        return 0;
+    }
+
+    /**
+     * @brief Read whole packets from FIFO_DATA in a single transfer, decode them with decode()
+     *
+     * @param data          Return data, packets * packet_size bytes
+     * @param packets       Packets to read, at most what fifo_count reported
+     *
+     * @return 0 or -1
+     */
+    int read_fifo(uint8_t* data, uint16_t packets) {
+        if (packets == 0) return 0;
+        if (set_bank(0) != 0) return -1;
+        return read(FIFO_DATA, data, static_cast<uint16_t>(packets * packet_size));
+    }
+
+    static void decode(const uint8_t* packet, sample_t* sample) {
+        if constexpr (Packet == 2) {
+            decode_xyz(&packet[1], sample->gyro);
+        } else {
+            decode_xyz(&packet[1], sample->accel);
+        }
+        if constexpr (Packet <= 2) {
+            sample->temp = static_cast<int8_t>(packet[7]);
+            sample->time = 0;
+        } else if constexpr (Packet == 3) {
+            decode_xyz(&packet[7], sample->gyro);
+            sample->temp = static_cast<int8_t>(packet[13]);
+            sample->time = static_cast<uint16_t>((packet[14] << 8) | packet[15]);
+        } else {
+            decode_xyz(&packet[7], sample->gyro);
+            sample->temp = static_cast<int16_t>((packet[13] << 8) | packet[14]);
+            sample->time = static_cast<uint16_t>((packet[15] << 8) | packet[16]);
+        }
+    }
+
+private:
+    static constexpr uint8_t fifo_config1 = (Packet == 1) ? 0b00101 : ((Packet == 2) ? 0b00110 : ((Packet == 3) ? 0b01111 : 0b11111));
+
+    static void decode_xyz(const uint8_t* raw, int16_t* xyz) {
+        xyz[0] = static_cast<int16_t>((raw[0] << 8) | raw[1]);
+        xyz[1] = static_cast<int16_t>((raw[2] << 8) | raw[3]);
+        xyz[2] = static_cast<int16_t>((raw[4] << 8) | raw[5]);
+    }
+
+    uint8_t bank_ = 0xFF;       // Unknown until the first set_bank, bank writes through the C API are not seen
+};
+
+#endif /* ICM_42688_HPP_ */
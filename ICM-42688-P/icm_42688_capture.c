@@ -0,0 +1,112 @@
+#include "icm_42688_capture.h"
+#include <string.h>
+
+static void put_le16(uint8_t* data, uint16_t value) {
+    data[0] = (uint8_t)value;
+    data[1] = (uint8_t)(value >> 8);
+}
+
+static void put_le32(uint8_t* data, uint32_t value) {
+    put_le16(data, (uint16_t)value);
+    put_le16(&data[2], (uint16_t)(value >> 16));
+}
+
+// Burst times, cycles where the core has DWT, otherwise ms ticks
+static uint32_t timestamp(void) {
+#if defined(DWT)
+    return DWT->CYCCNT;
+#else
+    return HAL_GetTick();
+#endif
+}
+
+static uint32_t ticks_per_second(void) {
+#if defined(DWT)
+    return SystemCoreClock;
+#else
+    return 1000U;
+#endif
+}
+
+int icm_42688_capture_init(icm_42688_capture_t* capture, icm_42688_cfg_t* hw_cfg, uint8_t* buffer, uint32_t size) {
+    if (!capture) return -1;
+    if ((hw_cfg == NULL) || (buffer == NULL)) return -1;
+    if (size < ICM_42688_CAPTURE_HEADER_SIZE) return -1;
+    if (icm_42688_fifo_packet_size(hw_cfg) == 0) return -1; // FIFO unconfigured
+
+#if defined(DWT)
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
+
+    capture->buffer = buffer;
+    capture->size = size;
+    capture->sink = NULL;
+    capture->sink_context = NULL;
+    memset(&capture->stats, 0, sizeof(capture->stats));
+
+    memset(buffer, 0, ICM_42688_CAPTURE_HEADER_SIZE);
+    put_le32(&buffer[0], ICM_42688_CAPTURE_MAGIC);
+    buffer[4] = ICM_42688_CAPTURE_VERSION;
+    buffer[5] = hw_cfg->packet_no;
+    put_le32(&buffer[8], ticks_per_second());
+    capture->used = ICM_42688_CAPTURE_HEADER_SIZE;
+    return 0;
+}
+
+int icm_42688_capture_set_sink(icm_42688_capture_t* capture, icm_42688_capture_sink sink, void* context) {
+    if (!capture) return -1;
+    capture->sink = sink;
+    capture->sink_context = context;
+    return 0;
+}
+
+int icm_42688_capture_flush(icm_42688_capture_t* capture) {
+    if (!capture) return -1;
+    if (capture->used == 0) return 0;
+    if (capture->sink == NULL) return -1;
+    if (capture->sink(capture->sink_context, capture->buffer, capture->used) != 0) return -1;
+    capture->used = 0;
+    capture->stats.flushes++;
+    return 0;
+}
+
+int icm_42688_capture_burst(icm_42688_capture_t* capture, icm_42688_cfg_t* hw_cfg, uint8_t* data, uint16_t max_size, uint16_t* size) {
+    if (!capture) return -1;
+    uint32_t time = timestamp();
+    if (icm_42688_read_fifo_batch(hw_cfg, data, max_size, size) != 0) return -1;
+
+    capture->stats.fifo_bytes += *size;
+    if (hw_cfg->fifo_count > capture->stats.max_fifo_count) capture->stats.max_fifo_count = hw_cfg->fifo_count;
+
+    // A failed or missing sink loses this burst from the capture only, the caller still gets the data
+    uint32_t record_size = ICM_42688_CAPTURE_RECORD_SIZE + *size;
+    if ((capture->used + record_size) > capture->size) {
+        if ((record_size > capture->size) || (icm_42688_capture_flush(capture) != 0)) {
+            capture->stats.bursts_dropped++;
+            return 0;
+        }
+    }
+
+    uint8_t* record = &capture->buffer[capture->used];
+    put_le32(&record[0], time);
+    put_le16(&record[4], hw_cfg->fifo_count);
+    put_le16(&record[6], *size);
+    memcpy(&record[ICM_42688_CAPTURE_RECORD_SIZE], data, *size);
+    capture->used += record_size;
+    capture->stats.records++;
+    return 0;
+}
+
+uint32_t icm_42688_capture_used(icm_42688_capture_t* capture) {
+    if (!capture) return 0;
+    return capture->used;
+}
+
+int icm_42688_capture_get_stats(icm_42688_capture_t* capture, icm_42688_capture_stats_t* stats, uint8_t reset) {
+    if (!capture) return -1;
+    if (stats == NULL) return -1;
+    *stats = capture->stats;
+    if (reset) memset(&capture->stats, 0, sizeof(capture->stats));
+    return 0;
+}
@@ -0,0 +1,112 @@
+#ifndef ICM_42688_CAPTURE_H_
+#define ICM_42688_CAPTURE_H_
+
+#include "icm_42688.h"
+#include <stdint.h>
+
+/*
+ * Raw FIFO burst capture, recorded on the target and replayed on the host (host/replay_icm42688.h) to work on
+ * the FIFO decode path with real sensor traffic. A capture is a header and a sequence of records, little endian:
+ *
+ *   Header   0  magic 0x46433234 ("42CF")     Record   0  time of the burst in ticks
+ *            4  format version                          4  FIFO_COUNT as read (bytes)
+ *            5  FIFO packet structure (1 to 4)          6  bytes of FIFO data that follow
+ *            6  reserved, 0                             8  FIFO data, raw packets
+ *            8  ticks per second (DWT cycles, or 1000 for HAL_GetTick)
+ *           12  reserved, 0
+ *
+ * Records are never split, a record that does not fit the buffer goes to the sink first.
+ */
+
+#define ICM_42688_CAPTURE_MAGIC 0x46433234
+#define ICM_42688_CAPTURE_VERSION 1
+#define ICM_42688_CAPTURE_HEADER_SIZE 16
+#define ICM_42688_CAPTURE_RECORD_SIZE 8
+
+// Takes a full capture buffer, e.g. to program it to flash. Returns 0, or -1 to stop capturing
+typedef int (*icm_42688_capture_sink)(void* context, const uint8_t* data, uint32_t size);
+
+typedef struct {
+    uint32_t records;
+    uint32_t bursts_dropped;    // No room and no sink, or the sink failed
+    uint32_t fifo_bytes;
+    uint16_t max_fifo_count;
+    uint32_t flushes;
+} icm_42688_capture_stats_t;
+
+typedef struct {
+    uint8_t* buffer;
+    uint32_t size;
+    uint32_t used;
+    icm_42688_capture_sink sink;
+    void* sink_context;
+    icm_42688_capture_stats_t stats;
+} icm_42688_capture_t;
+
+/**
+ * @brief Start a capture in a RAM buffer and write the header for the FIFO's packet structure
+ *
+ * @param capture       Capture structure
+ * @param hw_cfg        Configured driver, FIFO set up with icm_42688_config_fifo_register
+ * @param buffer        Capture buffer, at least ICM_42688_CAPTURE_HEADER_SIZE bytes
+ * @param size          Size of buffer
+ *
+ * @return 0 or -1
+ */
+int icm_42688_capture_init(icm_42688_capture_t* capture, icm_42688_cfg_t* hw_cfg, uint8_t* buffer, uint32_t size);
+
+/**
+ * @brief Hand the buffer to a sink whenever the next record does not fit, instead of dropping bursts
+ *
+ * @param capture       Capture structure
+ * @param sink          Sink function, NULL to drop bursts once the buffer is full
+ * @param context       Passed to the sink
+ *
+ * @return 0 or -1
+ */
+int icm_42688_capture_set_sink(icm_42688_capture_t* capture, icm_42688_capture_sink sink, void* context);
+
+/**
+ * @brief Drain the FIFO with icm_42688_read_fifo_batch and record the burst with its time and FIFO_COUNT. The
+ * data is returned as with icm_42688_read_fifo_batch, so the capture can sit in the normal read path
+ *
+ * @param capture       Capture structure
+ * @param hw_cfg        Driver configuration structure
+ * @param data          Return data, packets back to back
+ * @param max_size      Size of data
+ * @param size          Return data, bytes read
+ *
+ * @return 0 or -1 (read failure)
+ */
+int icm_42688_capture_burst(icm_42688_capture_t* capture, icm_42688_cfg_t* hw_cfg, uint8_t* data, uint16_t max_size, uint16_t* size);
+
+/**
+ * @brief Pass what is left in the buffer to the sink
+ *
+ * @param capture       Capture structure
+ *
+ * @return 0 or -1
+ */
+int icm_42688_capture_flush(icm_42688_capture_t* capture);
+
+/**
+ * @brief Bytes of the buffer in use, header included until the first flush
+ *
+ * @param capture       Capture structure
+ *
+ * @return Bytes
+ */
+uint32_t icm_42688_capture_used(icm_42688_capture_t* capture);
+
+/**
+ * @brief Copy out the capture counters
+ *
+ * @param capture       Capture structure
+ * @param stats         Return data
+ * @param reset         Set to 0 to keep counting, otherwise counters are cleared
+ *
+ * @return 0 or -1
+ */
+int icm_42688_capture_get_stats(icm_42688_capture_t* capture, icm_42688_capture_stats_t* stats, uint8_t reset);
+
+#endif /* ICM_42688_CAPTURE_H_ */
@@ -0,0 +1,172 @@
+#include "icm_42688_motion.h"
+#include "icm_42688_registers.h"
+#include <string.h>
+
+#define PWR_MGMT0_ACTIVE 0x0F       // Gyro and accel low noise
+#define PWR_MGMT0_IDLE 0x02         // Gyro off, accel low power
+#define SMD_CONFIG_WOM 0x05         // WOM_MODE compare with the previous sample, SMD_MODE wake on motion
+#define INT_STATUS2_WOM 0x07        // WOM_X / Y / Z
+#define CONFIG0_FS_MASK 0xE0
+
+// Transition times, cycles where the core has DWT, otherwise ms ticks
+static uint32_t timestamp(void) {
+#if defined(DWT)
+    return DWT->CYCCNT;
+#else
+    return HAL_GetTick();
+#endif
+}
+
+static uint32_t elapsed_us(uint32_t start) {
+#if defined(DWT)
+    return (DWT->CYCCNT - start) / (SystemCoreClock / 1000000U);
+#else
+    return (HAL_GetTick() - start) * 1000U;
+#endif
+}
+
+static void account(icm_42688_motion_t* motion) {
+    uint32_t now = HAL_GetTick();
+    motion->stats.time_ms[motion->mode] += now - motion->account_tick;
+    motion->account_tick = now;
+}
+
+static void restart_window(icm_42688_motion_t* motion) {
+    memset(motion->sum, 0, sizeof(motion->sum));
+    memset(motion->sum_squares, 0, sizeof(motion->sum_squares));
+    motion->window_count = 0;
+}
+
+static int write_idle(icm_42688_motion_t* motion) {
+    icm_42688_cfg_t* imu = motion->imu;
+    if (icm_42688_set_bank(imu, 0) != 0) return -1;
+    if (icm_42688_write_reg(imu, ACCEL_CONFIG0, motion->accel_config0 | motion->config.idle_odr) != 0) return -1;
+    if (icm_42688_write_reg(imu, PWR_MGMT0, PWR_MGMT0_IDLE) != 0) return -1;
+    if (icm_42688_write_reg(imu, SMD_CONFIG, SMD_CONFIG_WOM) != 0) return -1;
+    return 0;
+}
+
+static int write_active(icm_42688_motion_t* motion) {
+    icm_42688_cfg_t* imu = motion->imu;
+    if (icm_42688_set_bank(imu, 0) != 0) return -1;
+    if (icm_42688_write_reg(imu, SMD_CONFIG, 0x00) != 0) return -1;
+    uint8_t config0[2] = {motion->gyro_config0 | motion->config.active_odr, motion->accel_config0 | motion->config.active_odr};
+    if (icm_42688_write_regs(imu, GYRO_CONFIG0, config0, sizeof(config0)) != 0) return -1;
+    if (icm_42688_write_reg(imu, PWR_MGMT0, PWR_MGMT0_ACTIVE) != 0) return -1;
+    return 0;
+}
+
+static int enter(icm_42688_motion_t* motion, uint8_t mode, uint32_t start) {
+    if (((mode == ICM_42688_MOTION_IDLE) ? write_idle(motion) : write_active(motion)) != 0) return -1;
+    uint32_t us = elapsed_us(start);
+    account(motion);
+    motion->mode = mode;
+    motion->mode_tick = motion->account_tick;
+    motion->still = 0;
+    restart_window(motion);
+    motion->stats.transitions[mode]++;
+    motion->stats.transition_us_total[mode] += us;
+    if (us > motion->stats.transition_us_max[mode]) motion->stats.transition_us_max[mode] = us;
+    return 0;
+}
+
+int icm_42688_motion_init(icm_42688_motion_t* motion, icm_42688_cfg_t* imu, const icm_42688_motion_config_t* config) {
+    if (!motion) return -1;
+    if ((imu == NULL) || (config == NULL)) return -1;
+    if ((config->active_odr == 0) || (config->active_odr > 0x0F)) return -1;
+    if ((config->idle_odr == 0) || (config->idle_odr > 0x0F)) return -1;
+
+#if defined(DWT)
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
+
+    memset(motion, 0, sizeof(*motion));
+    motion->imu = imu;
+    motion->config = *config;
+
+    // Keep the full scale ranges, the ODR bits are rewritten on every transition
+    uint8_t data;
+    if (icm_42688_set_bank(imu, 0) != 0) return -1;
+    if (icm_42688_read_reg(imu, GYRO_CONFIG0, &data) != 0) return -1;
+    motion->gyro_config0 = data & CONFIG0_FS_MASK;
+    if (icm_42688_read_reg(imu, ACCEL_CONFIG0, &data) != 0) return -1;
+    motion->accel_config0 = data & CONFIG0_FS_MASK;
+    if (config->wom_int1 && (icm_42688_read_mod_write(imu, 0b111, INT_SOURCE1, 0x07, 0) != 0)) return -1;
+
+    uint8_t thresholds[3] = {config->wom_threshold, config->wom_threshold, config->wom_threshold};
+    if (icm_42688_set_bank(imu, 4) != 0) return -1;
+    if (icm_42688_write_regs(imu, ACCEL_WOM_X_THR, thresholds, sizeof(thresholds)) != 0) return -1;
+
+    motion->mode = ICM_42688_MOTION_ACTIVE;
+    motion->account_tick = HAL_GetTick();
+    if (enter(motion, ICM_42688_MOTION_ACTIVE, timestamp()) != 0) return -1;
+    memset(&motion->stats, 0, sizeof(motion->stats));
+    return 0;
+}
+
+int icm_42688_motion_add_sample(icm_42688_motion_t* motion, const int16_t* accel) {
+    if (!motion) return -1;
+    if (accel == NULL) return -1;
+    if (motion->mode != ICM_42688_MOTION_ACTIVE) return 0;
+
+    for (int i = 0; i < 3; i++) {
+        motion->sum[i] += accel[i];
+        motion->sum_squares[i] += (int64_t)accel[i] * accel[i];
+    }
+    if (++motion->window_count < ICM_42688_MOTION_WINDOW) return 0;
+
+    // Population variance per axis, N * sum(x^2) - sum(x)^2 over N^2
+    int64_t variance = 0;
+    for (int i = 0; i < 3; i++) {
+        variance += (motion->sum_squares[i] * ICM_42688_MOTION_WINDOW) - ((int64_t)motion->sum[i] * motion->sum[i]);
+    }
+    variance /= (int64_t)ICM_42688_MOTION_WINDOW * ICM_42688_MOTION_WINDOW;
+    motion->variance = (variance > UINT32_MAX) ? UINT32_MAX : (uint32_t)variance;
+    motion->stats.windows++;
+    restart_window(motion);
+
+    if (motion->variance >= motion->config.still_variance) {
+        motion->still = 0;
+    } else if (!motion->still) {
+        motion->still = 1;
+        motion->still_tick = HAL_GetTick();
+    }
+    return 0;
+}
+
+int icm_42688_motion_poll(icm_42688_motion_t* motion) {
+    if (!motion) return -1;
+    account(motion);
+    uint32_t start = timestamp();
+
+    if (motion->mode == ICM_42688_MOTION_IDLE) {
+        uint8_t status;
+        if (icm_42688_set_bank(motion->imu, 0) != 0) return -1;
+        if (icm_42688_read_reg(motion->imu, INT_STATUS2, &status) != 0) return -1;
+        if (!(status & INT_STATUS2_WOM)) return 0;
+        if (enter(motion, ICM_42688_MOTION_ACTIVE, start) != 0) return -1;
+        return 1;
+    }
+
+    uint32_t now = motion->account_tick;
+    if (!motion->still) return 0;
+    if ((now - motion->still_tick) < motion->config.still_ms) return 0;
+    if ((now - motion->mode_tick) < motion->config.min_active_ms) return 0;
+    if (enter(motion, ICM_42688_MOTION_IDLE, start) != 0) return -1;
+    return 1;
+}
+
+uint8_t icm_42688_motion_mode(icm_42688_motion_t* motion) {
+    if (!motion) return ICM_42688_MOTION_ACTIVE;
+    return motion->mode;
+}
+
+int icm_42688_motion_get_stats(icm_42688_motion_t* motion, icm_42688_motion_stats_t* stats, uint8_t reset) {
+    if (!motion) return -1;
+    if (stats == NULL) return -1;
+    account(motion);
+    *stats = motion->stats;
+    if (reset) memset(&motion->stats, 0, sizeof(motion->stats));
+    return 0;
+}
@@ -0,0 +1,118 @@
+#ifndef ICM_42688_MOTION_H_
+#define ICM_42688_MOTION_H_
+
+#include "icm_42688.h"
+#include <stdint.h>
+
+/*
+ * Motion-adaptive power control. ACTIVE runs accel and gyro in low noise mode at the full ODR. IDLE runs the
+ * accel alone in low power mode at a low ODR with wake on motion armed, and the gyro off. The controller moves
+ * to IDLE once the accel variance has stayed under a threshold for a while, and back to ACTIVE when the sensor
+ * reports motion (INT_STATUS2 WOM flags, optionally routed to INT1). The wake threshold is a sample to sample
+ * change and the sleep threshold a variance, so a signal between the two keeps the current mode; still_ms and
+ * min_active_ms add hysteresis in time.
+ *
+ * Transitions are short register batches with the full-scale bits cached at init, no read-modify-write:
+ * IDLE is ACCEL_CONFIG0, PWR_MGMT0, SMD_CONFIG; ACTIVE is SMD_CONFIG, GYRO_CONFIG0 + ACCEL_CONFIG0 in one
+ * burst, then PWR_MGMT0 last since the part takes no register writes for 200us after a sensor turns on. Gyro
+ * data is valid about 30ms after a wake (start-up time).
+ */
+
+#define ICM_42688_MOTION_IDLE 0
+#define ICM_42688_MOTION_ACTIVE 1
+#define ICM_42688_MOTION_MODES 2
+
+// Accel samples per variance estimate
+#ifndef ICM_42688_MOTION_WINDOW
+#define ICM_42688_MOTION_WINDOW 32
+#endif
+
+typedef struct {
+    uint8_t active_odr;         // Accel and gyro ODR code in ACTIVE, e.g. 6 (1kHz)
+    uint8_t idle_odr;           // Accel ODR code in IDLE, e.g. 9 (50Hz)
+    uint8_t wom_threshold;      // Wake: change from the previous sample on any axis, 1g / 256 steps (3.9mg)
+    uint8_t wom_int1;           // Route the wake on motion flags to INT1 (INT_SOURCE1)
+    uint32_t still_variance;    // Sleep: accel variance over a window, X + Y + Z in LSB^2
+    uint16_t still_ms;          // Time under still_variance before IDLE
+    uint16_t min_active_ms;     // Shortest stay in ACTIVE after a wake
+} icm_42688_motion_config_t;
+
+typedef struct {
+    uint32_t time_ms[ICM_42688_MOTION_MODES];               // Time in each mode
+    uint32_t transitions[ICM_42688_MOTION_MODES];           // Into each mode
+    uint32_t transition_us_total[ICM_42688_MOTION_MODES];   // Decision to the last register written
+    uint32_t transition_us_max[ICM_42688_MOTION_MODES];
+    uint32_t windows;                                       // Variance estimates made
+} icm_42688_motion_stats_t;
+
+typedef struct {
+    icm_42688_cfg_t* imu;
+    icm_42688_motion_config_t config;
+    uint8_t mode;
+    uint8_t gyro_config0;       // Full-scale bits, ODR bits clear
+    uint8_t accel_config0;
+    int32_t sum[3];
+    int64_t sum_squares[3];
+    uint16_t window_count;
+    uint32_t variance;          // Last estimate
+    uint8_t still;
+    uint32_t still_tick;        // Start of the current still stretch
+    uint32_t mode_tick;         // Entry into the current mode
+    uint32_t account_tick;      // time_ms counted up to here
+    icm_42688_motion_stats_t stats;
+} icm_42688_motion_t;
+
+/**
+ * @brief Set up wake on motion (thresholds, INT1 routing) and start in ACTIVE. Call after the ODR, full scale
+ * and FIFO are configured, the ODRs are then owned by the controller
+ *
+ * @param motion        Controller structure
+ * @param imu           Configured driver structure
+ * @param config        Modes and thresholds, copied
+ *
+ * @return 0 or -1
+ */
+int icm_42688_motion_init(icm_42688_motion_t* motion, icm_42688_cfg_t* imu, const icm_42688_motion_config_t* config);
+
+/**
+ * @brief Feed one accel sample (XYZ, raw LSB) to the variance estimate, e.g. from each decoded FIFO packet.
+ * Samples are ignored in IDLE
+ *
+ * @param motion        Controller structure
+ * @param accel         Accel XYZ
+ *
+ * @return 0 or -1
+ */
+int icm_42688_motion_add_sample(icm_42688_motion_t* motion, const int16_t* accel);
+
+/**
+ * @brief Change mode when due: in IDLE reads INT_STATUS2 for motion, in ACTIVE checks how long the samples have
+ * been still. Call from the main loop or after INT1
+ *
+ * @param motion        Controller structure
+ *
+ * @return 1 if the mode changed, 0 if not, -1 on a bus error
+ */
+int icm_42688_motion_poll(icm_42688_motion_t* motion);
+
+/**
+ * @brief Current mode
+ *
+ * @param motion        Controller structure
+ *
+ * @return ICM_42688_MOTION_IDLE or ICM_42688_MOTION_ACTIVE
+ */
+uint8_t icm_42688_motion_mode(icm_42688_motion_t* motion);
+
+/**
+ * @brief Copy out the time in each mode, transition counts and latencies
+ *
+ * @param motion        Controller structure
+ * @param stats         Return data
+ * @param reset         Set to 0 to keep counting, otherwise counters are cleared
+ *
+ * @return 0 or -1
+ */
+int icm_42688_motion_get_stats(icm_42688_motion_t* motion, icm_42688_motion_stats_t* stats, uint8_t reset);
+
+#endif /* ICM_42688_MOTION_H_ */
@@ -0,0 +1,176 @@
+#include "icm_42688_time.h"
+#include "icm_42688_registers.h"
+#include <string.h>
+
+#define TMST_CONFIG_TO_REGS_EN 0x10
+#define TMST_CONFIG_RES 0x08
+#define SIGNAL_PATH_RESET_TMST_STROBE 0x04
+#define TIMER_MASK 0xFFFFF              // TMSTVAL is 20 bits
+#define FIFO_WRAP 0x10000               // FIFO timestamps are 16 bits
+#define UNWRAP_MARGIN (FIFO_WRAP / 8)   // Fit error allowed when placing a sample from the current time
+
+static uint32_t mcu_ticks(void) {
+#if defined(DWT)
+    return DWT->CYCCNT;
+#else
+    return HAL_GetTick();
+#endif
+}
+
+uint64_t icm_42688_time_mcu_now(icm_42688_time_t* time) {
+    if (!time) return 0;
+    uint32_t ticks = mcu_ticks();
+    time->mcu_now += (uint32_t)(ticks - time->last_ticks);
+    time->last_ticks = ticks;
+    return time->mcu_now;
+}
+
+static uint64_t to_mcu(const icm_42688_time_t* time, uint64_t sensor) {
+    int64_t ticks = (int64_t)(sensor - time->origin_sensor);
+    return time->origin_mcu + (uint64_t)((ticks * (int64_t)time->ratio_q24) >> 24);
+}
+
+static uint64_t to_sensor(const icm_42688_time_t* time, uint64_t mcu) {
+    int64_t ticks = (int64_t)(mcu - time->origin_mcu);
+    return time->origin_sensor + (uint64_t)((ticks * (int64_t)time->inverse_q32) >> 32);
+}
+
+// Least squares line through the sync points, anchored at the newest one so the origin keeps full precision
+static void fit(icm_42688_time_t* time) {
+    uint8_t newest = (uint8_t)((time->head + ICM_42688_TIME_POINTS - 1) % ICM_42688_TIME_POINTS);
+    uint64_t x0 = time->sensor[newest];
+    uint64_t y0 = time->mcu[newest];
+    double nominal = (double)time->mcu_hz * time->resolution_us / 1000000.0;
+    double slope = nominal;
+    double mean_x = 0.0;
+    double mean_y = 0.0;
+
+    if (time->points > 1) {
+        for (uint8_t i = 0; i < time->points; i++) {
+            mean_x += (double)(int64_t)(time->sensor[i] - x0);
+            mean_y += (double)(int64_t)(time->mcu[i] - y0);
+        }
+        mean_x /= time->points;
+        mean_y /= time->points;
+        double sxx = 0.0;
+        double sxy = 0.0;
+        for (uint8_t i = 0; i < time->points; i++) {
+            double dx = (double)(int64_t)(time->sensor[i] - x0) - mean_x;
+            double dy = (double)(int64_t)(time->mcu[i] - y0) - mean_y;
+            sxx += dx * dx;
+            sxy += dx * dy;
+        }
+        if (sxx > 0.0) slope = sxy / sxx;
+    }
+
+    double residual_max = 0.0;
+    for (uint8_t i = 0; i < time->points; i++) {
+        double dx = (double)(int64_t)(time->sensor[i] - x0) - mean_x;
+        double residual = (double)(int64_t)(time->mcu[i] - y0) - (mean_y + (slope * dx));
+        if (residual < 0.0) residual = -residual;
+        if (residual > residual_max) residual_max = residual;
+    }
+
+    double offset = mean_y - (slope * mean_x);
+    time->origin_sensor = x0;
+    time->origin_mcu = y0 + (uint64_t)(int64_t)((offset < 0.0) ? (offset - 0.5) : (offset + 0.5));
+    time->ratio_q24 = (uint64_t)((slope * 16777216.0) + 0.5);
+    if (time->ratio_q24 == 0) time->ratio_q24 = 1;
+    time->inverse_q32 = (1ULL << 56) / time->ratio_q24;
+    time->stats.residual_max = (uint32_t)(residual_max + 0.5);
+    time->stats.drift_ppb = (int32_t)(((nominal / slope) - 1.0) * 1e9);
+}
+
+int icm_42688_time_sync(icm_42688_time_t* time) {
+    if (!time) return -1;
+    icm_42688_cfg_t* imu = time->imu;
+
+    // The timer latches during the strobe write, take the middle of the MCU times around it
+    if (icm_42688_set_bank(imu, 0) != 0) return -1;
+    uint64_t before = icm_42688_time_mcu_now(time);
+    if (icm_42688_write_reg(imu, SIGNAL_PATH_RESET, SIGNAL_PATH_RESET_TMST_STROBE) != 0) return -1;
+    uint64_t after = icm_42688_time_mcu_now(time);
+
+    uint8_t data[3];
+    if (icm_42688_set_bank(imu, 1) != 0) return -1;
+    for (uint8_t i = 0; i < 3; i++) {
+        if (icm_42688_read_reg(imu, TMSTVAL0 + i, &data[i]) != 0) return -1;
+    }
+    if (icm_42688_set_bank(imu, 0) != 0) return -1;
+    uint64_t done = icm_42688_time_mcu_now(time);
+    uint32_t us = (uint32_t)((done - before) * 1000000ULL / time->mcu_hz);
+    if (us > time->stats.sync_us_max) time->stats.sync_us_max = us;
+
+    uint32_t timer = (uint32_t)(data[0] | (data[1] << 8) | ((data[2] & 0x0F) << 16));
+    uint64_t sensor = timer;
+    if (time->points > 0) {
+        uint8_t newest = (uint8_t)((time->head + ICM_42688_TIME_POINTS - 1) % ICM_42688_TIME_POINTS);
+        sensor = time->sensor[newest] + ((timer - time->last_timer) & TIMER_MASK);
+    }
+    time->last_timer = timer;
+    time->sensor[time->head] = sensor;
+    time->mcu[time->head] = before + ((after - before) / 2);
+    time->head = (uint8_t)((time->head + 1) % ICM_42688_TIME_POINTS);
+    if (time->points < ICM_42688_TIME_POINTS) time->points++;
+    time->stats.syncs++;
+    fit(time);
+    return 0;
+}
+
+int icm_42688_time_init(icm_42688_time_t* time, icm_42688_cfg_t* imu) {
+    if (!time) return -1;
+    if (imu == NULL) return -1;
+
+#if defined(DWT)
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
+
+    memset(time, 0, sizeof(*time));
+    time->imu = imu;
+#if defined(DWT)
+    time->mcu_hz = SystemCoreClock;
+#else
+    time->mcu_hz = 1000;
+#endif
+    time->last_ticks = mcu_ticks();
+
+    uint8_t data;
+    if (icm_42688_set_bank(imu, 0) != 0) return -1;
+    if (icm_42688_read_mod_write(imu, 0b1, TMST_CONFIG, 0x1, 4) != 0) return -1;
+    if (icm_42688_read_reg(imu, TMST_CONFIG, &data) != 0) return -1;
+    time->resolution_us = (data & TMST_CONFIG_RES) ? 16 : 1;
+    if (!(data & TMST_CONFIG_TO_REGS_EN)) return -1;
+    return icm_42688_time_sync(time);
+}
+
+int icm_42688_time_convert(icm_42688_time_t* time, uint16_t timestamp, uint64_t* mcu_time) {
+    if (!time) return -1;
+    if ((mcu_time == NULL) || (time->points == 0)) return -1;
+
+    // Step forward from the previous sample while it is less than a wrap old, otherwise take the latest time
+    // with these low bits that is not after now
+    uint64_t now = to_sensor(time, icm_42688_time_mcu_now(time)) + UNWRAP_MARGIN;
+    if (time->sample_valid && ((int64_t)(now - time->sample) < FIFO_WRAP)) {
+        time->sample += (uint16_t)(timestamp - (uint16_t)time->sample);
+    } else {
+        if (time->sample_valid) time->stats.unwrap_resets++;
+        time->sample = now - (uint16_t)((uint16_t)now - timestamp);
+        time->sample_valid = 1;
+    }
+    *mcu_time = to_mcu(time, time->sample);
+    return 0;
+}
+
+int icm_42688_time_get_stats(icm_42688_time_t* time, icm_42688_time_stats_t* stats, uint8_t reset) {
+    if (!time) return -1;
+    if (stats == NULL) return -1;
+    *stats = time->stats;
+    if (reset) {
+        // The fit results describe the current line rather than count events, keep them
+        memset(&time->stats, 0, sizeof(time->stats));
+        time->stats.residual_max = stats->residual_max;
+        time->stats.drift_ppb = stats->drift_ppb;
+    }
+    return 0;
+}
@@ -0,0 +1,107 @@
+#ifndef ICM_42688_TIME_H_
+#define ICM_42688_TIME_H_
+
+#include "icm_42688.h"
+#include <stdint.h>
+
+/*
+ * Sensor to MCU time conversion. The sensor timestamps samples with its own clock, which runs hundreds of ppm
+ * away from the MCU clock on the internal oscillator. A sync strobes TMST_STROBE, notes the MCU timer around
+ * the write and reads the latched 20-bit timer from TMSTVAL0-2 (bank 1). The last ICM_42688_TIME_POINTS syncs
+ * give a least squares line from sensor ticks to MCU time, and FIFO sample timestamps are mapped through it
+ * with integer arithmetic only, no register reads per sample.
+ *
+ * MCU time is DWT cycles where the core has DWT, otherwise ms ticks, unwrapped to 64 bits. Sensor ticks are
+ * 1us or 16us (TMST_RES, read at init). The FIFO timestamp must be the absolute timer (TMST_DELTA_EN clear),
+ * it holds the low 16 bits of the same counter. Call icm_42688_time_sync more often than the TMSTVAL wrap,
+ * about 1s at 1us resolution or 16s at 16us, and more often than the DWT wrap (25s at 168MHz); a few times a
+ * second is typical. With CLKIN in RTC mode from an MCU clock the ratio is fixed and syncs only track offset.
+ */
+
+// Syncs in the running fit
+#ifndef ICM_42688_TIME_POINTS
+#define ICM_42688_TIME_POINTS 16
+#endif
+
+typedef struct {
+    uint32_t syncs;
+    uint32_t sync_us_max;       // Strobe to last TMSTVAL byte read
+    uint32_t residual_max;      // Largest distance of a sync from the line at the last fit, MCU ticks
+    int32_t drift_ppb;          // Sensor clock against the MCU clock, positive when the sensor runs fast
+    uint32_t unwrap_resets;     // Samples placed from the current time instead of the previous sample
+} icm_42688_time_stats_t;
+
+typedef struct {
+    icm_42688_cfg_t* imu;
+    uint32_t mcu_hz;                                // MCU ticks per second
+    uint8_t resolution_us;                          // Sensor tick, 1 or 16
+    uint64_t sensor[ICM_42688_TIME_POINTS];         // Sync points, unwrapped sensor ticks
+    uint64_t mcu[ICM_42688_TIME_POINTS];            // and MCU ticks
+    uint8_t points;
+    uint8_t head;                                   // Next point to replace
+    uint32_t last_timer;                            // Last TMSTVAL, 20 bits
+    uint32_t last_ticks;                            // Last raw MCU timer read
+    uint64_t mcu_now;                               // Unwrapped MCU time at last_ticks
+    uint64_t origin_sensor;                         // Line through (origin_sensor, origin_mcu)
+    uint64_t origin_mcu;
+    uint64_t ratio_q24;                             // MCU ticks per sensor tick, Q24
+    uint64_t inverse_q32;                           // Sensor ticks per MCU tick, Q32
+    uint64_t sample;                                // Last converted sample, unwrapped sensor ticks
+    uint8_t sample_valid;
+    icm_42688_time_stats_t stats;
+} icm_42688_time_t;
+
+/**
+ * @brief Enable TMSTVAL latching (TMST_TO_REGS_EN), read the timestamp resolution and take the first sync.
+ * Call after the timestamp and clock settings (TMST_CONFIG, icm_42688_set_rtc_mode) are final
+ *
+ * @param time          Converter structure
+ * @param imu           Configured driver structure
+ *
+ * @return 0 or -1
+ */
+int icm_42688_time_init(icm_42688_time_t* time, icm_42688_cfg_t* imu);
+
+/**
+ * @brief Latch the sensor timer against the MCU timer and refit the line. Leaves bank 0 selected
+ *
+ * @param time          Converter structure
+ *
+ * @return 0 or -1
+ */
+int icm_42688_time_sync(icm_42688_time_t* time);
+
+/**
+ * @brief Convert the 16-bit timestamp of a FIFO packet to MCU time. Samples must be passed in FIFO order, each
+ * is unwrapped from the previous one, or from the current time after a gap of a whole wrap
+ *
+ * @param time          Converter structure
+ * @param timestamp     FIFO packet timestamp
+ * @param mcu_time      Return data, MCU ticks on the icm_42688_time_mcu_now timeline
+ *
+ * @return 0 or -1
+ */
+int icm_42688_time_convert(icm_42688_time_t* time, uint16_t timestamp, uint64_t* mcu_time);
+
+/**
+ * @brief Current MCU time, unwrapped. Must be called (directly or through sync / convert) more often than the
+ * MCU timer wraps
+ *
+ * @param time          Converter structure
+ *
+ * @return MCU ticks, 0 if time is NULL
+ */
+uint64_t icm_42688_time_mcu_now(icm_42688_time_t* time);
+
+/**
+ * @brief Copy out the sync count, fit quality and estimated drift
+ *
+ * @param time          Converter structure
+ * @param stats         Return data
+ * @param reset         Set to 0 to keep counting, otherwise counters are cleared
+ *
+ * @return 0 or -1
+ */
+int icm_42688_time_get_stats(icm_42688_time_t* time, icm_42688_time_stats_t* stats, uint8_t reset);
+
+#endif /* ICM_42688_TIME_H_ */
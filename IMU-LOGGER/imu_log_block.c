@@ -0,0 +1,303 @@
+#include "imu_log_block.h"
+#include "W25Q64JV_crc.h"
+#include <string.h>
+
+#define PACKET_HEADER_EMPTY 0x80
+#define PACKET_HEADER_FORMAT 0x70   // Accel, gyro, 20-bit flag
+#define PACKET_HEADER_PACKET_3 0x60
+
+#define TIMESTAMP_CHANNEL 7
+
+static void put_le16(uint8_t* data, uint16_t value) {
+    data[0] = (uint8_t)value;
+    data[1] = (uint8_t)(value >> 8);
+}
+
+static void put_le32(uint8_t* data, uint32_t value) {
+    for (int i = 0; i < 4; i++) data[i] = (uint8_t)(value >> (8 * i));
+}
+
+static uint16_t get_le16(const uint8_t* data) {
+    return (uint16_t)(data[0] | (data[1] << 8));
+}
+
+static uint32_t get_le32(const uint8_t* data) {
+    return (uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+static int16_t get_be16(const uint8_t* data) {
+    return (int16_t)((data[0] << 8) | data[1]);
+}
+
+int imu_log_parse_packet(const uint8_t* packet, imu_log_sample_t* sample) {
+    if ((packet == NULL) || (sample == NULL)) return -1;
+    if (packet[0] & PACKET_HEADER_EMPTY) return -1;
+    if ((packet[0] & PACKET_HEADER_FORMAT) != PACKET_HEADER_PACKET_3) return -1;
+
+    for (int i = 0; i < 3; i++) {
+        sample->accel[i] = get_be16(&packet[1 + (2 * i)]);
+        sample->gyro[i] = get_be16(&packet[7 + (2 * i)]);
+    }
+    sample->temperature = (int8_t)packet[13];
+    sample->timestamp = (uint16_t)((packet[14] << 8) | packet[15]);
+    sample->time = 0;
+    return 0;
+}
+
+// Channel values as 16-bit words, the order residuals are packed in
+static void channels(const imu_log_sample_t* sample, uint16_t* values) {
+    for (int i = 0; i < 3; i++) {
+        values[i] = (uint16_t)sample->accel[i];
+        values[3 + i] = (uint16_t)sample->gyro[i];
+    }
+    values[6] = (uint16_t)sample->temperature;
+    values[TIMESTAMP_CHANNEL] = sample->timestamp;
+}
+
+static uint16_t zigzag(uint16_t residual) {
+    int16_t value = (int16_t)residual;
+    return (uint16_t)(((uint16_t)value << 1) ^ (uint16_t)(value >> 15));
+}
+
+static uint16_t unzigzag(uint16_t value) {
+    return (uint16_t)((value >> 1) ^ (uint16_t)(-(int16_t)(value & 1)));
+}
+
+static uint8_t width(uint16_t value) {
+    uint8_t bits = 0;
+    while ((bits < 16) && ((value >> bits) != 0)) bits++;
+    return bits;
+}
+
+// LSB first into the payload, which starts zeroed
+static void put_bits(uint8_t* payload, uint16_t* position, uint16_t value, uint8_t bits) {
+    while (bits > 0) {
+        uint8_t shift = *position & 7;
+        uint8_t take = (uint8_t)(8 - shift);
+        if (take > bits) take = bits;
+        payload[*position >> 3] |= (uint8_t)((value & ((1U << take) - 1)) << shift);
+        value = (uint16_t)(value >> take);
+        *position += take;
+        bits -= take;
+    }
+}
+
+static uint16_t get_bits(const uint8_t* payload, uint16_t* position, uint8_t bits) {
+    uint16_t value = 0;
+    uint8_t done = 0;
+    while (done < bits) {
+        uint8_t shift = *position & 7;
+        uint8_t take = (uint8_t)(8 - shift);
+        if (take > (bits - done)) take = (uint8_t)(bits - done);
+        value |= (uint16_t)(((payload[*position >> 3] >> shift) & ((1U << take) - 1)) << done);
+        *position += take;
+        done += take;
+    }
+    return value;
+}
+
+int imu_log_encoder_init(imu_log_encoder_t* encoder, uint8_t packet_header) {
+    if (!encoder) return -1;
+    memset(encoder, 0, sizeof(*encoder));
+    encoder->packet_header = packet_header;
+    return 0;
+}
+
+// First sample of a block, stored whole in the header
+static void add_key(imu_log_encoder_t* encoder, const imu_log_sample_t* sample) {
+    uint8_t* block = encoder->block;
+    encoder->step = encoder->started ? (uint16_t)(sample->timestamp - encoder->last.timestamp) : 0;
+    put_le16(&block[0], IMU_LOG_BLOCK_MAGIC);
+    block[2] = encoder->packet_header;
+    block[3] = IMU_LOG_GROUP_SIZE;
+    put_le32(&block[8], encoder->sequence);
+    put_le32(&block[12], sample->time);
+    put_le16(&block[16], encoder->step);
+    for (int i = 0; i < 3; i++) {
+        put_le16(&block[18 + (2 * i)], (uint16_t)sample->accel[i]);
+        put_le16(&block[24 + (2 * i)], (uint16_t)sample->gyro[i]);
+    }
+    block[30] = (uint8_t)sample->temperature;
+    block[31] = 0xFF;
+    encoder->last = *sample;
+    encoder->started = 1;
+    encoder->count = 1;
+}
+
+// Pack the first count samples of the group, 1 if they do not fit
+static int pack_group(imu_log_encoder_t* encoder, uint8_t count) {
+    uint16_t residuals[IMU_LOG_CHANNELS][IMU_LOG_GROUP_SIZE];
+    uint8_t widths[IMU_LOG_CHANNELS] = {0};
+    uint16_t previous[IMU_LOG_CHANNELS];
+    uint16_t step = encoder->step;
+    channels(&encoder->last, previous);
+
+    for (uint8_t i = 0; i < count; i++) {
+        uint16_t values[IMU_LOG_CHANNELS];
+        channels(&encoder->group[i], values);
+        for (uint8_t channel = 0; channel < IMU_LOG_CHANNELS; channel++) {
+            uint16_t residual = (uint16_t)(values[channel] - previous[channel]);
+            if (channel == TIMESTAMP_CHANNEL) {
+                uint16_t next_step = residual;
+                residual = (uint16_t)(next_step - step);
+                step = next_step;
+            }
+            residuals[channel][i] = zigzag(residual);
+            uint8_t bits = width(residuals[channel][i]);
+            if (bits > widths[channel]) widths[channel] = bits;
+            previous[channel] = values[channel];
+        }
+    }
+
+    uint16_t size = IMU_LOG_CHANNELS * IMU_LOG_WIDTH_BITS;
+    for (uint8_t channel = 0; channel < IMU_LOG_CHANNELS; channel++) size += (uint16_t)(widths[channel] * count);
+    if ((encoder->bits + size) > (IMU_LOG_PAYLOAD_SIZE * 8)) return 1;
+
+    uint8_t* payload = &encoder->block[IMU_LOG_HEADER_SIZE];
+    for (uint8_t channel = 0; channel < IMU_LOG_CHANNELS; channel++) {
+        put_bits(payload, &encoder->bits, widths[channel], IMU_LOG_WIDTH_BITS);
+        for (uint8_t i = 0; i < count; i++) put_bits(payload, &encoder->bits, residuals[channel][i], widths[channel]);
+    }
+    encoder->last = encoder->group[count - 1];
+    encoder->step = step;
+    encoder->count += count;
+
+    // Anything after the packed samples moves to the front
+    encoder->group_count -= count;
+    for (uint8_t i = 0; i < encoder->group_count; i++) encoder->group[i] = encoder->group[count + i];
+    return 0;
+}
+
+static void seal_block(imu_log_encoder_t* encoder) {
+    uint8_t* block = encoder->block;
+    put_le16(&block[4], encoder->count);
+    put_le16(&block[6], encoder->lost);
+    put_le32(&block[IMU_LOG_BLOCK_SIZE - IMU_LOG_CRC_SIZE], w25q64jv_crc32(0, block, IMU_LOG_BLOCK_SIZE - IMU_LOG_CRC_SIZE));
+    encoder->lost = 0;
+    encoder->sequence++;
+    encoder->block = NULL;
+}
+
+int imu_log_encoder_begin(imu_log_encoder_t* encoder, uint8_t* block) {
+    if (!encoder) return -1;
+    if (block == NULL) return -1;
+    memset(block, 0, IMU_LOG_BLOCK_SIZE);
+    encoder->block = block;
+    encoder->bits = 0;
+    encoder->count = 0;
+    if (encoder->group_count == 0) return 0;
+
+    // The group held back by the last seal, its first sample becomes the key
+    add_key(encoder, &encoder->group[0]);
+    encoder->group_count--;
+    for (uint8_t i = 0; i < encoder->group_count; i++) encoder->group[i] = encoder->group[i + 1];
+    return 0;
+}
+
+int imu_log_encoder_add(imu_log_encoder_t* encoder, imu_log_sample_t* sample) {
+    if (!encoder) return -1;
+    if ((encoder->block == NULL) || (sample == NULL)) return -1;
+
+    // Unwrap against the sample before it, which may still be waiting in the group
+    if (encoder->started) {
+        const imu_log_sample_t* previous = encoder->group_count ? &encoder->group[encoder->group_count - 1] : &encoder->last;
+        sample->time = previous->time + (uint16_t)(sample->timestamp - previous->timestamp);
+    } else {
+        sample->time = sample->timestamp;
+    }
+
+    if (encoder->count == 0) {
+        add_key(encoder, sample);
+        return 0;
+    }
+    encoder->group[encoder->group_count++] = *sample;
+    if (encoder->group_count < IMU_LOG_GROUP_SIZE) return 0;
+    if (pack_group(encoder, IMU_LOG_GROUP_SIZE) == 0) return 0;
+    seal_block(encoder);
+    return 1;
+}
+
+void imu_log_encoder_skip(imu_log_encoder_t* encoder) {
+    if (!encoder) return;
+    if (encoder->lost < 0xFFFF) encoder->lost++;
+}
+
+int imu_log_encoder_seal(imu_log_encoder_t* encoder) {
+    if (!encoder) return -1;
+    if (encoder->block == NULL) return -1;
+    if (encoder->count == 0) return 0;
+
+    int held_back = 0;
+    if (encoder->group_count > 0) held_back = pack_group(encoder, encoder->group_count);
+    seal_block(encoder);
+    return held_back ? 2 : 1;
+}
+
+int imu_log_block_decode(const uint8_t* block, imu_log_block_info_t* info, imu_log_sample_t* samples, uint16_t max_samples) {
+    if ((block == NULL) || (samples == NULL)) return -1;
+    if (get_le16(&block[0]) != IMU_LOG_BLOCK_MAGIC) return -1;
+    if (get_le32(&block[IMU_LOG_BLOCK_SIZE - IMU_LOG_CRC_SIZE]) != w25q64jv_crc32(0, block, IMU_LOG_BLOCK_SIZE - IMU_LOG_CRC_SIZE)) return -1;
+
+    uint8_t group_size = block[3];
+    uint16_t count = get_le16(&block[4]);
+    if ((count == 0) || (count > max_samples) || (group_size == 0)) return -1;
+    if (info != NULL) {
+        info->packet_header = block[2];
+        info->group_size = group_size;
+        info->count = count;
+        info->lost = get_le16(&block[6]);
+        info->sequence = get_le32(&block[8]);
+        info->time = get_le32(&block[12]);
+    }
+
+    imu_log_sample_t* sample = &samples[0];
+    sample->time = get_le32(&block[12]);
+    uint16_t step = get_le16(&block[16]);
+    for (int i = 0; i < 3; i++) {
+        sample->accel[i] = (int16_t)get_le16(&block[18 + (2 * i)]);
+        sample->gyro[i] = (int16_t)get_le16(&block[24 + (2 * i)]);
+    }
+    sample->temperature = (int8_t)block[30];
+    sample->timestamp = (uint16_t)sample->time;
+
+    const uint8_t* payload = &block[IMU_LOG_HEADER_SIZE];
+    uint16_t position = 0;
+    uint16_t decoded = 1;
+    while (decoded < count) {
+        uint16_t group = count - decoded;
+        if (group > group_size) group = group_size;
+
+        uint16_t previous[IMU_LOG_CHANNELS];
+        channels(&samples[decoded - 1], previous);
+        uint32_t time = samples[decoded - 1].time;
+        for (uint8_t channel = 0; channel < IMU_LOG_CHANNELS; channel++) {
+            if ((position + IMU_LOG_WIDTH_BITS) > (IMU_LOG_PAYLOAD_SIZE * 8)) return -1;
+            uint8_t bits = (uint8_t)get_bits(payload, &position, IMU_LOG_WIDTH_BITS);
+            if ((bits > 16) || ((position + (bits * group)) > (IMU_LOG_PAYLOAD_SIZE * 8))) return -1;
+
+            uint16_t value = previous[channel];
+            for (uint16_t i = 0; i < group; i++) {
+                uint16_t residual = unzigzag(get_bits(payload, &position, bits));
+                sample = &samples[decoded + i];
+                if (channel == TIMESTAMP_CHANNEL) {
+                    step = (uint16_t)(step + residual);
+                    value = (uint16_t)(value + step);
+                    time += step;
+                    sample->timestamp = value;
+                    sample->time = time;
+                    continue;
+                }
+                value = (uint16_t)(value + residual);
+                if (channel < 3) {
+                    sample->accel[channel] = (int16_t)value;
+                } else if (channel < 6) {
+                    sample->gyro[channel - 3] = (int16_t)value;
+                } else {
+                    sample->temperature = (int8_t)value;
+                }
+            }
+        }
+        decoded += group;
+    }
+    return count;
+}
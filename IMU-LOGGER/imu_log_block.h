@@ -0,0 +1,146 @@
+#ifndef IMU_LOG_BLOCK_H_
+#define IMU_LOG_BLOCK_H_
+
+#include <stdint.h>
+
+/*
+ * Compressed log block, one flash page. Plain C without the HAL so the same code encodes on the board and
+ * decodes on the host.
+ *
+ * Header (little endian), payload, CRC-32 of everything before it:
+ *
+ *   0  magic 0x4C49         12  time of the key sample (unwrapped timestamp ticks)
+ *   2  FIFO packet header   16  timestamp step into the key sample
+ *   3  group size           18  key sample accel XYZ, gyro XYZ (int16)
+ *   4  sample count         30  key sample temperature (int8)
+ *   6  samples lost before  32  payload
+ *   8  sequence number     252  CRC-32
+ *
+ * After the key sample, samples are coded in groups of IMU_LOG_GROUP_SIZE. Each channel is predicted from the
+ * previous sample (accel, gyro, temperature) or the previous timestamp step (timestamp), the residual is zigzag
+ * coded and all residuals of a channel in the group are packed at the width of the largest: a 5 bit width per
+ * channel, then the values. Arithmetic is modulo 2^16 so any input round trips exactly. The last group of a
+ * block may be short, the sample count tells.
+ */
+
+#define IMU_LOG_BLOCK_SIZE 256
+#define IMU_LOG_BLOCK_MAGIC 0x4C49
+#define IMU_LOG_HEADER_SIZE 32
+#define IMU_LOG_CRC_SIZE 4
+#define IMU_LOG_PAYLOAD_SIZE (IMU_LOG_BLOCK_SIZE - IMU_LOG_HEADER_SIZE - IMU_LOG_CRC_SIZE)
+#define IMU_LOG_CHANNELS 8
+#define IMU_LOG_WIDTH_BITS 5
+
+// Samples per group: larger groups spend fewer bits on widths, smaller ones follow the signal more closely
+#ifndef IMU_LOG_GROUP_SIZE
+#define IMU_LOG_GROUP_SIZE 8
+#endif
+
+// Most samples a block can hold, groups of all zero residuals cost only their widths
+#define IMU_LOG_BLOCK_MAX_SAMPLES (1 + (((IMU_LOG_PAYLOAD_SIZE * 8) / (IMU_LOG_CHANNELS * IMU_LOG_WIDTH_BITS)) * IMU_LOG_GROUP_SIZE))
+
+// FIFO packet 3: header, accel XYZ, gyro XYZ (big endian), temperature, timestamp
+#define IMU_LOG_PACKET_SIZE 16
+
+typedef struct {
+    int16_t accel[3];
+    int16_t gyro[3];
+    int8_t temperature;
+    uint16_t timestamp;     // FIFO timestamp as read
+    uint32_t time;          // Timestamp unwrapped across the 16-bit rollover, same ticks (1us or 16us)
+} imu_log_sample_t;
+
+typedef struct {
+    uint8_t packet_header;
+    uint8_t group_size;
+    uint16_t count;
+    uint16_t lost;
+    uint32_t sequence;
+    uint32_t time;
+} imu_log_block_info_t;
+
+typedef struct {
+    uint8_t* block;         // Block being filled, NULL between imu_log_encoder_seal and imu_log_encoder_begin
+    uint16_t bits;          // Payload bits used
+    uint16_t count;
+    uint16_t lost;          // Samples skipped since the last sealed block, recorded in the next header
+    uint32_t sequence;
+    uint8_t packet_header;
+    uint8_t started;        // A sample has been seen, last and step are valid
+    imu_log_sample_t last;
+    uint16_t step;
+    imu_log_sample_t group[IMU_LOG_GROUP_SIZE];
+    uint8_t group_count;
+} imu_log_encoder_t;
+
+/**
+ * @brief Decode one raw FIFO packet 3
+ *
+ * @param packet        IMU_LOG_PACKET_SIZE bytes as read from FIFO_DATA
+ * @param sample        Return data, time is left for the encoder to fill in
+ *
+ * @return 0 or -1 for an empty or invalid packet (header bit 7 set, or not accel + gyro)
+ */
+int imu_log_parse_packet(const uint8_t* packet, imu_log_sample_t* sample);
+
+/**
+ * @brief Reset the encoder, the first block starts with sequence 0
+ *
+ * @param encoder       Encoder structure
+ * @param packet_header FIFO packet header recorded in every block
+ *
+ * @return 0 or -1
+ */
+int imu_log_encoder_init(imu_log_encoder_t* encoder, uint8_t packet_header);
+
+/**
+ * @brief Start filling a block. Samples held back by the last seal go in first
+ *
+ * @param encoder       Encoder structure
+ * @param block         IMU_LOG_BLOCK_SIZE bytes, owned by the encoder until sealed
+ *
+ * @return 0 or -1
+ */
+int imu_log_encoder_begin(imu_log_encoder_t* encoder, uint8_t* block);
+
+/**
+ * @brief Add a sample to the block. When its group does not fit the block is sealed instead, the group is held
+ * back for the next block and 1 is returned: call imu_log_encoder_begin with a free block before adding more
+ *
+ * @param encoder       Encoder structure
+ * @param sample        Sample to add, time is filled in
+ *
+ * @return 0, 1 when the block was sealed, -1 without a block
+ */
+int imu_log_encoder_add(imu_log_encoder_t* encoder, imu_log_sample_t* sample);
+
+/**
+ * @brief Record a sample that could not be logged, counted in the next block header
+ *
+ * @param encoder       Encoder structure
+ */
+void imu_log_encoder_skip(imu_log_encoder_t* encoder);
+
+/**
+ * @brief Close the block with what it holds, e.g. when logging stops. A short group that does not fit is held
+ * back: 2 is returned and the caller begins another block and seals again
+ *
+ * @param encoder       Encoder structure
+ *
+ * @return 0 nothing to seal, 1 sealed, 2 sealed with samples held back, -1 without a block
+ */
+int imu_log_encoder_seal(imu_log_encoder_t* encoder);
+
+/**
+ * @brief Check and decode a block read back from flash
+ *
+ * @param block         IMU_LOG_BLOCK_SIZE bytes
+ * @param info          Return data, header fields, may be NULL
+ * @param samples       Return data, IMU_LOG_BLOCK_MAX_SAMPLES entries guarantee room for any block
+ * @param max_samples   Size of samples
+ *
+ * @return Number of samples, or -1 for an erased, corrupt or oversized block
+ */
+int imu_log_block_decode(const uint8_t* block, imu_log_block_info_t* info, imu_log_sample_t* samples, uint16_t max_samples);
+
+#endif /* IMU_LOG_BLOCK_H_ */
@@ -0,0 +1,174 @@
+#include "imu_logger.h"
+#include <string.h>
+
+#define STOP_TIMEOUT 100    // ms for the last programs
+
+int imu_logger_erase(w25q64jv_cfg_t* flash, uint32_t address, uint32_t size) {
+    if (!flash) return -1;
+    if ((address % W25Q64JV_SECTOR_SIZE) || (size % W25Q64JV_SECTOR_SIZE)) return -1;
+    if ((address + size) > flash->params.capacity) return -1;
+
+    uint32_t end = address + size;
+    while (address < end) {
+        if (((address % W25Q64JV_BLOCK_64KB_SIZE) == 0) && ((end - address) >= W25Q64JV_BLOCK_64KB_SIZE)) {
+            if (w25q64jv_block_erase_64KB(flash, address) != 0) return -1;
+            address += W25Q64JV_BLOCK_64KB_SIZE;
+        } else {
+            if (w25q64jv_sector_erase_4KB(flash, address) != 0) return -1;
+            address += W25Q64JV_SECTOR_SIZE;
+        }
+    }
+    return 0;
+}
+
+int imu_logger_start(imu_logger_t* logger, icm_42688_cfg_t* imu, w25q64jv_cfg_t* flash, uint32_t address, uint32_t size) {
+    if (!logger) return -1;
+    if ((imu == NULL) || (flash == NULL)) return -1;
+    if (icm_42688_fifo_packet_size(imu) != IMU_LOG_PACKET_SIZE) return -1;   // Packet 3 only
+    if ((address % IMU_LOG_BLOCK_SIZE) || (size % IMU_LOG_BLOCK_SIZE) || (size == 0)) return -1;
+    if ((address + size) > flash->params.capacity) return -1;
+
+    logger->imu = imu;
+    logger->flash = flash;
+    logger->start = address;
+    logger->address = address;
+    logger->end = address + size;
+    logger->head = 0;
+    logger->sealed = 0;
+    logger->programming = 0;
+    logger->full = 0;
+    memset(&logger->stats, 0, sizeof(logger->stats));
+    if (imu_log_encoder_init(&logger->encoder, 0) != 0) return -1;
+    if (imu_log_encoder_begin(&logger->encoder, logger->blocks[0]) != 0) return -1;
+    logger->running = 1;
+    return 0;
+}
+
+static uint8_t* free_block(imu_logger_t* logger) {
+    if (logger->sealed >= IMU_LOGGER_BUFFERS) return NULL;
+    return logger->blocks[(logger->head + logger->sealed) % IMU_LOGGER_BUFFERS];
+}
+
+// Retire the block in flight once the chip is done with it, then send the next sealed one
+static int service_flash(imu_logger_t* logger) {
+    if (logger->programming) {
+        uint8_t busy = 0;
+        if (w25q64jv_busy(logger->flash, &busy) != 0) return -1;
+        if (busy) return 0;
+        logger->programming = 0;
+        logger->head = (logger->head + 1) % IMU_LOGGER_BUFFERS;
+        logger->sealed--;
+        logger->address += IMU_LOG_BLOCK_SIZE;
+        logger->stats.blocks++;
+    }
+
+    // A sealed block with nowhere to go starts the next one as soon as a buffer is free
+    if ((logger->encoder.block == NULL) && logger->running) {
+        uint8_t* block = free_block(logger);
+        if ((block != NULL) && (imu_log_encoder_begin(&logger->encoder, block) != 0)) return -1;
+    }
+
+    if (logger->sealed == 0) return 0;
+    if (logger->address >= logger->end) {
+        logger->full = 1;
+        return 0;
+    }
+    if (w25q64jv_page_program_dma(logger->flash, logger->address, logger->blocks[logger->head], IMU_LOG_BLOCK_SIZE) != 0) return -1;
+    logger->programming = 1;
+    return 0;
+}
+
+static void seal_next(imu_logger_t* logger) {
+    logger->sealed++;
+    uint8_t* block = free_block(logger);
+    if (block == NULL) {
+        logger->stats.buffer_waits++;
+        return;
+    }
+    imu_log_encoder_begin(&logger->encoder, block);
+}
+
+static int encode(imu_logger_t* logger, uint16_t size) {
+    for (uint16_t offset = 0; offset < size; offset += IMU_LOG_PACKET_SIZE) {
+        imu_log_sample_t sample;
+        if (imu_log_parse_packet(&logger->fifo[offset], &sample) != 0) {
+            logger->stats.invalid_packets++;
+            continue;
+        }
+        if (!logger->encoder.started) logger->encoder.packet_header = logger->fifo[offset];
+
+        // Still no buffer, another program may have finished since the last check
+        if ((logger->encoder.block == NULL) && !logger->full && (service_flash(logger) != 0)) return -1;
+        if ((logger->encoder.block == NULL) || logger->full) {
+            imu_log_encoder_skip(&logger->encoder);
+            logger->stats.dropped++;
+            continue;
+        }
+
+        int status = imu_log_encoder_add(&logger->encoder, &sample);
+        if (status < 0) return -1;
+        logger->stats.samples++;
+        if (status == 1) {
+            seal_next(logger);
+            if (service_flash(logger) != 0) return -1;
+        }
+    }
+    return 0;
+}
+
+int imu_logger_poll(imu_logger_t* logger) {
+    if (!logger) return -1;
+    if (!logger->running) return -1;
+    if (service_flash(logger) != 0) return -1;
+
+    uint16_t size = 0;
+    if (icm_42688_read_fifo_batch(logger->imu, logger->fifo, sizeof(logger->fifo), &size) != 0) return -1;
+    logger->stats.drains++;
+    logger->stats.fifo_bytes += size;
+    if (size > logger->stats.max_drain_bytes) logger->stats.max_drain_bytes = size;
+    if (encode(logger, size) != 0) return -1;
+    return service_flash(logger);
+}
+
+int imu_logger_stop(imu_logger_t* logger) {
+    if (!logger) return -1;
+    if (!logger->running) return -1;
+    if (imu_logger_poll(logger) != 0) return -1;
+
+    // Seal what is left, a short group that does not fit goes in one more block
+    int status = 1;
+    uint32_t start = HAL_GetTick();
+    while (status != 0) {
+        if (logger->encoder.block == NULL) {
+            if (service_flash(logger) != 0) return -1;
+            if (logger->full) break;
+            if ((HAL_GetTick() - start) > STOP_TIMEOUT) return -1;
+            continue;
+        }
+        status = imu_log_encoder_seal(&logger->encoder);
+        if (status < 0) return -1;
+        if (status == 0) break;
+        logger->sealed++;
+        if (status == 1) break;
+    }
+    logger->running = 0;
+
+    while ((logger->sealed > 0) && !logger->full) {
+        if (service_flash(logger) != 0) return -1;
+        if ((HAL_GetTick() - start) > STOP_TIMEOUT) return -1;
+    }
+    return 0;
+}
+
+uint32_t imu_logger_used(imu_logger_t* logger) {
+    if (!logger) return 0;
+    return logger->address - logger->start;
+}
+
+int imu_logger_get_stats(imu_logger_t* logger, imu_logger_stats_t* stats, uint8_t reset) {
+    if (!logger) return -1;
+    if (stats == NULL) return -1;
+    *stats = logger->stats;
+    if (reset) memset(&logger->stats, 0, sizeof(logger->stats));
+    return 0;
+}
@@ -0,0 +1,124 @@
+#ifndef IMU_LOGGER_H_
+#define IMU_LOGGER_H_
+
+#include "main.h"
+#include "icm_42688.h"
+#include "W25Q64JV.h"
+#include "imu_log_block.h"
+#include <stdint.h>
+
+/*
+ * ICM-42688-P to W25Q64JV logger. Each poll drains the FIFO in one burst, compresses the packets into
+ * imu_log_block.h blocks and programs sealed blocks as whole pages by DMA, so the next block fills while the
+ * last one is sent and programmed. Logging needs FIFO packet 3 (accel, gyro, temperature, timestamp).
+ */
+
+// Page buffers, one filling while the others wait for or are in a DMA program
+#ifndef IMU_LOGGER_BUFFERS
+#define IMU_LOGGER_BUFFERS 2
+#endif
+
+// Largest FIFO burst per poll, the whole 2KB FIFO by default
+#ifndef IMU_LOGGER_DRAIN_SIZE
+#define IMU_LOGGER_DRAIN_SIZE 2048
+#endif
+
+#if IMU_LOGGER_BUFFERS < 2
+#error "IMU_LOGGER_BUFFERS must be at least 2"
+#endif
+
+typedef struct {
+    uint32_t samples;           // Encoded
+    uint32_t dropped;           // No free buffer or the log area is full
+    uint32_t invalid_packets;   // Empty or not packet 3
+    uint32_t drains;
+    uint32_t fifo_bytes;
+    uint16_t max_drain_bytes;
+    uint32_t blocks;            // Programmed
+    uint32_t buffer_waits;      // Times the encoder had a sealed block and no free buffer
+} imu_logger_stats_t;
+
+typedef struct {
+    // DMA buffers first and 32 byte aligned, whole D-cache lines
+    uint8_t blocks[IMU_LOGGER_BUFFERS][IMU_LOG_BLOCK_SIZE] __attribute__((aligned(32)));
+    uint8_t fifo[IMU_LOGGER_DRAIN_SIZE] __attribute__((aligned(32)));
+    icm_42688_cfg_t* imu;
+    w25q64jv_cfg_t* flash;
+    imu_log_encoder_t encoder;
+    uint32_t start;
+    uint32_t address;           // Next page to program
+    uint32_t end;
+    uint8_t head;               // Oldest sealed block
+    uint8_t sealed;             // Sealed blocks waiting or being programmed
+    uint8_t programming;
+    uint8_t full;
+    uint8_t running;
+    imu_logger_stats_t stats;
+} imu_logger_t;
+
+/**
+ * @brief Erase a log area ahead of logging, with 64KB block erases where aligned and 4KB sector erases at the
+ * edges. The logger never erases while running: a 4KB erase takes longer than the 2KB FIFO lasts at 4kHz
+ *
+ * @param flash         Configured driver structure
+ * @param address       Start, 4KB aligned
+ * @param size          Bytes, a multiple of 4KB
+ *
+ * @return 0 or -1
+ */
+int imu_logger_erase(w25q64jv_cfg_t* flash, uint32_t address, uint32_t size);
+
+/**
+ * @brief Start logging to an erased area. The FIFO must be configured for packet 3 and the flash's DMA
+ * completion (HAL_SPI_TxCpltCallback) must call w25q64jv_dma_complete
+ *
+ * @param logger        Logger structure
+ * @param imu           Configured ICM-42688-P, FIFO in packet 3
+ * @param flash         Configured W25Q64JV
+ * @param address       Start, page aligned
+ * @param size          Bytes, a multiple of the page size
+ *
+ * @return 0 or -1
+ */
+int imu_logger_start(imu_logger_t* logger, icm_42688_cfg_t* imu, w25q64jv_cfg_t* flash, uint32_t address, uint32_t size);
+
+/**
+ * @brief Drain the FIFO, encode and keep the flash busy. Call before the FIFO fills, e.g. from the main loop
+ * or on the FIFO watermark interrupt (2KB holds 32ms at 4kHz)
+ *
+ * @param logger        Logger structure
+ *
+ * @return 0 or -1
+ */
+int imu_logger_poll(imu_logger_t* logger);
+
+/**
+ * @brief Drain the FIFO a last time, seal the partial block and wait until every block is programmed
+ *
+ * @param logger        Logger structure
+ *
+ * @return 0 or -1
+ */
+int imu_logger_stop(imu_logger_t* logger);
+
+/**
+ * @brief Bytes of the log area used so far, programmed pages only
+ *
+ * @param logger        Logger structure
+ *
+ * @return Bytes
+ */
+uint32_t imu_logger_used(imu_logger_t* logger);
+
+/**
+ * @brief Copy out the logger counters
+ *
+ * @param logger        Logger structure
+ * @param stats         Return data
+ * @param reset         Set to 0 to keep counting, otherwise counters are cleared
+ *
+ * @return 0 or -1
+ */
+int imu_logger_get_stats(imu_logger_t* logger, imu_logger_stats_t* stats, uint8_t reset);
+
+#endif /* IMU_LOGGER_H_ */
@@ -1,5 +1,14 @@
 #include "SN74HC595.h"
 
+#ifdef BUS_TRACE_ENABLE
+#include "bus_trace.h"
+#else
+#define BUS_TRACE_BEGIN(span)
+#define BUS_TRACE_CS_LOW(span)
+#define BUS_TRACE_CS_HIGH(span)
+#define BUS_TRACE_END(span, device, op, bytes)
+#endif
+
 static HAL_StatusTypeDef standard_spi_transmit(SPI_HandleTypeDef* hspi, uint8_t* pData, uint16_t size) {
     return HAL_SPI_Transmit(hspi, pData, size, HAL_MAX_DELAY);
 }
@@ -26,24 +35,68 @@ int sn74hc595_config(sn74hc595_cfg_t* hw_cfg, SPI_HandleTypeDef* hspi, GPIO_Type
         return -1;
     }
 
+#ifdef SPI_BUS_ENABLE
+    hw_cfg->bus = NULL;
+#endif
     hw_cfg->config_run = 1;
     return 0;
 }
 
+#ifdef SPI_BUS_ENABLE
+int sn74hc595_set_bus(sn74hc595_cfg_t* hw_cfg, spi_bus_t* bus, spi_bus_device_t* device, uint8_t priority) {
+    if (!hw_cfg) return -1;
+    if ((bus != NULL) && (device == NULL)) return -1;
+    hw_cfg->bus = bus;
+    hw_cfg->bus_device = device;
+    hw_cfg->bus_priority = priority;
+    return 0;
+}
+
+static void bus_latch(spi_bus_transaction_t* transaction, void* context) {
+    if (transaction->state == SPI_BUS_DONE) sn74hc595_latch_data((sn74hc595_cfg_t*)context);
+}
+#endif
+
 int sn74hc595_latch_data(sn74hc595_cfg_t* hw_cfg){
     if (!hw_cfg) return -1;
+    BUS_TRACE_BEGIN(trace);
+    // RCLK needs a pulse of tens of ns, back to back GPIO writes are enough. This also runs from SPI callbacks
     HAL_GPIO_WritePin(hw_cfg->rclk_port, hw_cfg->rclk_pin, GPIO_PIN_SET);
-    HAL_Delay(1);
+    BUS_TRACE_CS_LOW(trace);
     HAL_GPIO_WritePin(hw_cfg->rclk_port, hw_cfg->rclk_pin, GPIO_PIN_RESET);
+    BUS_TRACE_CS_HIGH(trace);
+    BUS_TRACE_END(trace, BUS_TRACE_SN74HC595, BUS_TRACE_OP_LATCH, 0);
     return 0;
 }
 
 int sn74hc595_shift_byte(sn74hc595_cfg_t* hw_cfg, uint8_t data) {
     if (!hw_cfg) return -1;
     if (hw_cfg->config_run != 1) return -1;
-    uint8_t tx_data[1] = {data};
+    uint8_t* tx_data = hw_cfg->tx_buffer;
+    tx_data[0] = data;
+
+#ifdef SPI_BUS_ENABLE
+    if (hw_cfg->bus != NULL) {
+        // The chain has no chip select and shifts in every byte on the bus, so latch before the next transaction
+        spi_bus_transaction_t transaction;
+        if (spi_bus_transaction_setup(&transaction, hw_cfg->bus_device, NULL, 0, tx_data, NULL, 1) != 0) return -1;
+        transaction.priority = hw_cfg->bus_priority;
+        transaction.complete = &bus_latch;
+        transaction.context = hw_cfg;
+        BUS_TRACE_BEGIN(bus_trace);
+        int bus_status = spi_bus_transfer(hw_cfg->bus, &transaction);
+        BUS_TRACE_END(bus_trace, BUS_TRACE_SN74HC595, BUS_TRACE_OP_SHIFT, 1);
+        return bus_status;
+    }
+#endif
 
-    if (hw_cfg->transmit_function(hw_cfg->hspi, tx_data, 1) != HAL_OK) return -1;
+#if defined(__DCACHE_PRESENT) && (__DCACHE_PRESENT == 1U)
+    if (hw_cfg->spi_mode == SN74HC595_SPI_DMA) SCB_CleanDCache_by_Addr((uint32_t*)tx_data, sizeof(hw_cfg->tx_buffer));
+#endif
+    BUS_TRACE_BEGIN(trace);
+    HAL_StatusTypeDef status = hw_cfg->transmit_function(hw_cfg->hspi, tx_data, 1);
+    BUS_TRACE_END(trace, BUS_TRACE_SN74HC595, BUS_TRACE_OP_SHIFT, 1);
+    if (status != HAL_OK) return -1;
     if (hw_cfg->spi_mode == SN74HC595_SPI_BLOCKING){
         sn74hc595_latch_data(hw_cfg);
     }
@@ -3,6 +3,9 @@
 
 #include <stdint.h>
 #include "main.h"
+#ifdef SPI_BUS_ENABLE
+#include "spi_bus.h"
+#endif
 
 #define SN74HC595_SPI_BLOCKING 1
 #define SN74HC595_SPI_IT 2
@@ -11,12 +14,20 @@
 typedef HAL_StatusTypeDef (*sn74hc595_transmit_function)(SPI_HandleTypeDef*, uint8_t*, uint16_t);
 
 typedef struct {
+    // Byte being shifted, owned by the driver so interrupt and DMA transmits outlive the call. 32 byte aligned for
+    // D-cache maintenance
+    uint8_t tx_buffer[32] __attribute__((aligned(32)));
     GPIO_TypeDef* rclk_port;
     uint16_t rclk_pin;
     SPI_HandleTypeDef* hspi;
     uint8_t spi_mode;
     sn74hc595_transmit_function transmit_function;
     uint8_t config_run;
+#ifdef SPI_BUS_ENABLE
+    spi_bus_t* bus;
+    spi_bus_device_t* bus_device;
+    uint8_t bus_priority;
+#endif
 } sn74hc595_cfg_t;
 
 /**
@@ -57,4 +68,19 @@ int sn74hc595_latch_data(sn74hc595_cfg_t* hw_cfg);
 int sn74hc595_shift_byte(   sn74hc595_cfg_t* hw_cfg, 
                             uint8_t data);
 
+#ifdef SPI_BUS_ENABLE
+/**
+ * @brief Shift through a shared SPI bus arbiter instead of the HAL. The byte is queued at the given priority
+ * and latched from the bus completion, before any other transaction, whatever the SPI mode
+ *
+ * @param hw_cfg    Driver configuration structure
+ * @param bus       Bus the chain is on, NULL to go back to the configured SPI mode
+ * @param device    SPI mode and prescaler for the chain, with no chip select
+ * @param priority  SPI_BUS_PRIORITY_*
+ *
+ * @return 0 or -1
+ */
+int sn74hc595_set_bus(sn74hc595_cfg_t* hw_cfg, spi_bus_t* bus, spi_bus_device_t* device, uint8_t priority);
+#endif
+
 #endif /* SN74HC595_H_ */
\ No newline at end of file
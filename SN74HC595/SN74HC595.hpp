@@ -0,0 +1,62 @@
+#ifndef SN74HC595_HPP_
+#define SN74HC595_HPP_
+
+#include "main.h"
+#include <stdint.h>
+#include "stm32_drivers_policies.hpp"
+
+/*
+ * Header-only C++ driver for a fixed chain of N 74HC595s. The chain length, SPI transport and latch pin are
+ * template arguments: a frame is one N byte transfer and a single latch pulse, with none of the per byte checks
+ * or function pointer calls of the C driver. SN74HC595.h stays the API for C code, interrupt / DMA modes and the
+ * shared bus.
+ *
+ * Sn74hc595Chain<2, HalSpi<hspi2>, GpioPin<GpioPortC, GPIO_PIN_1>> leds;
+ * leds.set(0, 0x81);
+ * leds.update();
+ */
+
+template <uint8_t N, typename Spi, typename Latch>
+class Sn74hc595Chain {
+    static_assert(N > 0, "Empty chain");
+
+public:
+    static constexpr uint8_t length = N;
+
+    /**
+     * @brief Shift a whole frame and latch it
+     *
+     * @param frame         N bytes, frame[0] ends up in the last register of the chain
+     *
+     * @return 0 or -1
+     */
+    int write(const uint8_t* frame) {
+        if (Spi::transmit(frame, N) != HAL_OK) return -1;
+        latch();
+        return 0;
+    }
+
+    // Outputs of one register, 0 is the register wired to MOSI. Sent by update()
+    void set(uint8_t index, uint8_t value) {
+        frame_[N - 1 - index] = value;
+    }
+
+    uint8_t get(uint8_t index) const {
+        return frame_[N - 1 - index];
+    }
+
+    int update() {
+        return write(frame_);
+    }
+
+    // RCLK needs a pulse of tens of ns, back to back pin writes are enough
+    static void latch() {
+        Latch::set();
+        Latch::reset();
+    }
+
+private:
+    uint8_t frame_[N] = {};
+};
+
+#endif /* SN74HC595_HPP_ */
@@ -0,0 +1,333 @@
+#include "spi_bus.h"
+#include <string.h>
+
+#define PHASE_HEADER 0
+#define PHASE_DATA 1
+
+// The queue is shared between thread code and interrupts
+static uint32_t lock(void) {
+#if defined(__ARM_ARCH)
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    return primask;
+#else
+    return 0;
+#endif
+}
+
+static void unlock(uint32_t primask) {
+#if defined(__ARM_ARCH)
+    __set_PRIMASK(primask);
+#else
+    (void)primask;
+#endif
+}
+
+uint32_t spi_bus_now(void) {
+    return DWT->CYCCNT;
+}
+
+uint32_t spi_bus_cycles(uint32_t us) {
+    return us * (SystemCoreClock / 1000000U);
+}
+
+int spi_bus_device_config(spi_bus_device_t* device, GPIO_TypeDef* cs_port, uint16_t cs_pin, uint32_t polarity, uint32_t phase, uint32_t prescaler) {
+    if (!device) return -1;
+    device->cs_port = cs_port;
+    device->cs_pin = cs_pin;
+    device->polarity = polarity;
+    device->phase = phase;
+    device->prescaler = prescaler;
+    if (cs_port != NULL) HAL_GPIO_WritePin(cs_port, cs_pin, GPIO_PIN_SET);
+    return 0;
+}
+
+int spi_bus_init(spi_bus_t* bus, SPI_HandleTypeDef* hspi) {
+    if (!bus) return -1;
+    if (hspi == NULL) return -1;
+    memset(bus, 0, sizeof(*bus));
+    bus->hspi = hspi;
+    memset(bus->fill, 0xFF, sizeof(bus->fill));
+#if defined(__DCACHE_PRESENT) && (__DCACHE_PRESENT == 1U)
+    SCB_CleanDCache_by_Addr((uint32_t*)bus->fill, sizeof(bus->fill));
+#endif
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    return 0;
+}
+
+int spi_bus_transaction_setup(spi_bus_transaction_t* transaction, spi_bus_device_t* device, const uint8_t* header, uint8_t header_size,
+                              const uint8_t* tx_data, uint8_t* rx_data, uint32_t size) {
+    if (!transaction) return -1;
+    if (header_size > SPI_BUS_HEADER_SIZE) return -1;
+    if ((header == NULL) && (header_size != 0)) return -1;
+    memset(transaction, 0, sizeof(*transaction));
+    transaction->device = device;
+    if (header_size != 0) memcpy(transaction->header, header, header_size);
+    transaction->header_size = header_size;
+    transaction->tx_data = tx_data;
+    transaction->rx_data = rx_data;
+    transaction->size = size;
+    return 0;
+}
+
+// 1 when a should run before b: priority, then earliest deadline, transactions without one last
+static uint8_t runs_before(const spi_bus_transaction_t* a, const spi_bus_transaction_t* b) {
+    if (a->priority != b->priority) return a->priority > b->priority;
+    if (a->deadline == 0) return 0;
+    if (b->deadline == 0) return 1;
+    return (int32_t)(a->deadline - b->deadline) < 0;
+}
+
+// Called locked. New transactions go behind equals, a preempted one goes back in front of them
+static void enqueue(spi_bus_t* bus, spi_bus_transaction_t* transaction, uint8_t resumed) {
+    spi_bus_transaction_t** link = &bus->queue;
+    while (*link != NULL) {
+        if (resumed ? !runs_before(*link, transaction) : runs_before(transaction, *link)) break;
+        link = &(*link)->next;
+    }
+    transaction->next = *link;
+    *link = transaction;
+}
+
+static void select_device(spi_bus_device_t* device, uint8_t selected) {
+    if (device->cs_port == NULL) return;
+    HAL_GPIO_WritePin(device->cs_port, device->cs_pin, selected ? GPIO_PIN_RESET : GPIO_PIN_SET);
+}
+
+// Only touch the peripheral when the mode or clock differs, HAL_SPI_Init costs a few microseconds
+static int configure(spi_bus_t* bus, spi_bus_device_t* device) {
+    if (bus->configured == device) return 0;
+    SPI_InitTypeDef* init = &bus->hspi->Init;
+    if ((init->CLKPolarity != device->polarity) || (init->CLKPhase != device->phase) || (init->BaudRatePrescaler != device->prescaler)) {
+        init->CLKPolarity = device->polarity;
+        init->CLKPhase = device->phase;
+        init->BaudRatePrescaler = device->prescaler;
+        if (HAL_SPI_Init(bus->hspi) != HAL_OK) {
+            bus->configured = NULL;
+            return -1;
+        }
+        bus->stats.reconfigurations++;
+    }
+    bus->configured = device;
+    return 0;
+}
+
+static void finish(spi_bus_t* bus, uint8_t state) {
+    spi_bus_transaction_t* transaction = bus->active;
+    select_device(transaction->device, 0);
+    bus->active = NULL;
+
+    transaction->finished = spi_bus_now();
+    bus->stats.transactions++;
+    bus->stats.bytes += transaction->header_size + transaction->done;
+    if (state == SPI_BUS_ERROR) bus->stats.errors++;
+    if ((transaction->deadline != 0) && ((int32_t)(transaction->finished - transaction->deadline) > 0)) {
+        bus->stats.deadline_misses++;
+    }
+
+    // A blocking caller may return as soon as the state changes, read the callback first
+    spi_bus_callback complete = transaction->complete;
+    void* context = transaction->context;
+    transaction->state = state;
+    if (complete != NULL) complete(transaction, context);
+}
+
+static int activate(spi_bus_t* bus, spi_bus_transaction_t* transaction) {
+    if (configure(bus, transaction->device) != 0) return -1;
+
+    uint32_t now = spi_bus_now();
+    if (transaction->done == 0) {
+        uint8_t level = (transaction->priority < SPI_BUS_PRIORITIES) ? transaction->priority : (SPI_BUS_PRIORITIES - 1);
+        uint32_t wait = now - transaction->submitted;
+        transaction->started = now;
+        if (wait > bus->stats.max_wait_cycles[level]) bus->stats.max_wait_cycles[level] = wait;
+    } else if ((now - transaction->preempted) > bus->stats.max_preempt_cycles) {
+        bus->stats.max_preempt_cycles = now - transaction->preempted;
+    }
+
+    // A resumed read restarts at the address it reached
+    memcpy(bus->header, transaction->header, transaction->header_size);
+    if (transaction->resume_address && transaction->done) {
+        uint8_t* address = &bus->header[transaction->resume_address];
+        uint32_t next = (((uint32_t)address[0] << 16) | ((uint32_t)address[1] << 8) | address[2]) + transaction->done;
+        address[0] = (uint8_t)(next >> 16);
+        address[1] = (uint8_t)(next >> 8);
+        address[2] = (uint8_t)next;
+    }
+    transaction->state = SPI_BUS_ACTIVE;
+    bus->phase = (transaction->header_size != 0) ? PHASE_HEADER : PHASE_DATA;
+    select_device(transaction->device, 1);
+    return 0;
+}
+
+static HAL_StatusTypeDef issue(spi_bus_t* bus) {
+    spi_bus_transaction_t* transaction = bus->active;
+    if (bus->phase == PHASE_HEADER) {
+        bus->chunk = transaction->header_size;
+#if defined(__DCACHE_PRESENT) && (__DCACHE_PRESENT == 1U)
+        SCB_CleanDCache_by_Addr((uint32_t*)bus->header, sizeof(bus->header));
+#endif
+        return HAL_SPI_Transmit_DMA(bus->hspi, bus->header, (uint16_t)bus->chunk);
+    }
+
+    // Data without a tx buffer is clocked from the fill buffer, so it goes a chunk at a time like preemptible reads
+    uint32_t limit = ((transaction->tx_data != NULL) && !transaction->resume_address) ? 0xFFFF : SPI_BUS_CHUNK_SIZE;
+    uint32_t remaining = transaction->size - transaction->done;
+    bus->chunk = (remaining > limit) ? limit : remaining;
+    uint8_t* tx_data = (transaction->tx_data != NULL) ? (uint8_t*)&transaction->tx_data[transaction->done] : bus->fill;
+#if defined(__DCACHE_PRESENT) && (__DCACHE_PRESENT == 1U)
+    if (transaction->tx_data != NULL) SCB_CleanDCache_by_Addr((uint32_t*)tx_data, bus->chunk);
+#endif
+    if (transaction->rx_data == NULL) return HAL_SPI_Transmit_DMA(bus->hspi, tx_data, (uint16_t)bus->chunk);
+    return HAL_SPI_TransmitReceive_DMA(bus->hspi, tx_data, &transaction->rx_data[transaction->done], (uint16_t)bus->chunk);
+}
+
+// Starts transfers until one is left in flight or the queue is empty. Completions that happen inside (or an
+// interrupt that lands here) only advance the state, this loop issues the next transfer
+static void run(spi_bus_t* bus) {
+    uint32_t primask = lock();
+    if (bus->running || bus->dma_busy) {
+        unlock(primask);
+        return;
+    }
+    bus->running = 1;
+    unlock(primask);
+
+    while (1) {
+        primask = lock();
+        if (bus->dma_busy) {
+            bus->running = 0;
+            unlock(primask);
+            return;
+        }
+        spi_bus_transaction_t* transaction = bus->active;
+        if (transaction == NULL) {
+            transaction = bus->queue;
+            if (transaction == NULL) {
+                bus->running = 0;
+                unlock(primask);
+                return;
+            }
+            bus->queue = transaction->next;
+            bus->active = transaction;
+            unlock(primask);
+
+            if (activate(bus, transaction) != 0) {
+                finish(bus, SPI_BUS_ERROR);
+                continue;
+            }
+            if ((bus->phase == PHASE_DATA) && (transaction->done == transaction->size)) {
+                finish(bus, SPI_BUS_DONE);
+                continue;
+            }
+        } else {
+            unlock(primask);
+        }
+
+        bus->dma_busy = 1;
+        if (issue(bus) != HAL_OK) {
+            bus->dma_busy = 0;
+            finish(bus, SPI_BUS_ERROR);
+        }
+    }
+}
+
+int spi_bus_submit(spi_bus_t* bus, spi_bus_transaction_t* transaction) {
+    if (!bus) return -1;
+    if ((transaction == NULL) || (transaction->device == NULL)) return -1;
+    if (transaction->header_size > SPI_BUS_HEADER_SIZE) return -1;
+    if (transaction->resume_address && ((transaction->resume_address + 3) > transaction->header_size)) return -1;
+    if ((transaction->state == SPI_BUS_QUEUED) || (transaction->state == SPI_BUS_ACTIVE)) return -1;
+
+    transaction->done = 0;
+    transaction->submitted = spi_bus_now();
+    transaction->state = SPI_BUS_QUEUED;
+    uint32_t primask = lock();
+    enqueue(bus, transaction, 0);
+    unlock(primask);
+    run(bus);
+    return 0;
+}
+
+int spi_bus_transfer(spi_bus_t* bus, spi_bus_transaction_t* transaction) {
+    if (spi_bus_submit(bus, transaction) != 0) return -1;
+    while ((transaction->state == SPI_BUS_QUEUED) || (transaction->state == SPI_BUS_ACTIVE)) {
+    }
+    return (transaction->state == SPI_BUS_DONE) ? 0 : -1;
+}
+
+int spi_bus_cancel(spi_bus_t* bus, spi_bus_transaction_t* transaction) {
+    if (!bus) return -1;
+    if (transaction == NULL) return -1;
+
+    int result = 0;
+    uint32_t primask = lock();
+    if (transaction->state == SPI_BUS_QUEUED) {
+        spi_bus_transaction_t** link = &bus->queue;
+        while ((*link != NULL) && (*link != transaction)) link = &(*link)->next;
+        if (*link != NULL) *link = transaction->next;
+    } else if ((transaction->state == SPI_BUS_ACTIVE) && (bus->active == transaction)) {
+        if (bus->dma_busy && (HAL_SPI_Abort(bus->hspi) != HAL_OK)) result = -1;
+        bus->dma_busy = 0;
+        select_device(transaction->device, 0);
+        bus->active = NULL;
+    } else {
+        unlock(primask);
+        return 0;
+    }
+    transaction->next = NULL;
+    transaction->finished = spi_bus_now();
+    transaction->state = SPI_BUS_ERROR;
+    bus->stats.errors++;
+    unlock(primask);
+
+    run(bus);
+    return result;
+}
+
+int spi_bus_dma_complete(spi_bus_t* bus) {
+    if (!bus) return -1;
+    if (!bus->dma_busy) return -1;
+    spi_bus_transaction_t* transaction = bus->active;
+
+    if (bus->phase == PHASE_HEADER) {
+        bus->phase = PHASE_DATA;
+        if (transaction->size == 0) finish(bus, SPI_BUS_DONE);
+    } else {
+#if defined(__DCACHE_PRESENT) && (__DCACHE_PRESENT == 1U)
+        if (transaction->rx_data != NULL) {
+            SCB_InvalidateDCache_by_Addr((uint32_t*)&transaction->rx_data[transaction->done], bus->chunk);
+        }
+#endif
+        transaction->done += bus->chunk;
+        if (transaction->done >= transaction->size) {
+            finish(bus, SPI_BUS_DONE);
+        } else if (transaction->resume_address) {
+            // Chunk boundary: give the bus to anything of higher priority that arrived meanwhile
+            uint32_t primask = lock();
+            if ((bus->queue != NULL) && (bus->queue->priority > transaction->priority)) {
+                select_device(transaction->device, 0);
+                transaction->state = SPI_BUS_QUEUED;
+                transaction->preempted = spi_bus_now();
+                bus->active = NULL;
+                bus->stats.preemptions++;
+                enqueue(bus, transaction, 1);
+            }
+            unlock(primask);
+        }
+    }
+    bus->dma_busy = 0;
+    run(bus);
+    return 0;
+}
+
+int spi_bus_get_stats(spi_bus_t* bus, spi_bus_stats_t* stats, uint8_t reset) {
+    if (!bus) return -1;
+    if (stats == NULL) return -1;
+    uint32_t primask = lock();
+    *stats = bus->stats;
+    if (reset) memset(&bus->stats, 0, sizeof(bus->stats));
+    unlock(primask);
+    return 0;
+}
@@ -0,0 +1,200 @@
+#ifndef SPI_BUS_H_
+#define SPI_BUS_H_
+
+#include "main.h"
+#include <stdint.h>
+
+/*
+ * Shared SPI bus arbiter. Drivers built with SPI_BUS_ENABLE and given a bus (icm_42688_set_bus,
+ * sn74hc595_set_bus, w25q64jv_set_bus) submit their transfers here instead of calling the HAL directly.
+ * Transfers run by DMA, one after the other, highest priority first and earliest deadline first within a
+ * priority. The bus drives CS and switches the SPI mode and prescaler between devices. Reads that carry a 24-bit
+ * address (flash) run in chunks and give way to higher priority work at chunk boundaries, resuming with the
+ * address advanced. Times are DWT->CYCCNT cycles.
+ */
+
+// Bytes per DMA transfer of a preemptible read, the longest a higher priority transaction waits for the bus
+#ifndef SPI_BUS_CHUNK_SIZE
+#define SPI_BUS_CHUNK_SIZE 256
+#endif
+
+#define SPI_BUS_HEADER_SIZE 8
+#define SPI_BUS_PRIORITIES 4
+
+#define SPI_BUS_PRIORITY_LOW 0
+#define SPI_BUS_PRIORITY_NORMAL 1
+#define SPI_BUS_PRIORITY_HIGH 2
+#define SPI_BUS_PRIORITY_URGENT 3
+
+#define SPI_BUS_IDLE 0
+#define SPI_BUS_QUEUED 1
+#define SPI_BUS_ACTIVE 2
+#define SPI_BUS_DONE 3
+#define SPI_BUS_ERROR 4
+
+typedef struct {
+    GPIO_TypeDef* cs_port;      // NULL for a device without a chip select (74HC595 chain)
+    uint16_t cs_pin;
+    uint32_t polarity;          // SPI_POLARITY_*
+    uint32_t phase;             // SPI_PHASE_*
+    uint32_t prescaler;         // SPI_BAUDRATEPRESCALER_*
+} spi_bus_device_t;
+
+typedef struct spi_bus_transaction spi_bus_transaction_t;
+typedef void (*spi_bus_callback)(spi_bus_transaction_t* transaction, void* context);
+
+struct spi_bus_transaction {
+    spi_bus_device_t* device;
+    uint8_t header[SPI_BUS_HEADER_SIZE];    // Command, address and dummy bytes, sent before the data
+    uint8_t header_size;
+    uint8_t resume_address;     // Header index of a 24-bit address, makes the transaction preemptible. 0 = not
+    const uint8_t* tx_data;     // Data phase: tx only, rx only or both. Neither clocks size bytes of 0xFF
+    uint8_t* rx_data;
+    uint32_t size;
+    uint8_t priority;           // SPI_BUS_PRIORITY_*
+    uint32_t deadline;          // Cycle count to finish by, 0 for none
+    spi_bus_callback complete;  // Called from the DMA interrupt when done or failed, may be NULL
+    void* context;
+
+    // Owned by the bus
+    volatile uint8_t state;
+    uint32_t done;
+    uint32_t submitted;
+    uint32_t started;
+    uint32_t preempted;
+    uint32_t finished;
+    spi_bus_transaction_t* next;
+};
+
+typedef struct {
+    uint32_t transactions;
+    uint32_t errors;
+    uint32_t preemptions;
+    uint32_t reconfigurations;  // SPI mode / prescaler changes
+    uint32_t deadline_misses;
+    uint64_t bytes;
+    uint32_t max_wait_cycles[SPI_BUS_PRIORITIES];   // Submit to first byte, per priority
+    uint32_t max_preempt_cycles;    // Longest a preempted transaction waited to resume
+} spi_bus_stats_t;
+
+typedef struct {
+    uint8_t header[SPI_BUS_HEADER_SIZE] __attribute__((aligned(32)));   // DMA copy, address advanced on resume
+    uint8_t fill[SPI_BUS_CHUNK_SIZE] __attribute__((aligned(32)));      // 0xFF for data phases with no tx data
+    SPI_HandleTypeDef* hspi;
+    spi_bus_transaction_t* queue;
+    spi_bus_transaction_t* active;
+    spi_bus_device_t* configured;
+    uint8_t phase;
+    uint32_t chunk;
+    volatile uint8_t dma_busy;
+    volatile uint8_t running;
+    spi_bus_stats_t stats;
+} spi_bus_t;
+
+/**
+ * @brief Set up a device's chip select and SPI mode
+ *
+ * @param device        Device structure, must stay valid
+ * @param cs_port       Chip select port, NULL without a chip select
+ * @param cs_pin        Chip select pin
+ * @param polarity      SPI_POLARITY_LOW or SPI_POLARITY_HIGH
+ * @param phase         SPI_PHASE_1EDGE or SPI_PHASE_2EDGE
+ * @param prescaler     SPI_BAUDRATEPRESCALER_*, within the device's maximum clock
+ *
+ * @return 0 or -1
+ */
+int spi_bus_device_config(spi_bus_device_t* device, GPIO_TypeDef* cs_port, uint16_t cs_pin, uint32_t polarity, uint32_t phase, uint32_t prescaler);
+
+/**
+ * @brief Take over an SPI peripheral. Call spi_bus_dma_complete from the SPI completion callbacks
+ *
+ * @param bus           Bus structure
+ * @param hspi          STM32 SPI handle with DMA on TX and RX
+ *
+ * @return 0 or -1
+ */
+int spi_bus_init(spi_bus_t* bus, SPI_HandleTypeDef* hspi);
+
+/**
+ * @brief Clear a transaction and fill in the transfer. Priority, deadline, resume_address and the callback are
+ * set by the caller afterwards
+ *
+ * @param transaction   Transaction structure
+ * @param device        Target device
+ * @param header        Command bytes, may be NULL with header_size 0
+ * @param header_size   0 to SPI_BUS_HEADER_SIZE
+ * @param tx_data       Data to send, NULL for none
+ * @param rx_data       Data received, NULL to discard
+ * @param size          Data phase length
+ *
+ * @return 0 or -1
+ */
+int spi_bus_transaction_setup(spi_bus_transaction_t* transaction, spi_bus_device_t* device, const uint8_t* header, uint8_t header_size,
+                              const uint8_t* tx_data, uint8_t* rx_data, uint32_t size);
+
+/**
+ * @brief Queue a transaction and return. It starts at once if the bus is idle. Safe from interrupts
+ *
+ * @param bus           Bus structure
+ * @param transaction   Transaction, must stay valid until its state is SPI_BUS_DONE or SPI_BUS_ERROR
+ *
+ * @return 0 or -1
+ */
+int spi_bus_submit(spi_bus_t* bus, spi_bus_transaction_t* transaction);
+
+/**
+ * @brief Queue a transaction and wait for it. Not for use from an interrupt that blocks the SPI DMA interrupt
+ *
+ * @param bus           Bus structure
+ * @param transaction   Transaction
+ *
+ * @return 0 or -1
+ */
+int spi_bus_transfer(spi_bus_t* bus, spi_bus_transaction_t* transaction);
+
+/**
+ * @brief Drop a transaction that is queued or in flight, for a caller whose completion never came. An active
+ * transfer is stopped with HAL_SPI_Abort and CS released. The state becomes SPI_BUS_ERROR and the callback is
+ * not called
+ *
+ * @param bus           Bus structure
+ * @param transaction   Transaction, nothing is done if it is not queued or active
+ *
+ * @return 0 or -1
+ */
+int spi_bus_cancel(spi_bus_t* bus, spi_bus_transaction_t* transaction);
+
+/**
+ * @brief Call from HAL_SPI_TxCpltCallback, HAL_SPI_RxCpltCallback and HAL_SPI_TxRxCpltCallback for this bus.
+ * Finishes the DMA transfer and chains the next one
+ *
+ * @param bus           Bus structure
+ *
+ * @return 0 or -1
+ */
+int spi_bus_dma_complete(spi_bus_t* bus);
+
+/**
+ * @brief Current cycle count, the time base for deadlines
+ */
+uint32_t spi_bus_now(void);
+
+/**
+ * @brief Convert microseconds to cycles for deadlines
+ *
+ * @param us            Time in microseconds
+ */
+uint32_t spi_bus_cycles(uint32_t us);
+
+/**
+ * @brief Get bus statistics
+ *
+ * @param bus           Bus structure
+ * @param stats         Return data
+ * @param reset         1 to clear the counters after reading
+ *
+ * @return 0 or -1
+ */
+int spi_bus_get_stats(spi_bus_t* bus, spi_bus_stats_t* stats, uint8_t reset);
+
+#endif /* SPI_BUS_H_ */
@@ -1,51 +1,987 @@
-#include "w25q64jv_registers.h"
-#include "w25q64jv.h"
-
-typedef struct {
-    void* comms_handle;
-
-} w25q64jv_cfg_t;
-
-int write_enable();
-int volatile_sr_write_enable();
-int write_disable();
-int release_power_down_id();
-int manufacturer_device_id();
-int jedec_id();
-int read_unique_id();
-int read_data();
-int fast_read();
-int page_program();
-int sector_erase_4KB();
-int block_erase_32KB();
-int block_erase_64KB();
-int chip_erase();
-int read_status_register_1();
-int write_status_register_1();
-int read_status_register_2();
-int write_status_register_2();
-int read_status_register_3();
-int write_status_register_3();
-int read_sfdp_register();
-int erase_security_register();
-int program_security_register();
-int read_security_register();
-int global_block_lock();
-int global_block_unlock();
-int read_block_lock();
-int individual_block_lock();
-int individual_block_unlock();
-int erase_program_suspend();
-int erase_program_resume();
-int power_down();
-int enable_reset();
-int reset_device();
-
-int fast_read_dual_output();
-int fast_read_dual_io();
-int mftr_device_id_dual_io();
-int quad_input_page_program();
-int fast_read_quad_output();
-int mftr_device_id_quad_io();
-int fast_read_quad_io();
-int set_burst_with_wrap();
\ No newline at end of file
+#include "W25Q64JV.h"
+#include "W25Q64JV_registers.h"
+#include <string.h>
+
+#ifdef BUS_TRACE_ENABLE
+#include "bus_trace.h"
+#else
+#define BUS_TRACE_BEGIN(span)
+#define BUS_TRACE_CS_LOW(span)
+#define BUS_TRACE_CS_HIGH(span)
+#define BUS_TRACE_END(span, device, op, bytes)
+#endif
+
+// Maximum times from the datasheet AC characteristics, in ms. Program and erase times live in hw_cfg->params
+#define STATUS_WRITE_TIMEOUT 15
+#define SUSPEND_TIMEOUT 1
+#define DMA_TIMEOUT 100
+
+// Deep power-down timing in us
+#define POWER_DOWN_TIME 3           // tDP
+#define RELEASE_POWER_DOWN_TIME 3   // tRES1
+#define RELEASE_POWER_DOWN_ID_TIME 2    // tRES2
+
+#define JEDEC_MANUFACTURER_ID 0xEF
+#define JEDEC_MEMORY_TYPE 0x40
+
+#define SFDP_SIGNATURE 0x50444653
+#define SFDP_BASIC_TABLE_ID 0xFF00
+#define SFDP_MAX_HEADERS 8
+#define SFDP_BASIC_DWORDS 16
+#define SFDP_MAX_CAPACITY 16777216     // Larger parts need 4-byte addressing
+
+// W25Q64JV datasheet values, used until w25q64jv_configure_device reads the part
+static const w25q64jv_params_t default_params = {
+    W25Q64JV_CAPACITY,
+    W25Q64JV_PAGE_SIZE,
+    {
+        {W25Q64JV_SECTOR_SIZE, SECTOR_ERASE_4KB, 45, 400},
+        {W25Q64JV_BLOCK_32KB_SIZE, BLOCK_ERASE_32KB, 120, 1600},
+        {W25Q64JV_BLOCK_64KB_SIZE, BLOCK_ERASE_64KB, 150, 2000},
+        {0, 0, 0, 0}
+    },
+    400,
+    30,
+    3,
+    3,
+    20000,
+    100000,
+    {FAST_READ, 1, 1, 0, 8}
+};
+
+int w25q64jv_config(w25q64jv_cfg_t* hw_cfg, void* comms_handle, GPIO_TypeDef* gpio_port, uint16_t gpio_pin, uint8_t interface) {
+    if (!hw_cfg) return -1;
+    hw_cfg->comms_handle = comms_handle;
+    hw_cfg->gpio_port = gpio_port;
+    hw_cfg->gpio_pin = gpio_pin;
+    hw_cfg->xip_active = 0;
+    hw_cfg->xip_wrap = 0;
+#ifndef HAL_QSPI_MODULE_ENABLED
+    hw_cfg->xip_shadow = NULL;
+    hw_cfg->xip_shadow_size = 0;
+#endif
+    hw_cfg->dma_active = 0;
+#ifdef SPI_BUS_ENABLE
+    hw_cfg->bus = NULL;
+#endif
+    hw_cfg->modify_function = NULL;
+    hw_cfg->modify_context = NULL;
+    hw_cfg->params = default_params;
+    hw_cfg->power_down_timeout = 0;
+    hw_cfg->last_access_tick = 0;
+    hw_cfg->power_down_tick = 0;
+    hw_cfg->powered_down = 0;
+    memset(&hw_cfg->power_stats, 0, sizeof(hw_cfg->power_stats));
+
+#if defined(DWT)
+    // Cycle counter for the microsecond busy-poll schedule
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
+
+    switch (interface) {
+        case W25Q64JV_INTERFACE_SPI:
+        if (gpio_port == NULL) return -1;
+        break;
+#ifdef HAL_QSPI_MODULE_ENABLED
+        case W25Q64JV_INTERFACE_QSPI:
+        break;
+#endif
+        default:
+        return -1;
+    }
+    hw_cfg->interface = interface;
+
+    hw_cfg->config_run = 1;
+    return 0;
+}
+
+static int cs_high(w25q64jv_cfg_t* hw_cfg) {
+    if (hw_cfg->gpio_port == NULL) return -1;
+    HAL_GPIO_WritePin(hw_cfg->gpio_port, hw_cfg->gpio_pin, GPIO_PIN_SET);
+    return 0;
+}
+
+static int cs_low(w25q64jv_cfg_t* hw_cfg) {
+    if (hw_cfg->gpio_port == NULL) return -1;
+    HAL_GPIO_WritePin(hw_cfg->gpio_port, hw_cfg->gpio_pin, GPIO_PIN_RESET);
+    return 0;
+}
+
+#ifdef SPI_BUS_ENABLE
+int w25q64jv_set_bus(w25q64jv_cfg_t* hw_cfg, spi_bus_t* bus, spi_bus_device_t* device, uint8_t priority) {
+    if (!hw_cfg) return -1;
+    if (hw_cfg->config_run != 1) return -1;
+    if (hw_cfg->interface != W25Q64JV_INTERFACE_SPI) return -1;
+    if ((bus != NULL) && (device == NULL)) return -1;
+    if (hw_cfg->dma_active) return -1;
+    hw_cfg->bus = bus;
+    hw_cfg->bus_device = device;
+    hw_cfg->bus_priority = priority;
+    return 0;
+}
+
+// Array reads carry their address at header[1], so the bus can stop them between chunks and resume further on
+static int bus_setup(w25q64jv_cfg_t* hw_cfg, spi_bus_transaction_t* transaction, const uint8_t* header, uint8_t header_size,
+                     const uint8_t* tx_data, uint8_t* rx_data, uint32_t size) {
+    if (spi_bus_transaction_setup(transaction, hw_cfg->bus_device, header, header_size, tx_data, rx_data, size) != 0) return -1;
+    transaction->priority = hw_cfg->bus_priority;
+    if ((header[0] == READ_DATA) || (header[0] == FAST_READ)) transaction->resume_address = 1;
+    return 0;
+}
+
+static int bus_transfer(w25q64jv_cfg_t* hw_cfg, const uint8_t* header, uint8_t header_size, const uint8_t* tx_data, uint8_t* rx_data, uint32_t size) {
+    spi_bus_transaction_t transaction;
+    if (bus_setup(hw_cfg, &transaction, header, header_size, tx_data, rx_data, size) != 0) return -1;
+    BUS_TRACE_BEGIN(trace);
+    int status = spi_bus_transfer(hw_cfg->bus, &transaction);
+    BUS_TRACE_END(trace, BUS_TRACE_W25Q64JV, header[0], header_size + size);
+    return status;
+}
+
+static void bus_dma_complete(spi_bus_transaction_t* transaction, void* context) {
+    (void)transaction;
+    w25q64jv_bus_dma_callback((w25q64jv_cfg_t*)context);
+}
+
+__attribute__((weak)) void w25q64jv_bus_dma_callback(w25q64jv_cfg_t* hw_cfg) {
+    w25q64jv_dma_complete(hw_cfg);
+}
+#endif
+
+static int spi_transfer(w25q64jv_cfg_t* hw_cfg, const uint8_t* header, uint8_t header_size, const uint8_t* tx_data, uint8_t* rx_data, uint32_t size) {
+#ifdef SPI_BUS_ENABLE
+    if (hw_cfg->bus != NULL) return bus_transfer(hw_cfg, header, header_size, tx_data, rx_data, size);
+#endif
+    HAL_StatusTypeDef status = HAL_OK;
+    BUS_TRACE_BEGIN(trace);
+    uint32_t bytes = header_size + size;
+    (void)bytes;
+
+    cs_low(hw_cfg);
+    BUS_TRACE_CS_LOW(trace);
+    status = HAL_SPI_Transmit(hw_cfg->comms_handle, (uint8_t*)header, header_size, HAL_MAX_DELAY);
+
+    // HAL transfers are limited to 16-bit lengths, keep CS low across chunks
+    while ((status == HAL_OK) && (size > 0)) {
+        uint16_t chunk = (size > 0xFFFF) ? 0xFFFF : (uint16_t)size;
+        if (tx_data != NULL) {
+            status = HAL_SPI_Transmit(hw_cfg->comms_handle, (uint8_t*)tx_data, chunk, HAL_MAX_DELAY);
+            tx_data += chunk;
+        } else {
+            status = HAL_SPI_Receive(hw_cfg->comms_handle, rx_data, chunk, HAL_MAX_DELAY);
+            rx_data += chunk;
+        }
+        size -= chunk;
+    }
+    cs_high(hw_cfg);
+    BUS_TRACE_CS_HIGH(trace);
+    BUS_TRACE_END(trace, BUS_TRACE_W25Q64JV, header[0], bytes);
+    if (status != HAL_OK) return -1;
+    return 0;
+}
+
+#ifdef HAL_QSPI_MODULE_ENABLED
+static int qspi_transfer(w25q64jv_cfg_t* hw_cfg, const uint8_t* header, uint8_t address_bytes, uint8_t dummy_bytes, const uint8_t* tx_data, uint8_t* rx_data, uint32_t size) {
+    QSPI_CommandTypeDef command = {0};
+    command.InstructionMode = QSPI_INSTRUCTION_1_LINE;
+    command.Instruction = header[0];
+    command.AddressMode = address_bytes ? QSPI_ADDRESS_1_LINE : QSPI_ADDRESS_NONE;
+    command.AddressSize = QSPI_ADDRESS_24_BITS;
+    command.Address = ((uint32_t)header[1] << 16) | ((uint32_t)header[2] << 8) | header[3];
+    command.AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE;
+    command.DummyCycles = dummy_bytes * 8;
+    command.DataMode = size ? QSPI_DATA_1_LINE : QSPI_DATA_NONE;
+    command.NbData = size;
+    command.DdrMode = QSPI_DDR_MODE_DISABLE;
+    command.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
+    command.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
+
+    // The peripheral drives CS, traces record the call time only
+    BUS_TRACE_BEGIN(trace);
+    HAL_StatusTypeDef status = HAL_QSPI_Command(hw_cfg->comms_handle, &command, HAL_QSPI_TIMEOUT_DEFAULT_VALUE);
+    if ((status == HAL_OK) && (size > 0)) {
+        if (tx_data != NULL) {
+            status = HAL_QSPI_Transmit(hw_cfg->comms_handle, (uint8_t*)tx_data, HAL_QSPI_TIMEOUT_DEFAULT_VALUE);
+        } else {
+            status = HAL_QSPI_Receive(hw_cfg->comms_handle, rx_data, HAL_QSPI_TIMEOUT_DEFAULT_VALUE);
+        }
+    }
+    BUS_TRACE_END(trace, BUS_TRACE_W25Q64JV, header[0], 1 + address_bytes + dummy_bytes + size);
+    if (status != HAL_OK) return -1;
+    return 0;
+}
+
+static uint32_t qspi_lines(uint8_t lines, uint32_t one, uint32_t two, uint32_t four) {
+    if (lines == 4) return four;
+    if (lines == 2) return two;
+    return one;
+}
+
+// Read command phase for the mode in hw_cfg->params.read, data follows with HAL_QSPI_Receive(_DMA)
+static int qspi_read_command(w25q64jv_cfg_t* hw_cfg, uint32_t address, uint32_t size) {
+    w25q64jv_read_mode_t* mode = &hw_cfg->params.read;
+    QSPI_CommandTypeDef command = {0};
+    command.InstructionMode = QSPI_INSTRUCTION_1_LINE;
+    command.Instruction = mode->opcode;
+    command.AddressMode = qspi_lines(mode->address_lines, QSPI_ADDRESS_1_LINE, QSPI_ADDRESS_2_LINES, QSPI_ADDRESS_4_LINES);
+    command.AddressSize = QSPI_ADDRESS_24_BITS;
+    command.Address = address;
+    command.DummyCycles = mode->dummy_clocks;
+
+    // Mode bits of 0xFF keep the part out of continuous read mode
+    if ((mode->mode_clocks * mode->address_lines) == 8) {
+        command.AlternateByteMode = qspi_lines(mode->address_lines, QSPI_ALTERNATE_BYTES_1_LINE, QSPI_ALTERNATE_BYTES_2_LINES, QSPI_ALTERNATE_BYTES_4_LINES);
+        command.AlternateBytesSize = QSPI_ALTERNATE_BYTES_8_BITS;
+        command.AlternateBytes = CONTINUOUS_READ_MODE_RESET;
+    } else {
+        command.AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE;
+        command.DummyCycles += mode->mode_clocks;
+    }
+    command.DataMode = qspi_lines(mode->data_lines, QSPI_DATA_1_LINE, QSPI_DATA_2_LINES, QSPI_DATA_4_LINES);
+    command.NbData = size;
+    command.DdrMode = QSPI_DDR_MODE_DISABLE;
+    command.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
+    command.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
+
+    if (HAL_QSPI_Command(hw_cfg->comms_handle, &command, HAL_QSPI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) return -1;
+    return 0;
+}
+#endif
+
+static int wait_dma(w25q64jv_cfg_t* hw_cfg) {
+    uint32_t start = HAL_GetTick();
+    while (hw_cfg->dma_active) {
+        if ((HAL_GetTick() - start) > DMA_TIMEOUT) return -1;
+    }
+    return 0;
+}
+
+static void build_header(uint8_t* header, uint8_t opcode, uint32_t address, uint8_t address_bytes) {
+    // Instruction, optional 24-bit address, then dummy bytes (sent as 0xFF)
+    for (int i = 0; i < 8; i++) header[i] = 0xFF;
+    header[0] = opcode;
+    if (address_bytes) {
+        header[1] = (uint8_t)(address >> 16);
+        header[2] = (uint8_t)(address >> 8);
+        header[3] = (uint8_t)address;
+    }
+}
+
+static void delay_us(uint32_t us) {
+#if defined(DWT)
+    uint32_t cycles_per_us = SystemCoreClock / 1000000U;
+    while (us > 0) {
+        // Steps of 1ms keep the cycle count far from wrapping
+        uint32_t step = (us > 1000) ? 1000 : us;
+        uint32_t start = DWT->CYCCNT;
+        while ((DWT->CYCCNT - start) < (step * cycles_per_us)) {
+        }
+        us -= step;
+    }
+#else
+    if (us >= 1000) HAL_Delay(us / 1000);
+#endif
+}
+
+// Start point for short intervals, cycles where the core has DWT, otherwise ms ticks
+static uint32_t timestamp(void) {
+#if defined(DWT)
+    return DWT->CYCCNT;
+#else
+    return HAL_GetTick();
+#endif
+}
+
+static uint32_t elapsed_us(uint32_t start) {
+#if defined(DWT)
+    return (DWT->CYCCNT - start) / (SystemCoreClock / 1000000U);
+#else
+    return (HAL_GetTick() - start) * 1000U;
+#endif
+}
+
+static void wait_release(uint32_t us) {
+#if defined(DWT)
+    delay_us(us);
+#else
+    (void)us;
+    HAL_Delay(1);   // No microsecond timebase, wait a whole tick
+#endif
+}
+
+// Sends a command as is, without the access checks or the wake
+static int command_transfer(w25q64jv_cfg_t* hw_cfg, uint8_t opcode, uint32_t address, uint8_t address_bytes, uint8_t dummy_bytes, const uint8_t* tx_data, uint8_t* rx_data, uint32_t size) {
+    uint8_t header[8];
+    build_header(header, opcode, address, address_bytes);
+
+    if (hw_cfg->interface == W25Q64JV_INTERFACE_SPI) {
+        return spi_transfer(hw_cfg, header, 1 + address_bytes + dummy_bytes, tx_data, rx_data, size);
+    }
+#ifdef HAL_QSPI_MODULE_ENABLED
+    if (hw_cfg->interface == W25Q64JV_INTERFACE_QSPI) {
+        return qspi_transfer(hw_cfg, header, address_bytes, dummy_bytes, tx_data, rx_data, size);
+    }
+#endif
+    return -1;
+}
+
+// Leave deep power-down before any other command, the part ignores everything but 0xAB until tRES1 has passed.
+// With id the release also reads the device ID. The part counts as awake only once the release went out
+static int wake(w25q64jv_cfg_t* hw_cfg, uint8_t* id) {
+    uint32_t start = timestamp();
+    uint32_t tick = HAL_GetTick();
+    if (id == NULL) {
+        if (command_transfer(hw_cfg, RELEASE_POWER_DOWN, 0, 0, 0, NULL, NULL, 0) != 0) return -1;
+        wait_release(RELEASE_POWER_DOWN_TIME);
+    } else {
+        if (command_transfer(hw_cfg, RELEASE_POWER_DOWN, 0, 0, 3, NULL, id, 1) != 0) return -1;
+        wait_release(RELEASE_POWER_DOWN_ID_TIME);
+    }
+    hw_cfg->powered_down = 0;
+    hw_cfg->power_stats.powered_down_ms += tick - hw_cfg->power_down_tick;
+
+    uint32_t latency = elapsed_us(start);
+    hw_cfg->power_stats.wakes++;
+    hw_cfg->power_stats.wake_us_total += latency;
+    if (latency > hw_cfg->power_stats.wake_us_max) hw_cfg->power_stats.wake_us_max = latency;
+    return 0;
+}
+
+// Checks shared by every command
+static int check_access(w25q64jv_cfg_t* hw_cfg) {
+    if (hw_cfg->config_run != 1) return -1;
+    if (hw_cfg->xip_active) return -1;  // Indirect commands are refused while memory mapped
+    if (wait_dma(hw_cfg) != 0) return -1;
+    return 0;
+}
+
+// Checks, wakes the part and restarts the idle timer
+static int begin_access(w25q64jv_cfg_t* hw_cfg) {
+    if (check_access(hw_cfg) != 0) return -1;
+    if (hw_cfg->powered_down && (wake(hw_cfg, NULL) != 0)) return -1;
+    hw_cfg->last_access_tick = HAL_GetTick();
+    return 0;
+}
+
+static int flash_transfer(w25q64jv_cfg_t* hw_cfg, uint8_t opcode, uint32_t address, uint8_t address_bytes, uint8_t dummy_bytes, const uint8_t* tx_data, uint8_t* rx_data, uint32_t size) {
+    if (!hw_cfg) return -1;
+    if (begin_access(hw_cfg) != 0) return -1;
+    return command_transfer(hw_cfg, opcode, address, address_bytes, dummy_bytes, tx_data, rx_data, size);
+}
+
+int w25q64jv_write_enable(w25q64jv_cfg_t* hw_cfg) {
+    return flash_transfer(hw_cfg, WRITE_ENABLE, 0, 0, 0, NULL, NULL, 0);
+}
+
+int w25q64jv_volatile_sr_write_enable(w25q64jv_cfg_t* hw_cfg) {
+    return flash_transfer(hw_cfg, VOLATILE_SR_WRITE_ENABLE, 0, 0, 0, NULL, NULL, 0);
+}
+
+int w25q64jv_write_disable(w25q64jv_cfg_t* hw_cfg) {
+    return flash_transfer(hw_cfg, WRITE_DISABLE, 0, 0, 0, NULL, NULL, 0);
+}
+
+int w25q64jv_read_status_register(w25q64jv_cfg_t* hw_cfg, uint8_t reg_no, uint8_t* data) {
+    switch (reg_no) {
+        case 1:
+        return flash_transfer(hw_cfg, READ_STATUS_REGISTER_1, 0, 0, 0, NULL, data, 1);
+        case 2:
+        return flash_transfer(hw_cfg, READ_STATUS_REGISTER_2, 0, 0, 0, NULL, data, 1);
+        case 3:
+        return flash_transfer(hw_cfg, READ_STATUS_REGISTER_3, 0, 0, 0, NULL, data, 1);
+        default:
+        return -1;
+    }
+}
+
+int w25q64jv_write_status_register(w25q64jv_cfg_t* hw_cfg, uint8_t reg_no, uint8_t data) {
+    uint8_t opcode = 0;
+    switch (reg_no) {
+        case 1:
+        opcode = WRITE_STATUS_REGISTER_1;
+        break;
+        case 2:
+        opcode = WRITE_STATUS_REGISTER_2;
+        break;
+        case 3:
+        opcode = WRITE_STATUS_REGISTER_3;
+        break;
+        default:
+        return -1;
+    }
+    if (flash_transfer(hw_cfg, opcode, 0, 0, 0, &data, NULL, 1) != 0) return -1;
+    return w25q64jv_wait_busy(hw_cfg, STATUS_WRITE_TIMEOUT);
+}
+
+int w25q64jv_wait_busy(w25q64jv_cfg_t* hw_cfg, uint32_t timeout) {
+    uint32_t start = HAL_GetTick();
+    uint8_t status = 0;
+    do {
+        if (w25q64jv_read_status_register(hw_cfg, 1, &status) != 0) return -1;
+        if ((status & SR1_BUSY) == 0) return 0;
+    } while ((HAL_GetTick() - start) <= timeout);
+    return -1;
+}
+
+// Busy-poll schedule seeded from the typical time: the first status read is made once 7/8 of it has passed,
+// then every 1/16 of it, instead of reading status continuously for the whole operation
+static int wait_ready(w25q64jv_cfg_t* hw_cfg, uint32_t typical_us, uint32_t timeout) {
+    uint32_t start = HAL_GetTick();
+    uint32_t interval = typical_us / 16;
+    uint8_t status = 0;
+
+    delay_us(typical_us - (typical_us / 8));
+    do {
+        if (w25q64jv_read_status_register(hw_cfg, 1, &status) != 0) return -1;
+        if ((status & SR1_BUSY) == 0) return 0;
+        delay_us(interval);
+    } while ((HAL_GetTick() - start) <= timeout);
+    return -1;
+}
+
+int w25q64jv_manufacturer_device_id(w25q64jv_cfg_t* hw_cfg, uint8_t* id) {
+    return flash_transfer(hw_cfg, MANUFACTURER_DEVICE_ID, 0, 3, 0, NULL, id, 2);
+}
+
+int w25q64jv_jedec_id(w25q64jv_cfg_t* hw_cfg, uint8_t* id) {
+    return flash_transfer(hw_cfg, JEDEC_ID, 0, 0, 0, NULL, id, 3);
+}
+
+int w25q64jv_read_unique_id(w25q64jv_cfg_t* hw_cfg, uint8_t* id) {
+    return flash_transfer(hw_cfg, READ_UNIQUE_ID, 0, 0, 4, NULL, id, 8);
+}
+
+int w25q64jv_read_data(w25q64jv_cfg_t* hw_cfg, uint32_t address, uint8_t* data, uint32_t size) {
+    if (!hw_cfg) return -1;
+    if (data == NULL) return -1;
+    if ((address + size) > hw_cfg->params.capacity) return -1;
+    return flash_transfer(hw_cfg, READ_DATA, address, 3, 0, NULL, data, size);
+}
+
+int w25q64jv_fast_read(w25q64jv_cfg_t* hw_cfg, uint32_t address, uint8_t* data, uint32_t size) {
+    if (!hw_cfg) return -1;
+    if (data == NULL) return -1;
+    if ((address + size) > hw_cfg->params.capacity) return -1;
+#ifdef HAL_QSPI_MODULE_ENABLED
+    if ((hw_cfg->interface == W25Q64JV_INTERFACE_QSPI) && (hw_cfg->params.read.opcode != FAST_READ)) {
+        if (begin_access(hw_cfg) != 0) return -1;
+        if (size == 0) return 0;
+        BUS_TRACE_BEGIN(trace);
+        if (qspi_read_command(hw_cfg, address, size) != 0) return -1;
+        HAL_StatusTypeDef status = HAL_QSPI_Receive(hw_cfg->comms_handle, data, HAL_QSPI_TIMEOUT_DEFAULT_VALUE);
+        BUS_TRACE_END(trace, BUS_TRACE_W25Q64JV, hw_cfg->params.read.opcode, 4 + size);
+        if (status != HAL_OK) return -1;
+        return 0;
+    }
+#endif
+    return flash_transfer(hw_cfg, FAST_READ, address, 3, 1, NULL, data, size);
+}
+
+int w25q64jv_fast_read_dma(w25q64jv_cfg_t* hw_cfg, uint32_t address, uint8_t* data, uint32_t size) {
+    if (!hw_cfg) return -1;
+    if (data == NULL) return -1;
+    if ((size == 0) || (size > 0xFFFF)) return -1;
+    if ((address + size) > hw_cfg->params.capacity) return -1;
+    if (begin_access(hw_cfg) != 0) return -1;
+
+    uint8_t header[8];
+    build_header(header, FAST_READ, address, 3);
+    hw_cfg->dma_active = 1;
+#ifdef BUS_TRACE_ENABLE
+    hw_cfg->trace_dma_start = bus_trace_now();
+    hw_cfg->trace_dma_bytes = (uint16_t)size;
+    hw_cfg->trace_dma_opcode = (hw_cfg->interface == W25Q64JV_INTERFACE_SPI) ? FAST_READ : hw_cfg->params.read.opcode;
+#endif
+
+#ifdef SPI_BUS_ENABLE
+    if (hw_cfg->bus != NULL) {
+        spi_bus_transaction_t* transaction = &hw_cfg->bus_transaction;
+        if (bus_setup(hw_cfg, transaction, header, 5, NULL, data, size) != 0) {
+            hw_cfg->dma_active = 0;
+            return -1;
+        }
+        transaction->complete = &bus_dma_complete;
+        transaction->context = hw_cfg;
+        if (spi_bus_submit(hw_cfg->bus, transaction) != 0) {
+            hw_cfg->dma_active = 0;
+            return -1;
+        }
+        return 0;
+    }
+#endif
+    if (hw_cfg->interface == W25Q64JV_INTERFACE_SPI) {
+        cs_low(hw_cfg);
+        if ((HAL_SPI_Transmit(hw_cfg->comms_handle, header, 5, HAL_MAX_DELAY) != HAL_OK) ||
+            (HAL_SPI_Receive_DMA(hw_cfg->comms_handle, data, (uint16_t)size) != HAL_OK)) {
+            cs_high(hw_cfg);
+            hw_cfg->dma_active = 0;
+            return -1;
+        }
+        return 0;
+    }
+#ifdef HAL_QSPI_MODULE_ENABLED
+    if (hw_cfg->interface == W25Q64JV_INTERFACE_QSPI) {
+        if ((qspi_read_command(hw_cfg, address, size) != 0) ||
+            (HAL_QSPI_Receive_DMA(hw_cfg->comms_handle, data) != HAL_OK)) {
+            hw_cfg->dma_active = 0;
+            return -1;
+        }
+        return 0;
+    }
+#endif
+    hw_cfg->dma_active = 0;
+    return -1;
+}
+
+int w25q64jv_dma_complete(w25q64jv_cfg_t* hw_cfg) {
+    if (!hw_cfg) return -1;
+    if (!hw_cfg->dma_active) return -1;
+#ifdef SPI_BUS_ENABLE
+    if ((hw_cfg->interface == W25Q64JV_INTERFACE_SPI) && (hw_cfg->bus == NULL)) cs_high(hw_cfg);
+#else
+    if (hw_cfg->interface == W25Q64JV_INTERFACE_SPI) cs_high(hw_cfg);
+#endif
+#ifdef BUS_TRACE_ENABLE
+    uint8_t spi = (hw_cfg->interface == W25Q64JV_INTERFACE_SPI);
+    bus_trace_span_t trace = {hw_cfg->trace_dma_start, spi ? hw_cfg->trace_dma_start : 0, bus_trace_now()};
+    uint8_t header_size = (hw_cfg->trace_dma_opcode == PAGE_PROGRAM) ? 4 : (spi ? 5 : 4);
+    BUS_TRACE_END(trace, BUS_TRACE_W25Q64JV, hw_cfg->trace_dma_opcode, hw_cfg->trace_dma_bytes + header_size);
+#endif
+    hw_cfg->dma_active = 0;
+    return 0;
+}
+
+int w25q64jv_dma_abort(w25q64jv_cfg_t* hw_cfg) {
+    if (!hw_cfg) return -1;
+    if (!hw_cfg->dma_active) return 0;
+
+    int result = 0;
+#ifdef SPI_BUS_ENABLE
+    if (hw_cfg->bus != NULL) {
+        result = spi_bus_cancel(hw_cfg->bus, &hw_cfg->bus_transaction);
+        hw_cfg->dma_active = 0;
+        return result;
+    }
+#endif
+    if (hw_cfg->interface == W25Q64JV_INTERFACE_SPI) {
+        if (HAL_SPI_Abort(hw_cfg->comms_handle) != HAL_OK) result = -1;
+        cs_high(hw_cfg);
+    }
+#ifdef HAL_QSPI_MODULE_ENABLED
+    if (hw_cfg->interface == W25Q64JV_INTERFACE_QSPI) {
+        if (HAL_QSPI_Abort(hw_cfg->comms_handle) != HAL_OK) result = -1;
+    }
+#endif
+    hw_cfg->dma_active = 0;
+    return result;
+}
+
+int w25q64jv_set_modify_function(w25q64jv_cfg_t* hw_cfg, w25q64jv_modify_function function, void* context) {
+    if (!hw_cfg) return -1;
+    hw_cfg->modify_function = function;
+    hw_cfg->modify_context = context;
+    return 0;
+}
+
+static void notify_modify(w25q64jv_cfg_t* hw_cfg, uint32_t address, uint32_t size) {
+    if (hw_cfg->modify_function != NULL) {
+        hw_cfg->modify_function(hw_cfg->modify_context, address, size);
+    }
+}
+
+int w25q64jv_page_program_start(w25q64jv_cfg_t* hw_cfg, uint32_t address, const uint8_t* data, uint32_t size) {
+    if (!hw_cfg) return -1;
+    if (data == NULL) return -1;
+    uint16_t page_size = hw_cfg->params.page_size;
+    if ((size == 0) || (size > page_size)) return -1;
+    if (((address % page_size) + size) > page_size) return -1;    // Would wrap within the page
+    if ((address + size) > hw_cfg->params.capacity) return -1;
+
+    notify_modify(hw_cfg, address, size);
+    if (w25q64jv_write_enable(hw_cfg) != 0) return -1;
+    return flash_transfer(hw_cfg, PAGE_PROGRAM, address, 3, 0, data, NULL, size);
+}
+
+int w25q64jv_page_program(w25q64jv_cfg_t* hw_cfg, uint32_t address, const uint8_t* data, uint32_t size) {
+    if (w25q64jv_page_program_start(hw_cfg, address, data, size) != 0) return -1;
+    return w25q64jv_page_program_wait(hw_cfg, size);
+}
+
+int w25q64jv_page_program_wait(w25q64jv_cfg_t* hw_cfg, uint32_t size) {
+    if (!hw_cfg) return -1;
+    if ((size == 0) || (size > hw_cfg->params.page_size)) return -1;
+
+    // Short programs finish well inside the full page time
+    uint32_t typical = hw_cfg->params.program_first_byte_us + (hw_cfg->params.program_next_byte_us * (size - 1));
+    if (typical > hw_cfg->params.program_typical_us) typical = hw_cfg->params.program_typical_us;
+    return wait_ready(hw_cfg, typical, hw_cfg->params.program_max_ms);
+}
+
+int w25q64jv_page_program_dma(w25q64jv_cfg_t* hw_cfg, uint32_t address, const uint8_t* data, uint32_t size) {
+    if (!hw_cfg) return -1;
+    if (data == NULL) return -1;
+    uint16_t page_size = hw_cfg->params.page_size;
+    if ((size == 0) || (size > page_size)) return -1;
+    if (((address % page_size) + size) > page_size) return -1;    // Would wrap within the page
+    if ((address + size) > hw_cfg->params.capacity) return -1;
+
+    notify_modify(hw_cfg, address, size);
+    if (w25q64jv_write_enable(hw_cfg) != 0) return -1;
+#if defined(__DCACHE_PRESENT) && (__DCACHE_PRESENT == 1U)
+    SCB_CleanDCache_by_Addr((uint32_t*)data, (int32_t)size);
+#endif
+
+    uint8_t header[8];
+    build_header(header, PAGE_PROGRAM, address, 3);
+    hw_cfg->dma_active = 1;
+#ifdef BUS_TRACE_ENABLE
+    hw_cfg->trace_dma_start = bus_trace_now();
+    hw_cfg->trace_dma_bytes = (uint16_t)size;
+    hw_cfg->trace_dma_opcode = PAGE_PROGRAM;
+#endif
+
+#ifdef SPI_BUS_ENABLE
+    if (hw_cfg->bus != NULL) {
+        spi_bus_transaction_t* transaction = &hw_cfg->bus_transaction;
+        if (bus_setup(hw_cfg, transaction, header, 4, data, NULL, size) != 0) {
+            hw_cfg->dma_active = 0;
+            return -1;
+        }
+        transaction->complete = &bus_dma_complete;
+        transaction->context = hw_cfg;
+        if (spi_bus_submit(hw_cfg->bus, transaction) != 0) {
+            hw_cfg->dma_active = 0;
+            return -1;
+        }
+        return 0;
+    }
+#endif
+    if (hw_cfg->interface == W25Q64JV_INTERFACE_SPI) {
+        cs_low(hw_cfg);
+        if ((HAL_SPI_Transmit(hw_cfg->comms_handle, header, 4, HAL_MAX_DELAY) != HAL_OK) ||
+            (HAL_SPI_Transmit_DMA(hw_cfg->comms_handle, (uint8_t*)data, (uint16_t)size) != HAL_OK)) {
+            cs_high(hw_cfg);
+            hw_cfg->dma_active = 0;
+            return -1;
+        }
+        return 0;
+    }
+#ifdef HAL_QSPI_MODULE_ENABLED
+    if (hw_cfg->interface == W25Q64JV_INTERFACE_QSPI) {
+        QSPI_CommandTypeDef command = {0};
+        command.InstructionMode = QSPI_INSTRUCTION_1_LINE;
+        command.Instruction = PAGE_PROGRAM;
+        command.AddressMode = QSPI_ADDRESS_1_LINE;
+        command.AddressSize = QSPI_ADDRESS_24_BITS;
+        command.Address = address;
+        command.AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE;
+        command.DataMode = QSPI_DATA_1_LINE;
+        command.NbData = size;
+        command.DdrMode = QSPI_DDR_MODE_DISABLE;
+        command.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
+        command.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
+        if ((HAL_QSPI_Command(hw_cfg->comms_handle, &command, HAL_QSPI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) ||
+            (HAL_QSPI_Transmit_DMA(hw_cfg->comms_handle, (uint8_t*)data) != HAL_OK)) {
+            hw_cfg->dma_active = 0;
+            return -1;
+        }
+        return 0;
+    }
+#endif
+    hw_cfg->dma_active = 0;
+    return -1;
+}
+
+int w25q64jv_busy(w25q64jv_cfg_t* hw_cfg, uint8_t* busy) {
+    if (!hw_cfg) return -1;
+    if (busy == NULL) return -1;
+    if (hw_cfg->dma_active) {
+        *busy = 1;
+        return 0;
+    }
+    uint8_t status = 0;
+    if (w25q64jv_read_status_register(hw_cfg, 1, &status) != 0) return -1;
+    *busy = (status & SR1_BUSY) ? 1 : 0;
+    return 0;
+}
+
+static w25q64jv_erase_type_t* find_erase_type(w25q64jv_cfg_t* hw_cfg, uint32_t size) {
+    for (uint8_t i = 0; i < W25Q64JV_ERASE_TYPES; i++) {
+        if ((hw_cfg->params.erase[i].size == size) && (size != 0)) return &hw_cfg->params.erase[i];
+    }
+    return NULL;
+}
+
+int w25q64jv_erase_start(w25q64jv_cfg_t* hw_cfg, uint32_t address, uint32_t size) {
+    if (!hw_cfg) return -1;
+    if (address >= hw_cfg->params.capacity) return -1;
+
+    uint8_t opcode = CHIP_ERASE;
+    uint8_t address_bytes = 0;
+    if (size != hw_cfg->params.capacity) {
+        w25q64jv_erase_type_t* type = find_erase_type(hw_cfg, size);
+        if (type == NULL) return -1;
+        opcode = type->opcode;
+        address_bytes = 3;
+    }
+
+    notify_modify(hw_cfg, address & ~(size - 1), size);
+    if (w25q64jv_write_enable(hw_cfg) != 0) return -1;
+    return flash_transfer(hw_cfg, opcode, address, address_bytes, 0, NULL, NULL, 0);
+}
+
+static int erase(w25q64jv_cfg_t* hw_cfg, uint32_t address, uint32_t size) {
+    if (!hw_cfg) return -1;
+    uint32_t typical = hw_cfg->params.chip_erase_typical_ms;
+    uint32_t timeout = hw_cfg->params.chip_erase_max_ms;
+    if (size != hw_cfg->params.capacity) {
+        w25q64jv_erase_type_t* type = find_erase_type(hw_cfg, size);
+        if (type == NULL) return -1;
+        typical = type->typical_ms;
+        timeout = type->max_ms;
+    }
+    if (w25q64jv_erase_start(hw_cfg, address, size) != 0) return -1;
+    return wait_ready(hw_cfg, typical * 1000, timeout);
+}
+
+int w25q64jv_sector_erase_4KB(w25q64jv_cfg_t* hw_cfg, uint32_t address) {
+    return erase(hw_cfg, address, W25Q64JV_SECTOR_SIZE);
+}
+
+int w25q64jv_block_erase_32KB(w25q64jv_cfg_t* hw_cfg, uint32_t address) {
+    return erase(hw_cfg, address, W25Q64JV_BLOCK_32KB_SIZE);
+}
+
+int w25q64jv_block_erase_64KB(w25q64jv_cfg_t* hw_cfg, uint32_t address) {
+    return erase(hw_cfg, address, W25Q64JV_BLOCK_64KB_SIZE);
+}
+
+int w25q64jv_chip_erase(w25q64jv_cfg_t* hw_cfg) {
+    if (!hw_cfg) return -1;
+    return erase(hw_cfg, 0, hw_cfg->params.capacity);
+}
+
+int w25q64jv_erase_program_suspend(w25q64jv_cfg_t* hw_cfg) {
+    if (flash_transfer(hw_cfg, ERASE_PROGRAM_SUSPEND, 0, 0, 0, NULL, NULL, 0) != 0) return -1;
+    return w25q64jv_wait_busy(hw_cfg, SUSPEND_TIMEOUT);
+}
+
+int w25q64jv_erase_program_resume(w25q64jv_cfg_t* hw_cfg) {
+    return flash_transfer(hw_cfg, ERASE_PROGRAM_RESUME, 0, 0, 0, NULL, NULL, 0);
+}
+
+int w25q64jv_reset_device(w25q64jv_cfg_t* hw_cfg) {
+    if (flash_transfer(hw_cfg, ENABLE_RESET, 0, 0, 0, NULL, NULL, 0) != 0) return -1;
+    if (flash_transfer(hw_cfg, RESET_DEVICE, 0, 0, 0, NULL, NULL, 0) != 0) return -1;
+    hw_cfg->xip_wrap = 0;   // Back to the power-on state, wrapping off
+    HAL_Delay(1);   // tRST is 30us
+    return 0;
+}
+
+int w25q64jv_test_comms(w25q64jv_cfg_t* hw_cfg) {
+    uint8_t id[3];
+    if (w25q64jv_jedec_id(hw_cfg, id) != 0) return -1;
+    if ((id[0] != JEDEC_MANUFACTURER_ID) || (id[1] != JEDEC_MEMORY_TYPE)) return -1;
+    if ((id[2] >= 32) || ((1UL << id[2]) != hw_cfg->params.capacity)) return -1;    // Capacity ID is log2 of the size in bytes
+    return 0;
+}
+
+int w25q64jv_power_down(w25q64jv_cfg_t* hw_cfg) {
+    if (!hw_cfg) return -1;
+    if (hw_cfg->powered_down) return 0;
+
+    // The part ignores power-down while a program or erase is running
+    uint8_t status = 0;
+    if (w25q64jv_read_status_register(hw_cfg, 1, &status) != 0) return -1;
+    if (status & SR1_BUSY) return -1;
+
+    if (flash_transfer(hw_cfg, POWER_DOWN, 0, 0, 0, NULL, NULL, 0) != 0) return -1;
+    delay_us(POWER_DOWN_TIME);
+    hw_cfg->powered_down = 1;
+    hw_cfg->power_down_tick = HAL_GetTick();
+    hw_cfg->power_stats.power_downs++;
+    return 0;
+}
+
+int w25q64jv_release_power_down_id(w25q64jv_cfg_t* hw_cfg, uint8_t* id) {
+    if (!hw_cfg) return -1;
+    if (id == NULL) return -1;
+    if (hw_cfg->powered_down) {
+        // The ID read is the release, counted and timed like any other wake
+        if (check_access(hw_cfg) != 0) return -1;
+        if (wake(hw_cfg, id) != 0) return -1;
+        hw_cfg->last_access_tick = HAL_GetTick();
+        return 0;
+    }
+    if (flash_transfer(hw_cfg, RELEASE_POWER_DOWN, 0, 0, 3, NULL, id, 1) != 0) return -1;
+    wait_release(RELEASE_POWER_DOWN_ID_TIME);
+    return 0;
+}
+
+int w25q64jv_set_power_down_timeout(w25q64jv_cfg_t* hw_cfg, uint32_t timeout) {
+    if (!hw_cfg) return -1;
+    hw_cfg->power_down_timeout = timeout;
+    hw_cfg->last_access_tick = HAL_GetTick();
+    return 0;
+}
+
+int w25q64jv_power_poll(w25q64jv_cfg_t* hw_cfg) {
+    if (!hw_cfg) return -1;
+    if ((hw_cfg->power_down_timeout == 0) || hw_cfg->powered_down) return 0;
+    if (hw_cfg->xip_active || hw_cfg->dma_active) return 0;
+    if ((HAL_GetTick() - hw_cfg->last_access_tick) < hw_cfg->power_down_timeout) return 0;
+
+    // A program or erase still running restarts the idle timer
+    uint8_t status = 0;
+    if (w25q64jv_read_status_register(hw_cfg, 1, &status) != 0) return -1;
+    if (status & SR1_BUSY) return 0;
+    return w25q64jv_power_down(hw_cfg);
+}
+
+int w25q64jv_get_power_stats(w25q64jv_cfg_t* hw_cfg, w25q64jv_power_stats_t* stats, uint8_t reset) {
+    if (!hw_cfg) return -1;
+    if (stats == NULL) return -1;
+    *stats = hw_cfg->power_stats;
+
+    // Include the period in progress
+    uint32_t now = HAL_GetTick();
+    if (hw_cfg->powered_down) stats->powered_down_ms += now - hw_cfg->power_down_tick;
+    if (reset) {
+        memset(&hw_cfg->power_stats, 0, sizeof(hw_cfg->power_stats));
+        if (hw_cfg->powered_down) hw_cfg->power_down_tick = now;
+    }
+    return 0;
+}
+
+int w25q64jv_read_sfdp(w25q64jv_cfg_t* hw_cfg, uint32_t address, uint8_t* data, uint32_t size) {
+    if (data == NULL) return -1;
+    return flash_transfer(hw_cfg, READ_SFDP_REGISTER, address, 3, 1, NULL, data, size);
+}
+
+int w25q64jv_enable_quad(w25q64jv_cfg_t* hw_cfg) {
+    uint8_t status = 0;
+    if (w25q64jv_read_status_register(hw_cfg, 2, &status) != 0) return -1;
+    if (status & SR2_QE) return 0;
+
+    // QE is non-volatile, only written the first time a part is used in quad mode
+    if (w25q64jv_write_enable(hw_cfg) != 0) return -1;
+    return w25q64jv_write_status_register(hw_cfg, 2, status | SR2_QE);
+}
+
+static uint32_t sfdp_dword(const uint8_t* table, uint8_t number) {
+    // DWORDs are numbered from 1 in JESD216
+    const uint8_t* p = &table[(number - 1) * 4];
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void sfdp_read_mode(w25q64jv_read_mode_t* mode, uint16_t field, uint8_t address_lines, uint8_t data_lines) {
+    // Dummy clocks in bits 4:0, mode clocks in 7:5, opcode in 15:8
+    mode->opcode = (uint8_t)(field >> 8);
+    mode->address_lines = address_lines;
+    mode->data_lines = data_lines;
+    mode->mode_clocks = (uint8_t)((field >> 5) & 0x07);
+    mode->dummy_clocks = (uint8_t)(field & 0x1F);
+}
+
+static int sfdp_parse(w25q64jv_cfg_t* hw_cfg, const uint8_t* table, uint8_t dwords) {
+    w25q64jv_params_t params = hw_cfg->params;
+    if (dwords < 9) return -1;
+
+    // Density in bits, as N - 1 or as a power of two
+    uint32_t density = sfdp_dword(table, 2);
+    if (density & 0x80000000) {
+        density &= 0x7FFFFFFF;
+        if (density > 27) return -1;
+        params.capacity = (1UL << density) / 8;
+    } else {
+        params.capacity = (density / 8) + 1;
+    }
+    if (params.capacity > SFDP_MAX_CAPACITY) return -1;
+
+    uint32_t erase_types = sfdp_dword(table, 8);
+    uint32_t erase_types_2 = sfdp_dword(table, 9);
+    for (uint8_t i = 0; i < W25Q64JV_ERASE_TYPES; i++) {
+        uint16_t field = (uint16_t)(((i < 2) ? (erase_types >> (16 * i)) : (erase_types_2 >> (16 * (i - 2)))) & 0xFFFF);
+        uint8_t exponent = (uint8_t)(field & 0xFF);
+        params.erase[i].size = ((exponent == 0) || (exponent > 24)) ? 0 : (1UL << exponent);
+        params.erase[i].opcode = (uint8_t)(field >> 8);
+    }
+
+    // JESD216B adds typical and maximum times in DWORDs 10 and 11, older tables keep the datasheet values
+    if (dwords >= 11) {
+        static const uint16_t erase_units[4] = {1, 16, 128, 1000};
+        static const uint32_t chip_units[4] = {16, 256, 4000, 64000};
+        uint32_t erase_times = sfdp_dword(table, 10);
+        uint32_t erase_multiplier = 2 * ((erase_times & 0x0F) + 1);
+        for (uint8_t i = 0; i < W25Q64JV_ERASE_TYPES; i++) {
+            uint8_t field = (uint8_t)((erase_times >> (4 + (7 * i))) & 0x7F);
+            params.erase[i].typical_ms = ((field & 0x1F) + 1) * erase_units[field >> 5];
+            params.erase[i].max_ms = params.erase[i].typical_ms * erase_multiplier;
+        }
+
+        uint32_t program_times = sfdp_dword(table, 11);
+        uint32_t program_multiplier = 2 * ((program_times & 0x0F) + 1);
+        params.page_size = (uint16_t)(1U << ((program_times >> 4) & 0x0F));
+        uint8_t field = (uint8_t)((program_times >> 8) & 0x3F);
+        params.program_typical_us = ((field & 0x1F) + 1) * ((field & 0x20) ? 64 : 8);
+        params.program_max_ms = ((params.program_typical_us * program_multiplier) + 999) / 1000;
+        field = (uint8_t)((program_times >> 14) & 0x1F);
+        params.program_first_byte_us = (uint16_t)(((field & 0x0F) + 1) * ((field & 0x10) ? 8 : 1));
+        field = (uint8_t)((program_times >> 19) & 0x1F);
+        params.program_next_byte_us = (uint16_t)(((field & 0x0F) + 1) * ((field & 0x10) ? 8 : 1));
+        field = (uint8_t)((program_times >> 24) & 0x7F);
+        params.chip_erase_typical_ms = ((field & 0x1F) + 1) * chip_units[field >> 5];
+        params.chip_erase_max_ms = params.chip_erase_typical_ms * program_multiplier;
+    }
+    if (params.page_size != W25Q64JV_PAGE_SIZE) return -1;
+
+    // Fastest read first, each later mode clocks more bits on a single line
+    uint32_t features = sfdp_dword(table, 1);
+    uint32_t quad = sfdp_dword(table, 3);
+    uint32_t dual = sfdp_dword(table, 4);
+    params.read = default_params.read;
+    if (hw_cfg->interface == W25Q64JV_INTERFACE_QSPI) {
+        if (features & (1UL << 21)) {
+            sfdp_read_mode(&params.read, (uint16_t)quad, 4, 4);
+        } else if (features & (1UL << 22)) {
+            sfdp_read_mode(&params.read, (uint16_t)(quad >> 16), 1, 4);
+        } else if (features & (1UL << 20)) {
+            sfdp_read_mode(&params.read, (uint16_t)(dual >> 16), 2, 2);
+        } else if (features & (1UL << 16)) {
+            sfdp_read_mode(&params.read, (uint16_t)dual, 1, 2);
+        }
+    }
+
+    hw_cfg->params = params;
+    return 0;
+}
+
+int w25q64jv_configure_device(w25q64jv_cfg_t* hw_cfg) {
+    if (!hw_cfg) return -1;
+    uint8_t header[8 * (SFDP_MAX_HEADERS + 1)];
+    if (w25q64jv_read_sfdp(hw_cfg, 0, header, sizeof(header)) != 0) return -1;
+
+    // No SFDP, keep the W25Q64JV values
+    if (sfdp_dword(header, 1) != SFDP_SIGNATURE) return 0;
+
+    uint8_t headers = header[6] + 1;
+    if (headers > SFDP_MAX_HEADERS) headers = SFDP_MAX_HEADERS;
+    for (uint8_t i = 0; i < headers; i++) {
+        const uint8_t* parameter = &header[8 * (i + 1)];
+        uint16_t id = (uint16_t)((parameter[7] << 8) | parameter[0]);
+        if (id != SFDP_BASIC_TABLE_ID) continue;
+
+        uint8_t dwords = (parameter[3] > SFDP_BASIC_DWORDS) ? SFDP_BASIC_DWORDS : parameter[3];
+        uint32_t pointer = (uint32_t)parameter[4] | ((uint32_t)parameter[5] << 8) | ((uint32_t)parameter[6] << 16);
+        uint8_t table[SFDP_BASIC_DWORDS * 4];
+        if (w25q64jv_read_sfdp(hw_cfg, pointer, table, (uint32_t)dwords * 4) != 0) return -1;
+        if (sfdp_parse(hw_cfg, table, dwords) != 0) return -1;
+
+        if ((hw_cfg->interface == W25Q64JV_INTERFACE_QSPI) && (hw_cfg->params.read.data_lines == 4)) {
+            return w25q64jv_enable_quad(hw_cfg);
+        }
+        return 0;
+    }
+    return 0;
+}
@@ -3,37 +3,519 @@
 
 #include "main.h"
 #include <stdint.h>
+#ifdef SPI_BUS_ENABLE
+#include "spi_bus.h"
+#endif
+
+#define W25Q64JV_INTERFACE_SPI 1
+#define W25Q64JV_INTERFACE_QSPI 2
+
+#define W25Q64JV_PAGE_SIZE 256
+#define W25Q64JV_SECTOR_SIZE 4096
+#define W25Q64JV_BLOCK_32KB_SIZE 32768
+#define W25Q64JV_BLOCK_64KB_SIZE 65536
+#define W25Q64JV_CAPACITY 8388608
+
+#define W25Q64JV_ERASE_TYPES 4
+
+// Called before any program or erase with the affected range, used to keep caches coherent
+typedef void (*w25q64jv_modify_function)(void* context, uint32_t address, uint32_t size);
+
+typedef struct {
+    uint32_t size;              // Bytes, 0 if the slot is unused
+    uint8_t opcode;
+    uint32_t typical_ms;
+    uint32_t max_ms;
+} w25q64jv_erase_type_t;
+
+typedef struct {
+    uint8_t opcode;
+    uint8_t address_lines;
+    uint8_t data_lines;
+    uint8_t mode_clocks;
+    uint8_t dummy_clocks;
+} w25q64jv_read_mode_t;
+
+// Geometry and timing. W25Q64JV datasheet values after w25q64jv_config, read from the part by w25q64jv_configure_device
+typedef struct {
+    uint32_t capacity;
+    uint16_t page_size;
+    w25q64jv_erase_type_t erase[W25Q64JV_ERASE_TYPES];
+    uint32_t program_typical_us;       // Full page
+    uint16_t program_first_byte_us;
+    uint16_t program_next_byte_us;
+    uint32_t program_max_ms;
+    uint32_t chip_erase_typical_ms;
+    uint32_t chip_erase_max_ms;
+    w25q64jv_read_mode_t read;  // Used by w25q64jv_fast_read, the fastest mode the interface supports
+} w25q64jv_params_t;
+
+typedef struct {
+    uint32_t power_downs;
+    uint32_t wakes;
+    uint32_t powered_down_ms;
+    uint32_t wake_us_total;     // Wake latency paid by accesses, release command plus tRES1
+    uint32_t wake_us_max;
+} w25q64jv_power_stats_t;
 
 typedef struct {
     void* comms_handle;
     GPIO_TypeDef* gpio_port;
     uint16_t gpio_pin;
-    uint8_t packet_no;
-    uint16_t accel_calibration[3];
-    uint16_t gyro_calibration[3];
-} icm_42688_cfg_t;
-
-int write_enable();
-int volatile_sr_write_enable();
-int write_disable();
-int release_power_down_id();
-int manufacturer_device_id();
-int jedec_id();
-int read_unique_id();
-int read_data();
-int fast_read();
-int page_program();
-int sector_erase_4KB();
-int block_erase_32KB();
-int block_erase_64KB();
-int chip_erase();
-int read_status_register_1();
-int write_status_register_1();
-int read_status_register_2();
-int write_status_register_2();
-int read_status_register_3();
-int write_status_register_3();
-int read_sfdp_register();
+    uint8_t interface;
+    uint8_t xip_active;
+    uint8_t xip_wrap;
+#ifndef HAL_QSPI_MODULE_ENABLED
+    uint8_t* xip_shadow;
+    uint32_t xip_shadow_size;
+#endif
+    volatile uint8_t dma_active;
+#ifdef BUS_TRACE_ENABLE
+    uint32_t trace_dma_start;   // DMA read or program in flight, traced on completion
+    uint16_t trace_dma_bytes;
+    uint8_t trace_dma_opcode;
+#endif
+#ifdef SPI_BUS_ENABLE
+    spi_bus_t* bus;             // NULL for direct HAL calls
+    spi_bus_device_t* bus_device;
+    uint8_t bus_priority;
+    spi_bus_transaction_t bus_transaction;  // w25q64jv_fast_read_dma / w25q64jv_page_program_dma in flight
+#endif
+    w25q64jv_modify_function modify_function;
+    void* modify_context;
+    w25q64jv_params_t params;
+    uint32_t power_down_timeout;
+    uint32_t last_access_tick;
+    uint32_t power_down_tick;
+    uint8_t powered_down;
+    w25q64jv_power_stats_t power_stats;
+    uint8_t config_run;
+} w25q64jv_cfg_t;
+
+/**
+ * @brief Configure the W25Q64JV driver interface
+ *
+ * @param hw_cfg        Driver configuration structure
+ * @param comms_handle  STM32 SPI handle, or QSPI handle when using W25Q64JV_INTERFACE_QSPI
+ * @param gpio_port     GPIO port for spi CS pin, NULL when the QSPI peripheral drives CS
+ * @param gpio_pin      GPIO pin number for spi CS pin
+ * @param interface     One of W25Q64JV_INTERFACE_SPI or W25Q64JV_INTERFACE_QSPI
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_config(w25q64jv_cfg_t* hw_cfg, void* comms_handle, GPIO_TypeDef* gpio_port, uint16_t gpio_pin, uint8_t interface);
+
+/**
+ * @brief Read the SFDP basic parameter table and configure geometry, erase types, timing and the read mode
+ * from it, so W25Q32JV / W25Q64JV / W25Q128JV parts work without code changes. In QSPI mode the fastest
+ * quad read is selected and the QE bit is set. Parts without SFDP keep the W25Q64JV values
+ *
+ * @param hw_cfg        Driver configuration structure, after w25q64jv_config
+ *
+ * @return 0 or -1 if the part is not supported (over 16MB, or a page size other than W25Q64JV_PAGE_SIZE)
+ */
+int w25q64jv_configure_device(w25q64jv_cfg_t* hw_cfg);
+
+/**
+ * @brief Read the SFDP area
+ *
+ * @param hw_cfg        Driver configuration structure
+ * @param address       Start address in the SFDP area
+ * @param data          Reference for data
+ * @param size          Number of bytes to read
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_read_sfdp(w25q64jv_cfg_t* hw_cfg, uint32_t address, uint8_t* data, uint32_t size);
+
+/**
+ * @brief Set the QE bit so the quad read and XIP commands can use IO2 / IO3. QE is non-volatile, it is only
+ * written if not already set
+ *
+ * @param hw_cfg        Driver configuration structure
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_enable_quad(w25q64jv_cfg_t* hw_cfg);
+
+/**
+ * @brief Set the write enable latch, required before every program, erase or status register write
+ *
+ * @param hw_cfg        Driver configuration structure
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_write_enable(w25q64jv_cfg_t* hw_cfg);
+
+/**
+ * @brief Allow the next status register write to change the volatile bits only
+ *
+ * @param hw_cfg        Driver configuration structure
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_volatile_sr_write_enable(w25q64jv_cfg_t* hw_cfg);
+
+/**
+ * @brief Clear the write enable latch
+ *
+ * @param hw_cfg        Driver configuration structure
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_write_disable(w25q64jv_cfg_t* hw_cfg);
+
+/**
+ * @brief Read one of the three status registers
+ *
+ * @param hw_cfg        Driver configuration structure
+ * @param reg_no        Status register number, 1 to 3
+ * @param data          Reference for data
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_read_status_register(w25q64jv_cfg_t* hw_cfg, uint8_t reg_no, uint8_t* data);
+
+/**
+ * @brief Write one of the three status registers. Write enable (or volatile write enable) must be issued first
+ *
+ * @param hw_cfg        Driver configuration structure
+ * @param reg_no        Status register number, 1 to 3
+ * @param data          Data to write
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_write_status_register(w25q64jv_cfg_t* hw_cfg, uint8_t reg_no, uint8_t data);
+
+/**
+ * @brief Poll the BUSY bit until the current program, erase or status write has finished
+ *
+ * @param hw_cfg        Driver configuration structure
+ * @param timeout       Timeout in ms
+ *
+ * @return 0 or -1 on timeout
+ */
+int w25q64jv_wait_busy(w25q64jv_cfg_t* hw_cfg, uint32_t timeout);
+
+/**
+ * @brief Read the manufacturer and device ID
+ *
+ * @param hw_cfg        Driver configuration structure
+ * @param id            Array of length 2 minimum to store data
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_manufacturer_device_id(w25q64jv_cfg_t* hw_cfg, uint8_t* id);
+
+/**
+ * @brief Read the JEDEC manufacturer, memory type and capacity ID
+ *
+ * @param hw_cfg        Driver configuration structure
+ * @param id            Array of length 3 minimum to store data
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_jedec_id(w25q64jv_cfg_t* hw_cfg, uint8_t* id);
+
+/**
+ * @brief Read the factory programmed 64-bit unique ID
+ *
+ * @param hw_cfg        Driver configuration structure
+ * @param id            Array of length 8 minimum to store data
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_read_unique_id(w25q64jv_cfg_t* hw_cfg, uint8_t* id);
+
+/**
+ * @brief Read data with the standard read command (limited to 50MHz)
+ *
+ * @param hw_cfg        Driver configuration structure
+ * @param address       24-bit start address
+ * @param data          Reference for data
+ * @param size          Number of bytes to read
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_read_data(w25q64jv_cfg_t* hw_cfg, uint32_t address, uint8_t* data, uint32_t size);
+
+/**
+ * @brief Read data with the fast read command, or the quad read selected by w25q64jv_configure_device on QSPI
+ *
+ * @param hw_cfg        Driver configuration structure
+ * @param address       24-bit start address
+ * @param data          Reference for data
+ * @param size          Number of bytes to read
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_fast_read(w25q64jv_cfg_t* hw_cfg, uint32_t address, uint8_t* data, uint32_t size);
+
+/**
+ * @brief Start a fast read that completes by DMA. CS stays low until w25q64jv_dma_complete is called from
+ * HAL_SPI_RxCpltCallback (or HAL_QSPI_RxCpltCallback). Other commands wait for the transfer to finish
+ *
+ * @param hw_cfg        Driver configuration structure
+ * @param address       24-bit start address
+ * @param data          Reference for data, must stay valid until completion
+ * @param size          Number of bytes to read, 1 to 65535
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_fast_read_dma(w25q64jv_cfg_t* hw_cfg, uint32_t address, uint8_t* data, uint32_t size);
+
+/**
+ * @brief Finish a DMA transfer started with w25q64jv_fast_read_dma or w25q64jv_page_program_dma
+ *
+ * @param hw_cfg        Driver configuration structure
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_dma_complete(w25q64jv_cfg_t* hw_cfg);
+
+/**
+ * @brief Stop a DMA transfer whose completion never came, so the driver accepts commands again. Aborts the
+ * peripheral (or cancels the bus transaction) and releases CS. A page program cut short programs only the bytes
+ * already sent
+ *
+ * @param hw_cfg        Driver configuration structure
+ *
+ * @return 0 or -1, the driver is usable again either way
+ */
+int w25q64jv_dma_abort(w25q64jv_cfg_t* hw_cfg);
+
+#ifdef SPI_BUS_ENABLE
+/**
+ * @brief Send all SPI transfers through a shared SPI bus arbiter instead of the HAL. Array reads become
+ * preemptible: they run in SPI_BUS_CHUNK_SIZE pieces and higher priority transactions can take the bus between
+ * them. w25q64jv_fast_read_dma is queued on the bus, which calls w25q64jv_bus_dma_callback when it is done
+ *
+ * @param hw_cfg        Driver configuration structure, SPI interface only
+ * @param bus           Bus the chip is on, NULL to go back to direct HAL calls
+ * @param device        Chip select and SPI mode for the W25Q64JV (mode 0 or 3)
+ * @param priority      SPI_BUS_PRIORITY_*
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_set_bus(w25q64jv_cfg_t* hw_cfg, spi_bus_t* bus, spi_bus_device_t* device, uint8_t priority);
+
+/**
+ * @brief Called from the bus when a w25q64jv_fast_read_dma or w25q64jv_page_program_dma transfer finishes. The
+ * default calls w25q64jv_dma_complete, override it to call w25q64jv_cache_dma_complete or w25q64jv_ota_dma_complete instead
+ *
+ * @param hw_cfg        Driver configuration structure
+ */
+void w25q64jv_bus_dma_callback(w25q64jv_cfg_t* hw_cfg);
+#endif
+
+/**
+ * @brief Register a function called with the affected range before every program or erase
+ *
+ * @param hw_cfg        Driver configuration structure
+ * @param function      Function to call, NULL to remove
+ * @param context       Passed back to the function
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_set_modify_function(w25q64jv_cfg_t* hw_cfg, w25q64jv_modify_function function, void* context);
+
+/**
+ * @brief Start programming up to one page without waiting for completion, see w25q64jv_page_program
+ *
+ * @param hw_cfg        Driver configuration structure
+ * @param address       24-bit start address
+ * @param data          Data to program
+ * @param size          Number of bytes, 1 to 256
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_page_program_start(w25q64jv_cfg_t* hw_cfg, uint32_t address, const uint8_t* data, uint32_t size);
+
+/**
+ * @brief Program up to one page and wait for completion. Data past the end of the page wraps to its start, so it is rejected
+ *
+ * @param hw_cfg        Driver configuration structure
+ * @param address       24-bit start address
+ * @param data          Data to program
+ * @param size          Number of bytes, 1 to 256
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_page_program(w25q64jv_cfg_t* hw_cfg, uint32_t address, const uint8_t* data, uint32_t size);
+
+/**
+ * @brief Start programming up to one page with the data sent by DMA. CS stays low until w25q64jv_dma_complete
+ * is called from HAL_SPI_TxCpltCallback (or HAL_QSPI_TxCpltCallback), after which the chip programs on its own:
+ * check w25q64jv_busy before the next program, other commands wait for the transfer to finish
+ *
+ * @param hw_cfg        Driver configuration structure
+ * @param address       24-bit start address
+ * @param data          Data to program, must stay valid until completion
+ * @param size          Number of bytes, 1 to 256
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_page_program_dma(w25q64jv_cfg_t* hw_cfg, uint32_t address, const uint8_t* data, uint32_t size);
+
+/**
+ * @brief Wait for a program started with w25q64jv_page_program_start or w25q64jv_page_program_dma, polling
+ * status on the schedule w25q64jv_page_program uses (from 7/8 of the typical time for that many bytes)
+ *
+ * @param hw_cfg        Driver configuration structure
+ * @param size          Number of bytes programmed, 1 to 256
+ *
+ * @return 0 or -1 on timeout
+ */
+int w25q64jv_page_program_wait(w25q64jv_cfg_t* hw_cfg, uint32_t size);
+
+/**
+ * @brief Check without waiting whether a DMA transfer, program, erase or status write is still running
+ *
+ * @param hw_cfg        Driver configuration structure
+ * @param busy          Return data, 1 while busy
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_busy(w25q64jv_cfg_t* hw_cfg, uint8_t* busy);
+
+/**
+ * @brief Erase the 4KB sector containing address and wait for completion
+ *
+ * @param hw_cfg        Driver configuration structure
+ * @param address       Any address inside the sector
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_sector_erase_4KB(w25q64jv_cfg_t* hw_cfg, uint32_t address);
+
+/**
+ * @brief Erase the 32KB block containing address and wait for completion
+ *
+ * @param hw_cfg        Driver configuration structure
+ * @param address       Any address inside the block
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_block_erase_32KB(w25q64jv_cfg_t* hw_cfg, uint32_t address);
+
+/**
+ * @brief Erase the 64KB block containing address and wait for completion
+ *
+ * @param hw_cfg        Driver configuration structure
+ * @param address       Any address inside the block
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_block_erase_64KB(w25q64jv_cfg_t* hw_cfg, uint32_t address);
+
+/**
+ * @brief Erase the whole chip and wait for completion (can take over 20 seconds)
+ *
+ * @param hw_cfg        Driver configuration structure
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_chip_erase(w25q64jv_cfg_t* hw_cfg);
+
+/**
+ * @brief Start an erase without waiting for completion
+ *
+ * @param hw_cfg        Driver configuration structure
+ * @param address       Any address inside the region
+ * @param size          One of the erase type sizes in hw_cfg->params, or the capacity for a chip erase
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_erase_start(w25q64jv_cfg_t* hw_cfg, uint32_t address, uint32_t size);
+
+/**
+ * @brief Suspend the erase or program in progress and wait until reads are possible (tSUS, 20us max).
+ * SUS in status register 2 is set if an operation was actually suspended
+ *
+ * @param hw_cfg        Driver configuration structure
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_erase_program_suspend(w25q64jv_cfg_t* hw_cfg);
+
+/**
+ * @brief Resume a suspended erase or program
+ *
+ * @param hw_cfg        Driver configuration structure
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_erase_program_resume(w25q64jv_cfg_t* hw_cfg);
+
+/**
+ * @brief Enter deep power-down (0xB9). Any later command wakes the part first, waiting tRES1
+ *
+ * @param hw_cfg        Driver configuration structure
+ *
+ * @return 0 or -1, -1 while a program or erase is running
+ */
+int w25q64jv_power_down(w25q64jv_cfg_t* hw_cfg);
+
+/**
+ * @brief Release from deep power-down and read the device ID (0xAB), also works when not powered down
+ *
+ * @param hw_cfg        Driver configuration structure
+ * @param id            Reference for the device ID
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_release_power_down_id(w25q64jv_cfg_t* hw_cfg, uint8_t* id);
+
+/**
+ * @brief Set the idle time after which w25q64jv_power_poll puts the part into deep power-down
+ *
+ * @param hw_cfg        Driver configuration structure
+ * @param timeout       Idle time in ms, 0 to disable
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_set_power_down_timeout(w25q64jv_cfg_t* hw_cfg, uint32_t timeout);
+
+/**
+ * @brief Enter deep power-down once the part has been idle for the timeout, call periodically.
+ * Nothing happens while memory mapped, during a DMA read or while a program or erase is running
+ *
+ * @param hw_cfg        Driver configuration structure
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_power_poll(w25q64jv_cfg_t* hw_cfg);
+
+/**
+ * @brief Copy out the power-down counters, the time includes a power-down in progress
+ *
+ * @param hw_cfg        Driver configuration structure
+ * @param stats         Return data
+ * @param reset         Set to 0 to keep counting, otherwise counters are cleared
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_get_power_stats(w25q64jv_cfg_t* hw_cfg, w25q64jv_power_stats_t* stats, uint8_t reset);
+
+/**
+ * @brief Software reset, returns all volatile settings to their power on values
+ *
+ * @param hw_cfg        Driver configuration structure
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_reset_device(w25q64jv_cfg_t* hw_cfg);
+
+/**
+ * @brief Read the JEDEC ID, and compare with the Winbond ID for the configured capacity
+ *
+ * @param hw_cfg        Driver configuration structure
+ *
+ * @return 0 on success, -1 on failure
+ */
+int w25q64jv_test_comms(w25q64jv_cfg_t* hw_cfg);
+
+// Not yet implemented
 int erase_security_register();
 int program_security_register();
 int read_security_register();
@@ -42,11 +524,6 @@ int global_block_unlock();
 int read_block_lock();
 int individual_block_lock();
 int individual_block_unlock();
-int erase_program_suspend();
-int erase_program_resume();
-int power_down();
-int enable_reset();
-int reset_device();
 
 int fast_read_dual_output();
 int fast_read_dual_io();
@@ -54,7 +531,5 @@ int mftr_device_id_dual_io();
 int quad_input_page_program();
 int fast_read_quad_output();
 int mftr_device_id_quad_io();
-int fast_read_quad_io();
-int set_burst_with_wrap();
 
-#endif /* W25Q64JV_H_ */
\ No newline at end of file
+#endif /* W25Q64JV_H_ */
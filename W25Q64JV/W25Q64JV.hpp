@@ -0,0 +1,149 @@
+#ifndef W25Q64JV_HPP_
+#define W25Q64JV_HPP_
+
+#include "main.h"
+#include <stdint.h>
+#include "stm32_drivers_policies.hpp"
+#include "W25Q64JV_registers.h"
+
+/*
+ * Header-only C++ driver for a W25Q64JV on plain SPI. Transport and chip select are template arguments and the
+ * datasheet geometry and timings are constants, so a command is one header transfer and the data phase between
+ * two pin writes. There is no power-down manager, DMA, QSPI or SFDP discovery: W25Q64JV.h stays the API for
+ * those and for C code.
+ *
+ * W25q64jv<HalSpi<hspi1>, GpioPin<GpioPortA, GPIO_PIN_4>> flash;
+ * flash.fast_read(0x1000, data, sizeof(data));
+ */
+
+template <typename Spi, typename Cs>
+class W25q64jv {
+public:
+    static constexpr uint32_t capacity = 8388608;
+    static constexpr uint32_t page_size = 256;
+    static constexpr uint32_t sector_size = 4096;
+    static constexpr uint32_t block_size = 65536;
+
+    int read_data(uint32_t address, uint8_t* data, uint32_t size) {
+        if ((address + size) > capacity) return -1;
+        return command(READ_DATA, address, 3, 0, nullptr, data, size);
+    }
+
+    int fast_read(uint32_t address, uint8_t* data, uint32_t size) {
+        if ((address + size) > capacity) return -1;
+        return command(FAST_READ, address, 3, 1, nullptr, data, size);
+    }
+
+    int jedec_id(uint8_t* id) {
+        return command(JEDEC_ID, 0, 0, 0, nullptr, id, 3);
+    }
+
+    int read_status_register_1(uint8_t* status) {
+        return command(READ_STATUS_REGISTER_1, 0, 0, 0, nullptr, status, 1);
+    }
+
+    int write_enable() {
+        return command(WRITE_ENABLE, 0, 0, 0, nullptr, nullptr, 0);
+    }
+
+    // Program within one page and return without waiting
+    int page_program_start(uint32_t address, const uint8_t* data, uint32_t size) {
+        if ((size == 0) || (size > page_size)) return -1;
+        if (((address % page_size) + size) > page_size) return -1;
+        if ((address + size) > capacity) return -1;
+        if (write_enable() != 0) return -1;
+        return command(PAGE_PROGRAM, address, 3, 0, data, nullptr, size);
+    }
+
+    int page_program(uint32_t address, const uint8_t* data, uint32_t size) {
+        if (page_program_start(address, data, size) != 0) return -1;
+        uint32_t typical = program_first_byte_us + (program_next_byte_us * (size - 1));
+        if (typical > program_typical_us) typical = program_typical_us;
+        return wait_ready(typical, program_max_ms);
+    }
+
+    int sector_erase_4KB(uint32_t address) {
+        return erase(SECTOR_ERASE_4KB, address, sector_size, 45, 400);
+    }
+
+    int block_erase_32KB(uint32_t address) {
+        return erase(BLOCK_ERASE_32KB, address, block_size / 2, 120, 1600);
+    }
+
+    int block_erase_64KB(uint32_t address) {
+        return erase(BLOCK_ERASE_64KB, address, block_size, 150, 2000);
+    }
+
+    /**
+     * @brief Wait for BUSY to clear, sleeping through most of the typical time before polling
+     *
+     * @param typical_us    Datasheet typical time of the operation
+     * @param timeout       Give up after this many ms
+     *
+     * @return 0 or -1
+     */
+    int wait_ready(uint32_t typical_us, uint32_t timeout) {
+        uint32_t start = HAL_GetTick();
+        uint8_t status = 0;
+        delay_us(typical_us - (typical_us / 8));
+        do {
+            if (read_status_register_1(&status) != 0) return -1;
+            if ((status & SR1_BUSY) == 0) return 0;
+            delay_us(typical_us / 16);
+        } while ((HAL_GetTick() - start) <= timeout);
+        return -1;
+    }
+
+private:
+    static constexpr uint32_t program_typical_us = 400;
+    static constexpr uint32_t program_first_byte_us = 30;
+    static constexpr uint32_t program_next_byte_us = 3;
+    static constexpr uint32_t program_max_ms = 3;
+    static constexpr uint32_t max_transfer = 0x8000;   // HAL sizes are 16 bit
+
+    int command(uint8_t opcode, uint32_t address, uint8_t address_bytes, uint8_t dummy_bytes, const uint8_t* tx_data,
+                uint8_t* rx_data, uint32_t size) {
+        uint8_t header[5] = {opcode, static_cast<uint8_t>(address >> 16), static_cast<uint8_t>(address >> 8),
+                             static_cast<uint8_t>(address), 0xFF};
+        Cs::reset();
+        HAL_StatusTypeDef status = Spi::transmit(header, static_cast<uint16_t>(1 + address_bytes + dummy_bytes));
+        for (uint32_t done = 0; (status == HAL_OK) && (done < size);) {
+            uint16_t chunk = static_cast<uint16_t>(((size - done) > max_transfer) ? max_transfer : (size - done));
+            status = (tx_data != nullptr) ? Spi::transmit(&tx_data[done], chunk) : Spi::receive(&rx_data[done], chunk);
+            done += chunk;
+        }
+        Cs::set();
+        return (status == HAL_OK) ? 0 : -1;
+    }
+
+    int erase(uint8_t opcode, uint32_t address, uint32_t size, uint32_t typical_ms, uint32_t max_ms) {
+        if ((address % size) != 0) return -1;
+        if (address >= capacity) return -1;
+        if (write_enable() != 0) return -1;
+        if (command(opcode, address, 3, 0, nullptr, nullptr, 0) != 0) return -1;
+        return wait_ready(typical_ms * 1000, max_ms);
+    }
+
+    static void delay_us(uint32_t us) {
+#if defined(DWT)
+        // The C driver starts the cycle counter in w25q64jv_config, this class has no config so it starts it here
+        if ((DWT->CTRL & DWT_CTRL_CYCCNTENA_Msk) == 0) {
+            CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+            DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+        }
+        uint32_t cycles_per_us = SystemCoreClock / 1000000U;
+        while (us > 0) {
+            // Steps of 1ms keep the cycle count far from wrapping
+            uint32_t step = (us > 1000) ? 1000 : us;
+            uint32_t begin = DWT->CYCCNT;
+            while ((DWT->CYCCNT - begin) < (step * cycles_per_us)) {
+            }
+            us -= step;
+        }
+#else
+        if (us >= 1000) HAL_Delay(us / 1000);
+#endif
+    }
+};
+
+#endif /* W25Q64JV_HPP_ */
@@ -0,0 +1,272 @@
+#include "W25Q64JV_bd.h"
+#include <string.h>
+
+#define DMA_TIMEOUT 100
+
+static uint8_t test_bit(const uint8_t* map, uint32_t block) {
+    return (map[block / 8] >> (block % 8)) & 1;
+}
+
+static void set_bit(uint8_t* map, uint32_t block) {
+    map[block / 8] |= (uint8_t)(1 << (block % 8));
+}
+
+static void clear_bit(uint8_t* map, uint32_t block) {
+    map[block / 8] &= (uint8_t)~(1 << (block % 8));
+}
+
+static int in_range(w25q64jv_bd_t* bd, uint32_t block, uint32_t offset, uint32_t size) {
+    if (block >= bd->block_count) return -1;
+    uint32_t available = (bd->block_count - block) * W25Q64JV_BD_BLOCK_SIZE;
+    if ((offset > available) || (size > (available - offset))) return -1;
+    return 0;
+}
+
+// Whole D-cache lines at a line boundary, so a DMA transfer never touches a line it does not own
+static uint8_t dma_safe(w25q64jv_bd_t* bd, const uint8_t* data, uint32_t size) {
+    return bd->dma && (((uintptr_t)data % 32) == 0) && ((size % 32) == 0);
+}
+
+static int wait_dma(w25q64jv_bd_t* bd) {
+    uint32_t start = HAL_GetTick();
+    while (bd->flash->dma_active) {
+        if ((HAL_GetTick() - start) > DMA_TIMEOUT) return -1;
+    }
+    return 0;
+}
+
+static int flash_read(w25q64jv_bd_t* bd, uint32_t address, uint8_t* data, uint32_t size) {
+    bd->stats.reads++;
+    bd->stats.read_bytes += size;
+    if (!dma_safe(bd, data, size) || (size > 0xFFFF)) return w25q64jv_fast_read(bd->flash, address, data, size);
+
+    if (w25q64jv_fast_read_dma(bd->flash, address, data, size) != 0) return -1;
+    bd->stats.dma_transfers++;
+    if (wait_dma(bd) != 0) return -1;
+#if defined(__DCACHE_PRESENT) && (__DCACHE_PRESENT == 1U)
+    SCB_InvalidateDCache_by_Addr((uint32_t*)data, (int32_t)size);
+#endif
+    return 0;
+}
+
+static int erase_unit(w25q64jv_bd_t* bd, uint32_t address, uint32_t size) {
+    switch (size) {
+        case W25Q64JV_SECTOR_SIZE:
+        return w25q64jv_sector_erase_4KB(bd->flash, address);
+        case W25Q64JV_BLOCK_32KB_SIZE:
+        return w25q64jv_block_erase_32KB(bd->flash, address);
+        case W25Q64JV_BLOCK_64KB_SIZE:
+        return w25q64jv_block_erase_64KB(bd->flash, address);
+        default:
+        return -1;
+    }
+}
+
+// Largest erase aligned at the block that stays inside [first, end) and only covers pending or blank blocks
+static uint32_t erase_size(w25q64jv_bd_t* bd, uint32_t block, uint32_t first, uint32_t end) {
+    uint32_t best = W25Q64JV_SECTOR_SIZE;
+    for (uint8_t i = 0; i < W25Q64JV_ERASE_TYPES; i++) {
+        uint32_t size = bd->flash->params.erase[i].size;
+        if ((size <= best) || (size > W25Q64JV_BLOCK_64KB_SIZE)) continue;
+        if (((bd->address + (block * W25Q64JV_BD_BLOCK_SIZE)) % size) != 0) continue;
+        uint32_t blocks = size / W25Q64JV_BD_BLOCK_SIZE;
+        if ((block < first) || ((block + blocks) > end)) continue;
+        uint32_t b = block;
+        while ((b < (block + blocks)) && (test_bit(bd->pending, b) || test_bit(bd->blank, b))) b++;
+        if (b == (block + blocks)) best = size;
+    }
+    return best;
+}
+
+// Send the pending erases of blocks first to first + count - 1
+static int flush_erases(w25q64jv_bd_t* bd, uint32_t first, uint32_t count) {
+    uint32_t end = first + count;
+    uint32_t block = first;
+    while (block < end) {
+        if (!test_bit(bd->pending, block)) {
+            block++;
+            continue;
+        }
+        uint32_t size = erase_size(bd, block, first, end);
+        if (erase_unit(bd, bd->address + (block * W25Q64JV_BD_BLOCK_SIZE), size) != 0) return -1;
+        bd->stats.erases++;
+        for (uint32_t i = 0; i < (size / W25Q64JV_BD_BLOCK_SIZE); i++, block++) {
+            clear_bit(bd->pending, block);
+            set_bit(bd->blank, block);
+            bd->stats.erase_blocks++;
+        }
+    }
+    return 0;
+}
+
+int w25q64jv_bd_init(w25q64jv_bd_t* bd, w25q64jv_cfg_t* flash, uint32_t address, uint32_t size, uint8_t dma) {
+    if (!bd) return -1;
+    if (!flash) return -1;
+    if (((address % W25Q64JV_BD_BLOCK_SIZE) != 0) || ((size % W25Q64JV_BD_BLOCK_SIZE) != 0)) return -1;
+    if ((size == 0) || (address >= flash->params.capacity) || (size > (flash->params.capacity - address))) return -1;
+    if ((size / W25Q64JV_BD_BLOCK_SIZE) > W25Q64JV_BD_MAX_BLOCKS) return -1;
+
+    memset(bd, 0, sizeof(*bd));
+    bd->flash = flash;
+    bd->address = address;
+    bd->block_count = size / W25Q64JV_BD_BLOCK_SIZE;
+    bd->dma = dma ? 1 : 0;
+    return 0;
+}
+
+int w25q64jv_bd_read(w25q64jv_bd_t* bd, uint32_t block, uint32_t offset, uint8_t* data, uint32_t size) {
+    if (!bd) return -1;
+    if (data == NULL) return -1;
+    if (in_range(bd, block, offset, size) != 0) return -1;
+    if (size == 0) return 0;
+
+    uint32_t start = (block * W25Q64JV_BD_BLOCK_SIZE) + offset;
+    uint32_t end = start + size;
+    uint32_t first = start / W25Q64JV_BD_BLOCK_SIZE;
+    uint32_t last = (end - 1) / W25Q64JV_BD_BLOCK_SIZE;
+    uint32_t pending = 0;
+    for (uint32_t b = first; b <= last; b++) pending += test_bit(bd->pending, b);
+
+    // One command for the whole range, blocks waiting for their erase are then overwritten with 0xFF
+    if ((pending < (last - first + 1)) && (flash_read(bd, bd->address + start, data, size) != 0)) return -1;
+    for (uint32_t b = first; (b <= last) && (pending > 0); b++) {
+        if (!test_bit(bd->pending, b)) continue;
+        uint32_t low = b * W25Q64JV_BD_BLOCK_SIZE;
+        uint32_t high = low + W25Q64JV_BD_BLOCK_SIZE;
+        if (low < start) low = start;
+        if (high > end) high = end;
+        memset(&data[low - start], 0xFF, high - low);
+        bd->stats.blank_bytes += high - low;
+    }
+    return 0;
+}
+
+int w25q64jv_bd_prog(w25q64jv_bd_t* bd, uint32_t block, uint32_t offset, const uint8_t* data, uint32_t size) {
+    if (!bd) return -1;
+    if (data == NULL) return -1;
+    if (in_range(bd, block, offset, size) != 0) return -1;
+    if (size == 0) return 0;
+
+    uint32_t start = (block * W25Q64JV_BD_BLOCK_SIZE) + offset;
+    uint32_t first = start / W25Q64JV_BD_BLOCK_SIZE;
+    uint32_t last = (start + size - 1) / W25Q64JV_BD_BLOCK_SIZE;
+    if (flush_erases(bd, first, last - first + 1) != 0) return -1;
+
+    // With DMA the next page is staged while the previous one programs
+    uint16_t page_size = bd->flash->params.page_size;
+    uint8_t slot = 0;
+    uint32_t programming = 0;   // Bytes of the program in flight
+    uint32_t done = 0;
+    while (done < size) {
+        uint32_t address = bd->address + start + done;
+        uint32_t chunk = page_size - (address % page_size);
+        if (chunk > (size - done)) chunk = size - done;
+
+        if (!bd->dma) {
+            if (w25q64jv_page_program(bd->flash, address, &data[done], chunk) != 0) return -1;
+        } else {
+            const uint8_t* source = &data[done];
+            if (!dma_safe(bd, source, chunk)) {
+                memcpy(bd->page[slot], source, chunk);
+                source = bd->page[slot];
+                slot ^= 1;
+            }
+            if (programming && (w25q64jv_page_program_wait(bd->flash, programming) != 0)) return -1;
+            if (w25q64jv_page_program_dma(bd->flash, address, source, chunk) != 0) return -1;
+            programming = chunk;
+            bd->stats.dma_transfers++;
+        }
+        bd->stats.pages++;
+        done += chunk;
+    }
+    if (programming && (w25q64jv_page_program_wait(bd->flash, programming) != 0)) return -1;
+
+    for (uint32_t b = first; b <= last; b++) clear_bit(bd->blank, b);
+    bd->stats.progs++;
+    bd->stats.prog_bytes += size;
+    return 0;
+}
+
+int w25q64jv_bd_erase(w25q64jv_bd_t* bd, uint32_t block) {
+    if (!bd) return -1;
+    if (block >= bd->block_count) return -1;
+    bd->stats.erase_requests++;
+    if (test_bit(bd->blank, block)) {
+        bd->stats.erases_skipped++;
+        return 0;
+    }
+    set_bit(bd->pending, block);
+    return 0;
+}
+
+int w25q64jv_bd_sync(w25q64jv_bd_t* bd) {
+    if (!bd) return -1;
+    bd->stats.syncs++;
+    return w25q64jv_wait_busy(bd->flash, bd->flash->params.program_max_ms);
+}
+
+int w25q64jv_bd_disk_read(w25q64jv_bd_t* bd, uint8_t* buffer, uint32_t sector, uint32_t count) {
+    if (!bd) return -1;
+    if (count > bd->block_count) return -1;
+    return w25q64jv_bd_read(bd, sector, 0, buffer, count * W25Q64JV_BD_BLOCK_SIZE);
+}
+
+int w25q64jv_bd_disk_write(w25q64jv_bd_t* bd, const uint8_t* buffer, uint32_t sector, uint32_t count) {
+    if (!bd) return -1;
+    if (buffer == NULL) return -1;
+    if ((count == 0) || (in_range(bd, sector, 0, count * W25Q64JV_BD_BLOCK_SIZE) != 0)) return -1;
+
+    // Sectors are rewritten whole, so every one that is not blank is erased, together where the run allows
+    for (uint32_t b = sector; b < (sector + count); b++) {
+        if (!test_bit(bd->blank, b)) set_bit(bd->pending, b);
+    }
+    return w25q64jv_bd_prog(bd, sector, 0, buffer, count * W25Q64JV_BD_BLOCK_SIZE);
+}
+
+#ifdef W25Q64JV_BD_LITTLEFS
+static int bd_lfs_read(const struct lfs_config* c, lfs_block_t block, lfs_off_t off, void* buffer, lfs_size_t size) {
+    return (w25q64jv_bd_read((w25q64jv_bd_t*)c->context, block, off, (uint8_t*)buffer, size) == 0) ? 0 : LFS_ERR_IO;
+}
+
+static int bd_lfs_prog(const struct lfs_config* c, lfs_block_t block, lfs_off_t off, const void* buffer, lfs_size_t size) {
+    return (w25q64jv_bd_prog((w25q64jv_bd_t*)c->context, block, off, (const uint8_t*)buffer, size) == 0) ? 0 : LFS_ERR_IO;
+}
+
+static int bd_lfs_erase(const struct lfs_config* c, lfs_block_t block) {
+    return (w25q64jv_bd_erase((w25q64jv_bd_t*)c->context, block) == 0) ? 0 : LFS_ERR_IO;
+}
+
+static int bd_lfs_sync(const struct lfs_config* c) {
+    return (w25q64jv_bd_sync((w25q64jv_bd_t*)c->context) == 0) ? 0 : LFS_ERR_IO;
+}
+
+int w25q64jv_bd_lfs_config(w25q64jv_bd_t* bd, struct lfs_config* config) {
+    if (!bd) return -1;
+    if (config == NULL) return -1;
+    memset(config, 0, sizeof(*config));
+    config->context = bd;
+    config->read = &bd_lfs_read;
+    config->prog = &bd_lfs_prog;
+    config->erase = &bd_lfs_erase;
+    config->sync = &bd_lfs_sync;
+    config->read_size = 1;
+    config->prog_size = 1;
+    config->block_size = W25Q64JV_BD_BLOCK_SIZE;
+    config->block_count = bd->block_count;
+    config->block_cycles = 500;
+    config->cache_size = W25Q64JV_BD_CACHE_SIZE;
+    config->lookahead_size = W25Q64JV_BD_LOOKAHEAD_SIZE;
+    config->read_buffer = bd->read_buffer;
+    config->prog_buffer = bd->prog_buffer;
+    config->lookahead_buffer = bd->lookahead_buffer;
+    return 0;
+}
+#endif
+
+int w25q64jv_bd_get_stats(w25q64jv_bd_t* bd, w25q64jv_bd_stats_t* stats, uint8_t reset) {
+    if (!bd) return -1;
+    if (stats == NULL) return -1;
+    *stats = bd->stats;
+    if (reset) memset(&bd->stats, 0, sizeof(bd->stats));
+    return 0;
+}
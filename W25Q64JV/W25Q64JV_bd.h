@@ -0,0 +1,181 @@
+#ifndef W25Q64JV_BD_H_
+#define W25Q64JV_BD_H_
+
+#include "W25Q64JV.h"
+#include <stdint.h>
+#ifdef W25Q64JV_BD_LITTLEFS
+#include "lfs.h"
+#endif
+
+/*
+ * Block device over a sector aligned region of the flash, for littlefs (read / prog / erase / sync) and FatFS
+ * (disk_read / disk_write with 4KB sectors, FF_MAX_SS 4096). Blocks are 4KB erase sectors.
+ *
+ * A read over any number of contiguous blocks is one FAST_READ. Erases are lazy: an erase request only marks
+ * the block, reads of a marked block return 0xFF without touching the flash, and the erase is sent before the
+ * first program into it. Blocks known to be blank since their last erase are not erased again, and runs of
+ * blocks written together (disk_write) are erased with the largest 32KB / 64KB erase that fits. Pending erases
+ * live in RAM: after a reset the block still holds its old data, as if the erase had never been requested.
+ *
+ * With DMA on, page programs and reads of up to 64KB go by DMA from buffers that are 32 byte aligned with a
+ * size that is a multiple of 32 (D-cache lines), which includes the littlefs caches below; program data in
+ * other buffers is staged through the aligned page buffers, other reads use the polled path. The SPI callbacks
+ * must call w25q64jv_dma_complete as for w25q64jv_page_program_dma.
+ */
+
+#define W25Q64JV_BD_BLOCK_SIZE W25Q64JV_SECTOR_SIZE
+
+// Largest region in blocks, 8MB
+#ifndef W25Q64JV_BD_MAX_BLOCKS
+#define W25Q64JV_BD_MAX_BLOCKS 2048
+#endif
+
+// littlefs read and program cache, a multiple of 32 for DMA
+#ifndef W25Q64JV_BD_CACHE_SIZE
+#define W25Q64JV_BD_CACHE_SIZE W25Q64JV_PAGE_SIZE
+#endif
+
+// littlefs lookahead buffer, 8 blocks per byte
+#ifndef W25Q64JV_BD_LOOKAHEAD_SIZE
+#define W25Q64JV_BD_LOOKAHEAD_SIZE 32
+#endif
+
+typedef struct {
+    uint32_t reads;             // FAST_READ commands
+    uint32_t read_bytes;
+    uint32_t blank_bytes;       // Read from blocks with a pending erase, not sent to the flash
+    uint32_t progs;
+    uint32_t prog_bytes;
+    uint32_t pages;             // Page program commands
+    uint32_t erase_requests;
+    uint32_t erases;            // Erase commands, any size
+    uint32_t erase_blocks;      // Blocks erased by them
+    uint32_t erases_skipped;    // Requests for blocks still blank
+    uint32_t dma_transfers;
+    uint32_t syncs;
+} w25q64jv_bd_stats_t;
+
+typedef struct {
+    // Buffers first and 32 byte aligned so DMA never shares a D-cache line with the bookkeeping
+    uint8_t read_buffer[W25Q64JV_BD_CACHE_SIZE] __attribute__((aligned(32)));       // littlefs caches
+    uint8_t prog_buffer[W25Q64JV_BD_CACHE_SIZE] __attribute__((aligned(32)));
+    uint8_t lookahead_buffer[W25Q64JV_BD_LOOKAHEAD_SIZE] __attribute__((aligned(32)));
+    uint8_t page[2][W25Q64JV_PAGE_SIZE] __attribute__((aligned(32)));                // Program staging
+    w25q64jv_cfg_t* flash;
+    uint32_t address;
+    uint32_t block_count;
+    uint8_t dma;
+    uint8_t pending[W25Q64JV_BD_MAX_BLOCKS / 8];     // Erase requested, not sent yet
+    uint8_t blank[W25Q64JV_BD_MAX_BLOCKS / 8];       // Erased and not programmed since
+    w25q64jv_bd_stats_t stats;
+} w25q64jv_bd_t;
+
+/**
+ * @brief Set up a block device over part of the flash. Nothing is read or erased, every block starts as not
+ * known to be blank
+ *
+ * @param bd            Block device structure, place in static memory
+ * @param flash         Configured driver structure
+ * @param address       Region start, sector aligned
+ * @param size          Region size in bytes, a multiple of W25Q64JV_BD_BLOCK_SIZE
+ * @param dma           Set to 1 to use DMA for aligned transfers, 0 for polled transfers only
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_bd_init(w25q64jv_bd_t* bd, w25q64jv_cfg_t* flash, uint32_t address, uint32_t size, uint8_t dma);
+
+/**
+ * @brief Read from one or more contiguous blocks with a single command
+ *
+ * @param bd            Block device structure
+ * @param block         First block
+ * @param offset        Offset into the first block, may run on into the following blocks
+ * @param data          Reference for data
+ * @param size          Number of bytes
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_bd_read(w25q64jv_bd_t* bd, uint32_t block, uint32_t offset, uint8_t* data, uint32_t size);
+
+/**
+ * @brief Program erased flash, sending any pending erase of the blocks first. Waits for completion
+ *
+ * @param bd            Block device structure
+ * @param block         First block
+ * @param offset        Offset into the first block, may run on into the following blocks
+ * @param data          Data to program
+ * @param size          Number of bytes
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_bd_prog(w25q64jv_bd_t* bd, uint32_t block, uint32_t offset, const uint8_t* data, uint32_t size);
+
+/**
+ * @brief Request an erase. The block reads as erased from here on, the flash is erased before the next program
+ *
+ * @param bd            Block device structure
+ * @param block         Block to erase
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_bd_erase(w25q64jv_bd_t* bd, uint32_t block);
+
+/**
+ * @brief Wait until the flash is idle. Programs are complete on return already, pending erases stay pending
+ *
+ * @param bd            Block device structure
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_bd_sync(w25q64jv_bd_t* bd);
+
+/**
+ * @brief FatFS disk_read: read whole sectors (blocks) with a single command
+ *
+ * @param bd            Block device structure
+ * @param buffer        Reference for data, count * W25Q64JV_BD_BLOCK_SIZE bytes
+ * @param sector        First sector
+ * @param count         Number of sectors
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_bd_disk_read(w25q64jv_bd_t* bd, uint8_t* buffer, uint32_t sector, uint32_t count);
+
+/**
+ * @brief FatFS disk_write: erase the sectors that are not blank, with the largest erases that fit the run, and
+ * program them
+ *
+ * @param bd            Block device structure
+ * @param buffer        Data, count * W25Q64JV_BD_BLOCK_SIZE bytes
+ * @param sector        First sector
+ * @param count         Number of sectors
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_bd_disk_write(w25q64jv_bd_t* bd, const uint8_t* buffer, uint32_t sector, uint32_t count);
+
+#ifdef W25Q64JV_BD_LITTLEFS
+/**
+ * @brief Fill a littlefs configuration: callbacks, geometry, and the caches and lookahead buffer inside the
+ * block device. Change block_cycles or the sizes afterwards if needed
+ *
+ * @param bd            Block device structure, after w25q64jv_bd_init
+ * @param config        littlefs configuration, cleared first
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_bd_lfs_config(w25q64jv_bd_t* bd, struct lfs_config* config);
+#endif
+
+/**
+ * @brief Copy out the command and erase counters
+ *
+ * @param bd            Block device structure
+ * @param stats         Return data
+ * @param reset         Set to 0 to keep counting, otherwise counters are cleared
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_bd_get_stats(w25q64jv_bd_t* bd, w25q64jv_bd_stats_t* stats, uint8_t reset);
+
+#endif /* W25Q64JV_BD_H_ */
@@ -0,0 +1,162 @@
+#include "W25Q64JV_cache.h"
+#include <string.h>
+
+#define INVALID_TAG 0xFFFFFFFF
+#define PREFETCH_TIMEOUT 100
+
+static void cache_modify_function(void* context, uint32_t address, uint32_t size) {
+    w25q64jv_cache_invalidate((w25q64jv_cache_t*)context, address, size);
+}
+
+int w25q64jv_cache_init(w25q64jv_cache_t* cache, w25q64jv_cfg_t* flash) {
+    if (!cache) return -1;
+    if (!flash) return -1;
+
+    for (int i = 0; i < W25Q64JV_CACHE_LINES; i++) {
+        cache->tag[i] = INVALID_TAG;
+        cache->last_use[i] = 0;
+        cache->filling[i] = 0;
+        cache->prefetched[i] = 0;
+    }
+    cache->fill_line = -1;
+    cache->use_count = 0;
+    cache->last_line = INVALID_TAG;
+    cache->flash = flash;
+    memset(&cache->stats, 0, sizeof(cache->stats));
+
+    return w25q64jv_set_modify_function(flash, &cache_modify_function, cache);
+}
+
+static int find_line(w25q64jv_cache_t* cache, uint32_t tag) {
+    for (int i = 0; i < W25Q64JV_CACHE_LINES; i++) {
+        if (cache->tag[i] == tag) return i;
+    }
+    return -1;
+}
+
+static int find_victim(w25q64jv_cache_t* cache, int exclude) {
+    // Least recently used line, never the one in use or one still being filled by DMA
+    int victim = -1;
+    for (int i = 0; i < W25Q64JV_CACHE_LINES; i++) {
+        if ((i == exclude) || cache->filling[i]) continue;
+        if (cache->tag[i] == INVALID_TAG) return i;
+        if ((victim < 0) || (cache->last_use[i] < cache->last_use[victim])) victim = i;
+    }
+    return victim;
+}
+
+static int wait_fill(w25q64jv_cache_t* cache, int line) {
+    uint32_t start = HAL_GetTick();
+    while (cache->filling[line]) {
+        if ((HAL_GetTick() - start) > PREFETCH_TIMEOUT) {
+            // Stop the transfer so the flash takes commands again and the line can be reused
+            w25q64jv_dma_abort(cache->flash);
+            cache->tag[line] = INVALID_TAG;
+            cache->prefetched[line] = 0;
+            cache->filling[line] = 0;
+            cache->fill_line = -1;
+            cache->stats.prefetch_aborts++;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void prefetch(w25q64jv_cache_t* cache, int current, uint32_t tag) {
+    if (tag >= cache->flash->params.capacity) return;
+    if (find_line(cache, tag) >= 0) return;
+    if (cache->flash->dma_active) return;   // Only one prefetch in flight
+
+    int line = find_victim(cache, current);
+    if (line < 0) return;
+
+    cache->tag[line] = tag;
+    cache->filling[line] = 1;
+    cache->prefetched[line] = 1;
+    cache->last_use[line] = cache->use_count;
+    cache->fill_line = (int8_t)line;
+    if (w25q64jv_fast_read_dma(cache->flash, tag, cache->data[line], W25Q64JV_CACHE_LINE_SIZE) != 0) {
+        cache->tag[line] = INVALID_TAG;
+        cache->filling[line] = 0;
+        cache->fill_line = -1;
+        return;
+    }
+    cache->stats.prefetches++;
+}
+
+int w25q64jv_cache_read(w25q64jv_cache_t* cache, uint32_t address, uint8_t* data, uint32_t size) {
+    if (!cache) return -1;
+    if (data == NULL) return -1;
+    if ((address + size) > cache->flash->params.capacity) return -1;
+
+    while (size > 0) {
+        uint32_t tag = address & ~(uint32_t)(W25Q64JV_CACHE_LINE_SIZE - 1);
+        uint32_t offset = address - tag;
+        uint32_t chunk = W25Q64JV_CACHE_LINE_SIZE - offset;
+        if (chunk > size) chunk = size;
+
+        int line = find_line(cache, tag);
+        if ((line >= 0) && (wait_fill(cache, line) != 0)) line = -1;
+
+        if (line >= 0) {
+            cache->stats.hits++;
+            if (cache->prefetched[line]) {
+                cache->stats.prefetch_hits++;
+                cache->prefetched[line] = 0;
+            }
+        } else {
+            cache->stats.misses++;
+            line = find_victim(cache, -1);
+            if (line < 0) return -1;
+            cache->tag[line] = INVALID_TAG;
+            cache->prefetched[line] = 0;
+            if (w25q64jv_fast_read(cache->flash, tag, cache->data[line], W25Q64JV_CACHE_LINE_SIZE) != 0) return -1;
+            cache->tag[line] = tag;
+        }
+        cache->last_use[line] = ++cache->use_count;
+
+        // Start the next line on DMA before copying so the fill overlaps the copy and the caller's processing
+        if (tag == (cache->last_line + W25Q64JV_CACHE_LINE_SIZE)) {
+            prefetch(cache, line, tag + W25Q64JV_CACHE_LINE_SIZE);
+        }
+        cache->last_line = tag;
+
+        memcpy(data, &cache->data[line][offset], chunk);
+        data += chunk;
+        address += chunk;
+        size -= chunk;
+    }
+    return 0;
+}
+
+int w25q64jv_cache_invalidate(w25q64jv_cache_t* cache, uint32_t address, uint32_t size) {
+    if (!cache) return -1;
+    for (int i = 0; i < W25Q64JV_CACHE_LINES; i++) {
+        uint32_t tag = cache->tag[i];
+        if (tag == INVALID_TAG) continue;
+        if ((tag < (address + size)) && ((tag + W25Q64JV_CACHE_LINE_SIZE) > address)) {
+            cache->tag[i] = INVALID_TAG;
+            cache->prefetched[i] = 0;
+        }
+    }
+    return 0;
+}
+
+int w25q64jv_cache_dma_complete(w25q64jv_cache_t* cache) {
+    if (!cache) return -1;
+    if (cache->fill_line >= 0) {
+#if defined(__DCACHE_PRESENT) && (__DCACHE_PRESENT == 1U)
+        SCB_InvalidateDCache_by_Addr((uint32_t*)cache->data[cache->fill_line], W25Q64JV_CACHE_LINE_SIZE);
+#endif
+        cache->filling[cache->fill_line] = 0;
+        cache->fill_line = -1;
+    }
+    return w25q64jv_dma_complete(cache->flash);
+}
+
+int w25q64jv_cache_get_stats(w25q64jv_cache_t* cache, w25q64jv_cache_stats_t* stats, uint8_t reset) {
+    if (!cache) return -1;
+    if (stats != NULL) *stats = cache->stats;
+    if (reset != 0) memset(&cache->stats, 0, sizeof(cache->stats));
+    return 0;
+}
@@ -0,0 +1,100 @@
+#ifndef W25Q64JV_CACHE_H_
+#define W25Q64JV_CACHE_H_
+
+#include "W25Q64JV.h"
+#include <stdint.h>
+
+// Number of cached lines, at least 2 so a prefetch never evicts the line being read
+#ifndef W25Q64JV_CACHE_LINES
+#define W25Q64JV_CACHE_LINES 8
+#endif
+
+// Line size, one page (256) or one sector (4096)
+#ifndef W25Q64JV_CACHE_LINE_SIZE
+#define W25Q64JV_CACHE_LINE_SIZE W25Q64JV_PAGE_SIZE
+#endif
+
+#if (W25Q64JV_CACHE_LINES < 2)
+#error "W25Q64JV_CACHE_LINES must be at least 2"
+#endif
+#if (W25Q64JV_CACHE_LINE_SIZE != W25Q64JV_PAGE_SIZE) && (W25Q64JV_CACHE_LINE_SIZE != W25Q64JV_SECTOR_SIZE)
+#error "W25Q64JV_CACHE_LINE_SIZE must be 256 or 4096"
+#endif
+
+typedef struct {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t prefetches;
+    uint32_t prefetch_hits;
+    uint32_t prefetch_aborts;   // Fills whose DMA completion never came
+} w25q64jv_cache_stats_t;
+
+typedef struct {
+    // Line data first and 32 byte aligned so DMA fills do not share a D-cache line with the bookkeeping
+    uint8_t data[W25Q64JV_CACHE_LINES][W25Q64JV_CACHE_LINE_SIZE] __attribute__((aligned(32)));
+    uint32_t tag[W25Q64JV_CACHE_LINES];
+    uint32_t last_use[W25Q64JV_CACHE_LINES];
+    volatile uint8_t filling[W25Q64JV_CACHE_LINES];
+    uint8_t prefetched[W25Q64JV_CACHE_LINES];
+    int8_t fill_line;
+    uint32_t use_count;
+    uint32_t last_line;
+    w25q64jv_cfg_t* flash;
+    w25q64jv_cache_stats_t stats;
+} w25q64jv_cache_t;
+
+/**
+ * @brief Attach a read cache to a configured flash. The cache registers itself as the flash modify function,
+ * so every program and erase through the driver invalidates the affected lines
+ *
+ * @param cache         Cache structure, place in static memory
+ * @param flash         Configured driver structure
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_cache_init(w25q64jv_cache_t* cache, w25q64jv_cfg_t* flash);
+
+/**
+ * @brief Read through the cache. Reading consecutive lines starts a DMA prefetch of the following line
+ *
+ * @param cache         Cache structure
+ * @param address       24-bit start address
+ * @param data          Reference for data
+ * @param size          Number of bytes to read
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_cache_read(w25q64jv_cache_t* cache, uint32_t address, uint8_t* data, uint32_t size);
+
+/**
+ * @brief Drop any cached lines overlapping a range
+ *
+ * @param cache         Cache structure
+ * @param address       Start address
+ * @param size          Number of bytes
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_cache_invalidate(w25q64jv_cache_t* cache, uint32_t address, uint32_t size);
+
+/**
+ * @brief Finish a prefetch, call from HAL_SPI_RxCpltCallback (or HAL_QSPI_RxCpltCallback) for the flash handle
+ *
+ * @param cache         Cache structure
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_cache_dma_complete(w25q64jv_cache_t* cache);
+
+/**
+ * @brief Copy out the hit / miss counters
+ *
+ * @param cache         Cache structure
+ * @param stats         Return data
+ * @param reset         Set to 0 to keep counting, otherwise counters are cleared
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_cache_get_stats(w25q64jv_cache_t* cache, w25q64jv_cache_stats_t* stats, uint8_t reset);
+
+#endif /* W25Q64JV_CACHE_H_ */
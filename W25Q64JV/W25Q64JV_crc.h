@@ -0,0 +1,17 @@
+#ifndef W25Q64JV_CRC_H_
+#define W25Q64JV_CRC_H_
+
+#include <stdint.h>
+
+/**
+ * @brief CRC-32 (IEEE 802.3, reflected 0xEDB88320) with a 16 entry table
+ *
+ * @param crc       0 to start, or the previous return value to continue over more data
+ * @param data      Data to include
+ * @param size      Number of bytes
+ *
+ * @return Updated CRC
+ */
+uint32_t w25q64jv_crc32(uint32_t crc, const uint8_t* data, uint32_t size);
+
+#endif /* W25Q64JV_CRC_H_ */
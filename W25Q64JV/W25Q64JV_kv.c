@@ -0,0 +1,476 @@
+#include "W25Q64JV_kv.h"
+#include "W25Q64JV_crc.h"
+#include <string.h>
+
+// Sector header: magic, erase count, CRC of both, then the sequence number programmed when the sector is opened
+#define SECTOR_MAGIC 0x3153564B
+#define SECTOR_HEADER_SIZE 16
+#define SEQUENCE_OFFSET 12
+#define FREE_SEQUENCE 0xFFFFFFFF
+#define UNFORMATTED 0xFFFF
+
+// Record header: key, value length, CRC over key, length and value. Length 0 is a tombstone
+#define RECORD_HEADER_SIZE 8
+#define ERASED_KEY 0xFFFF
+#define INVALID_WINDOW 0xFFFFFFFF
+
+static uint16_t get_u16(const uint8_t* data) {
+    return (uint16_t)(data[0] | (data[1] << 8));
+}
+
+static uint32_t get_u32(const uint8_t* data) {
+    return (uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+static void put_u16(uint8_t* data, uint16_t value) {
+    data[0] = (uint8_t)value;
+    data[1] = (uint8_t)(value >> 8);
+}
+
+static void put_u32(uint8_t* data, uint32_t value) {
+    for (int i = 0; i < 4; i++) data[i] = (uint8_t)(value >> (8 * i));
+}
+
+static uint16_t record_size(uint16_t length) {
+    return (uint16_t)(RECORD_HEADER_SIZE + ((length + 3) & ~3));
+}
+
+static uint32_t sector_address(w25q64jv_kv_t* kv, uint16_t sector) {
+    return kv->base_address + ((uint32_t)sector * W25Q64JV_SECTOR_SIZE);
+}
+
+static int kv_read(w25q64jv_kv_t* kv, uint32_t address, uint8_t* data, uint32_t size) {
+    if (size > W25Q64JV_PAGE_SIZE) return w25q64jv_fast_read(kv->flash, address, data, size);
+
+    // Small reads (headers) are served from a one page window so a mount scan costs one command per page
+    if ((kv->window_address == INVALID_WINDOW) || (address < kv->window_address) ||
+        ((address + size) > (kv->window_address + W25Q64JV_PAGE_SIZE))) {
+        uint32_t window = address;
+        if ((window + W25Q64JV_PAGE_SIZE) > kv->flash->params.capacity) window = kv->flash->params.capacity - W25Q64JV_PAGE_SIZE;
+        kv->window_address = INVALID_WINDOW;
+        if (w25q64jv_fast_read(kv->flash, window, kv->window, W25Q64JV_PAGE_SIZE) != 0) return -1;
+        kv->window_address = window;
+    }
+    memcpy(data, &kv->window[address - kv->window_address], size);
+    return 0;
+}
+
+static int kv_program(w25q64jv_kv_t* kv, uint32_t address, const uint8_t* data, uint32_t size) {
+    kv->window_address = INVALID_WINDOW;
+    while (size > 0) {
+        uint32_t chunk = W25Q64JV_PAGE_SIZE - (address % W25Q64JV_PAGE_SIZE);
+        if (chunk > size) chunk = size;
+        if (w25q64jv_page_program(kv->flash, address, data, chunk) != 0) return -1;
+        kv->stats.flash_bytes += chunk;
+        address += chunk;
+        data += chunk;
+        size -= chunk;
+    }
+    return 0;
+}
+
+static int erase_sector(w25q64jv_kv_t* kv, uint16_t sector) {
+    kv->window_address = INVALID_WINDOW;
+    if (w25q64jv_sector_erase_4KB(kv->flash, sector_address(kv, sector)) != 0) return -1;
+    kv->erase_count[sector]++;
+    kv->stats.erases++;
+
+    // Erase count is written straight away so it survives until the sector is opened
+    uint8_t header[12];
+    put_u32(&header[0], SECTOR_MAGIC);
+    put_u32(&header[4], kv->erase_count[sector]);
+    put_u32(&header[8], w25q64jv_crc32(0, header, 8));
+    if (kv_program(kv, sector_address(kv, sector), header, sizeof(header)) != 0) return -1;
+
+    kv->sequence[sector] = FREE_SEQUENCE;
+    kv->used[sector] = SECTOR_HEADER_SIZE;
+    kv->dead[sector] = 0;
+    return 0;
+}
+
+static uint16_t free_sectors(w25q64jv_kv_t* kv) {
+    uint16_t count = 0;
+    for (uint16_t i = 0; i < kv->sector_count; i++) {
+        if (kv->sequence[i] == FREE_SEQUENCE) count++;
+    }
+    return count;
+}
+
+static int open_sector(w25q64jv_kv_t* kv, uint8_t for_gc) {
+    // One free sector is held back so garbage collection always has somewhere to copy to
+    if (!for_gc && (free_sectors(kv) <= 1)) return -1;
+
+    int sector = -1;
+    for (uint16_t i = 0; i < kv->sector_count; i++) {
+        if (kv->sequence[i] != FREE_SEQUENCE) continue;
+        if ((int)i == kv->gc_sector) continue;
+        if ((sector < 0) || (kv->erase_count[i] < kv->erase_count[sector])) sector = i;
+    }
+    if (sector < 0) return -1;
+    if ((kv->used[sector] == UNFORMATTED) && (erase_sector(kv, (uint16_t)sector) != 0)) return -1;
+
+    uint8_t sequence[4];
+    put_u32(sequence, kv->last_sequence + 1);
+    if (kv_program(kv, sector_address(kv, (uint16_t)sector) + SEQUENCE_OFFSET, sequence, sizeof(sequence)) != 0) return -1;
+    kv->last_sequence++;
+    kv->sequence[sector] = kv->last_sequence;
+    kv->active = (int16_t)sector;
+    return 0;
+}
+
+static int reserve(w25q64jv_kv_t* kv, uint16_t size, uint8_t for_gc) {
+    if ((kv->active >= 0) && ((kv->used[kv->active] + size) <= W25Q64JV_SECTOR_SIZE)) return 0;
+
+    // Records never span sectors, the rest of the active one is given up
+    if (kv->active >= 0) {
+        kv->dead[kv->active] += W25Q64JV_SECTOR_SIZE - kv->used[kv->active];
+        kv->used[kv->active] = W25Q64JV_SECTOR_SIZE;
+        kv->active = -1;
+    }
+    if (for_gc) return open_sector(kv, 1);
+
+    for (uint16_t attempt = 0; attempt <= kv->sector_count; attempt++) {
+        if (open_sector(kv, 0) == 0) return 0;
+        int result;
+        do {
+            result = w25q64jv_kv_gc_step(kv);
+        } while (result == 1);
+        if (result != 0) return -1;
+    }
+    return -1;  // Full of live data
+}
+
+static int find_entry(w25q64jv_kv_t* kv, uint16_t key) {
+    for (uint16_t i = 0; i < kv->key_count; i++) {
+        if (kv->index[i].key == key) return i;
+    }
+    return -1;
+}
+
+static int index_apply(w25q64jv_kv_t* kv, uint16_t key, uint16_t sector, uint16_t offset, uint16_t size) {
+    int entry = find_entry(kv, key);
+    if (entry >= 0) {
+        kv->dead[kv->index[entry].sector] += kv->index[entry].size;
+    } else {
+        if (kv->key_count >= W25Q64JV_KV_MAX_KEYS) return -1;
+        entry = kv->key_count++;
+        kv->index[entry].key = key;
+    }
+    kv->index[entry].sector = sector;
+    kv->index[entry].offset = offset;
+    kv->index[entry].size = size;
+    return 0;
+}
+
+static int check_record(w25q64jv_kv_t* kv, uint32_t address, uint16_t length, uint32_t expected) {
+    uint8_t header[RECORD_HEADER_SIZE];
+    if (kv_read(kv, address, header, sizeof(header)) != 0) return -1;
+    uint32_t crc = w25q64jv_crc32(0, header, 4);
+
+    address += RECORD_HEADER_SIZE;
+    while (length > 0) {
+        uint16_t chunk = (length > W25Q64JV_PAGE_SIZE) ? W25Q64JV_PAGE_SIZE : length;
+        if (w25q64jv_fast_read(kv->flash, address, kv->page, chunk) != 0) return -1;
+        crc = w25q64jv_crc32(crc, kv->page, chunk);
+        address += chunk;
+        length -= chunk;
+    }
+    return (crc == expected) ? 0 : -1;
+}
+
+static int check_erased(w25q64jv_kv_t* kv, uint32_t address, uint32_t size) {
+    while (size > 0) {
+        uint32_t chunk = (size > W25Q64JV_PAGE_SIZE) ? W25Q64JV_PAGE_SIZE : size;
+        if (w25q64jv_fast_read(kv->flash, address, kv->page, chunk) != 0) return -1;
+        for (uint32_t i = 0; i < chunk; i++) {
+            if (kv->page[i] != 0xFF) return -1;
+        }
+        address += chunk;
+        size -= chunk;
+    }
+    return 0;
+}
+
+static int scan_sector(w25q64jv_kv_t* kv, uint16_t sector) {
+    uint32_t base = sector_address(kv, sector);
+    uint16_t offset = SECTOR_HEADER_SIZE;
+    int32_t last = -1;
+    uint16_t last_key = 0;
+    uint16_t last_length = 0;
+    uint32_t last_crc = 0;
+
+    while ((offset + RECORD_HEADER_SIZE) <= W25Q64JV_SECTOR_SIZE) {
+        uint8_t header[RECORD_HEADER_SIZE];
+        if (kv_read(kv, base + offset, header, sizeof(header)) != 0) return -1;
+        uint16_t key = get_u16(&header[0]);
+        uint16_t length = get_u16(&header[2]);
+        if ((key == ERASED_KEY) && (length == 0xFFFF)) break;
+        if ((length > W25Q64JV_KV_MAX_VALUE) || ((offset + record_size(length)) > W25Q64JV_SECTOR_SIZE)) {
+            offset = W25Q64JV_SECTOR_SIZE;     // Torn header, close the sector
+            break;
+        }
+
+        // Only the newest record of a sector can be torn, earlier ones are indexed from the header alone
+        if (last >= 0) {
+            if (index_apply(kv, last_key, sector, (uint16_t)last, record_size(last_length)) != 0) return -1;
+        }
+        last = offset;
+        last_key = key;
+        last_length = length;
+        last_crc = get_u32(&header[4]);
+        offset += record_size(length);
+    }
+
+    if (last >= 0) {
+        if (check_record(kv, base + (uint32_t)last, last_length, last_crc) == 0) {
+            if (index_apply(kv, last_key, sector, (uint16_t)last, record_size(last_length)) != 0) return -1;
+        } else {
+            kv->dead[sector] += record_size(last_length);
+            offset = W25Q64JV_SECTOR_SIZE;
+        }
+    }
+
+    // An append torn before its header was programmed leaves value bytes behind an erased header. Appending
+    // over them would corrupt the next record, so the sector is closed unless the rest of it is blank
+    if ((offset < W25Q64JV_SECTOR_SIZE) && (check_erased(kv, base + offset, W25Q64JV_SECTOR_SIZE - offset) != 0)) {
+        kv->dead[sector] += W25Q64JV_SECTOR_SIZE - offset;
+        offset = W25Q64JV_SECTOR_SIZE;
+    }
+    kv->used[sector] = offset;
+    return 0;
+}
+
+int w25q64jv_kv_mount(w25q64jv_kv_t* kv, w25q64jv_cfg_t* flash, uint32_t base_address, uint16_t sector_count) {
+    if (!kv) return -1;
+    if (!flash) return -1;
+    if ((base_address % W25Q64JV_SECTOR_SIZE) != 0) return -1;
+    if ((sector_count < 3) || (sector_count > W25Q64JV_KV_MAX_SECTORS)) return -1;
+    if ((base_address + ((uint32_t)sector_count * W25Q64JV_SECTOR_SIZE)) > flash->params.capacity) return -1;
+
+    kv->flash = flash;
+    kv->base_address = base_address;
+    kv->sector_count = sector_count;
+    kv->key_count = 0;
+    kv->last_sequence = 0;
+    kv->active = -1;
+    kv->gc_sector = -1;
+    kv->gc_offset = 0;
+    kv->window_address = INVALID_WINDOW;
+    memset(&kv->stats, 0, sizeof(kv->stats));
+
+    // Pass 1: sector headers
+    uint16_t order[W25Q64JV_KV_MAX_SECTORS];
+    uint16_t data_sectors = 0;
+    for (uint16_t i = 0; i < sector_count; i++) {
+        uint8_t header[SECTOR_HEADER_SIZE];
+        if (kv_read(kv, sector_address(kv, i), header, sizeof(header)) != 0) return -1;
+        kv->dead[i] = 0;
+
+        if ((get_u32(&header[0]) != SECTOR_MAGIC) || (get_u32(&header[8]) != w25q64jv_crc32(0, header, 8))) {
+            kv->erase_count[i] = 0;
+            kv->sequence[i] = FREE_SEQUENCE;
+            kv->used[i] = UNFORMATTED;
+            continue;
+        }
+        kv->erase_count[i] = get_u32(&header[4]);
+        kv->sequence[i] = get_u32(&header[SEQUENCE_OFFSET]);
+        kv->used[i] = SECTOR_HEADER_SIZE;
+        if (kv->sequence[i] == FREE_SEQUENCE) continue;
+        if (kv->sequence[i] > kv->last_sequence) kv->last_sequence = kv->sequence[i];
+
+        // Insertion sort by sequence so newer records override older ones
+        uint16_t j = data_sectors++;
+        while ((j > 0) && (kv->sequence[order[j - 1]] > kv->sequence[i])) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = i;
+    }
+
+    // Pass 2: record headers, oldest sector first
+    for (uint16_t i = 0; i < data_sectors; i++) {
+        if (scan_sector(kv, order[i]) != 0) return -1;
+    }
+    for (uint16_t i = 0; i < data_sectors; i++) {
+        uint16_t sector = order[i];
+        if ((i == (data_sectors - 1)) && (kv->used[sector] < W25Q64JV_SECTOR_SIZE)) {
+            kv->active = (int16_t)sector;
+        } else {
+            kv->dead[sector] += W25Q64JV_SECTOR_SIZE - kv->used[sector];
+            kv->used[sector] = W25Q64JV_SECTOR_SIZE;
+        }
+    }
+    return 0;
+}
+
+int w25q64jv_kv_format(w25q64jv_kv_t* kv, w25q64jv_cfg_t* flash, uint32_t base_address, uint16_t sector_count) {
+    if (w25q64jv_kv_mount(kv, flash, base_address, sector_count) != 0) return -1;
+    for (uint16_t i = 0; i < sector_count; i++) {
+        if (erase_sector(kv, i) != 0) return -1;
+    }
+    return w25q64jv_kv_mount(kv, flash, base_address, sector_count);
+}
+
+static int append(w25q64jv_kv_t* kv, uint16_t key, const uint8_t* data, uint16_t length) {
+    uint16_t size = record_size(length);
+    if (reserve(kv, size, 0) != 0) return -1;
+
+    uint16_t sector = (uint16_t)kv->active;
+    uint16_t offset = kv->used[sector];
+    uint32_t address = sector_address(kv, sector) + offset;
+
+    uint8_t header[RECORD_HEADER_SIZE];
+    put_u16(&header[0], key);
+    put_u16(&header[2], length);
+    uint32_t crc = w25q64jv_crc32(0, header, 4);
+    put_u32(&header[4], w25q64jv_crc32(crc, data, length));
+
+    // Stage header and value one page at a time so each page costs a single program
+    uint32_t total = RECORD_HEADER_SIZE + length;
+    uint32_t position = 0;
+    while (position < total) {
+        uint32_t chunk = W25Q64JV_PAGE_SIZE - ((address + position) % W25Q64JV_PAGE_SIZE);
+        if (chunk > (total - position)) chunk = total - position;
+        for (uint32_t i = 0; i < chunk; i++) {
+            uint32_t current = position + i;
+            kv->page[i] = (current < RECORD_HEADER_SIZE) ? header[current] : data[current - RECORD_HEADER_SIZE];
+        }
+        if (kv_program(kv, address + position, kv->page, chunk) != 0) return -1;
+        position += chunk;
+    }
+    kv->used[sector] += size;
+
+    if (index_apply(kv, key, sector, offset, size) != 0) return -1;
+    kv->stats.user_bytes += length;
+    return 0;
+}
+
+int w25q64jv_kv_set(w25q64jv_kv_t* kv, uint16_t key, const void* data, uint16_t size) {
+    if (!kv) return -1;
+    if (data == NULL) return -1;
+    if (key == ERASED_KEY) return -1;
+    if ((size == 0) || (size > W25Q64JV_KV_MAX_VALUE)) return -1;
+    if ((find_entry(kv, key) < 0) && (kv->key_count >= W25Q64JV_KV_MAX_KEYS)) return -1;
+    return append(kv, key, (const uint8_t*)data, size);
+}
+
+int w25q64jv_kv_delete(w25q64jv_kv_t* kv, uint16_t key) {
+    if (!kv) return -1;
+    int entry = find_entry(kv, key);
+    if (entry < 0) return 0;
+    if (kv->index[entry].size == RECORD_HEADER_SIZE) return 0;  // Already a tombstone
+    return append(kv, key, NULL, 0);
+}
+
+int w25q64jv_kv_get(w25q64jv_kv_t* kv, uint16_t key, void* data, uint16_t max_size, uint16_t* size) {
+    if (!kv) return -1;
+    if (data == NULL) return -1;
+    int entry = find_entry(kv, key);
+    if (entry < 0) return -1;
+
+    uint32_t address = sector_address(kv, kv->index[entry].sector) + kv->index[entry].offset;
+    uint8_t header[RECORD_HEADER_SIZE];
+    if (kv_read(kv, address, header, sizeof(header)) != 0) return -1;
+    uint16_t length = get_u16(&header[2]);
+    if ((length == 0) || (length > max_size)) return -1;
+
+    if (w25q64jv_fast_read(kv->flash, address + RECORD_HEADER_SIZE, data, length) != 0) return -1;
+    uint32_t crc = w25q64jv_crc32(0, header, 4);
+    if (w25q64jv_crc32(crc, data, length) != get_u32(&header[4])) return -1;
+    if (size != NULL) *size = length;
+    return 0;
+}
+
+static int pick_victim(w25q64jv_kv_t* kv) {
+    int coldest = -1;
+    uint16_t max_dead = 0;
+    uint32_t max_erase = 0;
+    for (uint16_t i = 0; i < kv->sector_count; i++) {
+        if (kv->erase_count[i] > max_erase) max_erase = kv->erase_count[i];
+        if ((kv->sequence[i] == FREE_SEQUENCE) || ((int)i == kv->active)) continue;
+        if (kv->dead[i] > max_dead) max_dead = kv->dead[i];
+        if ((coldest < 0) || (kv->erase_count[i] < kv->erase_count[coldest])) coldest = i;
+    }
+
+    // Static data would otherwise pin its sectors at a low erase count forever
+    if ((coldest >= 0) && ((max_erase - kv->erase_count[coldest]) >= W25Q64JV_KV_WEAR_DELTA)) return coldest;
+    if (max_dead == 0) return -1;
+
+    // Least erased of the sectors about as dirty as the dirtiest, so equally dead sectors take turns
+    int victim = -1;
+    for (uint16_t i = 0; i < kv->sector_count; i++) {
+        if ((kv->sequence[i] == FREE_SEQUENCE) || ((int)i == kv->active)) continue;
+        if ((kv->dead[i] == 0) || ((kv->dead[i] + W25Q64JV_KV_DEAD_SLACK) < max_dead)) continue;
+        if ((victim < 0) || (kv->erase_count[i] < kv->erase_count[victim]) ||
+            ((kv->erase_count[i] == kv->erase_count[victim]) && (kv->dead[i] > kv->dead[victim]))) {
+            victim = i;
+        }
+    }
+    return victim;
+}
+
+static int copy_record(w25q64jv_kv_t* kv, int entry) {
+    uint16_t size = kv->index[entry].size;
+    if (reserve(kv, size, 1) != 0) return -1;
+
+    uint32_t source = sector_address(kv, kv->index[entry].sector) + kv->index[entry].offset;
+    uint16_t sector = (uint16_t)kv->active;
+    uint16_t offset = kv->used[sector];
+    uint32_t destination = sector_address(kv, sector) + offset;
+
+    uint32_t position = 0;
+    while (position < size) {
+        uint32_t chunk = W25Q64JV_PAGE_SIZE - ((destination + position) % W25Q64JV_PAGE_SIZE);
+        if (chunk > (size - position)) chunk = size - position;
+        if (w25q64jv_fast_read(kv->flash, source + position, kv->page, chunk) != 0) return -1;
+        if (kv_program(kv, destination + position, kv->page, chunk) != 0) return -1;
+        position += chunk;
+    }
+    kv->used[sector] += size;
+    kv->index[entry].sector = sector;
+    kv->index[entry].offset = offset;
+    kv->stats.gc_copies++;
+    return 0;
+}
+
+int w25q64jv_kv_gc_step(w25q64jv_kv_t* kv) {
+    if (!kv) return -1;
+    if (kv->gc_sector < 0) {
+        int victim = pick_victim(kv);
+        if (victim < 0) return 0;
+        kv->gc_sector = (int16_t)victim;
+        kv->gc_offset = SECTOR_HEADER_SIZE;
+    }
+
+    uint16_t sector = (uint16_t)kv->gc_sector;
+    uint32_t base = sector_address(kv, sector);
+    while ((kv->gc_offset + RECORD_HEADER_SIZE) <= W25Q64JV_SECTOR_SIZE) {
+        uint8_t header[RECORD_HEADER_SIZE];
+        if (kv_read(kv, base + kv->gc_offset, header, sizeof(header)) != 0) return -1;
+        uint16_t key = get_u16(&header[0]);
+        uint16_t length = get_u16(&header[2]);
+        if ((key == ERASED_KEY) && (length == 0xFFFF)) break;
+        if (length > W25Q64JV_KV_MAX_VALUE) break;
+
+        uint16_t offset = kv->gc_offset;
+        kv->gc_offset += record_size(length);
+
+        // Live when the index still points here, copy one record per step
+        int entry = find_entry(kv, key);
+        if ((entry >= 0) && (kv->index[entry].sector == sector) && (kv->index[entry].offset == offset)) {
+            if (copy_record(kv, entry) != 0) return -1;
+            return 1;
+        }
+    }
+
+    if (erase_sector(kv, sector) != 0) return -1;
+    kv->gc_sector = -1;
+    return 0;
+}
+
+int w25q64jv_kv_get_stats(w25q64jv_kv_t* kv, w25q64jv_kv_stats_t* stats, uint8_t reset) {
+    if (!kv) return -1;
+    if (stats != NULL) *stats = kv->stats;
+    if (reset != 0) memset(&kv->stats, 0, sizeof(kv->stats));
+    return 0;
+}
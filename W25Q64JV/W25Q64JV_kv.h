@@ -0,0 +1,147 @@
+#ifndef W25Q64JV_KV_H_
+#define W25Q64JV_KV_H_
+
+#include "W25Q64JV.h"
+#include <stdint.h>
+
+// Maximum number of distinct keys held in the RAM index (8 bytes each)
+#ifndef W25Q64JV_KV_MAX_KEYS
+#define W25Q64JV_KV_MAX_KEYS 64
+#endif
+
+// Maximum number of 4KB sectors in one store (12 bytes of RAM each)
+#ifndef W25Q64JV_KV_MAX_SECTORS
+#define W25Q64JV_KV_MAX_SECTORS 64
+#endif
+
+// Largest value accepted by w25q64jv_kv_set
+#ifndef W25Q64JV_KV_MAX_VALUE
+#define W25Q64JV_KV_MAX_VALUE 1024
+#endif
+
+// A data sector erased this many times fewer than the most worn one is collected even when clean
+#ifndef W25Q64JV_KV_WEAR_DELTA
+#define W25Q64JV_KV_WEAR_DELTA 32
+#endif
+
+// Sectors within this many dead bytes of the dirtiest count as equally dirty, the least erased of them is collected
+#ifndef W25Q64JV_KV_DEAD_SLACK
+#define W25Q64JV_KV_DEAD_SLACK 256
+#endif
+
+typedef struct {
+    uint16_t key;
+    uint16_t sector;
+    uint16_t offset;
+    uint16_t size;
+} w25q64jv_kv_entry_t;
+
+typedef struct {
+    uint32_t user_bytes;
+    uint32_t flash_bytes;
+    uint32_t erases;
+    uint32_t gc_copies;
+} w25q64jv_kv_stats_t;
+
+typedef struct {
+    w25q64jv_cfg_t* flash;
+    uint32_t base_address;
+    uint16_t sector_count;
+    uint16_t key_count;
+    w25q64jv_kv_entry_t index[W25Q64JV_KV_MAX_KEYS];
+    uint32_t sequence[W25Q64JV_KV_MAX_SECTORS];
+    uint32_t erase_count[W25Q64JV_KV_MAX_SECTORS];
+    uint16_t used[W25Q64JV_KV_MAX_SECTORS];
+    uint16_t dead[W25Q64JV_KV_MAX_SECTORS];
+    uint32_t last_sequence;
+    int16_t active;
+    int16_t gc_sector;
+    uint16_t gc_offset;
+    uint32_t window_address;
+    uint8_t window[W25Q64JV_PAGE_SIZE];
+    uint8_t page[W25Q64JV_PAGE_SIZE];
+    w25q64jv_kv_stats_t stats;
+} w25q64jv_kv_t;
+
+/**
+ * @brief Mount a store, rebuilding the RAM index from record headers. Sectors without a valid
+ * header are treated as free and formatted when first used, so a blank region mounts as an empty store
+ *
+ * @param kv            Store structure, place in static memory
+ * @param flash         Configured driver structure
+ * @param base_address  Sector aligned start of the region
+ * @param sector_count  Number of 4KB sectors, 3 to W25Q64JV_KV_MAX_SECTORS
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_kv_mount(w25q64jv_kv_t* kv, w25q64jv_cfg_t* flash, uint32_t base_address, uint16_t sector_count);
+
+/**
+ * @brief Erase the whole region and mount it empty
+ *
+ * @param kv            Store structure
+ * @param flash         Configured driver structure
+ * @param base_address  Sector aligned start of the region
+ * @param sector_count  Number of 4KB sectors, 3 to W25Q64JV_KV_MAX_SECTORS
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_kv_format(w25q64jv_kv_t* kv, w25q64jv_cfg_t* flash, uint32_t base_address, uint16_t sector_count);
+
+/**
+ * @brief Append a new value for a key, superseding any older one
+ *
+ * @param kv            Store structure
+ * @param key           Key, 0 to 0xFFFE
+ * @param data          Value
+ * @param size          Value length, 1 to W25Q64JV_KV_MAX_VALUE
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_kv_set(w25q64jv_kv_t* kv, uint16_t key, const void* data, uint16_t size);
+
+/**
+ * @brief Read the latest value of a key, checking its CRC
+ *
+ * @param kv            Store structure
+ * @param key           Key
+ * @param data          Reference for data
+ * @param max_size      Size of data
+ * @param size          Returns the value length, pass NULL if not needed
+ *
+ * @return 0 or -1 if missing, corrupt or larger than max_size
+ */
+int w25q64jv_kv_get(w25q64jv_kv_t* kv, uint16_t key, void* data, uint16_t max_size, uint16_t* size);
+
+/**
+ * @brief Delete a key by appending a tombstone. The tombstone keeps its index slot until the key is set again
+ *
+ * @param kv            Store structure
+ * @param key           Key
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_kv_delete(w25q64jv_kv_t* kv, uint16_t key);
+
+/**
+ * @brief Run one step of garbage collection: copy one live record out of the dirtiest sector, or erase
+ * it once empty. Call from idle time, writes also run it when space runs low
+ *
+ * @param kv            Store structure
+ *
+ * @return 1 while a collection is in progress, 0 when idle, -1 on error
+ */
+int w25q64jv_kv_gc_step(w25q64jv_kv_t* kv);
+
+/**
+ * @brief Copy out the byte, erase and copy counters. Write amplification is flash_bytes / user_bytes
+ *
+ * @param kv            Store structure
+ * @param stats         Return data
+ * @param reset         Set to 0 to keep counting, otherwise counters are cleared
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_kv_get_stats(w25q64jv_kv_t* kv, w25q64jv_kv_stats_t* stats, uint8_t reset);
+
+#endif /* W25Q64JV_KV_H_ */
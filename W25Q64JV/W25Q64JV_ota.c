@@ -0,0 +1,216 @@
+#include "W25Q64JV_ota.h"
+#include "W25Q64JV_crc.h"
+#include "W25Q64JV_registers.h"
+#include <string.h>
+
+#define DMA_TIMEOUT 100
+
+#define CHIP_IDLE 0
+#define CHIP_ERASING 1
+#define CHIP_PROGRAMMING 2
+#define CHIP_VERIFYING 3
+
+int w25q64jv_ota_open(w25q64jv_ota_t* ota, w25q64jv_cfg_t* flash, uint32_t address, uint32_t size) {
+    if (!ota) return -1;
+    if (!flash) return -1;
+    if ((address % W25Q64JV_SECTOR_SIZE) != 0) return -1;
+    if (address >= flash->params.capacity) return -1;
+    if ((size == 0) || (size > (flash->params.capacity - address))) return -1;
+
+    memset(ota, 0, sizeof(*ota));
+    ota->flash = flash;
+    ota->write_address = address;
+    ota->erased_until = address;
+    ota->end_address = address + size;
+    ota->open = 1;
+    return 0;
+}
+
+static uint32_t erase_end(w25q64jv_ota_t* ota) {
+    return (ota->end_address + W25Q64JV_SECTOR_SIZE - 1) & ~(uint32_t)(W25Q64JV_SECTOR_SIZE - 1);
+}
+
+// Largest erase type aligned to the erase pointer that stays inside the region
+static int start_erase(w25q64jv_ota_t* ota) {
+    w25q64jv_erase_type_t* best = NULL;
+    uint32_t remaining = erase_end(ota) - ota->erased_until;
+    for (uint8_t i = 0; i < W25Q64JV_ERASE_TYPES; i++) {
+        w25q64jv_erase_type_t* type = &ota->flash->params.erase[i];
+        if ((type->size == 0) || (type->size > remaining) || ((ota->erased_until % type->size) != 0)) continue;
+        if ((best == NULL) || (type->size > best->size)) best = type;
+    }
+    if (best == NULL) return -1;
+    if (w25q64jv_erase_start(ota->flash, ota->erased_until, best->size) != 0) return -1;
+
+    ota->chip = CHIP_ERASING;
+    ota->op_tick = HAL_GetTick();
+    ota->op_typical = best->typical_ms;
+    ota->op_timeout = best->max_ms;
+    ota->erased_until += best->size;
+    ota->stats.erases++;
+    return 1;
+}
+
+// Erase ahead of the oldest unprogrammed page, otherwise program it. Returns 1 if an operation was started
+static int start_next(w25q64jv_ota_t* ota) {
+    uint8_t slot = ota->next;
+    uint32_t address = (ota->state[slot] == W25Q64JV_OTA_FULL) ? ota->address[slot] : ota->write_address;
+    if ((address >= ota->erased_until) && (ota->erased_until < erase_end(ota))) return start_erase(ota);
+    if (ota->state[slot] != W25Q64JV_OTA_FULL) return 0;
+
+    if (w25q64jv_page_program_start(ota->flash, ota->address[slot], ota->data[slot], ota->size[slot]) != 0) return -1;
+    w25q64jv_params_t* params = &ota->flash->params;
+    uint32_t typical = params->program_first_byte_us + (params->program_next_byte_us * (ota->size[slot] - 1));
+    if (typical > params->program_typical_us) typical = params->program_typical_us;
+
+    ota->chip = CHIP_PROGRAMMING;
+    ota->op_tick = HAL_GetTick();
+    ota->op_typical = typical / 1000;
+    ota->op_timeout = params->program_max_ms;
+    ota->active = slot;
+    ota->next = slot ^ 1;
+    return 1;
+}
+
+// Returns 1 while the erase or program is busy, 0 once it is done
+static int check_busy(w25q64jv_ota_t* ota) {
+    // Status is not read before 7/8 of the typical time has run
+    uint32_t elapsed = HAL_GetTick() - ota->op_tick;
+    if (elapsed < (ota->op_typical - (ota->op_typical / 8))) return 1;
+
+    uint8_t status = 0;
+    if (w25q64jv_read_status_register(ota->flash, 1, &status) != 0) return -1;
+    if (status & SR1_BUSY) return (elapsed > ota->op_timeout) ? -1 : 1;
+    return 0;
+}
+
+// Returns 1 if the pipeline moved, 0 if it is waiting on the flash and -1 on error
+static int step(w25q64jv_ota_t* ota) {
+    int result;
+    uint8_t slot;
+    switch (ota->chip) {
+        case CHIP_ERASING:
+        case CHIP_PROGRAMMING:
+        result = check_busy(ota);
+        if (result != 0) return (result > 0) ? 0 : -1;
+        if (ota->chip == CHIP_ERASING) {
+            ota->chip = CHIP_IDLE;
+            return 1;
+        }
+        // The read back runs while the caller fetches the next chunk
+        ota->chip = CHIP_VERIFYING;
+        ota->op_tick = HAL_GetTick();
+        slot = ota->active;
+        if (w25q64jv_fast_read_dma(ota->flash, ota->address[slot], ota->verify, ota->size[slot]) != 0) return -1;
+        return 1;
+        case CHIP_VERIFYING:
+        if (ota->flash->dma_active) return ((HAL_GetTick() - ota->op_tick) > DMA_TIMEOUT) ? -1 : 0;
+
+        // Start the next page before comparing so the compare overlaps its program time
+        slot = ota->active;
+        ota->chip = CHIP_IDLE;
+        if (start_next(ota) < 0) return -1;
+        if (memcmp(ota->verify, ota->data[slot], ota->size[slot]) != 0) {
+            ota->stats.verify_failures++;
+            return -1;
+        }
+        ota->state[slot] = W25Q64JV_OTA_EMPTY;
+        ota->stats.pages++;
+        return 1;
+        default:
+        return start_next(ota);
+    }
+}
+
+static int run(w25q64jv_ota_t* ota) {
+    int result;
+    while ((result = step(ota)) > 0) {
+    }
+    if (result < 0) ota->error = 1;
+    return (result < 0) ? -1 : 0;
+}
+
+int w25q64jv_ota_write(w25q64jv_ota_t* ota, const uint8_t* data, uint32_t size) {
+    if (!ota) return -1;
+    if (data == NULL) return -1;
+    if (!ota->open || ota->error) return -1;
+    if (size > (ota->end_address - ota->write_address)) return -1;
+
+    while (size > 0) {
+        uint8_t slot = ota->fill;
+        if (ota->state[slot] == W25Q64JV_OTA_EMPTY) {
+            ota->state[slot] = W25Q64JV_OTA_FILLING;
+            ota->address[slot] = ota->write_address;
+            ota->size[slot] = 0;
+        } else if (ota->state[slot] != W25Q64JV_OTA_FILLING) {
+            // Both buffers in use, wait for the older page to be verified
+            ota->stats.stalls++;
+            while (ota->state[slot] != W25Q64JV_OTA_EMPTY) {
+                if (step(ota) < 0) {
+                    ota->error = 1;
+                    return -1;
+                }
+            }
+            continue;
+        }
+
+        uint32_t chunk = W25Q64JV_PAGE_SIZE - ota->size[slot];
+        if (chunk > size) chunk = size;
+        memcpy(&ota->data[slot][ota->size[slot]], data, chunk);
+        ota->crc = w25q64jv_crc32(ota->crc, data, chunk);
+        ota->size[slot] += chunk;
+        ota->write_address += chunk;
+        ota->stats.bytes += chunk;
+        data += chunk;
+        size -= chunk;
+
+        if (ota->size[slot] == W25Q64JV_PAGE_SIZE) {
+            ota->state[slot] = W25Q64JV_OTA_FULL;
+            ota->fill = slot ^ 1;
+        }
+        if (run(ota) != 0) return -1;
+    }
+    return 0;
+}
+
+int w25q64jv_ota_poll(w25q64jv_ota_t* ota) {
+    if (!ota) return -1;
+    if (!ota->open || ota->error) return -1;
+    return run(ota);
+}
+
+int w25q64jv_ota_finalize(w25q64jv_ota_t* ota, uint32_t* crc) {
+    if (!ota) return -1;
+    if (!ota->open) return -1;
+
+    // Nothing more will be written, stop the erase pointer at the end of the image
+    ota->end_address = ota->write_address;
+    if (ota->state[ota->fill] == W25Q64JV_OTA_FILLING) {
+        ota->state[ota->fill] = W25Q64JV_OTA_FULL;
+        ota->fill ^= 1;
+    }
+    while (!ota->error && ((ota->state[0] != W25Q64JV_OTA_EMPTY) || (ota->state[1] != W25Q64JV_OTA_EMPTY) ||
+                           (ota->chip != CHIP_IDLE))) {
+        if (step(ota) < 0) ota->error = 1;
+    }
+    ota->open = 0;
+    if (ota->error) return -1;
+    if (crc != NULL) *crc = ota->crc;
+    return 0;
+}
+
+int w25q64jv_ota_dma_complete(w25q64jv_ota_t* ota) {
+    if (!ota) return -1;
+#if defined(__DCACHE_PRESENT) && (__DCACHE_PRESENT == 1U)
+    SCB_InvalidateDCache_by_Addr((uint32_t*)ota->verify, W25Q64JV_PAGE_SIZE);
+#endif
+    return w25q64jv_dma_complete(ota->flash);
+}
+
+int w25q64jv_ota_get_stats(w25q64jv_ota_t* ota, w25q64jv_ota_stats_t* stats, uint8_t reset) {
+    if (!ota) return -1;
+    if (stats == NULL) return -1;
+    *stats = ota->stats;
+    if (reset) memset(&ota->stats, 0, sizeof(ota->stats));
+    return 0;
+}
@@ -0,0 +1,107 @@
+#ifndef W25Q64JV_OTA_H_
+#define W25Q64JV_OTA_H_
+
+#include "W25Q64JV.h"
+#include <stdint.h>
+
+#define W25Q64JV_OTA_EMPTY 0
+#define W25Q64JV_OTA_FILLING 1
+#define W25Q64JV_OTA_FULL 2
+
+typedef struct {
+    uint32_t bytes;
+    uint32_t pages;
+    uint32_t erases;
+    uint32_t verify_failures;
+    uint32_t stalls;            // Writes that waited for a page buffer to free up
+} w25q64jv_ota_stats_t;
+
+typedef struct {
+    // Page data first and 32 byte aligned so the DMA read back does not share a D-cache line with the bookkeeping
+    uint8_t verify[W25Q64JV_PAGE_SIZE] __attribute__((aligned(32)));
+    uint8_t data[2][W25Q64JV_PAGE_SIZE] __attribute__((aligned(32)));
+    uint32_t address[2];
+    uint16_t size[2];
+    uint8_t state[2];
+    uint8_t fill;               // Page buffer receiving data
+    uint8_t next;               // Oldest page buffer, programmed next
+    uint8_t active;             // Page buffer being programmed or verified
+    uint8_t chip;
+    uint8_t open;
+    uint8_t error;
+    uint32_t op_tick;
+    uint32_t op_typical;
+    uint32_t op_timeout;
+    uint32_t end_address;
+    uint32_t write_address;
+    uint32_t erased_until;
+    uint32_t crc;
+    w25q64jv_cfg_t* flash;
+    w25q64jv_ota_stats_t stats;
+} w25q64jv_ota_t;
+
+/**
+ * @brief Open a region for a streamed image. Nothing is erased up front, each erase unit is erased just ahead of
+ * the write pointer with the largest erase type that fits the region
+ *
+ * @param ota           Writer structure, place in static memory
+ * @param flash         Configured driver structure
+ * @param address       Region start, sector aligned
+ * @param size          Maximum image size in bytes, erases round up to the next sector
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_ota_open(w25q64jv_ota_t* ota, w25q64jv_cfg_t* flash, uint32_t address, uint32_t size);
+
+/**
+ * @brief Append a chunk of any size. Full pages are programmed without waiting, the previous page is read back by DMA
+ * and compared while the next one fills. Only blocks when both page buffers are in use
+ *
+ * @param ota           Writer structure
+ * @param data          Chunk data, copied
+ * @param size          Number of bytes
+ *
+ * @return 0 or -1 on overflow, flash error or verify failure
+ */
+int w25q64jv_ota_write(w25q64jv_ota_t* ota, const uint8_t* data, uint32_t size);
+
+/**
+ * @brief Advance erases, programs and verifies without adding data, call while waiting for the next chunk
+ *
+ * @param ota           Writer structure
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_ota_poll(w25q64jv_ota_t* ota);
+
+/**
+ * @brief Program the last partial page, wait for every page to be verified and close the region
+ *
+ * @param ota           Writer structure
+ * @param crc           Return data, CRC-32 of all data written (w25q64jv_crc32), may be NULL
+ *
+ * @return 0 or -1 if any page failed to program or verify
+ */
+int w25q64jv_ota_finalize(w25q64jv_ota_t* ota, uint32_t* crc);
+
+/**
+ * @brief Call from HAL_SPI_RxCpltCallback / HAL_QSPI_RxCpltCallback instead of w25q64jv_dma_complete
+ *
+ * @param ota           Writer structure
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_ota_dma_complete(w25q64jv_ota_t* ota);
+
+/**
+ * @brief Copy out the byte, page, erase and stall counters
+ *
+ * @param ota           Writer structure
+ * @param stats         Return data
+ * @param reset         Set to 0 to keep counting, otherwise counters are cleared
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_ota_get_stats(w25q64jv_ota_t* ota, w25q64jv_ota_stats_t* stats, uint8_t reset);
+
+#endif /* W25Q64JV_OTA_H_ */
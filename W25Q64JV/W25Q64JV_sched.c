@@ -0,0 +1,194 @@
+#include "W25Q64JV_sched.h"
+#include "W25Q64JV_registers.h"
+#include <string.h>
+
+int w25q64jv_sched_init(w25q64jv_sched_t* sched, w25q64jv_cfg_t* flash, uint32_t min_run) {
+    if (!sched) return -1;
+    if (!flash) return -1;
+    memset(sched, 0, sizeof(*sched));
+    sched->flash = flash;
+    sched->min_run = min_run;
+    return 0;
+}
+
+static w25q64jv_erase_type_t* find_erase_type(w25q64jv_sched_t* sched, uint32_t size) {
+    for (uint8_t i = 0; i < W25Q64JV_ERASE_TYPES; i++) {
+        if ((sched->flash->params.erase[i].size == size) && (size != 0)) return &sched->flash->params.erase[i];
+    }
+    return NULL;
+}
+
+static int push(w25q64jv_sched_t* sched, const w25q64jv_sched_op_t* op) {
+    if (sched->count >= W25Q64JV_SCHED_QUEUE_DEPTH) return -1;
+    sched->queue[(sched->head + sched->count) % W25Q64JV_SCHED_QUEUE_DEPTH] = *op;
+    sched->count++;
+    return 0;
+}
+
+int w25q64jv_sched_erase(w25q64jv_sched_t* sched, uint32_t address, uint32_t size, w25q64jv_sched_callback callback, void* context) {
+    if (!sched) return -1;
+    if (find_erase_type(sched, size) == NULL) return -1;
+    if (address >= sched->flash->params.capacity) return -1;
+    w25q64jv_sched_op_t op = {W25Q64JV_SCHED_ERASE, address & ~(size - 1), size, NULL, callback, context};
+    return push(sched, &op);
+}
+
+int w25q64jv_sched_program(w25q64jv_sched_t* sched, uint32_t address, const uint8_t* data, uint32_t size,
+                           w25q64jv_sched_callback callback, void* context) {
+    if (!sched) return -1;
+    if (data == NULL) return -1;
+    if ((size == 0) || ((address + size) > sched->flash->params.capacity)) return -1;
+    w25q64jv_sched_op_t op = {W25Q64JV_SCHED_PROGRAM, address, size, data, callback, context};
+    return push(sched, &op);
+}
+
+static uint32_t step_timeout(w25q64jv_sched_t* sched) {
+    w25q64jv_sched_op_t* op = &sched->queue[sched->head];
+    if (op->type == W25Q64JV_SCHED_PROGRAM) return sched->flash->params.program_max_ms;
+    return find_erase_type(sched, op->size)->max_ms;
+}
+
+static uint32_t step_typical(w25q64jv_sched_t* sched) {
+    w25q64jv_sched_op_t* op = &sched->queue[sched->head];
+    if (op->type == W25Q64JV_SCHED_PROGRAM) return sched->flash->params.program_typical_us / 1000;
+    return find_erase_type(sched, op->size)->typical_ms;
+}
+
+static void finish(w25q64jv_sched_t* sched, int result) {
+    w25q64jv_sched_op_t* op = &sched->queue[sched->head];
+    w25q64jv_sched_callback callback = op->callback;
+    void* context = op->context;
+
+    sched->head = (sched->head + 1) % W25Q64JV_SCHED_QUEUE_DEPTH;
+    sched->count--;
+    sched->running = 0;
+    if (result == 0) {
+        sched->stats.completed++;
+    } else {
+        sched->stats.failed++;
+    }
+    if (callback) callback(context, result);
+}
+
+static int start_step(w25q64jv_sched_t* sched) {
+    w25q64jv_sched_op_t* op = &sched->queue[sched->head];
+    int result;
+    if (op->type == W25Q64JV_SCHED_ERASE) {
+        sched->step_size = op->size;
+        result = w25q64jv_erase_start(sched->flash, op->address, op->size);
+    } else {
+        sched->step_size = W25Q64JV_PAGE_SIZE - (op->address % W25Q64JV_PAGE_SIZE);
+        if (sched->step_size > op->size) sched->step_size = op->size;
+        result = w25q64jv_page_program_start(sched->flash, op->address, op->data, sched->step_size);
+    }
+    if (result != 0) {
+        finish(sched, -1);
+        return -1;
+    }
+    sched->running = 1;
+    sched->step_tick = HAL_GetTick();
+    sched->resume_tick = sched->step_tick;
+    return 0;
+}
+
+// Called once the flash reports not busy, moves a program to its next page or completes the operation.
+// The next step is left to w25q64jv_sched_poll so a waiting read is served first
+static void step_done(w25q64jv_sched_t* sched) {
+    w25q64jv_sched_op_t* op = &sched->queue[sched->head];
+    if (op->type == W25Q64JV_SCHED_PROGRAM) {
+        op->address += sched->step_size;
+        op->data += sched->step_size;
+        op->size -= sched->step_size;
+        if (op->size > 0) {
+            sched->running = 0;
+            return;
+        }
+    }
+    finish(sched, 0);
+}
+
+// Returns 1 while the running step is busy, 0 once it is done
+static int check_running(w25q64jv_sched_t* sched) {
+    // Status is not read before 7/8 of the typical time has run, time spent suspended is excluded
+    uint32_t typical = step_typical(sched);
+    if ((HAL_GetTick() - sched->step_tick) < (typical - (typical / 8))) return 1;
+
+    uint8_t status = 0;
+    if (w25q64jv_read_status_register(sched->flash, 1, &status) != 0) {
+        finish(sched, -1);
+        return -1;
+    }
+    if (status & SR1_BUSY) {
+        if ((HAL_GetTick() - sched->step_tick) > step_timeout(sched)) {
+            finish(sched, -1);
+            return -1;
+        }
+        return 1;
+    }
+    step_done(sched);
+    return 0;
+}
+
+int w25q64jv_sched_poll(w25q64jv_sched_t* sched) {
+    if (!sched) return -1;
+    if (sched->running) {
+        int result = check_running(sched);
+        if (result != 0) return (result > 0) ? 0 : -1;
+    }
+    if (!sched->running && (sched->count > 0)) return start_step(sched);
+    return 0;
+}
+
+static uint8_t overlaps_step(w25q64jv_sched_t* sched, uint32_t address, uint32_t size) {
+    w25q64jv_sched_op_t* op = &sched->queue[sched->head];
+    return (address < (op->address + sched->step_size)) && (op->address < (address + size));
+}
+
+int w25q64jv_sched_read(w25q64jv_sched_t* sched, uint32_t address, uint8_t* data, uint32_t size) {
+    if (!sched) return -1;
+    sched->stats.reads++;
+    if (!sched->running) return w25q64jv_fast_read(sched->flash, address, data, size);
+
+    // Data under the operation in progress is undefined until it completes
+    if (overlaps_step(sched, address, size)) return -1;
+
+    // Fairness: let the operation run for min_run since the last resume, it may complete meanwhile
+    if ((HAL_GetTick() - sched->resume_tick) < sched->min_run) sched->stats.deferred_reads++;
+    while (sched->running && ((HAL_GetTick() - sched->resume_tick) < sched->min_run)) {
+        if (check_running(sched) < 0) return -1;
+    }
+    if (!sched->running) return w25q64jv_fast_read(sched->flash, address, data, size);
+
+    uint32_t suspend_tick = HAL_GetTick();
+    if (w25q64jv_erase_program_suspend(sched->flash) != 0) return -1;
+
+    // SUS stays clear if the operation completed before the suspend arrived
+    uint8_t status = 0;
+    if (w25q64jv_read_status_register(sched->flash, 2, &status) != 0) return -1;
+    if (!(status & SR2_SUS)) {
+        step_done(sched);
+        return w25q64jv_fast_read(sched->flash, address, data, size);
+    }
+    sched->stats.suspends++;
+
+    int result = w25q64jv_fast_read(sched->flash, address, data, size);
+    if (w25q64jv_erase_program_resume(sched->flash) != 0) result = -1;
+
+    // Time spent suspended does not count towards the operation timeout
+    sched->resume_tick = HAL_GetTick();
+    sched->step_tick += sched->resume_tick - suspend_tick;
+    return result;
+}
+
+uint8_t w25q64jv_sched_queue_depth(w25q64jv_sched_t* sched) {
+    if (!sched) return 0;
+    return sched->count;
+}
+
+int w25q64jv_sched_get_stats(w25q64jv_sched_t* sched, w25q64jv_sched_stats_t* stats, uint8_t reset) {
+    if (!sched) return -1;
+    if (stats == NULL) return -1;
+    *stats = sched->stats;
+    if (reset) memset(&sched->stats, 0, sizeof(sched->stats));
+    return 0;
+}
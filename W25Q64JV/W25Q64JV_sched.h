@@ -0,0 +1,129 @@
+#ifndef W25Q64JV_SCHED_H_
+#define W25Q64JV_SCHED_H_
+
+#include "W25Q64JV.h"
+#include <stdint.h>
+
+// Number of erase / program operations that can be queued, including the one running
+#ifndef W25Q64JV_SCHED_QUEUE_DEPTH
+#define W25Q64JV_SCHED_QUEUE_DEPTH 8
+#endif
+
+#define W25Q64JV_SCHED_ERASE 1
+#define W25Q64JV_SCHED_PROGRAM 2
+
+typedef void (*w25q64jv_sched_callback)(void* context, int result);
+
+typedef struct {
+    uint8_t type;
+    uint32_t address;
+    uint32_t size;
+    const uint8_t* data;
+    w25q64jv_sched_callback callback;
+    void* context;
+} w25q64jv_sched_op_t;
+
+typedef struct {
+    uint32_t completed;
+    uint32_t failed;
+    uint32_t reads;
+    uint32_t suspends;
+    uint32_t deferred_reads;
+} w25q64jv_sched_stats_t;
+
+typedef struct {
+    w25q64jv_cfg_t* flash;
+    w25q64jv_sched_op_t queue[W25Q64JV_SCHED_QUEUE_DEPTH];
+    uint8_t head;
+    uint8_t count;
+    uint8_t running;
+    uint32_t step_size;
+    uint32_t step_tick;
+    uint32_t resume_tick;
+    uint32_t min_run;
+    w25q64jv_sched_stats_t stats;
+} w25q64jv_sched_t;
+
+/**
+ * @brief Attach a background erase / program scheduler to a configured flash. Once attached, all erases,
+ * programs and reads of the flash should go through the scheduler
+ *
+ * @param sched         Scheduler structure
+ * @param flash         Configured driver structure
+ * @param min_run       Fairness policy: time in ms an operation runs after a resume before a read may suspend it
+ *                      again. Read latency is bounded by min_run + 1ms, erases progress at least min_run per read
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_sched_init(w25q64jv_sched_t* sched, w25q64jv_cfg_t* flash, uint32_t min_run);
+
+/**
+ * @brief Queue an erase
+ *
+ * @param sched         Scheduler structure
+ * @param address       Any address inside the region
+ * @param size          One of the erase type sizes in flash->params, usually 4KB, 32KB or 64KB
+ * @param callback      Called from w25q64jv_sched_poll or w25q64jv_sched_read with the result, may be NULL
+ * @param context       Passed to the callback
+ *
+ * @return 0 or -1 if the queue is full
+ */
+int w25q64jv_sched_erase(w25q64jv_sched_t* sched, uint32_t address, uint32_t size, w25q64jv_sched_callback callback, void* context);
+
+/**
+ * @brief Queue a program, split into page programs. The data is not copied and must stay valid until the callback
+ *
+ * @param sched         Scheduler structure
+ * @param address       24-bit start address, may span pages
+ * @param data          Data to program
+ * @param size          Number of bytes
+ * @param callback      Called from w25q64jv_sched_poll or w25q64jv_sched_read with the result, may be NULL
+ * @param context       Passed to the callback
+ *
+ * @return 0 or -1 if the queue is full
+ */
+int w25q64jv_sched_program(w25q64jv_sched_t* sched, uint32_t address, const uint8_t* data, uint32_t size,
+                           w25q64jv_sched_callback callback, void* context);
+
+/**
+ * @brief Advance the running operation and start the next one, call periodically
+ *
+ * @param sched         Scheduler structure
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_sched_poll(w25q64jv_sched_t* sched);
+
+/**
+ * @brief Read data, suspending the running operation for the duration of the read if needed
+ *
+ * @param sched         Scheduler structure
+ * @param address       24-bit start address
+ * @param data          Reference for data
+ * @param size          Number of bytes
+ *
+ * @return 0 or -1, -1 if the range overlaps the operation in progress
+ */
+int w25q64jv_sched_read(w25q64jv_sched_t* sched, uint32_t address, uint8_t* data, uint32_t size);
+
+/**
+ * @brief Number of operations queued, including the one running
+ *
+ * @param sched         Scheduler structure
+ *
+ * @return Queue depth
+ */
+uint8_t w25q64jv_sched_queue_depth(w25q64jv_sched_t* sched);
+
+/**
+ * @brief Copy out the operation, read and suspend counters
+ *
+ * @param sched         Scheduler structure
+ * @param stats         Return data
+ * @param reset         Set to 0 to keep counting, otherwise counters are cleared
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_sched_get_stats(w25q64jv_sched_t* sched, w25q64jv_sched_stats_t* stats, uint8_t reset);
+
+#endif /* W25Q64JV_SCHED_H_ */
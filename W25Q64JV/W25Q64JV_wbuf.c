@@ -0,0 +1,164 @@
+#include "W25Q64JV_wbuf.h"
+#include <string.h>
+
+#define EMPTY_PAGE 0xFFFFFFFF
+
+static void clear_buffer(w25q64jv_wbuf_t* wbuf) {
+    memset(wbuf->data, 0xFF, sizeof(wbuf->data));
+    memset(wbuf->dirty, 0, sizeof(wbuf->dirty));
+    wbuf->page_address = EMPTY_PAGE;
+    wbuf->dirty_count = 0;
+    wbuf->dirty_first = W25Q64JV_PAGE_SIZE;
+    wbuf->dirty_last = 0;
+}
+
+int w25q64jv_wbuf_init(w25q64jv_wbuf_t* wbuf, w25q64jv_cfg_t* flash, uint32_t timeout) {
+    if (!wbuf) return -1;
+    if (!flash) return -1;
+    clear_buffer(wbuf);
+    wbuf->first_write_tick = 0;
+    wbuf->timeout = timeout;
+    wbuf->power_fail = 0;
+    wbuf->in_use = 0;
+    wbuf->flash = flash;
+    memset(&wbuf->stats, 0, sizeof(wbuf->stats));
+    return 0;
+}
+
+// in_use and power_fail are shared with the power fail interrupt
+static uint32_t lock(void) {
+#if defined(__ARM_ARCH)
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    return primask;
+#else
+    return 0;
+#endif
+}
+
+static void unlock(uint32_t primask) {
+#if defined(__ARM_ARCH)
+    __set_PRIMASK(primask);
+#else
+    (void)primask;
+#endif
+}
+
+static int program_pending(w25q64jv_wbuf_t* wbuf) {
+    if (wbuf->page_address == EMPTY_PAGE) return 0;
+
+    // Only the dirty span is sent, untouched bytes inside it are 0xFF and leave the flash unchanged. A failed
+    // program keeps the page for the next flush
+    uint32_t size = (uint32_t)(wbuf->dirty_last - wbuf->dirty_first) + 1;
+    if (w25q64jv_page_program(wbuf->flash, wbuf->page_address + wbuf->dirty_first, &wbuf->data[wbuf->dirty_first], size) != 0) return -1;
+    wbuf->stats.programs++;
+    wbuf->stats.bytes_programmed += size;
+    clear_buffer(wbuf);
+    return 0;
+}
+
+static int release(w25q64jv_wbuf_t* wbuf, int result) {
+    // Test and clear together: a power fail raised before this is served here with the bus still held, one
+    // raised after finds the bus free and programs the page itself
+    uint32_t primask = lock();
+    uint8_t power_fail = wbuf->power_fail;
+    if (!power_fail) wbuf->in_use = 0;
+    unlock(primask);
+
+    if (power_fail) {
+        if (program_pending(wbuf) != 0) result = -1;
+        wbuf->in_use = 0;
+    }
+    return result;
+}
+
+int w25q64jv_wbuf_write(w25q64jv_wbuf_t* wbuf, uint32_t address, const uint8_t* data, uint32_t size) {
+    if (!wbuf) return -1;
+    if (data == NULL) return -1;
+    if ((address + size) > wbuf->flash->params.capacity) return -1;
+
+    // Test and set together: a power fail raised before this refuses the write, one raised after finds the bus
+    // held and leaves the page to release()
+    uint32_t primask = lock();
+    uint8_t power_fail = wbuf->power_fail;
+    if (!power_fail) wbuf->in_use = 1;
+    unlock(primask);
+    if (power_fail) return -1;
+    wbuf->stats.writes++;
+
+    while (size > 0) {
+        uint32_t page = address & ~(uint32_t)(W25Q64JV_PAGE_SIZE - 1);
+        uint32_t offset = address - page;
+        uint32_t chunk = W25Q64JV_PAGE_SIZE - offset;
+        if (chunk > size) chunk = size;
+
+        if (page != wbuf->page_address) {
+            if (program_pending(wbuf) != 0) return release(wbuf, -1);
+            wbuf->page_address = page;
+            wbuf->first_write_tick = HAL_GetTick();
+        }
+
+        for (uint32_t i = offset; i < (offset + chunk); i++) {
+            wbuf->data[i] &= *data++;
+            if ((wbuf->dirty[i / 8] & (1 << (i % 8))) == 0) {
+                wbuf->dirty[i / 8] |= (uint8_t)(1 << (i % 8));
+                wbuf->dirty_count++;
+            }
+        }
+        if (offset < wbuf->dirty_first) wbuf->dirty_first = (uint16_t)offset;
+        if ((offset + chunk - 1) > wbuf->dirty_last) wbuf->dirty_last = (uint16_t)(offset + chunk - 1);
+
+        if (wbuf->dirty_count == W25Q64JV_PAGE_SIZE) {
+            if (program_pending(wbuf) != 0) return release(wbuf, -1);
+        }
+        address += chunk;
+        size -= chunk;
+    }
+    return release(wbuf, 0);
+}
+
+int w25q64jv_wbuf_flush(w25q64jv_wbuf_t* wbuf) {
+    if (!wbuf) return -1;
+    wbuf->in_use = 1;
+    return release(wbuf, program_pending(wbuf));
+}
+
+int w25q64jv_wbuf_poll(w25q64jv_wbuf_t* wbuf) {
+    if (!wbuf) return -1;
+    if (wbuf->page_address == EMPTY_PAGE) return 0;
+    if (wbuf->timeout == 0) return 0;
+    if ((HAL_GetTick() - wbuf->first_write_tick) < wbuf->timeout) return 0;
+    return w25q64jv_wbuf_flush(wbuf);
+}
+
+int w25q64jv_wbuf_read(w25q64jv_wbuf_t* wbuf, uint32_t address, uint8_t* data, uint32_t size) {
+    if (!wbuf) return -1;
+    wbuf->in_use = 1;
+    if (w25q64jv_fast_read(wbuf->flash, address, data, size) != 0) return release(wbuf, -1);
+    if (wbuf->page_address == EMPTY_PAGE) return release(wbuf, 0);
+
+    // Overlay pending bytes the way programming them will
+    for (uint32_t i = 0; i < size; i++) {
+        uint32_t current = address + i;
+        if ((current & ~(uint32_t)(W25Q64JV_PAGE_SIZE - 1)) != wbuf->page_address) continue;
+        data[i] &= wbuf->data[current - wbuf->page_address];
+    }
+    return release(wbuf, 0);
+}
+
+int w25q64jv_wbuf_power_fail(w25q64jv_wbuf_t* wbuf) {
+    if (!wbuf) return -1;
+    wbuf->power_fail = 1;
+    if (wbuf->in_use) return 0;     // Flushed by the interrupted call on its way out
+
+    // A DMA transfer in flight cannot complete while this interrupt runs, the page stays buffered
+    if (wbuf->flash->dma_active) return -1;
+    return program_pending(wbuf);
+}
+
+int w25q64jv_wbuf_get_stats(w25q64jv_wbuf_t* wbuf, w25q64jv_wbuf_stats_t* stats, uint8_t reset) {
+    if (!wbuf) return -1;
+    if (stats != NULL) *stats = wbuf->stats;
+    if (reset != 0) memset(&wbuf->stats, 0, sizeof(wbuf->stats));
+    return 0;
+}
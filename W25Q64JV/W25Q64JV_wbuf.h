@@ -0,0 +1,107 @@
+#ifndef W25Q64JV_WBUF_H_
+#define W25Q64JV_WBUF_H_
+
+#include "W25Q64JV.h"
+#include <stdint.h>
+
+typedef struct {
+    uint32_t writes;
+    uint32_t programs;
+    uint32_t bytes_programmed;
+} w25q64jv_wbuf_stats_t;
+
+typedef struct {
+    uint8_t data[W25Q64JV_PAGE_SIZE] __attribute__((aligned(32)));
+    uint8_t dirty[W25Q64JV_PAGE_SIZE / 8];
+    uint32_t page_address;
+    uint16_t dirty_count;
+    uint16_t dirty_first;
+    uint16_t dirty_last;
+    uint32_t first_write_tick;
+    uint32_t timeout;
+    volatile uint8_t power_fail;
+    volatile uint8_t in_use;
+    w25q64jv_cfg_t* flash;
+    w25q64jv_wbuf_stats_t stats;
+} w25q64jv_wbuf_t;
+
+/**
+ * @brief Attach a write combining page buffer to a configured flash
+ *
+ * @param wbuf          Buffer structure
+ * @param flash         Configured driver structure
+ * @param timeout       Time in ms a partially filled page may wait before w25q64jv_wbuf_poll programs it, 0 to disable
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_wbuf_init(w25q64jv_wbuf_t* wbuf, w25q64jv_cfg_t* flash, uint32_t timeout);
+
+/**
+ * @brief Buffer a write. Writes to the same page are combined and programmed once the page is full,
+ * the next write targets another page, the timeout expires or the buffer is flushed.
+ * Overlapping writes combine the same way repeated programs would (bitwise AND), the target must be erased
+ *
+ * @param wbuf          Buffer structure
+ * @param address       24-bit start address, may span pages
+ * @param data          Data to write
+ * @param size          Number of bytes
+ *
+ * @return 0 or -1, -1 after a power fail. When programming a full page fails it stays buffered for the next flush
+ */
+int w25q64jv_wbuf_write(w25q64jv_wbuf_t* wbuf, uint32_t address, const uint8_t* data, uint32_t size);
+
+/**
+ * @brief Program any pending data now
+ *
+ * @param wbuf          Buffer structure
+ *
+ * @return 0 or -1, the data stays buffered if the program fails
+ */
+int w25q64jv_wbuf_flush(w25q64jv_wbuf_t* wbuf);
+
+/**
+ * @brief Flush a partially filled page once it has waited longer than the timeout, call periodically
+ *
+ * @param wbuf          Buffer structure
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_wbuf_poll(w25q64jv_wbuf_t* wbuf);
+
+/**
+ * @brief Read data as it will be once pending writes are programmed
+ *
+ * @param wbuf          Buffer structure
+ * @param address       24-bit start address
+ * @param data          Reference for data
+ * @param size          Number of bytes
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_wbuf_read(w25q64jv_wbuf_t* wbuf, uint32_t address, uint8_t* data, uint32_t size);
+
+/**
+ * @brief Power fail hook, call from the PVD / brown out handler. Pending data is programmed immediately,
+ * or as soon as a write or flush already using the bus returns, and all later writes are refused.
+ * The program runs from the interrupt, so the buffer must own the flash: no other code (kv, sched, ota, the
+ * read cache) may be in the middle of a command on it when the interrupt can fire. A DMA transfer still in
+ * flight is detected and the page is left buffered
+ *
+ * @param wbuf          Buffer structure
+ *
+ * @return 0 or -1, -1 when the page could not be programmed
+ */
+int w25q64jv_wbuf_power_fail(w25q64jv_wbuf_t* wbuf);
+
+/**
+ * @brief Copy out the write and program counters
+ *
+ * @param wbuf          Buffer structure
+ * @param stats         Return data
+ * @param reset         Set to 0 to keep counting, otherwise counters are cleared
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_wbuf_get_stats(w25q64jv_wbuf_t* wbuf, w25q64jv_wbuf_stats_t* stats, uint8_t reset);
+
+#endif /* W25Q64JV_WBUF_H_ */
@@ -0,0 +1,151 @@
+#include "W25Q64JV_xip.h"
+#include "W25Q64JV_registers.h"
+
+static uint8_t wrap_bits(uint8_t wrap) {
+    // W4 = 1 disables wrapping, W6:W5 select 8/16/32/64 bytes
+    if (wrap == W25Q64JV_WRAP_NONE) return 0x10;
+    return (uint8_t)((wrap - 1) << 5);
+}
+
+#ifdef HAL_QSPI_MODULE_ENABLED
+
+int w25q64jv_set_burst_with_wrap(w25q64jv_cfg_t* hw_cfg, uint8_t wrap) {
+    if (!hw_cfg) return -1;
+    if (wrap > W25Q64JV_WRAP_64) return -1;
+    if (hw_cfg->interface != W25Q64JV_INTERFACE_QSPI) return -1;
+    if (hw_cfg->xip_active) return -1;
+
+    // Instruction on one line, then 24 dummy bits and the wrap bits on four lines
+    uint8_t data[4] = {0xFF, 0xFF, 0xFF, wrap_bits(wrap)};
+    QSPI_CommandTypeDef command = {0};
+    command.InstructionMode = QSPI_INSTRUCTION_1_LINE;
+    command.Instruction = SET_BURST_WITH_WRAP;
+    command.AddressMode = QSPI_ADDRESS_NONE;
+    command.AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE;
+    command.DummyCycles = 0;
+    command.DataMode = QSPI_DATA_4_LINES;
+    command.NbData = sizeof(data);
+    command.DdrMode = QSPI_DDR_MODE_DISABLE;
+    command.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
+    command.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
+
+    if (HAL_QSPI_Command(hw_cfg->comms_handle, &command, HAL_QSPI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) return -1;
+    if (HAL_QSPI_Transmit(hw_cfg->comms_handle, data, HAL_QSPI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) return -1;
+    hw_cfg->xip_wrap = wrap;
+    return 0;
+}
+
+int w25q64jv_xip_enter(w25q64jv_cfg_t* hw_cfg, uint8_t wrap, const uint8_t** base) {
+    if (!hw_cfg) return -1;
+    if (hw_cfg->interface != W25Q64JV_INTERFACE_QSPI) return -1;
+    if (hw_cfg->xip_active) return -1;
+
+    // QUADSPI reads and prefetches linearly through the mapping, a wrapped burst would return the wrong bytes
+    if (wrap != W25Q64JV_WRAP_NONE) return -1;
+
+    if (w25q64jv_enable_quad(hw_cfg) != 0) return -1;
+    if (hw_cfg->xip_wrap != W25Q64JV_WRAP_NONE) {
+        if (w25q64jv_set_burst_with_wrap(hw_cfg, W25Q64JV_WRAP_NONE) != 0) return -1;
+    }
+
+    // 1-4-4 read with M[7:0] = 0x20 so every access after the first skips the instruction phase
+    QSPI_CommandTypeDef command = {0};
+    command.InstructionMode = QSPI_INSTRUCTION_1_LINE;
+    command.Instruction = FAST_READ_QUAD_IO;
+    command.AddressMode = QSPI_ADDRESS_4_LINES;
+    command.AddressSize = QSPI_ADDRESS_24_BITS;
+    command.AlternateByteMode = QSPI_ALTERNATE_BYTES_4_LINES;
+    command.AlternateBytesSize = QSPI_ALTERNATE_BYTES_8_BITS;
+    command.AlternateBytes = CONTINUOUS_READ_MODE_BITS;
+    command.DummyCycles = (hw_cfg->params.read.opcode == FAST_READ_QUAD_IO) ? hw_cfg->params.read.dummy_clocks : 4;
+    command.DataMode = QSPI_DATA_4_LINES;
+    command.DdrMode = QSPI_DDR_MODE_DISABLE;
+    command.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
+    command.SIOOMode = QSPI_SIOO_INST_ONLY_FIRST_CMD;
+
+    QSPI_MemoryMappedTypeDef memory_mapped = {0};
+    memory_mapped.TimeOutActivation = QSPI_TIMEOUT_COUNTER_ENABLE;  // Release CS between bursts, the chip stays in continuous read mode
+    memory_mapped.TimeOutPeriod = 0x20;
+
+    if (HAL_QSPI_MemoryMapped(hw_cfg->comms_handle, &command, &memory_mapped) != HAL_OK) return -1;
+    hw_cfg->xip_active = 1;
+    if (base != NULL) *base = (const uint8_t*)W25Q64JV_XIP_BASE;
+    return 0;
+}
+
+int w25q64jv_xip_exit(w25q64jv_cfg_t* hw_cfg) {
+    if (!hw_cfg) return -1;
+    if (!hw_cfg->xip_active) return 0;
+    if (HAL_QSPI_Abort(hw_cfg->comms_handle) != HAL_OK) return -1;
+
+    // Clock M[7:0] = 0xFF after a dummy address so the chip expects an instruction again
+    QSPI_CommandTypeDef command = {0};
+    command.InstructionMode = QSPI_INSTRUCTION_NONE;
+    command.AddressMode = QSPI_ADDRESS_4_LINES;
+    command.AddressSize = QSPI_ADDRESS_24_BITS;
+    command.Address = 0xFFFFFF;
+    command.AlternateByteMode = QSPI_ALTERNATE_BYTES_4_LINES;
+    command.AlternateBytesSize = QSPI_ALTERNATE_BYTES_8_BITS;
+    command.AlternateBytes = CONTINUOUS_READ_MODE_RESET;
+    command.DummyCycles = 0;
+    command.DataMode = QSPI_DATA_NONE;
+    command.DdrMode = QSPI_DDR_MODE_DISABLE;
+    command.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
+    command.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
+
+    if (HAL_QSPI_Command(hw_cfg->comms_handle, &command, HAL_QSPI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) return -1;
+    hw_cfg->xip_active = 0;
+    return 0;
+}
+
+#else
+
+int w25q64jv_xip_set_shadow(w25q64jv_cfg_t* hw_cfg, uint8_t* shadow, uint32_t size) {
+    if (!hw_cfg) return -1;
+    if (hw_cfg->xip_active) return -1;
+    if ((shadow == NULL) || (size == 0) || (size > hw_cfg->params.capacity)) return -1;
+    hw_cfg->xip_shadow = shadow;
+    hw_cfg->xip_shadow_size = size;
+    return 0;
+}
+
+int w25q64jv_set_burst_with_wrap(w25q64jv_cfg_t* hw_cfg, uint8_t wrap) {
+    if (!hw_cfg) return -1;
+    if (wrap > W25Q64JV_WRAP_64) return -1;
+    if (hw_cfg->xip_active) return -1;
+    if (hw_cfg->gpio_port == NULL) return -1;
+
+    // Sent one byte per clock so the simulated chip sees it: instruction, 24 dummy bits and the wrap bits
+    uint8_t command[5] = {SET_BURST_WITH_WRAP, 0xFF, 0xFF, 0xFF, wrap_bits(wrap)};
+    HAL_GPIO_WritePin(hw_cfg->gpio_port, hw_cfg->gpio_pin, GPIO_PIN_RESET);
+    HAL_StatusTypeDef status = HAL_SPI_Transmit(hw_cfg->comms_handle, command, sizeof(command), HAL_MAX_DELAY);
+    HAL_GPIO_WritePin(hw_cfg->gpio_port, hw_cfg->gpio_pin, GPIO_PIN_SET);
+    if (status != HAL_OK) return -1;
+    hw_cfg->xip_wrap = wrap;
+    return 0;
+}
+
+int w25q64jv_xip_enter(w25q64jv_cfg_t* hw_cfg, uint8_t wrap, const uint8_t** base) {
+    if (!hw_cfg) return -1;
+    if (hw_cfg->xip_active) return -1;
+    if (hw_cfg->xip_shadow == NULL) return -1;
+    if (wrap != W25Q64JV_WRAP_NONE) return -1;      // As on QUADSPI
+
+    if (w25q64jv_enable_quad(hw_cfg) != 0) return -1;
+    if (hw_cfg->xip_wrap != W25Q64JV_WRAP_NONE) {
+        if (w25q64jv_set_burst_with_wrap(hw_cfg, W25Q64JV_WRAP_NONE) != 0) return -1;
+    }
+    if (w25q64jv_fast_read(hw_cfg, 0, hw_cfg->xip_shadow, hw_cfg->xip_shadow_size) != 0) return -1;
+
+    hw_cfg->xip_active = 1;
+    if (base != NULL) *base = hw_cfg->xip_shadow;
+    return 0;
+}
+
+int w25q64jv_xip_exit(w25q64jv_cfg_t* hw_cfg) {
+    if (!hw_cfg) return -1;
+    hw_cfg->xip_active = 0;
+    return 0;
+}
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef W25Q64JV_XIP_H_
+#define W25Q64JV_XIP_H_
+
+#include "W25Q64JV.h"
+#include <stdint.h>
+
+// QUADSPI memory mapped region on STM32F4/F7/H7/L4
+#define W25Q64JV_XIP_BASE 0x90000000UL
+
+// Wrap lengths for Set Burst with Wrap. Memory mapped mode needs W25Q64JV_WRAP_NONE
+#define W25Q64JV_WRAP_NONE 0
+#define W25Q64JV_WRAP_8 1
+#define W25Q64JV_WRAP_16 2
+#define W25Q64JV_WRAP_32 3
+#define W25Q64JV_WRAP_64 4
+
+/**
+ * @brief Configure the wrap length used by Fast Read Quad I/O bursts. Requires the QSPI interface. Wrapping
+ * applies to every 0xEB read, including w25q64jv_fast_read once SFDP has picked 1-4-4, so reads longer than
+ * the wrap length return wrapped data until it is set back to W25Q64JV_WRAP_NONE
+ *
+ * @param hw_cfg        Driver configuration structure
+ * @param wrap          One of W25Q64JV_WRAP_NONE, W25Q64JV_WRAP_8, W25Q64JV_WRAP_16, W25Q64JV_WRAP_32 or W25Q64JV_WRAP_64
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_set_burst_with_wrap(w25q64jv_cfg_t* hw_cfg, uint8_t wrap);
+
+/**
+ * @brief Enter memory mapped (execute in place) mode using Fast Read Quad I/O in continuous read mode.
+ * Sets the QE bit and turns wrapping off if needed. While mapped, all other driver commands return -1 until
+ * w25q64jv_xip_exit
+ *
+ * @param hw_cfg        Driver configuration structure
+ * @param wrap          W25Q64JV_WRAP_NONE, QUADSPI bursts are linear and any other length is refused
+ * @param base          Returns the address flash offset 0 is mapped to, pass NULL if not needed
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_xip_enter(w25q64jv_cfg_t* hw_cfg, uint8_t wrap, const uint8_t** base);
+
+/**
+ * @brief Leave memory mapped mode and reset continuous read mode so indirect commands (erase, program) can be issued.
+ * Wrapping stays off, as w25q64jv_xip_enter left it
+ *
+ * @param hw_cfg        Driver configuration structure
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_xip_exit(w25q64jv_cfg_t* hw_cfg);
+
+#ifndef HAL_QSPI_MODULE_ENABLED
+/**
+ * @brief Without a QUADSPI peripheral (host builds) the mapping is simulated by a RAM shadow of the
+ * start of flash, refreshed through the indirect read path on every w25q64jv_xip_enter
+ *
+ * @param hw_cfg        Driver configuration structure
+ * @param shadow        Buffer that stands in for the mapped region
+ * @param size          Number of bytes of flash to map from address 0
+ *
+ * @return 0 or -1
+ */
+int w25q64jv_xip_set_shadow(w25q64jv_cfg_t* hw_cfg, uint8_t* shadow, uint32_t size);
+#endif
+
+#endif /* W25Q64JV_XIP_H_ */
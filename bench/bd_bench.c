@@ -0,0 +1,280 @@
+/*
+ * Host benchmark for the W25Q64JV block device against the simulated chip, over a 1MB region with DMA on.
+ * Compares FatFS style sector transfers through the adapter with glue that sends one command per 4KB sector
+ * (a FAST_READ each, an erase and 16 page programs each), and shows lazy erase skipping blocks that are still
+ * blank, and checks the block device against the calls littlefs makes through its callbacks. Built with littlefs
+ * (W25Q64JV_BD_LITTLEFS, lfs.c and lfs_util.c from a littlefs checkout), it also formats the region and reports
+ * throughput for file create, append and read workloads.
+ *
+ * cc -O2 -Ihost -IW25Q64JV host/hal_host.c host/sim_w25q64jv.c W25Q64JV/W25Q64JV.c W25Q64JV/W25Q64JV_bd.c \
+ *    bench/bd_bench.c -o bd_bench
+ * cc -O2 -DW25Q64JV_BD_LITTLEFS -Ihost -IW25Q64JV -I<littlefs> host/hal_host.c host/sim_w25q64jv.c \
+ *    W25Q64JV/W25Q64JV.c W25Q64JV/W25Q64JV_bd.c <littlefs>/lfs.c <littlefs>/lfs_util.c bench/bd_bench.c -o bd_bench
+ */
+#include <stdio.h>
+#include <string.h>
+#include "main.h"
+#include "sim_w25q64jv.h"
+#include "W25Q64JV.h"
+#include "W25Q64JV_bd.h"
+
+#define REGION_BASE 0x100000
+#define REGION_SIZE 0x100000
+#define SECTORS 64              // 256KB per transfer test
+#define NAIVE_BASE 0x300000
+
+static sim_w25q64jv_t sim;
+static SPI_HandleTypeDef hspi1;
+static w25q64jv_cfg_t flash;
+static w25q64jv_bd_t bd;
+static uint8_t data[SECTORS * W25Q64JV_BD_BLOCK_SIZE] __attribute__((aligned(32)));
+static uint8_t readback[SECTORS * W25Q64JV_BD_BLOCK_SIZE] __attribute__((aligned(32)));
+static uint32_t seed = 12345;
+
+void HAL_SPI_TxCpltCallback(SPI_HandleTypeDef* hspi) {
+    if (hspi == &hspi1) w25q64jv_dma_complete(&flash);
+}
+
+void HAL_SPI_RxCpltCallback(SPI_HandleTypeDef* hspi) {
+    if (hspi == &hspi1) w25q64jv_dma_complete(&flash);
+}
+
+static uint8_t next_random(void) {
+    seed = (seed * 1103515245) + 12345;
+    return (uint8_t)(seed >> 16);
+}
+
+static void fill(uint8_t* buffer, uint32_t size) {
+    for (uint32_t i = 0; i < size; i++) buffer[i] = next_random();
+}
+
+typedef struct {
+    uint64_t start_ns;
+    uint64_t start_bytes;
+    uint32_t start_erases;
+} span_t;
+
+static void begin(span_t* span) {
+    span->start_ns = host_time_ns();
+    span->start_bytes = host_spi_bytes();
+    span->start_erases = sim.stats.erases;
+}
+
+static void report(const char* name, const span_t* span, uint32_t bytes, uint32_t commands) {
+    double seconds = (host_time_ns() - span->start_ns) / 1e9;
+    printf("%-34s %9.1f ms %9.1f KB/s %8lu cmds %6lu erases %9.1f KB SPI\n", name, seconds * 1000.0,
+           bytes / 1024.0 / seconds, (unsigned long)commands, (unsigned long)(sim.stats.erases - span->start_erases),
+           (host_spi_bytes() - span->start_bytes) / 1024.0);
+}
+
+// Glue sending one command per sector, as littlefs or FatFS callbacks written per 4KB block would
+static int naive_write(uint32_t address, const uint8_t* buffer, uint32_t count) {
+    for (uint32_t s = 0; s < count; s++) {
+        uint32_t sector = address + (s * W25Q64JV_BD_BLOCK_SIZE);
+        if (w25q64jv_sector_erase_4KB(&flash, sector) != 0) return -1;
+        for (uint32_t p = 0; p < W25Q64JV_BD_BLOCK_SIZE; p += W25Q64JV_PAGE_SIZE) {
+            if (w25q64jv_page_program(&flash, sector + p, &buffer[(s * W25Q64JV_BD_BLOCK_SIZE) + p], W25Q64JV_PAGE_SIZE) != 0) return -1;
+        }
+    }
+    return 0;
+}
+
+static int naive_read(uint32_t address, uint8_t* buffer, uint32_t count) {
+    for (uint32_t s = 0; s < count; s++) {
+        uint32_t offset = s * W25Q64JV_BD_BLOCK_SIZE;
+        if (w25q64jv_fast_read(&flash, address + offset, &buffer[offset], W25Q64JV_BD_BLOCK_SIZE) != 0) return -1;
+    }
+    return 0;
+}
+
+static int sector_tests(void) {
+    span_t span;
+    w25q64jv_bd_stats_t stats;
+    uint32_t bytes = SECTORS * W25Q64JV_BD_BLOCK_SIZE;
+    fill(data, bytes);
+
+    // Written twice so the second pass has to erase data, not blank flash
+    for (int pass = 0; pass < 2; pass++) {
+        const char* label = pass ? "rewrite" : "write blank";
+        char name[48];
+        begin(&span);
+        if (naive_write(NAIVE_BASE, data, SECTORS) != 0) return -1;
+        snprintf(name, sizeof(name), "%s, per sector glue", label);
+        report(name, &span, bytes, SECTORS * 17);
+
+        w25q64jv_bd_get_stats(&bd, &stats, 1);
+        begin(&span);
+        if (w25q64jv_bd_disk_write(&bd, data, 0, SECTORS) != 0) return -1;
+        w25q64jv_bd_get_stats(&bd, &stats, 0);
+        snprintf(name, sizeof(name), "%s, disk_write x%u", label, (unsigned)SECTORS);
+        report(name, &span, bytes, stats.pages + stats.erases);
+    }
+
+    begin(&span);
+    if (naive_read(NAIVE_BASE, readback, SECTORS) != 0) return -1;
+    report("read, per sector glue", &span, bytes, SECTORS);
+    if (memcmp(readback, data, bytes) != 0) return -1;
+
+    memset(readback, 0, bytes);
+    w25q64jv_bd_get_stats(&bd, &stats, 1);
+    begin(&span);
+    if (w25q64jv_bd_disk_read(&bd, readback, 0, SECTORS) != 0) return -1;
+    w25q64jv_bd_get_stats(&bd, &stats, 0);
+    report("read, disk_read x64", &span, bytes, stats.reads);
+    if (memcmp(readback, data, bytes) != 0) return -1;
+
+    // littlefs erases a block before it allocates it, often one that was never programmed since
+    w25q64jv_bd_get_stats(&bd, &stats, 1);
+    begin(&span);
+    for (uint32_t block = SECTORS; block < (2 * SECTORS); block++) {
+        if (w25q64jv_bd_erase(&bd, block) != 0) return -1;
+        if (w25q64jv_bd_prog(&bd, block, 0, data, W25Q64JV_PAGE_SIZE) != 0) return -1;
+    }
+    for (uint32_t block = SECTORS; block < (2 * SECTORS); block++) {
+        if (w25q64jv_bd_erase(&bd, block) != 0) return -1;
+    }
+    if (w25q64jv_bd_read(&bd, SECTORS, 0, readback, W25Q64JV_BD_BLOCK_SIZE) != 0) return -1;
+    for (uint32_t i = 0; i < W25Q64JV_BD_BLOCK_SIZE; i++) {
+        if (readback[i] != 0xFF) return -1;
+    }
+    w25q64jv_bd_get_stats(&bd, &stats, 0);
+    report("erase, program a page, erase x64", &span, SECTORS * W25Q64JV_PAGE_SIZE, stats.pages + stats.erases);
+    printf("  %lu erase requests, %lu erase commands, %lu still pending, %lu bytes read as blank from RAM\n",
+           (unsigned long)stats.erase_requests, (unsigned long)stats.erases,
+           (unsigned long)(stats.erase_requests - stats.erase_blocks - stats.erases_skipped),
+           (unsigned long)stats.blank_bytes);
+    return 0;
+}
+
+// The calls the littlefs callbacks forward: small programs at any offset from any buffer (metadata commits),
+// whole caches from the aligned caches in w25q64jv_bd_t, cache and byte sized reads, and an erase read back
+static int lfs_access_check(void) {
+    static uint8_t image[W25Q64JV_BD_BLOCK_SIZE];
+    static const uint16_t commits[] = {13, 40, 7, 200, 96};
+    uint32_t block = 2 * SECTORS;   // Not used by the sector tests
+    uint32_t offset = 0;
+    uint8_t byte;
+
+    memset(image, 0xFF, sizeof(image));
+    if (w25q64jv_bd_init(&bd, &flash, REGION_BASE, REGION_SIZE, 1) != 0) return -1;
+    if (w25q64jv_bd_erase(&bd, block) != 0) return -1;
+    for (uint32_t i = 0; i < sizeof(commits) / sizeof(commits[0]); i++) {
+        fill(&data[1], commits[i]);
+        if (w25q64jv_bd_prog(&bd, block, offset, &data[1], commits[i]) != 0) return -1;
+        memcpy(&image[offset], &data[1], commits[i]);
+        offset += commits[i];
+    }
+    // Program cache over a page boundary, then at an aligned offset so it goes by DMA without staging
+    const uint32_t cache_offsets[] = {offset, 1024};
+    for (uint32_t i = 0; i < 2; i++) {
+        fill(bd.prog_buffer, W25Q64JV_BD_CACHE_SIZE);
+        if (w25q64jv_bd_prog(&bd, block, cache_offsets[i], bd.prog_buffer, W25Q64JV_BD_CACHE_SIZE) != 0) return -1;
+        memcpy(&image[cache_offsets[i]], bd.prog_buffer, W25Q64JV_BD_CACHE_SIZE);
+    }
+    if (w25q64jv_bd_sync(&bd) != 0) return -1;
+
+    for (uint32_t at = 0; (at + W25Q64JV_BD_CACHE_SIZE) <= W25Q64JV_BD_BLOCK_SIZE; at += 97) {
+        if (w25q64jv_bd_read(&bd, block, at, bd.read_buffer, W25Q64JV_BD_CACHE_SIZE) != 0) return -1;
+        if (memcmp(bd.read_buffer, &image[at], W25Q64JV_BD_CACHE_SIZE) != 0) return -1;
+    }
+    for (uint32_t at = 0; at < W25Q64JV_BD_BLOCK_SIZE; at += 61) {
+        if ((w25q64jv_bd_read(&bd, block, at, &byte, 1) != 0) || (byte != image[at])) return -1;
+    }
+
+    if (w25q64jv_bd_erase(&bd, block) != 0) return -1;
+    if (w25q64jv_bd_read(&bd, block, 0, readback, W25Q64JV_BD_BLOCK_SIZE) != 0) return -1;
+    for (uint32_t i = 0; i < W25Q64JV_BD_BLOCK_SIZE; i++) {
+        if (readback[i] != 0xFF) return -1;
+    }
+    return w25q64jv_bd_sync(&bd);
+}
+
+#ifdef W25Q64JV_BD_LITTLEFS
+#define FILES 32
+#define FILE_SIZE 8192
+#define APPENDS 1024
+#define APPEND_SIZE 64
+#define APPEND_SYNC 16
+
+static lfs_t lfs;
+static struct lfs_config lfs_cfg;
+
+static int lfs_tests(void) {
+    span_t span;
+    lfs_file_t file;
+    char path[16];
+    w25q64jv_bd_stats_t stats;
+
+    if (w25q64jv_bd_init(&bd, &flash, REGION_BASE, REGION_SIZE, 1) != 0) return -1;
+    if (w25q64jv_bd_lfs_config(&bd, &lfs_cfg) != 0) return -1;
+    if (lfs_format(&lfs, &lfs_cfg) != 0) return -1;
+    if (lfs_mount(&lfs, &lfs_cfg) != 0) return -1;
+    printf("\nlittlefs, %u blocks of %u bytes, %u byte caches\n", (unsigned)lfs_cfg.block_count,
+           (unsigned)lfs_cfg.block_size, (unsigned)lfs_cfg.cache_size);
+
+    seed = 1;
+    fill(data, FILE_SIZE);
+    w25q64jv_bd_get_stats(&bd, &stats, 1);
+    begin(&span);
+    for (int i = 0; i < FILES; i++) {
+        snprintf(path, sizeof(path), "f%02d", i);
+        if (lfs_file_open(&lfs, &file, path, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC) != 0) return -1;
+        if (lfs_file_write(&lfs, &file, data, FILE_SIZE) != FILE_SIZE) return -1;
+        if (lfs_file_close(&lfs, &file) != 0) return -1;
+    }
+    w25q64jv_bd_get_stats(&bd, &stats, 0);
+    report("create 32 x 8KB files", &span, FILES * FILE_SIZE, stats.reads + stats.pages + stats.erases);
+
+    w25q64jv_bd_get_stats(&bd, &stats, 1);
+    begin(&span);
+    if (lfs_file_open(&lfs, &file, "log", LFS_O_WRONLY | LFS_O_CREAT | LFS_O_APPEND) != 0) return -1;
+    for (int i = 0; i < APPENDS; i++) {
+        if (lfs_file_write(&lfs, &file, &data[(i * APPEND_SIZE) % FILE_SIZE], APPEND_SIZE) != APPEND_SIZE) return -1;
+        if (((i + 1) % APPEND_SYNC) == 0 && (lfs_file_sync(&lfs, &file) != 0)) return -1;
+    }
+    if (lfs_file_close(&lfs, &file) != 0) return -1;
+    w25q64jv_bd_get_stats(&bd, &stats, 0);
+    report("append 1024 x 64B, sync every 16", &span, APPENDS * APPEND_SIZE, stats.reads + stats.pages + stats.erases);
+
+    w25q64jv_bd_get_stats(&bd, &stats, 1);
+    begin(&span);
+    for (int i = 0; i < FILES; i++) {
+        snprintf(path, sizeof(path), "f%02d", i);
+        if (lfs_file_open(&lfs, &file, path, LFS_O_RDONLY) != 0) return -1;
+        if (lfs_file_read(&lfs, &file, readback, FILE_SIZE) != FILE_SIZE) return -1;
+        if (lfs_file_close(&lfs, &file) != 0) return -1;
+        if (memcmp(readback, data, FILE_SIZE) != 0) return -1;
+    }
+    w25q64jv_bd_get_stats(&bd, &stats, 0);
+    report("read 32 x 8KB files", &span, FILES * FILE_SIZE, stats.reads);
+    if (lfs_unmount(&lfs) != 0) return -1;
+    return 0;
+}
+#endif
+
+int main(void) {
+    host_reset();
+    host_set_spi_clock(21000000);
+    if (sim_w25q64jv_init(&sim, GPIOA, GPIO_PIN_4) != 0) return 1;
+    if (w25q64jv_config(&flash, &hspi1, GPIOA, GPIO_PIN_4, W25Q64JV_INTERFACE_SPI) != 0) return 1;
+    if (w25q64jv_configure_device(&flash) != 0) return 1;
+    if (w25q64jv_bd_init(&bd, &flash, REGION_BASE, REGION_SIZE, 1) != 0) return 1;
+
+    printf("%-34s %12s %14s %13s %13s %12s\n", "workload", "time", "throughput", "commands", "chip erases", "bus");
+    if (sector_tests() != 0) {
+        printf("sector tests failed\n");
+        return 1;
+    }
+    int access = lfs_access_check();
+    printf("\nlittlefs style block device calls: %s\n", (access == 0) ? "ok" : "FAILED");
+    if (access != 0) return 1;
+#ifdef W25Q64JV_BD_LITTLEFS
+    if (lfs_tests() != 0) {
+        printf("littlefs tests failed\n");
+        return 1;
+    }
+#else
+    printf("littlefs workloads not built, configure with -DDRIVERS_LITTLEFS_DIR=<littlefs checkout>\n");
+#endif
+    return 0;
+}
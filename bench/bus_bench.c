@@ -0,0 +1,246 @@
+/*
+ * Host benchmark for the shared SPI bus arbiter. The ICM-42688-P, the W25Q64JV and a 74HC595 chain share SPI1.
+ * The IMU runs at 8kHz into its FIFO with a 2ms watermark on INT1 while the application streams 64KB reads
+ * from the flash and updates the chain every 10ms. Compares:
+ *  - direct: the drivers call the HAL, INT1 is polled between operations and everything runs at the IMU's
+ *    SPI clock (21MHz)
+ *  - bus: the drivers go through spi_bus, INT1 queues a high priority FIFO read that takes the bus at the next
+ *    256 byte chunk of a flash read, and each device gets its own SPI mode and clock (flash at 42MHz)
+ * Worst case latency is INT1 (the sample that crossed the watermark) to the FIFO data being in RAM.
+ *
+ * cc -O2 -DSPI_BUS_ENABLE -Ihost -ISPI-BUS -IICM-42688-P -ISN74HC595 -IW25Q64JV host/hal_host.c \
+ *    host/sim_icm42688.c host/sim_sn74hc595.c host/sim_w25q64jv.c SPI-BUS/spi_bus.c ICM-42688-P/icm_42688.c \
+ *    SN74HC595/SN74HC595.c W25Q64JV/W25Q64JV.c bench/bus_bench.c -o bus_bench
+ */
+#include <stdio.h>
+#include <string.h>
+#include "main.h"
+#include "spi_bus.h"
+#include "sim_icm42688.h"
+#include "sim_sn74hc595.h"
+#include "sim_w25q64jv.h"
+#include "icm_42688.h"
+#include "icm_42688_registers.h"
+#include "SN74HC595.h"
+#include "W25Q64JV.h"
+
+#ifndef SPI_BUS_ENABLE
+#error "Build with -DSPI_BUS_ENABLE"
+#endif
+
+#define RUN_NS 500000000ULL
+#define FRAME_PERIOD_NS 10000000ULL
+#define LOG_ADDRESS 0x100000
+#define READ_SIZE W25Q64JV_BLOCK_64KB_SIZE
+#define PACKET_SIZE 16
+#define WATERMARK (16 * PACKET_SIZE)        // 2ms at 8kHz
+#define FIFO_TIME_US 16000                  // 2KB FIFO at 8kHz
+
+static sim_icm42688_t imu_sim;
+static sim_sn74hc595_t leds_sim;
+static sim_w25q64jv_t flash_sim;
+static SPI_HandleTypeDef hspi1;
+static spi_bus_t bus;
+static spi_bus_device_t imu_device;
+static spi_bus_device_t flash_device;
+static spi_bus_device_t leds_device;
+static icm_42688_cfg_t imu;
+static sn74hc595_cfg_t leds;
+static w25q64jv_cfg_t flash;
+
+static uint8_t use_bus;
+static uint8_t pattern[READ_SIZE];
+static uint8_t data[READ_SIZE];
+
+typedef struct {
+    uint32_t drains;
+    uint32_t packets;
+    uint32_t reads;
+    uint32_t read_errors;
+    uint32_t frames;
+    uint64_t latency_max_ns;
+    uint64_t latency_total_ns;
+} result_t;
+
+static result_t result;
+static spi_bus_transaction_t drain;
+static uint8_t drain_data[3 + WATERMARK] __attribute__((aligned(32)));
+static volatile uint8_t drain_pending;
+static uint32_t setup_inits;
+static uint64_t asserted_ns;    // Taken when INT1 is seen, the FIFO read clears and re-raises FIFO_THS
+
+void HAL_SPI_TxCpltCallback(SPI_HandleTypeDef* hspi) {
+    if (use_bus && (hspi == &hspi1)) spi_bus_dma_complete(&bus);
+}
+
+void HAL_SPI_RxCpltCallback(SPI_HandleTypeDef* hspi) {
+    if (use_bus && (hspi == &hspi1)) spi_bus_dma_complete(&bus);
+}
+
+void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef* hspi) {
+    if (use_bus && (hspi == &hspi1)) spi_bus_dma_complete(&bus);
+}
+
+static void record_drain(uint32_t packets) {
+    uint64_t latency = host_time_ns() - asserted_ns;
+    result.drains++;
+    result.packets += packets;
+    result.latency_total_ns += latency;
+    if (latency > result.latency_max_ns) result.latency_max_ns = latency;
+}
+
+static void drain_complete(spi_bus_transaction_t* transaction, void* context) {
+    (void)context;
+    if (transaction->state == SPI_BUS_DONE) record_drain(WATERMARK / PACKET_SIZE);
+    drain_pending = 0;
+}
+
+// EXTI on INT1: queue the FIFO read, due before the FIFO would fill
+static void imu_interrupt(void* context) {
+    (void)context;
+    if (drain_pending) return;
+    if (!sim_icm42688_int1(&imu_sim)) return;
+    asserted_ns = imu_sim.fifo_ths_ns;
+    drain_pending = 1;
+    uint32_t deadline = spi_bus_now() + spi_bus_cycles(FIFO_TIME_US - 2000);
+    if (icm_42688_submit_fifo_read(&imu, &drain, drain_data, sizeof(drain_data), deadline, &drain_complete, NULL) != 0) {
+        drain_pending = 0;
+    }
+}
+
+// Without the arbiter INT1 can only be served between blocking calls
+static int poll_imu(void) {
+    if (!sim_icm42688_int1(&imu_sim)) return 0;
+    asserted_ns = imu_sim.fifo_ths_ns;
+    uint8_t count[2];
+    int8_t gyro_data[6], accel_data[6], temp_data[2], time_data[2];
+    uint8_t status;
+    if (icm_42688_read_reg(&imu, INT_STATUS, &status) != 0) return -1;
+    if (icm_42688_read_reg(&imu, FIFO_COUNTH, &count[0]) != 0) return -1;
+    if (icm_42688_read_reg(&imu, FIFO_COUNTL, &count[1]) != 0) return -1;
+    uint16_t packets = (uint16_t)((count[0] << 8) | count[1]) / PACKET_SIZE;
+    for (uint16_t i = 0; i < packets; i++) {
+        if (icm_42688_read_fifo(&imu, gyro_data, accel_data, temp_data, time_data, NULL) != 0) return -1;
+    }
+    record_drain(packets);
+    return 0;
+}
+
+static int setup(uint8_t bus_mode) {
+    host_reset();
+    memset(&result, 0, sizeof(result));
+    drain_pending = 0;
+    use_bus = bus_mode;
+    memset(&hspi1, 0, sizeof(hspi1));
+
+    if (sim_icm42688_init(&imu_sim, GPIOB, GPIO_PIN_0) != 0) return -1;
+    if (sim_w25q64jv_init(&flash_sim, GPIOA, GPIO_PIN_4) != 0) return -1;
+    if (sim_sn74hc595_init(&leds_sim, &hspi1, GPIOC, GPIO_PIN_1, 2) != 0) return -1;
+    imu_sim.device.hspi = &hspi1;
+    flash_sim.device.hspi = &hspi1;
+
+    if (icm_42688_config(&imu, &hspi1, GPIOB, GPIO_PIN_0) != 0) return -1;
+    if (w25q64jv_config(&flash, &hspi1, GPIOA, GPIO_PIN_4, W25Q64JV_INTERFACE_SPI) != 0) return -1;
+    if (sn74hc595_config(&leds, &hspi1, GPIOC, GPIO_PIN_1, SN74HC595_SPI_BLOCKING) != 0) return -1;
+
+    if (bus_mode) {
+        if (spi_bus_init(&bus, &hspi1) != 0) return -1;
+        spi_bus_device_config(&imu_device, GPIOB, GPIO_PIN_0, SPI_POLARITY_HIGH, SPI_PHASE_2EDGE, SPI_BAUDRATEPRESCALER_4);
+        spi_bus_device_config(&flash_device, GPIOA, GPIO_PIN_4, SPI_POLARITY_LOW, SPI_PHASE_1EDGE, SPI_BAUDRATEPRESCALER_2);
+        spi_bus_device_config(&leds_device, NULL, 0, SPI_POLARITY_LOW, SPI_PHASE_1EDGE, SPI_BAUDRATEPRESCALER_8);
+        if (icm_42688_set_bus(&imu, &bus, &imu_device, SPI_BUS_PRIORITY_HIGH) != 0) return -1;
+        if (w25q64jv_set_bus(&flash, &bus, &flash_device, SPI_BUS_PRIORITY_LOW) != 0) return -1;
+        if (sn74hc595_set_bus(&leds, &bus, &leds_device, SPI_BUS_PRIORITY_NORMAL) != 0) return -1;
+    } else {
+        // One clock for everything, the fastest the IMU allows
+        hspi1.Init.BaudRatePrescaler = SPI_BAUDRATEPRESCALER_4;
+        if (HAL_SPI_Init(&hspi1) != HAL_OK) return -1;
+    }
+
+    if (w25q64jv_configure_device(&flash) != 0) return -1;
+    for (uint32_t i = 0; i < READ_SIZE; i++) pattern[i] = (uint8_t)((i * 7) ^ (i >> 8));
+    if (w25q64jv_erase_start(&flash, LOG_ADDRESS, READ_SIZE) != 0) return -1;
+    if (w25q64jv_wait_busy(&flash, 1000) != 0) return -1;
+    for (uint32_t offset = 0; offset < READ_SIZE; offset += W25Q64JV_PAGE_SIZE) {
+        if (w25q64jv_page_program(&flash, LOG_ADDRESS + offset, &pattern[offset], W25Q64JV_PAGE_SIZE) != 0) return -1;
+    }
+
+    // 8kHz accel + gyro, packet 3 into the FIFO, watermark interrupt on INT1
+    if (icm_42688_configure_device(&imu) != 0) return -1;
+    if (icm_42688_set_accel_odr(&imu, 0x03) != 0) return -1;
+    if (icm_42688_set_gyro_odr(&imu, 0x03) != 0) return -1;
+    if (icm_42688_config_fifo_register(&imu, 3) != 0) return -1;
+    if (icm_42688_set_bank(&imu, 0) != 0) return -1;
+    if (icm_42688_write_reg(&imu, FIFO_CONFIG2, (uint8_t)WATERMARK) != 0) return -1;
+    if (icm_42688_write_reg(&imu, FIFO_CONFIG3, (uint8_t)(WATERMARK >> 8)) != 0) return -1;
+    if (icm_42688_write_reg(&imu, INT_SOURCE0, 0x04) != 0) return -1;
+    if (icm_42688_write_reg(&imu, SIGNAL_PATH_RESET, 0x02) != 0) return -1;    // FIFO flush
+    memset(&imu_sim.stats, 0, sizeof(imu_sim.stats));
+    if (bus_mode) {
+        spi_bus_stats_t stats;
+        spi_bus_get_stats(&bus, &stats, 1);
+        setup_inits = host_spi_inits();
+        host_set_interrupt(&imu_interrupt, NULL);
+    }
+    return 0;
+}
+
+static int run(uint8_t bus_mode) {
+    if (setup(bus_mode) != 0) return -1;
+    uint64_t start = host_time_ns();
+    uint64_t next_frame = start;
+    while (host_time_ns() - start < RUN_NS) {
+        memset(data, 0, sizeof(data));
+        if (w25q64jv_fast_read(&flash, LOG_ADDRESS, data, READ_SIZE) != 0) return -1;
+        result.reads++;
+        if (memcmp(data, pattern, READ_SIZE) != 0) result.read_errors++;
+        if (!bus_mode && (poll_imu() != 0)) return -1;
+
+        if (host_time_ns() >= next_frame) {
+            if (sn74hc595_shift_byte(&leds, (uint8_t)result.frames) != 0) return -1;
+            if (!bus_mode && (poll_imu() != 0)) return -1;
+            result.frames++;
+            next_frame += FRAME_PERIOD_NS;
+        }
+    }
+    host_set_interrupt(NULL, NULL);
+    return 0;
+}
+
+static void report(const char* name, double seconds) {
+    double read_mb = (double)result.reads * READ_SIZE / (1024.0 * 1024.0);
+    printf("%-8s %8.1f us %8.1f us %6lu %8lu %7lu %9.2f MB/s %6lu\n", name, (double)result.latency_max_ns / 1000.0,
+           (double)result.latency_total_ns / 1000.0 / (result.drains ? result.drains : 1), (unsigned long)result.drains,
+           (unsigned long)result.packets, (unsigned long)imu_sim.stats.packets_lost, read_mb / seconds,
+           (unsigned long)result.read_errors);
+}
+
+int main(void) {
+    double seconds = (double)RUN_NS / 1e9;
+    printf("%-8s %11s %11s %6s %8s %7s %14s %6s\n", "mode", "worst", "mean", "drains", "packets", "lost", "flash read",
+           "errors");
+
+    if (run(0) != 0) {
+        printf("direct run failed\n");
+        return 1;
+    }
+    report("direct", seconds);
+
+    if (run(1) != 0) {
+        printf("bus run failed\n");
+        return 1;
+    }
+    report("bus", seconds);
+
+    spi_bus_stats_t stats;
+    spi_bus_get_stats(&bus, &stats, 0);
+    printf("\nbus: %lu transactions, %lu preemptions, %lu mode switches (%lu HAL_SPI_Init), %lu deadline misses\n",
+           (unsigned long)stats.transactions, (unsigned long)stats.preemptions, (unsigned long)stats.reconfigurations,
+           (unsigned long)(host_spi_inits() - setup_inits), (unsigned long)stats.deadline_misses);
+    printf("max wait: low %.1f us, normal %.1f us, high %.1f us, preempted read %.1f us\n",
+           (double)stats.max_wait_cycles[SPI_BUS_PRIORITY_LOW] / (SystemCoreClock / 1e6),
+           (double)stats.max_wait_cycles[SPI_BUS_PRIORITY_NORMAL] / (SystemCoreClock / 1e6),
+           (double)stats.max_wait_cycles[SPI_BUS_PRIORITY_HIGH] / (SystemCoreClock / 1e6),
+           (double)stats.max_preempt_cycles / (SystemCoreClock / 1e6));
+    return 0;
+}
@@ -0,0 +1,179 @@
+/*
+ * Host benchmark for the W25Q64JV read cache against the simulated chip. Compares 32 byte reads, sequential
+ * over 64KB and repeated over a 1KB table, with and without the cache and reports hits, misses, prefetches and
+ * SPI time. Then checks that programs and erases through the driver invalidate cached lines, and that a
+ * prefetch whose DMA completion is lost is aborted and leaves the flash usable.
+ * The host DMA completes at once, so prefetch time is charged to the reader; on the board it overlaps the copy.
+ *
+ * cc -O2 -Ihost -IW25Q64JV host/hal_host.c host/sim_w25q64jv.c W25Q64JV/W25Q64JV.c W25Q64JV/W25Q64JV_cache.c \
+ *    bench/cache_bench.c -o cache_bench
+ */
+#include <stdio.h>
+#include <string.h>
+#include "main.h"
+#include "sim_w25q64jv.h"
+#include "W25Q64JV.h"
+#include "W25Q64JV_cache.h"
+
+#define REGION 0x10000
+#define REGION_SIZE 65536
+#define TABLE_SIZE 1024
+#define TABLE_PASSES 64
+#define READ_SIZE 32
+#define CHECK_ADDRESS 0x40000
+
+static sim_w25q64jv_t sim;
+static SPI_HandleTypeDef hspi1;
+static w25q64jv_cfg_t flash;
+static w25q64jv_cache_t cache;
+static uint8_t page[W25Q64JV_PAGE_SIZE];
+static uint8_t drop_completion;
+static int failures;
+
+void HAL_SPI_RxCpltCallback(SPI_HandleTypeDef* hspi) {
+    // A dropped completion stands in for a DMA interrupt that never arrives
+    if ((hspi == &hspi1) && !drop_completion) w25q64jv_cache_dma_complete(&cache);
+}
+
+typedef struct {
+    uint64_t ns;
+    uint64_t bytes;
+    uint32_t reads;
+} cost_t;
+
+static uint8_t pattern(uint32_t address) {
+    return (uint8_t)((address * 13U) ^ (address >> 9));
+}
+
+static void check(const char* name, int passed) {
+    printf("%-44s %s\n", name, passed ? "ok" : "FAILED");
+    if (!passed) failures++;
+}
+
+static int setup(void) {
+    host_reset();
+    host_set_spi_clock(20000000);
+    drop_completion = 0;
+    if (sim_w25q64jv_init(&sim, GPIOA, GPIO_PIN_4) != 0) return -1;
+    if (w25q64jv_config(&flash, &hspi1, GPIOA, GPIO_PIN_4, W25Q64JV_INTERFACE_SPI) != 0) return -1;
+    for (uint32_t address = REGION; address < (REGION + REGION_SIZE); address += W25Q64JV_PAGE_SIZE) {
+        for (uint32_t i = 0; i < W25Q64JV_PAGE_SIZE; i++) page[i] = pattern(address + i);
+        if (w25q64jv_page_program(&flash, address, page, W25Q64JV_PAGE_SIZE) != 0) return -1;
+    }
+    return w25q64jv_cache_init(&cache, &flash);
+}
+
+static int read(uint8_t cached, uint32_t address, uint8_t* data, cost_t* cost) {
+    int result;
+    uint64_t start = host_time_ns();
+    uint64_t bytes = host_spi_bytes();
+    if (cached) {
+        result = w25q64jv_cache_read(&cache, address, data, READ_SIZE);
+    } else {
+        result = w25q64jv_fast_read(&flash, address, data, READ_SIZE);
+    }
+    cost->ns += host_time_ns() - start;
+    cost->bytes += host_spi_bytes() - bytes;
+    cost->reads++;
+    if (result != 0) return -1;
+    for (uint32_t i = 0; i < READ_SIZE; i++) {
+        if (data[i] != pattern(address + i)) return -1;
+    }
+    return 0;
+}
+
+static int workload(const char* name, uint8_t table) {
+    uint8_t data[READ_SIZE];
+    for (uint8_t cached = 0; cached < 2; cached++) {
+        cost_t cost = {0};
+        w25q64jv_cache_stats_t stats = {0};
+        if (setup() != 0) return -1;
+        if (table) {
+            for (uint32_t pass = 0; pass < TABLE_PASSES; pass++) {
+                // Entries in a scattered order, as a lookup table is used
+                for (uint32_t i = 0; i < (TABLE_SIZE / READ_SIZE); i++) {
+                    uint32_t entry = (i * 7U + pass) % (TABLE_SIZE / READ_SIZE);
+                    if (read(cached, REGION + (entry * READ_SIZE), data, &cost) != 0) return -1;
+                }
+            }
+        } else {
+            for (uint32_t offset = 0; offset < REGION_SIZE; offset += READ_SIZE) {
+                if (read(cached, REGION + offset, data, &cost) != 0) return -1;
+            }
+        }
+        w25q64jv_cache_get_stats(&cache, &stats, 0);
+        printf("%-12s %-6s %7lu %9.2f %8.1f %8lu %8lu %10lu %10lu\n", name, cached ? "cache" : "direct",
+               (unsigned long)cost.reads, (double)cost.ns / 1000000.0, (double)cost.bytes / 1024.0,
+               (unsigned long)stats.hits, (unsigned long)stats.misses, (unsigned long)stats.prefetches,
+               (unsigned long)stats.prefetch_hits);
+    }
+    return 0;
+}
+
+static int cached_equals(uint32_t address, uint8_t value) {
+    uint8_t data[READ_SIZE];
+    if (w25q64jv_cache_read(&cache, address, data, sizeof(data)) != 0) return 0;
+    for (uint32_t i = 0; i < sizeof(data); i++) {
+        if (data[i] != value) return 0;
+    }
+    return 1;
+}
+
+static void invalidation_checks(void) {
+    w25q64jv_cache_stats_t stats;
+    uint8_t data[READ_SIZE];
+    if (setup() != 0) {
+        check("setup", 0);
+        return;
+    }
+
+    check("blank line cached", cached_equals(CHECK_ADDRESS, 0xFF));
+    w25q64jv_cache_get_stats(&cache, &stats, 1);
+    check("second read is a hit", cached_equals(CHECK_ADDRESS, 0xFF) &&
+          (w25q64jv_cache_get_stats(&cache, &stats, 1) == 0) && (stats.hits == 1) && (stats.misses == 0));
+    memset(page, 0x3C, sizeof(page));
+    check("program through the driver", w25q64jv_page_program(&flash, CHECK_ADDRESS, page, sizeof(page)) == 0);
+    check("programmed line reads the new data", cached_equals(CHECK_ADDRESS, 0x3C) &&
+          (w25q64jv_cache_get_stats(&cache, &stats, 1) == 0) && (stats.misses == 1));
+    check("erase through the driver", w25q64jv_sector_erase_4KB(&flash, CHECK_ADDRESS) == 0);
+    check("erased line reads blank", cached_equals(CHECK_ADDRESS, 0xFF) &&
+          (w25q64jv_cache_get_stats(&cache, &stats, 1) == 0) && (stats.misses == 1));
+    check("invalidate outside the line keeps it", (w25q64jv_cache_invalidate(&cache, CHECK_ADDRESS + 4096, 16) == 0) &&
+          cached_equals(CHECK_ADDRESS, 0xFF) && (w25q64jv_cache_get_stats(&cache, &stats, 1) == 0) && (stats.hits == 1));
+
+    // Two consecutive lines start a prefetch of the third, whose completion is dropped
+    drop_completion = 1;
+    int reads = (w25q64jv_cache_read(&cache, REGION, data, sizeof(data)) == 0) &&
+                (w25q64jv_cache_read(&cache, REGION + W25Q64JV_CACHE_LINE_SIZE, data, sizeof(data)) == 0);
+    check("prefetch left in flight", reads && flash.dma_active);
+    drop_completion = 0;
+    int refill = (w25q64jv_cache_read(&cache, REGION + 2 * W25Q64JV_CACHE_LINE_SIZE, data, sizeof(data)) == 0) &&
+                 (data[0] == pattern(REGION + 2 * W25Q64JV_CACHE_LINE_SIZE));
+    w25q64jv_cache_get_stats(&cache, &stats, 1);
+    check("lost prefetch aborted and read refilled", refill && (stats.prefetch_aborts == 1) && !flash.dma_active);
+    check("flash takes commands after the abort", (w25q64jv_fast_read(&flash, REGION, data, sizeof(data)) == 0) &&
+          (data[0] == pattern(REGION)));
+    int lines_free = 1;
+    for (uint32_t i = 0; i < W25Q64JV_CACHE_LINES; i++) {
+        if (cache.filling[i]) lines_free = 0;
+    }
+    check("no line left filling", lines_free && (cache.fill_line == -1));
+}
+
+int main(void) {
+    printf("%d byte reads at %dMHz SPI\n\n", READ_SIZE, 20);
+    printf("%-12s %-6s %7s %9s %8s %8s %8s %10s %10s\n", "workload", "path", "reads", "ms", "SPI KB", "hits",
+           "misses", "prefetches", "pf hits");
+    if ((workload("sequential", 0) != 0) || (workload("table", 1) != 0)) {
+        printf("workload failed\n");
+        return 1;
+    }
+    printf("\n");
+    invalidation_checks();
+    if (failures) {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,165 @@
+/*
+ * Host benchmark for ICM-42688-P sample timing. The simulated sensor runs at 1kHz (packet 3) for 10s with its
+ * internal oscillator 300ppm fast and drifting up by 5ppm every second, the FIFO is drained every 10ms and each
+ * packet timestamp is converted to MCU cycles (DWT) by icm_42688_time. Runs: a single sync with the nominal
+ * tick (no correction), the running fit with a sync every 100ms, and the sensor on CLKIN in RTC mode from an
+ * MCU derived clock (0ppm) with the same syncs. Reports the error of the sample times against the times the
+ * model produced the samples, the drift estimate and the SPI bytes spent on syncs.
+ *
+ * cc -O2 -Ihost -IICM-42688-P host/hal_host.c host/sim_icm42688.c ICM-42688-P/icm_42688.c \
+ *    ICM-42688-P/icm_42688_time.c bench/clock_bench.c -o clock_bench
+ */
+#include <stdio.h>
+#include <string.h>
+#include "main.h"
+#include "sim_icm42688.h"
+#include "icm_42688.h"
+#include "icm_42688_time.h"
+#include "icm_42688_registers.h"
+
+#define RUN_NS 10000000000ULL
+#define POLL_NS 10000000ULL
+#define SYNC_NS 100000000ULL
+#define ODR 6                   // 1kHz
+#define PACKET_SIZE 16
+#define INTERNAL_PPM 300
+#define DRIFT_PPM_PER_S 5
+#define CLKDIV_VALUE 0x1F       // Reset value, set from the datasheet for the CLKIN frequency on the target
+#define TRUTH_SIZE 4096
+
+static sim_icm42688_t imu_sim;
+static SPI_HandleTypeDef hspi1;
+static icm_42688_cfg_t imu;
+static icm_42688_time_t clock;
+static uint8_t fifo[2048] __attribute__((aligned(32)));
+
+// Host time of every sample the model produced, matched to packets in FIFO order
+static uint64_t truth[TRUTH_SIZE];
+static uint32_t produced;
+static uint32_t consumed;
+
+typedef struct {
+    const char* name;
+    uint8_t sync;
+    uint8_t clkin;
+    uint64_t samples;
+    double error_total_us;
+    double error_max_us;
+    double error_last_us;       // Mean over the last second
+    uint64_t last_samples;
+    uint64_t sync_bytes;
+    icm_42688_time_stats_t stats;
+} result_t;
+
+static void source(void* context, uint64_t time_ns, int16_t* accel, int16_t* gyro) {
+    (void)context;
+    truth[produced++ % TRUTH_SIZE] = time_ns;
+    memset(accel, 0, 3 * sizeof(int16_t));
+    memset(gyro, 0, 3 * sizeof(int16_t));
+    accel[2] = 2048;
+}
+
+static int setup(const result_t* result) {
+    host_reset();
+    host_set_spi_clock(21000000);
+    produced = 0;
+    consumed = 0;
+    if (sim_icm42688_init(&imu_sim, GPIOB, GPIO_PIN_0) != 0) return -1;
+    imu_sim.device.hspi = &hspi1;
+    sim_icm42688_set_source(&imu_sim, &source, NULL);
+    if (sim_icm42688_set_clock_ppm(&imu_sim, INTERNAL_PPM, 0) != 0) return -1;
+    if (icm_42688_config(&imu, &hspi1, GPIOB, GPIO_PIN_0) != 0) return -1;
+    if (icm_42688_configure_device(&imu) != 0) return -1;
+    if (result->clkin) {
+        if (icm_42688_set_clkin(&imu, 1) != 0) return -1;
+        if (icm_42688_set_rtc_mode(&imu, 1, CLKDIV_VALUE) != 0) return -1;
+    }
+    if (icm_42688_set_accel_odr(&imu, ODR) != 0) return -1;
+    if (icm_42688_set_gyro_odr(&imu, ODR) != 0) return -1;
+    if (icm_42688_config_fifo_register(&imu, 3) != 0) return -1;
+    if (icm_42688_time_init(&clock, &imu) != 0) return -1;
+    if (icm_42688_write_reg(&imu, SIGNAL_PATH_RESET, 0x02) != 0) return -1;
+    consumed = produced;
+    return 0;
+}
+
+// DWT cycles of a host time on the converter's timeline, which starts at its init
+static double expected_cycles(uint64_t time_ns, double offset) {
+    return ((double)time_ns * (SystemCoreClock / 1000000U) / 1000.0) + offset;
+}
+
+static int drain(result_t* result, double offset, uint64_t end) {
+    uint16_t size;
+    if (icm_42688_read_fifo_batch(&imu, fifo, sizeof(fifo), &size) != 0) return -1;
+    for (uint16_t i = 0; i < size; i += PACKET_SIZE) {
+        uint64_t mcu_time;
+        uint16_t timestamp = (uint16_t)((fifo[i + 14] << 8) | fifo[i + 15]);
+        if (icm_42688_time_convert(&clock, timestamp, &mcu_time) != 0) return -1;
+        if (consumed == produced) return -1;
+        uint64_t time_ns = truth[consumed++ % TRUTH_SIZE];
+        double error = ((double)mcu_time - expected_cycles(time_ns, offset)) * 1e6 / SystemCoreClock;
+        if (error < 0.0) error = -error;
+        result->samples++;
+        result->error_total_us += error;
+        if (error > result->error_max_us) result->error_max_us = error;
+        if ((end - time_ns) <= 1000000000ULL) {
+            result->error_last_us += error;
+            result->last_samples++;
+        }
+    }
+    return 0;
+}
+
+static int run(result_t* result) {
+    if (setup(result) != 0) return -1;
+    uint64_t start = host_time_ns();
+    double offset = (double)icm_42688_time_mcu_now(&clock) - expected_cycles(start, 0.0);
+    uint64_t end = start + RUN_NS;
+    uint64_t next = start;
+    uint64_t next_sync = start + SYNC_NS;
+    int32_t ppm = INTERNAL_PPM;
+    while (host_time_ns() < end) {
+        next += POLL_NS;
+        if (drain(result, offset, end) != 0) return -1;
+        if (result->sync && (host_time_ns() >= next_sync)) {
+            next_sync += SYNC_NS;
+            uint64_t bytes = host_spi_bytes();
+            if (icm_42688_time_sync(&clock) != 0) return -1;
+            result->sync_bytes += host_spi_bytes() - bytes;
+        }
+        int32_t drift = INTERNAL_PPM + (int32_t)((host_time_ns() - start) / 1000000000ULL) * DRIFT_PPM_PER_S;
+        if (drift != ppm) {
+            ppm = drift;
+            if (sim_icm42688_set_clock_ppm(&imu_sim, ppm, 0) != 0) return -1;
+        }
+        if (host_time_ns() < next) host_advance_ns(next - host_time_ns());
+    }
+    icm_42688_time_get_stats(&clock, &result->stats, 0);
+    return 0;
+}
+
+int main(void) {
+    result_t results[] = {
+        {.name = "nominal", .sync = 0, .clkin = 0},
+        {.name = "fitted", .sync = 1, .clkin = 0},
+        {.name = "clkin rtc", .sync = 1, .clkin = 1},
+    };
+
+    printf("internal oscillator %+dppm rising %dppm/s, %.0fs at 1kHz, syncs every %llums\n", INTERNAL_PPM,
+           DRIFT_PPM_PER_S, RUN_NS / 1e9, (unsigned long long)(SYNC_NS / 1000000ULL));
+    printf("%-10s %8s %12s %12s %14s %10s %7s %12s %10s\n", "timing", "samples", "mean err", "max err",
+           "last 1s err", "drift est", "syncs", "residual", "sync SPI");
+    for (size_t i = 0; i < sizeof(results) / sizeof(results[0]); i++) {
+        result_t* result = &results[i];
+        if (run(result) != 0) {
+            printf("%s run failed\n", result->name);
+            return 1;
+        }
+        printf("%-10s %8lu %9.2f us %9.2f us %11.2f us %6.1f ppm %7lu %9.2f us %6.1f B/s\n", result->name,
+               (unsigned long)result->samples, result->error_total_us / result->samples, result->error_max_us,
+               result->last_samples ? (result->error_last_us / result->last_samples) : 0.0,
+               result->stats.drift_ppb / 1000.0, (unsigned long)result->stats.syncs,
+               result->stats.residual_max * 1e6 / SystemCoreClock, result->sync_bytes / (RUN_NS / 1e9));
+    }
+    return 0;
+}
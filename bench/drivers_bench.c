@@ -0,0 +1,264 @@
+/*
+ * Driver benchmark: ICM-42688-P sample read and FIFO drain, SN74HC595 frame rate and W25Q64JV read, program and
+ * erase throughput, in CPU cycles and bytes clocked on the bus. Results are written as JSON.
+ *
+ * Host, against the simulated devices in host/ (or the drivers_bench target of the top level CMakeLists.txt):
+ *
+ * cc -O2 -Ihost -Ibench -IICM-42688-P -ISN74HC595 -IW25Q64JV host/hal_host.c host/sim_icm42688.c \
+ *    host/sim_sn74hc595.c host/sim_w25q64jv.c ICM-42688-P/icm_42688.c SN74HC595/SN74HC595.c W25Q64JV/W25Q64JV.c \
+ *    bench/drivers_bench.c -o drivers_bench
+ * ./drivers_bench [drivers_bench.json]
+ *
+ * Board: build this file with -DDRIVERS_BENCH_TARGET into the application and call drivers_bench_run with the
+ * board's SPI handles. The flash cases erase DRIVERS_BENCH_FLASH_ADDRESS to +64KB.
+ */
+#include "drivers_bench.h"
+#include "icm_42688.h"
+#include "icm_42688_registers.h"
+#include "SN74HC595.h"
+#include "W25Q64JV.h"
+#ifndef DRIVERS_BENCH_TARGET
+#include "sim_icm42688.h"
+#include "sim_sn74hc595.h"
+#include "sim_w25q64jv.h"
+#endif
+
+#define IMU_READS 1000
+#define IMU_FIFO_FILL_MS 100        // ~100 packets at the reset ODR of 1kHz
+#define IMU_PACKET_SIZE 16
+#define IMU_SAMPLE_SIZE 6
+#define LED_FRAMES 1000
+#define FLASH_SIZE W25Q64JV_BLOCK_64KB_SIZE
+#define FLASH_READ_PASSES 4
+
+static icm_42688_cfg_t imu;
+static sn74hc595_cfg_t leds;
+static w25q64jv_cfg_t flash;
+static uint8_t buffer[FLASH_SIZE] __attribute__((aligned(32)));
+
+static drivers_bench_result_t results[DRIVERS_BENCH_MAX_RESULTS];
+static uint32_t result_count;
+
+// Open case, the counters at its start
+typedef struct {
+    uint32_t cycles;
+    uint64_t bus_bytes;
+} sample_t;
+
+static uint64_t bus_bytes(void) {
+#ifndef DRIVERS_BENCH_TARGET
+    return host_spi_bytes();
+#else
+    return 0;
+#endif
+}
+
+static void begin(sample_t* sample) {
+    sample->bus_bytes = bus_bytes();
+    sample->cycles = DWT->CYCCNT;
+}
+
+static int end(const sample_t* sample, const char* name, uint32_t operations, uint32_t payload_bytes) {
+    uint32_t cycles = DWT->CYCCNT - sample->cycles;
+    if (result_count >= DRIVERS_BENCH_MAX_RESULTS) return -1;
+    drivers_bench_result_t* result = &results[result_count++];
+    result->name = name;
+    result->operations = operations;
+    result->payload_bytes = payload_bytes;
+#ifndef DRIVERS_BENCH_TARGET
+    result->bus_bytes = (int64_t)(bus_bytes() - sample->bus_bytes);
+#else
+    result->bus_bytes = -1;
+#endif
+    result->cycles = cycles;
+    return 0;
+}
+
+static int bench_imu(const drivers_bench_board_t* board) {
+    sample_t sample;
+    int16_t xyz[3];
+    if (icm_42688_config(&imu, board->imu_spi, board->imu_cs_port, board->imu_cs_pin) != 0) return -1;
+    if (icm_42688_configure_device(&imu) != 0) return -1;
+    if (icm_42688_set_bank(&imu, 0) != 0) return -1;
+
+    begin(&sample);
+    for (uint32_t i = 0; i < IMU_READS; i++) {
+        if (icm_42688_read_accel_xyz(&imu, xyz) != 0) return -1;
+    }
+    if (end(&sample, "icm42688_read_accel_xyz", IMU_READS, IMU_READS * IMU_SAMPLE_SIZE) != 0) return -1;
+
+    // Packet 3 (accel, gyro, temperature and timestamp), let the FIFO fill and then drain what it holds
+    int8_t accel_data[6], gyro_data[6], temp_data[2], time_data[2];
+    uint8_t count[2];
+    if (icm_42688_config_fifo_register(&imu, 3) != 0) return -1;
+    if (icm_42688_write_reg(&imu, SIGNAL_PATH_RESET, 0x02) != 0) return -1;    // FIFO flush
+    HAL_Delay(IMU_FIFO_FILL_MS);
+
+    begin(&sample);
+    if (icm_42688_read_reg(&imu, FIFO_COUNTH, &count[0]) != 0) return -1;
+    if (icm_42688_read_reg(&imu, FIFO_COUNTL, &count[1]) != 0) return -1;
+    uint32_t packets = (uint32_t)((count[0] << 8) | count[1]) / IMU_PACKET_SIZE;
+    for (uint32_t i = 0; i < packets; i++) {
+        if (icm_42688_read_fifo(&imu, gyro_data, accel_data, temp_data, time_data, NULL) != 0) return -1;
+    }
+    return end(&sample, "icm42688_fifo_drain", packets, packets * IMU_PACKET_SIZE);
+}
+
+// Blocking mode latches after every byte, a frame is one byte per register in the chain
+static int bench_leds(const drivers_bench_board_t* board) {
+    sample_t sample;
+    if (board->leds_chain_length == 0) return -1;
+    if (sn74hc595_config(&leds, board->leds_spi, board->leds_rclk_port, board->leds_rclk_pin, SN74HC595_SPI_BLOCKING) != 0) {
+        return -1;
+    }
+
+    begin(&sample);
+    for (uint32_t frame = 0; frame < LED_FRAMES; frame++) {
+        for (uint8_t i = 0; i < board->leds_chain_length; i++) {
+            if (sn74hc595_shift_byte(&leds, (uint8_t)(frame + i)) != 0) return -1;
+        }
+    }
+    return end(&sample, "sn74hc595_frame", LED_FRAMES, LED_FRAMES * board->leds_chain_length);
+}
+
+static int bench_flash(const drivers_bench_board_t* board) {
+    sample_t sample;
+    uint32_t address = DRIVERS_BENCH_FLASH_ADDRESS;
+    if (w25q64jv_config(&flash, board->flash_spi, board->flash_cs_port, board->flash_cs_pin, W25Q64JV_INTERFACE_SPI) != 0) {
+        return -1;
+    }
+    if (w25q64jv_configure_device(&flash) != 0) return -1;
+
+    begin(&sample);
+    for (uint32_t offset = 0; offset < FLASH_SIZE; offset += W25Q64JV_SECTOR_SIZE) {
+        if (w25q64jv_sector_erase_4KB(&flash, address + offset) != 0) return -1;
+    }
+    if (end(&sample, "w25q64jv_sector_erase_4KB", FLASH_SIZE / W25Q64JV_SECTOR_SIZE, FLASH_SIZE) != 0) return -1;
+
+    begin(&sample);
+    if (w25q64jv_block_erase_64KB(&flash, address) != 0) return -1;
+    if (end(&sample, "w25q64jv_block_erase_64KB", 1, FLASH_SIZE) != 0) return -1;
+
+    for (uint32_t i = 0; i < FLASH_SIZE; i++) buffer[i] = (uint8_t)(i * 7);
+    begin(&sample);
+    for (uint32_t offset = 0; offset < FLASH_SIZE; offset += W25Q64JV_PAGE_SIZE) {
+        if (w25q64jv_page_program(&flash, address + offset, &buffer[offset], W25Q64JV_PAGE_SIZE) != 0) return -1;
+    }
+    if (end(&sample, "w25q64jv_page_program", FLASH_SIZE / W25Q64JV_PAGE_SIZE, FLASH_SIZE) != 0) return -1;
+
+    begin(&sample);
+    for (uint32_t pass = 0; pass < FLASH_READ_PASSES; pass++) {
+        if (w25q64jv_read_data(&flash, address, buffer, FLASH_SIZE) != 0) return -1;
+    }
+    if (end(&sample, "w25q64jv_read_data", FLASH_READ_PASSES, FLASH_READ_PASSES * FLASH_SIZE) != 0) return -1;
+
+    begin(&sample);
+    for (uint32_t pass = 0; pass < FLASH_READ_PASSES; pass++) {
+        if (w25q64jv_fast_read(&flash, address, buffer, FLASH_SIZE) != 0) return -1;
+    }
+    if (end(&sample, "w25q64jv_fast_read", FLASH_READ_PASSES, FLASH_READ_PASSES * FLASH_SIZE) != 0) return -1;
+
+    // Read back what was programmed
+    for (uint32_t i = 0; i < FLASH_SIZE; i++) {
+        if (buffer[i] != (uint8_t)(i * 7)) return -1;
+    }
+    return 0;
+}
+
+static void write_json(FILE* out) {
+    fprintf(out, "{\n  \"platform\": \"%s\",\n  \"core_clock_hz\": %lu,\n  \"results\": [",
+#ifndef DRIVERS_BENCH_TARGET
+            "host",
+#else
+            "target",
+#endif
+            (unsigned long)SystemCoreClock);
+    for (uint32_t i = 0; i < result_count; i++) {
+        const drivers_bench_result_t* result = &results[i];
+        double seconds = (double)result->cycles / (double)SystemCoreClock;
+        fprintf(out, "%s\n    {\"name\": \"%s\", \"operations\": %lu, \"payload_bytes\": %lu, ", (i == 0) ? "" : ",",
+                result->name, (unsigned long)result->operations, (unsigned long)result->payload_bytes);
+        if (result->bus_bytes < 0) {
+            fprintf(out, "\"bus_bytes\": null, ");
+        } else {
+            fprintf(out, "\"bus_bytes\": %llu, ", (unsigned long long)result->bus_bytes);
+        }
+        fprintf(out, "\"cycles\": %llu, \"cycles_per_operation\": %.1f, \"operations_per_second\": %.1f, "
+                "\"payload_bytes_per_second\": %.1f}",
+                (unsigned long long)result->cycles,
+                (result->operations != 0) ? (double)result->cycles / (double)result->operations : 0.0,
+                (seconds > 0.0) ? (double)result->operations / seconds : 0.0,
+                (seconds > 0.0) ? (double)result->payload_bytes / seconds : 0.0);
+    }
+    fprintf(out, "\n  ]\n}\n");
+}
+
+int drivers_bench_run(const drivers_bench_board_t* board, FILE* out) {
+    if (!board) return -1;
+    if (!out) return -1;
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    result_count = 0;
+
+    if ((board->imu_spi != NULL) && (bench_imu(board) != 0)) return -1;
+    if ((board->leds_spi != NULL) && (bench_leds(board) != 0)) return -1;
+    if ((board->flash_spi != NULL) && (bench_flash(board) != 0)) return -1;
+    write_json(out);
+    return 0;
+}
+
+const drivers_bench_result_t* drivers_bench_results(uint32_t* count) {
+    if (count != NULL) *count = result_count;
+    return results;
+}
+
+#ifndef DRIVERS_BENCH_TARGET
+static sim_icm42688_t imu_sim;
+static sim_sn74hc595_t leds_sim;
+static sim_w25q64jv_t flash_sim;
+static SPI_HandleTypeDef hspi1;
+static SPI_HandleTypeDef hspi2;
+
+int main(int argc, char** argv) {
+    const char* path = (argc > 1) ? argv[1] : "drivers_bench.json";
+    drivers_bench_board_t board = {
+        .imu_spi = &hspi1, .imu_cs_port = GPIOB, .imu_cs_pin = GPIO_PIN_0,
+        .leds_spi = &hspi2, .leds_rclk_port = GPIOC, .leds_rclk_pin = GPIO_PIN_1, .leds_chain_length = 2,
+        .flash_spi = &hspi1, .flash_cs_port = GPIOA, .flash_cs_pin = GPIO_PIN_4,
+    };
+
+    host_reset();
+    host_set_spi_clock(21000000);
+    if (sim_icm42688_init(&imu_sim, board.imu_cs_port, board.imu_cs_pin) != 0) return 1;
+    if (sim_sn74hc595_init(&leds_sim, board.leds_spi, board.leds_rclk_port, board.leds_rclk_pin, board.leds_chain_length) != 0) {
+        return 1;
+    }
+    if (sim_w25q64jv_init(&flash_sim, board.flash_cs_port, board.flash_cs_pin) != 0) return 1;
+    imu_sim.device.hspi = &hspi1;
+    flash_sim.device.hspi = &hspi1;
+
+    FILE* out = fopen(path, "w");
+    if (out == NULL) {
+        printf("cannot open %s\n", path);
+        return 1;
+    }
+    int status = drivers_bench_run(&board, out);
+    fclose(out);
+    if (status != 0) {
+        printf("benchmark failed\n");
+        return 1;
+    }
+
+    uint32_t count;
+    const drivers_bench_result_t* result = drivers_bench_results(&count);
+    printf("%-26s %8s %12s %12s %14s %12s\n", "case", "ops", "bus bytes", "cycles/op", "ops/s", "payload KB/s");
+    for (uint32_t i = 0; i < count; i++) {
+        double seconds = (double)result[i].cycles / (double)SystemCoreClock;
+        printf("%-26s %8lu %12lld %12.1f %14.1f %12.1f\n", result[i].name, (unsigned long)result[i].operations,
+               (long long)result[i].bus_bytes, (double)result[i].cycles / (double)result[i].operations,
+               (double)result[i].operations / seconds, (double)result[i].payload_bytes / seconds / 1024.0);
+    }
+    printf("\n%lu partial latches on the chain, results written to %s\n", (unsigned long)leds_sim.stats.partial_latches, path);
+    return 0;
+}
+#endif
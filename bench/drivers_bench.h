@@ -0,0 +1,61 @@
+#ifndef DRIVERS_BENCH_H_
+#define DRIVERS_BENCH_H_
+
+#include "main.h"
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Driver micro benchmarks, timed with DWT->CYCCNT. On the host (host/) the cycle counter follows the virtual
+ * clock and bus bytes come from the simulated SPI bus. Built with DRIVERS_BENCH_TARGET the same cases run on the
+ * board from drivers_bench_run and bus bytes are reported as null.
+ */
+
+// Flash area the program and erase cases destroy, 64KB aligned
+#ifndef DRIVERS_BENCH_FLASH_ADDRESS
+#define DRIVERS_BENCH_FLASH_ADDRESS 0x400000
+#endif
+
+#define DRIVERS_BENCH_MAX_RESULTS 16
+
+typedef struct {
+    SPI_HandleTypeDef* imu_spi;         // NULL to skip the ICM-42688-P cases
+    GPIO_TypeDef* imu_cs_port;
+    uint16_t imu_cs_pin;
+    SPI_HandleTypeDef* leds_spi;        // NULL to skip the SN74HC595 case
+    GPIO_TypeDef* leds_rclk_port;
+    uint16_t leds_rclk_pin;
+    uint8_t leds_chain_length;
+    SPI_HandleTypeDef* flash_spi;       // NULL to skip the W25Q64JV cases
+    GPIO_TypeDef* flash_cs_port;
+    uint16_t flash_cs_pin;
+} drivers_bench_board_t;
+
+typedef struct {
+    const char* name;
+    uint32_t operations;
+    uint32_t payload_bytes;     // Data moved by the driver calls, sensor samples or flash contents
+    int64_t bus_bytes;          // Bytes clocked on SPI, -1 when not measured
+    uint64_t cycles;
+} drivers_bench_result_t;
+
+/**
+ * @brief Run every case the board has devices for and write the results as JSON
+ *
+ * @param board         SPI handles and pins
+ * @param out           JSON output, e.g. a file on the host or stdout retargeted to a UART / SWO on the board
+ *
+ * @return 0 or -1
+ */
+int drivers_bench_run(const drivers_bench_board_t* board, FILE* out);
+
+/**
+ * @brief Results of the last drivers_bench_run
+ *
+ * @param count         Return data, number of results
+ *
+ * @return Result array
+ */
+const drivers_bench_result_t* drivers_bench_results(uint32_t* count);
+
+#endif /* DRIVERS_BENCH_H_ */
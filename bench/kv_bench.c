@@ -0,0 +1,262 @@
+/*
+ * Host benchmark for the W25Q64JV key/value store against the simulated chip.
+ * Reports mount time and write amplification, and compares updates with rewriting a whole sector per change.
+ * A second workload keeps static keys next to a few hot ones so collection has to copy live records, remounts
+ * regularly, half of the time with a collection left part way, checks every key after each remount and reports
+ * write amplification and the per-sector erase counts. Last, an append torn with its value partly programmed
+ * and its header still erased must leave the sector closed and the key's value intact across remounts.
+ *
+ * cc -O2 -Ihost -IW25Q64JV host/hal_host.c host/sim_w25q64jv.c W25Q64JV/W25Q64JV.c \
+ *    W25Q64JV/W25Q64JV_crc.c W25Q64JV/W25Q64JV_kv.c bench/kv_bench.c -o kv_bench
+ */
+#include <stdio.h>
+#include <string.h>
+#include "main.h"
+#include "sim_w25q64jv.h"
+#include "W25Q64JV.h"
+#include "W25Q64JV_kv.h"
+
+#define STORE_BASE 0x10000
+#define STORE_SECTORS 16
+#define KEYS 16
+#define UPDATES 20000
+#define NAIVE_BASE 0x100000
+#define NAIVE_UPDATES 200
+#define STATIC_KEYS 20
+#define HOT_KEYS 4
+#define HOT_UPDATES 5000
+#define REMOUNT_EVERY 250
+#define MAX_KEYS (STATIC_KEYS + HOT_KEYS)
+
+static sim_w25q64jv_t sim;
+static SPI_HandleTypeDef hspi1;
+static w25q64jv_cfg_t flash;
+static w25q64jv_kv_t kv;
+
+static uint8_t shadow[MAX_KEYS][64];
+static uint16_t shadow_size[MAX_KEYS];
+static uint32_t seed = 12345;
+
+static uint32_t next_random(void) {
+    seed = (seed * 1103515245) + 12345;
+    return (seed >> 16) & 0x7FFF;
+}
+
+static uint16_t value_size(uint16_t key) {
+    // Calibration triples, config blocks and counters
+    static const uint16_t sizes[4] = {12, 32, 4, 48};
+    return sizes[key % 4];
+}
+
+static int verify(void) {
+    uint8_t value[64];
+    uint16_t size = 0;
+    for (uint16_t key = 0; key < MAX_KEYS; key++) {
+        if (shadow_size[key] == 0) continue;
+        if (w25q64jv_kv_get(&kv, key, value, sizeof(value), &size) != 0) return -1;
+        if ((size != shadow_size[key]) || (memcmp(value, shadow[key], size) != 0)) return -1;
+    }
+    return 0;
+}
+
+static double ms(uint64_t ns) {
+    return (double)ns / 1000000.0;
+}
+
+static int set_key(uint16_t key, uint32_t* user_bytes) {
+    uint16_t size = value_size(key);
+    for (uint16_t j = 0; j < size; j++) shadow[key][j] = (uint8_t)next_random();
+    shadow_size[key] = size;
+    *user_bytes += size;
+    return w25q64jv_kv_set(&kv, key, shadow[key], size);
+}
+
+// Static keys written once, hot keys updated; every REMOUNT_EVERY updates the store is remounted, on odd rounds
+// right after a collection step that left a sector part way copied
+static int static_hot(void) {
+    memset(shadow_size, 0, sizeof(shadow_size));
+    if (w25q64jv_kv_format(&kv, &flash, STORE_BASE, STORE_SECTORS) != 0) return -1;
+    uint64_t programmed_start = sim.stats.bytes_programmed;
+    uint32_t erases_start[STORE_SECTORS];
+    for (uint16_t s = 0; s < STORE_SECTORS; s++) erases_start[s] = sim.sector_erases[(STORE_BASE / 4096) + s];
+
+    uint32_t user_bytes = 0;
+    uint32_t gc_copies = 0;
+    uint32_t remounts = 0;
+    uint32_t mid_gc = 0;
+    w25q64jv_kv_stats_t stats;
+    for (uint16_t key = 0; key < STATIC_KEYS; key++) {
+        if (set_key(key, &user_bytes) != 0) return -1;
+    }
+    for (uint32_t i = 0; i < HOT_UPDATES; i++) {
+        if (set_key((uint16_t)(STATIC_KEYS + (next_random() % HOT_KEYS)), &user_bytes) != 0) {
+            printf("set failed at update %u\n", (unsigned)i);
+            return -1;
+        }
+        if ((i % REMOUNT_EVERY) != (REMOUNT_EVERY - 1)) continue;
+
+        if ((remounts % 2) == 1) {
+            // Collect until a step stops part way through a sector
+            for (uint16_t step = 0; step < 64; step++) {
+                int result = w25q64jv_kv_gc_step(&kv);
+                if (result < 0) return -1;
+                if (result == 1) {
+                    mid_gc++;
+                    break;
+                }
+            }
+        }
+        w25q64jv_kv_get_stats(&kv, &stats, 0);
+        gc_copies += stats.gc_copies;
+        if (w25q64jv_kv_mount(&kv, &flash, STORE_BASE, STORE_SECTORS) != 0) {
+            printf("remount %u failed\n", (unsigned)remounts);
+            return -1;
+        }
+        remounts++;
+        if (verify() != 0) {
+            printf("verify failed after remount %u\n", (unsigned)remounts);
+            return -1;
+        }
+    }
+    w25q64jv_kv_get_stats(&kv, &stats, 0);
+    gc_copies += stats.gc_copies;
+
+    uint64_t flash_bytes = sim.stats.bytes_programmed - programmed_start;
+    printf("static + hot:          %u static keys, %u hot keys, %u updates, %u sectors\n", STATIC_KEYS, HOT_KEYS,
+           HOT_UPDATES, STORE_SECTORS);
+    printf("  remounts:            %u (%u during a collection), all keys verified\n", (unsigned)remounts, (unsigned)mid_gc);
+    printf("  user bytes:          %u\n", (unsigned)user_bytes);
+    printf("  flash bytes:         %llu\n", (unsigned long long)flash_bytes);
+    printf("  write amplification: %.2f\n", (double)flash_bytes / user_bytes);
+    printf("  gc copies:           %u\n", (unsigned)gc_copies);
+    printf("  sector erases:      ");
+    for (uint16_t s = 0; s < STORE_SECTORS; s++) {
+        printf(" %u", (unsigned)(sim.sector_erases[(STORE_BASE / 4096) + s] - erases_start[s]));
+    }
+    printf("\n");
+    return 0;
+}
+
+// Power lost during an append after some value bytes were programmed but with the header still erased. The
+// store has to keep the key's previous value and not append over the partial bytes
+static int torn_append(void) {
+    static const uint8_t first[16] = "calibration v1";
+    static const uint8_t second[16] = "calibration v2";
+    static const uint8_t other[4] = {1, 2, 3, 4};
+    static const uint8_t partial[8] = {0x12, 0x00, 0x34, 0x00, 0x56, 0x00, 0x78, 0x00};
+    uint8_t value[16];
+    uint16_t size = 0;
+
+    if (w25q64jv_kv_format(&kv, &flash, STORE_BASE, STORE_SECTORS) != 0) return -1;
+    if (w25q64jv_kv_set(&kv, 1, first, sizeof(first)) != 0) return -1;
+    uint16_t sector = (uint16_t)kv.active;
+    uint32_t torn = STORE_BASE + ((uint32_t)sector * W25Q64JV_SECTOR_SIZE) + kv.used[sector];
+    if (w25q64jv_page_program(&flash, torn + 8, partial, sizeof(partial)) != 0) return -1;
+
+    int result = 0;
+    if (w25q64jv_kv_mount(&kv, &flash, STORE_BASE, STORE_SECTORS) != 0) return -1;
+    if ((w25q64jv_kv_get(&kv, 1, value, sizeof(value), &size) != 0) || (memcmp(value, first, sizeof(first)) != 0)) {
+        result = -1;
+    }
+    if ((kv.active == (int16_t)sector) && (kv.used[sector] < W25Q64JV_SECTOR_SIZE)) result = -1;
+
+    // A new value and a newer record after it, then a remount that indexes both
+    if ((w25q64jv_kv_set(&kv, 1, second, sizeof(second)) != 0) || (w25q64jv_kv_set(&kv, 2, other, sizeof(other)) != 0) ||
+        (w25q64jv_kv_mount(&kv, &flash, STORE_BASE, STORE_SECTORS) != 0)) {
+        return -1;
+    }
+    if ((w25q64jv_kv_get(&kv, 1, value, sizeof(value), &size) != 0) || (memcmp(value, second, sizeof(second)) != 0)) {
+        result = -1;
+    }
+    printf("torn append:           value bytes behind an erased header, sector closed and key kept: %s\n",
+           (result == 0) ? "ok" : "FAILED");
+    return result;
+}
+
+int main(void) {
+    host_reset();
+    host_set_spi_clock(20000000);
+    if (sim_w25q64jv_init(&sim, GPIOA, GPIO_PIN_4) != 0) return 1;
+    if (w25q64jv_config(&flash, &hspi1, GPIOA, GPIO_PIN_4, W25Q64JV_INTERFACE_SPI) != 0) return 1;
+    if (w25q64jv_test_comms(&flash) != 0) return 1;
+
+    if (w25q64jv_kv_format(&kv, &flash, STORE_BASE, STORE_SECTORS) != 0) return 1;
+    w25q64jv_kv_get_stats(&kv, NULL, 1);
+    uint64_t programmed_start = sim.stats.bytes_programmed;
+    uint32_t erases_start = sim.stats.erases;
+
+    // Random updates
+    uint64_t start = host_time_ns();
+    for (uint32_t i = 0; i < UPDATES; i++) {
+        uint16_t key = (uint16_t)(next_random() % KEYS);
+        uint16_t size = value_size(key);
+        for (uint16_t j = 0; j < size; j++) shadow[key][j] = (uint8_t)next_random();
+        shadow_size[key] = size;
+        if (w25q64jv_kv_set(&kv, key, shadow[key], size) != 0) {
+            printf("set failed at update %u\n", (unsigned)i);
+            return 1;
+        }
+    }
+    uint64_t update_time = host_time_ns() - start;
+    if (verify() != 0) {
+        printf("verify failed after updates\n");
+        return 1;
+    }
+
+    w25q64jv_kv_stats_t stats;
+    w25q64jv_kv_get_stats(&kv, &stats, 0);
+    uint32_t min_erase = 0xFFFFFFFF;
+    uint32_t max_erase = 0;
+    for (uint32_t s = STORE_BASE / 4096; s < (STORE_BASE / 4096) + STORE_SECTORS; s++) {
+        if (sim.sector_erases[s] < min_erase) min_erase = sim.sector_erases[s];
+        if (sim.sector_erases[s] > max_erase) max_erase = sim.sector_erases[s];
+    }
+
+    printf("kv updates:            %u over %u keys, %u sectors\n", UPDATES, KEYS, STORE_SECTORS);
+    printf("  time per update:     %.3f ms\n", ms(update_time) / UPDATES);
+    printf("  user bytes:          %u\n", (unsigned)stats.user_bytes);
+    printf("  flash bytes:         %llu\n", (unsigned long long)(sim.stats.bytes_programmed - programmed_start));
+    printf("  write amplification: %.2f\n", (double)(sim.stats.bytes_programmed - programmed_start) / stats.user_bytes);
+    printf("  erases:              %u (gc copies %u)\n", (unsigned)(sim.stats.erases - erases_start), (unsigned)stats.gc_copies);
+    printf("  sector erase spread: %u to %u\n", (unsigned)min_erase, (unsigned)max_erase);
+
+    // Mount scan
+    uint64_t spi_start = host_spi_bytes();
+    start = host_time_ns();
+    if (w25q64jv_kv_mount(&kv, &flash, STORE_BASE, STORE_SECTORS) != 0) {
+        printf("mount failed\n");
+        return 1;
+    }
+    uint64_t mount_time = host_time_ns() - start;
+    if (verify() != 0) {
+        printf("verify failed after mount\n");
+        return 1;
+    }
+    printf("kv mount:              %.3f ms, %llu bus bytes\n", ms(mount_time), (unsigned long long)(host_spi_bytes() - spi_start));
+
+    // Baseline: read, erase and rewrite the whole sector for every change
+    static uint8_t sector[W25Q64JV_SECTOR_SIZE];
+    programmed_start = sim.stats.bytes_programmed;
+    uint32_t naive_user = 0;
+    start = host_time_ns();
+    for (uint32_t i = 0; i < NAIVE_UPDATES; i++) {
+        uint16_t key = (uint16_t)(next_random() % KEYS);
+        uint16_t size = value_size(key);
+        if (w25q64jv_fast_read(&flash, NAIVE_BASE, sector, sizeof(sector)) != 0) return 1;
+        for (uint16_t j = 0; j < size; j++) sector[(key * 64) + j] = (uint8_t)next_random();
+        if (w25q64jv_sector_erase_4KB(&flash, NAIVE_BASE) != 0) return 1;
+        for (uint32_t page = 0; page < W25Q64JV_SECTOR_SIZE; page += W25Q64JV_PAGE_SIZE) {
+            if (w25q64jv_page_program(&flash, NAIVE_BASE + page, &sector[page], W25Q64JV_PAGE_SIZE) != 0) return 1;
+        }
+        naive_user += size;
+    }
+    uint64_t naive_time = host_time_ns() - start;
+    printf("sector rewrite:        %u updates\n", NAIVE_UPDATES);
+    printf("  time per update:     %.3f ms\n", ms(naive_time) / NAIVE_UPDATES);
+    printf("  write amplification: %.2f\n", (double)(sim.stats.bytes_programmed - programmed_start) / naive_user);
+    printf("  erases per update:   1.00\n");
+
+    if (static_hot() != 0) return 1;
+    if (torn_append() != 0) return 1;
+    return 0;
+}
@@ -0,0 +1,261 @@
+/*
+ * Host benchmark for the IMU-LOGGER pipeline against logging one FIFO packet per flash program, both polling
+ * every 5ms with the ICM-42688-P on SPI1 and the W25Q64JV on SPI2. The sensor sees a moving signal (slow
+ * triangle waves plus noise of a few LSB, as the real part shows at rest) at 4kHz and 8kHz. Reports samples lost
+ * (FIFO overflow plus logger drops), bytes of flash per sample, how long the 8MB part lasts, the share of time
+ * spent in the poll and the longest poll. Everything logged is read back and compared with what the sensor made.
+ * The logger's flash area is written to argv[1] when given, for host/imu_log_dump.
+ *
+ * cc -O2 -Ihost -IICM-42688-P -IW25Q64JV -IIMU-LOGGER host/hal_host.c host/sim_icm42688.c host/sim_w25q64jv.c \
+ *    ICM-42688-P/icm_42688.c W25Q64JV/W25Q64JV.c W25Q64JV/W25Q64JV_crc.c IMU-LOGGER/imu_log_block.c \
+ *    IMU-LOGGER/imu_logger.c bench/logger_bench.c -o logger_bench
+ */
+#include <stdio.h>
+#include <string.h>
+#include "main.h"
+#include "sim_icm42688.h"
+#include "sim_w25q64jv.h"
+#include "icm_42688.h"
+#include "icm_42688_registers.h"
+#include "W25Q64JV.h"
+#include "imu_logger.h"
+
+#define RUN_NS 10000000000ULL
+#define POLL_NS 5000000ULL
+#define LOG_ADDRESS 0x100000
+#define LOG_SIZE (2 * 1024 * 1024)
+#define MAX_SAMPLES 90000
+#define RECORD_SIZE IMU_LOG_PACKET_SIZE
+
+static sim_icm42688_t imu_sim;
+static sim_w25q64jv_t flash_sim;
+static SPI_HandleTypeDef hspi1;
+static SPI_HandleTypeDef hspi2;
+static icm_42688_cfg_t imu;
+static w25q64jv_cfg_t flash;
+static imu_logger_t logger;
+
+// Everything the sensor produced, in order
+static imu_log_sample_t reference[MAX_SAMPLES];
+static uint32_t reference_count;
+static uint32_t noise;
+
+static uint8_t readback[LOG_SIZE];
+static imu_log_sample_t decoded[IMU_LOG_BLOCK_MAX_SAMPLES];
+
+typedef struct {
+    const char* name;
+    uint32_t logged;
+    uint32_t lost;
+    uint32_t bytes;
+    uint64_t busy_ns;
+    uint64_t max_poll_ns;
+    int verified;
+} result_t;
+
+void HAL_SPI_TxCpltCallback(SPI_HandleTypeDef* hspi) {
+    if (hspi == &hspi2) w25q64jv_dma_complete(&flash);
+}
+
+static int16_t triangle(uint64_t time_ns, uint64_t period_ns, int16_t amplitude) {
+    int64_t phase = (int64_t)(time_ns % period_ns) * 4 * amplitude / (int64_t)period_ns;
+    if (phase > (2 * amplitude)) phase = (4 * amplitude) - phase;
+    return (int16_t)(phase - amplitude);
+}
+
+static int16_t random_noise(int16_t range) {
+    noise = (noise * 1103515245U) + 12345U;
+    return (int16_t)((int32_t)((noise >> 16) % (uint32_t)(2 * range + 1)) - range);
+}
+
+static void source(void* context, uint64_t time_ns, int16_t* accel, int16_t* gyro) {
+    (void)context;
+    accel[0] = triangle(time_ns, 500000000ULL, 400) + random_noise(6);
+    accel[1] = triangle(time_ns + 100000000ULL, 700000000ULL, 250) + random_noise(6);
+    accel[2] = 2048 + triangle(time_ns, 300000000ULL, 150) + random_noise(8);
+    gyro[0] = triangle(time_ns, 800000000ULL, 600) + random_noise(2);
+    gyro[1] = triangle(time_ns + 200000000ULL, 650000000ULL, 300) + random_noise(2);
+    gyro[2] = triangle(time_ns, 1100000000ULL, 150) + random_noise(2);
+
+    if (reference_count < MAX_SAMPLES) {
+        imu_log_sample_t* sample = &reference[reference_count++];
+        memcpy(sample->accel, accel, sizeof(sample->accel));
+        memcpy(sample->gyro, gyro, sizeof(sample->gyro));
+    }
+}
+
+static int setup(uint8_t odr) {
+    host_reset();
+    host_set_spi_clock(21000000);
+    if (sim_icm42688_init(&imu_sim, GPIOB, GPIO_PIN_0) != 0) return -1;
+    if (sim_w25q64jv_init(&flash_sim, GPIOA, GPIO_PIN_4) != 0) return -1;
+    imu_sim.device.hspi = &hspi1;
+    flash_sim.device.hspi = &hspi2;
+    sim_icm42688_set_source(&imu_sim, &source, NULL);
+    reference_count = 0;
+    noise = 1;
+
+    if (icm_42688_config(&imu, &hspi1, GPIOB, GPIO_PIN_0) != 0) return -1;
+    if (icm_42688_configure_device(&imu) != 0) return -1;
+    if (icm_42688_set_accel_odr(&imu, odr) != 0) return -1;
+    if (icm_42688_set_gyro_odr(&imu, odr) != 0) return -1;
+    if (w25q64jv_config(&flash, &hspi2, GPIOA, GPIO_PIN_4, W25Q64JV_INTERFACE_SPI) != 0) return -1;
+    if (w25q64jv_configure_device(&flash) != 0) return -1;
+    if (imu_logger_erase(&flash, LOG_ADDRESS, LOG_SIZE) != 0) return -1;
+
+    // Start from an empty FIFO and a fresh sample count once everything is set up
+    if (icm_42688_config_fifo_register(&imu, 3) != 0) return -1;
+    if (icm_42688_write_reg(&imu, SIGNAL_PATH_RESET, 0x02) != 0) return -1;
+    sim_icm42688_update(&imu_sim);
+    reference_count = 0;
+    memset(&imu_sim.stats, 0, sizeof(imu_sim.stats));
+    return 0;
+}
+
+static int same_sample(const imu_log_sample_t* a, const imu_log_sample_t* b) {
+    return (memcmp(a->accel, b->accel, sizeof(a->accel)) == 0) && (memcmp(a->gyro, b->gyro, sizeof(a->gyro)) == 0);
+}
+
+// Poll every POLL_NS for RUN_NS, timing each poll
+static int run(result_t* result, int (*poll)(void)) {
+    uint64_t start = host_time_ns();
+    uint64_t next = start;
+    while ((host_time_ns() - start) < RUN_NS) {
+        next += POLL_NS;
+        uint64_t begin = host_time_ns();
+        if (poll() != 0) return -1;
+        uint64_t took = host_time_ns() - begin;
+        result->busy_ns += took;
+        if (took > result->max_poll_ns) result->max_poll_ns = took;
+        if (host_time_ns() < next) host_advance_ns(next - host_time_ns());
+    }
+    return 0;
+}
+
+// Today's pipeline: a transfer per packet and a 16 byte page program per record
+static uint32_t record_address;
+static uint32_t records;
+
+static int poll_records(void) {
+    uint8_t count[2];
+    if (icm_42688_read_reg(&imu, FIFO_COUNTH, &count[0]) != 0) return -1;
+    if (icm_42688_read_reg(&imu, FIFO_COUNTL, &count[1]) != 0) return -1;
+    uint16_t packets = (uint16_t)(((count[0] << 8) | count[1]) / RECORD_SIZE);
+
+    uint8_t record[RECORD_SIZE];
+    for (uint16_t i = 0; i < packets; i++) {
+        int8_t accel[6], gyro[6], temp[1], time[2];
+        if (icm_42688_read_fifo(&imu, gyro, accel, temp, time, NULL) != 0) return -1;
+        record[0] = 0x68;
+        memcpy(&record[1], accel, 6);
+        memcpy(&record[7], gyro, 6);
+        record[13] = (uint8_t)temp[0];
+        memcpy(&record[14], time, 2);
+        if ((record_address + RECORD_SIZE) > (LOG_ADDRESS + LOG_SIZE)) continue;
+        if (w25q64jv_page_program(&flash, record_address, record, RECORD_SIZE) != 0) return -1;
+        record_address += RECORD_SIZE;
+        records++;
+    }
+    return 0;
+}
+
+static int bench_records(result_t* result) {
+    record_address = LOG_ADDRESS;
+    records = 0;
+    if (run(result, &poll_records) != 0) return -1;
+    result->logged = records;
+    result->lost = imu_sim.stats.packets_lost;
+    result->bytes = records * RECORD_SIZE;
+
+    if (w25q64jv_fast_read(&flash, LOG_ADDRESS, readback, result->bytes) != 0) return -1;
+    result->verified = (result->lost == 0);
+    for (uint32_t i = 0; (i < records) && result->verified; i++) {
+        imu_log_sample_t sample;
+        if (imu_log_parse_packet(&readback[i * RECORD_SIZE], &sample) != 0) result->verified = 0;
+        if (!same_sample(&sample, &reference[i])) result->verified = 0;
+    }
+    return 0;
+}
+
+static int poll_logger(void) {
+    return imu_logger_poll(&logger);
+}
+
+static int bench_logger(result_t* result) {
+    if (imu_logger_start(&logger, &imu, &flash, LOG_ADDRESS, LOG_SIZE) != 0) return -1;
+    if (run(result, &poll_logger) != 0) return -1;
+    uint64_t begin = host_time_ns();
+    if (imu_logger_stop(&logger) != 0) return -1;
+    result->busy_ns += host_time_ns() - begin;
+
+    imu_logger_stats_t stats;
+    imu_logger_get_stats(&logger, &stats, 0);
+    result->logged = stats.samples;
+    result->lost = imu_sim.stats.packets_lost + stats.dropped;
+    result->bytes = imu_logger_used(&logger);
+
+    // Decode block by block, the sequence numbers and samples must follow on
+    if (w25q64jv_fast_read(&flash, LOG_ADDRESS, readback, result->bytes) != 0) return -1;
+    uint32_t index = 0;
+    result->verified = 1;
+    for (uint32_t offset = 0; offset < result->bytes; offset += IMU_LOG_BLOCK_SIZE) {
+        imu_log_block_info_t info;
+        int count = imu_log_block_decode(&readback[offset], &info, decoded, IMU_LOG_BLOCK_MAX_SAMPLES);
+        if ((count < 0) || (info.sequence != (offset / IMU_LOG_BLOCK_SIZE))) {
+            result->verified = 0;
+            break;
+        }
+        for (int i = 0; i < count; i++) {
+            if ((index >= reference_count) || !same_sample(&decoded[i], &reference[index])) result->verified = 0;
+            index++;
+        }
+    }
+    if ((index != stats.samples) || (result->lost != 0)) result->verified = 0;
+    return 0;
+}
+
+static void report(const result_t* result, uint32_t rate) {
+    double bytes_per_sample = result->logged ? ((double)result->bytes / result->logged) : 0.0;
+    double minutes = bytes_per_sample ? (W25Q64JV_CAPACITY / bytes_per_sample / rate / 60.0) : 0.0;
+    printf("%-12s %6lu Hz %8lu %6lu %7.2f B %6.1f min %6.1f%% %7.2f ms %9s\n", result->name, (unsigned long)rate,
+           (unsigned long)result->logged, (unsigned long)result->lost, bytes_per_sample, minutes,
+           100.0 * (double)result->busy_ns / RUN_NS, result->max_poll_ns / 1000000.0, result->verified ? "yes" : "no");
+}
+
+static int dump(const char* path) {
+    if (w25q64jv_fast_read(&flash, LOG_ADDRESS, readback, LOG_SIZE) != 0) return -1;
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) return -1;
+    int status = (fwrite(readback, 1, LOG_SIZE, file) == LOG_SIZE) ? 0 : -1;
+    fclose(file);
+    return status;
+}
+
+int main(int argc, char** argv) {
+    static const struct {
+        uint8_t odr;
+        uint32_t rate;
+    } rates[] = {{4, 4000}, {3, 8000}};
+
+    printf("%-12s %9s %8s %6s %9s %10s %7s %10s %9s\n", "pipeline", "ODR", "samples", "lost", "per smpl", "8MB lasts",
+           "polling", "max poll", "verified");
+    for (uint32_t i = 0; i < (sizeof(rates) / sizeof(rates[0])); i++) {
+        result_t records_result = {"per record", 0, 0, 0, 0, 0, 0};
+        result_t logger_result = {"imu_logger", 0, 0, 0, 0, 0, 0};
+        if ((setup(rates[i].odr) != 0) || (bench_records(&records_result) != 0)) {
+            printf("per record failed\n");
+            return 1;
+        }
+        report(&records_result, rates[i].rate);
+        if ((setup(rates[i].odr) != 0) || (bench_logger(&logger_result) != 0)) {
+            printf("imu_logger failed\n");
+            return 1;
+        }
+        report(&logger_result, rates[i].rate);
+        if ((rates[i].rate == 4000) && (argc > 1) && (dump(argv[1]) != 0)) {
+            printf("could not write %s\n", argv[1]);
+            return 1;
+        }
+    }
+    return 0;
+}
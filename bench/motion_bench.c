@@ -0,0 +1,217 @@
+/*
+ * Host benchmark for the ICM-42688-P motion-adaptive power controller. A 60s scenario alternates still stretches
+ * (1g on Z plus a few LSB of noise) with bursts of movement. The FIFO is drained every 10ms, once with both
+ * sensors fixed in low noise mode at 1kHz and once under icm_42688_motion (ACTIVE 1kHz low noise, IDLE accel
+ * low power at 50Hz with wake on motion). Reports time with the gyro and accel in each power mode (from the
+ * sensor model), packets drained and SPI bytes, the share of movement seen at the full rate, transitions, the
+ * register batch per transition and the latency from the start of a movement to ACTIVE.
+ *
+ * cc -O2 -Ihost -IICM-42688-P host/hal_host.c host/sim_icm42688.c ICM-42688-P/icm_42688.c \
+ *    ICM-42688-P/icm_42688_motion.c bench/motion_bench.c -o motion_bench
+ */
+#include <stdio.h>
+#include <string.h>
+#include "main.h"
+#include "sim_icm42688.h"
+#include "icm_42688.h"
+#include "icm_42688_motion.h"
+#include "icm_42688_registers.h"
+
+#define RUN_NS 60000000000ULL
+#define POLL_NS 10000000ULL
+#define ACTIVE_ODR 6        // 1kHz
+#define IDLE_ODR 9          // 50Hz
+#define PACKET_SIZE 16
+
+static sim_icm42688_t imu_sim;
+static SPI_HandleTypeDef hspi1;
+static icm_42688_cfg_t imu;
+static icm_42688_motion_t motion;
+static uint8_t fifo[2048] __attribute__((aligned(32)));
+static uint32_t noise;
+
+// Movement bursts, start and end in ms
+static const struct {
+    uint32_t start;
+    uint32_t end;
+} movements[] = {{5000, 7000}, {20000, 21000}, {21500, 24000}, {33000, 33400}, {40000, 45000}, {52000, 53500}};
+
+#define MOVEMENTS (sizeof(movements) / sizeof(movements[0]))
+
+typedef struct {
+    const char* name;
+    uint64_t packets;
+    uint64_t spi_bytes;
+    uint64_t moving_ns;
+    uint64_t moving_active_ns;
+    uint32_t wakes_seen;
+    uint64_t wake_latency_ns_total;
+    uint64_t wake_latency_ns_max;
+    uint64_t idle_bytes;        // Bus bytes of the transitions into each mode
+    uint64_t active_bytes;
+} result_t;
+
+static int moving(uint64_t time_ns, uint32_t* index) {
+    uint32_t ms = (uint32_t)(time_ns / 1000000ULL);
+    for (uint32_t i = 0; i < MOVEMENTS; i++) {
+        if ((ms >= movements[i].start) && (ms < movements[i].end)) {
+            if (index != NULL) *index = i;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int16_t triangle(uint64_t time_ns, uint64_t period_ns, int16_t amplitude) {
+    int64_t phase = (int64_t)(time_ns % period_ns) * 4 * amplitude / (int64_t)period_ns;
+    if (phase > (2 * amplitude)) phase = (4 * amplitude) - phase;
+    return (int16_t)(phase - amplitude);
+}
+
+static int16_t random_noise(int16_t range) {
+    noise = (noise * 1103515245U) + 12345U;
+    return (int16_t)((int32_t)((noise >> 16) % (uint32_t)(2 * range + 1)) - range);
+}
+
+static void source(void* context, uint64_t time_ns, int16_t* accel, int16_t* gyro) {
+    (void)context;
+    for (int i = 0; i < 3; i++) {
+        accel[i] = random_noise(4);
+        gyro[i] = random_noise(3);
+    }
+    accel[2] += 2048;
+    if (!moving(time_ns, NULL)) return;
+    accel[0] += triangle(time_ns, 300000000ULL, 1500);
+    accel[1] += triangle(time_ns + 70000000ULL, 410000000ULL, 900);
+    gyro[0] += triangle(time_ns, 500000000ULL, 2000);
+    gyro[2] += triangle(time_ns + 90000000ULL, 350000000ULL, 1200);
+}
+
+static int setup(void) {
+    host_reset();
+    host_set_spi_clock(21000000);
+    noise = 1;
+    if (sim_icm42688_init(&imu_sim, GPIOB, GPIO_PIN_0) != 0) return -1;
+    imu_sim.device.hspi = &hspi1;
+    sim_icm42688_set_source(&imu_sim, &source, NULL);
+    if (icm_42688_config(&imu, &hspi1, GPIOB, GPIO_PIN_0) != 0) return -1;
+    if (icm_42688_configure_device(&imu) != 0) return -1;
+    if (icm_42688_set_accel_odr(&imu, ACTIVE_ODR) != 0) return -1;
+    if (icm_42688_set_gyro_odr(&imu, ACTIVE_ODR) != 0) return -1;
+    if (icm_42688_config_fifo_register(&imu, 3) != 0) return -1;
+    if (icm_42688_write_reg(&imu, SIGNAL_PATH_RESET, 0x02) != 0) return -1;
+    sim_icm42688_update(&imu_sim);
+    memset(&imu_sim.stats, 0, sizeof(imu_sim.stats));
+    return 0;
+}
+
+static int drain(result_t* result, uint8_t adaptive) {
+    uint16_t size;
+    if (icm_42688_read_fifo_batch(&imu, fifo, sizeof(fifo), &size) != 0) return -1;
+    for (uint16_t offset = 0; offset < size; offset += PACKET_SIZE) {
+        result->packets++;
+        if (!adaptive) continue;
+        int16_t accel[3];
+        for (int i = 0; i < 3; i++) accel[i] = (int16_t)((fifo[offset + 1 + (2 * i)] << 8) | fifo[offset + 2 + (2 * i)]);
+        if (icm_42688_motion_add_sample(&motion, accel) != 0) return -1;
+    }
+    return 0;
+}
+
+static int run(result_t* result, uint8_t adaptive) {
+    if (setup() != 0) return -1;
+    if (adaptive) {
+        icm_42688_motion_config_t config = {
+            .active_odr = ACTIVE_ODR,
+            .idle_odr = IDLE_ODR,
+            .wom_threshold = 20,        // 78mg between samples
+            .wom_int1 = 1,
+            .still_variance = 200,      // LSB^2, the still noise is about 20
+            .still_ms = 1000,
+            .min_active_ms = 500,
+        };
+        if (icm_42688_motion_init(&motion, &imu, &config) != 0) return -1;
+    }
+
+    uint64_t spi_start = host_spi_bytes();
+    uint64_t start = host_time_ns();
+    uint64_t next = start;
+    uint8_t answered[MOVEMENTS] = {0};    // Movement met in ACTIVE, by a wake or because it was still active
+    while ((host_time_ns() - start) < RUN_NS) {
+        next += POLL_NS;
+        if (drain(result, adaptive) != 0) return -1;
+        if (adaptive) {
+            uint64_t bytes = host_spi_bytes();
+            int changed = icm_42688_motion_poll(&motion);
+            if (changed < 0) return -1;
+            uint8_t mode = icm_42688_motion_mode(&motion);
+            if (changed && (mode == ICM_42688_MOTION_IDLE)) result->idle_bytes += host_spi_bytes() - bytes;
+            if (changed && (mode == ICM_42688_MOTION_ACTIVE)) {
+                result->active_bytes += host_spi_bytes() - bytes;
+                uint32_t index;
+                if (moving(host_time_ns(), &index) && !answered[index]) {
+                    uint64_t latency = host_time_ns() - (uint64_t)movements[index].start * 1000000ULL;
+                    result->wakes_seen++;
+                    result->wake_latency_ns_total += latency;
+                    if (latency > result->wake_latency_ns_max) result->wake_latency_ns_max = latency;
+                }
+            }
+        }
+
+        // Movement time covered at the full rate, counted per poll interval
+        uint8_t active = !adaptive || (icm_42688_motion_mode(&motion) == ICM_42688_MOTION_ACTIVE);
+        uint32_t index;
+        if (moving(host_time_ns(), &index)) {
+            result->moving_ns += POLL_NS;
+            if (active) result->moving_active_ns += POLL_NS;
+            if (active) answered[index] = 1;
+        }
+        if (host_time_ns() < next) host_advance_ns(next - host_time_ns());
+    }
+    sim_icm42688_update(&imu_sim);
+    result->spi_bytes = host_spi_bytes() - spi_start;
+    return 0;
+}
+
+static void report(const result_t* result) {
+    const sim_icm42688_stats_t* stats = &imu_sim.stats;
+    printf("%-10s %7.1f%% %7.1f%% %7.1f%% %9lu %9.1f KB %8.1f%%\n", result->name, 100.0 * stats->gyro_ln_ns / RUN_NS,
+           100.0 * stats->accel_ln_ns / RUN_NS, 100.0 * stats->accel_lp_ns / RUN_NS, (unsigned long)result->packets,
+           result->spi_bytes / 1024.0, result->moving_ns ? (100.0 * result->moving_active_ns / result->moving_ns) : 0.0);
+}
+
+int main(void) {
+    result_t fixed = {.name = "fixed LN"};
+    result_t adaptive = {.name = "adaptive"};
+
+    printf("%-10s %8s %8s %8s %9s %12s %9s\n", "mode", "gyro LN", "accel LN", "accel LP", "packets", "SPI", "moving@LN");
+    if (run(&fixed, 0) != 0) {
+        printf("fixed run failed\n");
+        return 1;
+    }
+    report(&fixed);
+    if (run(&adaptive, 1) != 0) {
+        printf("adaptive run failed\n");
+        return 1;
+    }
+    report(&adaptive);
+
+    icm_42688_motion_stats_t stats;
+    icm_42688_motion_get_stats(&motion, &stats, 0);
+    printf("\ncontroller: %lu ms active, %lu ms idle, %lu variance windows\n",
+           (unsigned long)stats.time_ms[ICM_42688_MOTION_ACTIVE], (unsigned long)stats.time_ms[ICM_42688_MOTION_IDLE],
+           (unsigned long)stats.windows);
+    for (uint8_t mode = 0; mode < ICM_42688_MOTION_MODES; mode++) {
+        uint32_t count = stats.transitions[mode];
+        uint64_t bytes = (mode == ICM_42688_MOTION_IDLE) ? adaptive.idle_bytes : adaptive.active_bytes;
+        printf("to %-7s %3lu transitions, register batch %.1f us mean %lu us max, %.1f SPI bytes per poll\n",
+               (mode == ICM_42688_MOTION_IDLE) ? "idle:" : "active:", (unsigned long)count,
+               count ? ((double)stats.transition_us_total[mode] / count) : 0.0,
+               (unsigned long)stats.transition_us_max[mode], count ? ((double)bytes / count) : 0.0);
+    }
+    printf("movement start to active: %lu of %u movements woke the controller (the rest began in ACTIVE), "
+           "%.1f ms mean, %.1f ms max\n", (unsigned long)adaptive.wakes_seen, (unsigned)MOVEMENTS,
+           adaptive.wakes_seen ? (adaptive.wake_latency_ns_total / 1e6 / adaptive.wakes_seen) : 0.0,
+           adaptive.wake_latency_ns_max / 1e6);
+    return 0;
+}
@@ -0,0 +1,158 @@
+/*
+ * Host benchmark for the W25Q64JV streaming image writer against the simulated chip.
+ * Writes a 512KB image and compares the writer against erasing the whole region, programming and then reading
+ * it back, and against plain erase + program with no verify (the chip's program bandwidth). Also streams the
+ * image at a fixed link rate to show flash work overlapping the arrival of data.
+ *
+ * cc -O2 -Ihost -IW25Q64JV host/hal_host.c host/sim_w25q64jv.c W25Q64JV/W25Q64JV.c W25Q64JV/W25Q64JV_crc.c \
+ *    W25Q64JV/W25Q64JV_ota.c bench/ota_bench.c -o ota_bench
+ */
+#include <stdio.h>
+#include <string.h>
+#include "main.h"
+#include "sim_w25q64jv.h"
+#include "W25Q64JV.h"
+#include "W25Q64JV_crc.h"
+#include "W25Q64JV_ota.h"
+
+#define IMAGE_ADDRESS 0x100000
+#define IMAGE_SIZE (512 * 1024)
+#define VERIFY_SIZE W25Q64JV_SECTOR_SIZE
+#define LOOP_NS 20000ULL
+
+static sim_w25q64jv_t sim;
+static SPI_HandleTypeDef hspi1;
+static w25q64jv_cfg_t flash;
+static w25q64jv_ota_t ota;
+static uint8_t image[IMAGE_SIZE];
+static uint32_t image_crc;
+static double bound_ms;
+
+void HAL_SPI_RxCpltCallback(SPI_HandleTypeDef* hspi) {
+    (void)hspi;
+    w25q64jv_ota_dma_complete(&ota);
+}
+
+static double ms(uint64_t ns) {
+    return (double)ns / 1000000.0;
+}
+
+static int setup(void) {
+    host_reset();
+    host_set_spi_clock(20000000);
+    if (sim_w25q64jv_init(&sim, GPIOA, GPIO_PIN_4) != 0) return -1;
+    if (w25q64jv_config(&flash, &hspi1, GPIOA, GPIO_PIN_4, W25Q64JV_INTERFACE_SPI) != 0) return -1;
+    return w25q64jv_configure_device(&flash);
+}
+
+static int check_image(void) {
+    static uint8_t data[IMAGE_SIZE];
+    if (w25q64jv_fast_read(&flash, IMAGE_ADDRESS, data, sizeof(data)) != 0) return -1;
+    return (memcmp(data, image, sizeof(data)) == 0) ? 0 : -1;
+}
+
+static void report(const char* name, uint64_t total_ns, uint32_t ram, uint32_t stalls, int verified) {
+    double total = ms(total_ns);
+    printf("%-26s %9.1f ms %8.1f KB/s %6.1f%% %7lu B %7lu %9s\n", name, total, (IMAGE_SIZE / 1024.0) / (total / 1000.0),
+           100.0 * bound_ms / total, (unsigned long)ram, (unsigned long)stalls, verified ? "yes" : "no");
+}
+
+// Erase and program only, the chip's program bandwidth and the reference for the percentage column
+static int run_program_only(void) {
+    if (setup() != 0) return -1;
+    uint64_t start = host_time_ns();
+    for (uint32_t offset = 0; offset < IMAGE_SIZE; offset += W25Q64JV_BLOCK_64KB_SIZE) {
+        if (w25q64jv_block_erase_64KB(&flash, IMAGE_ADDRESS + offset) != 0) return -1;
+    }
+    for (uint32_t offset = 0; offset < IMAGE_SIZE; offset += W25Q64JV_PAGE_SIZE) {
+        if (w25q64jv_page_program(&flash, IMAGE_ADDRESS + offset, &image[offset], W25Q64JV_PAGE_SIZE) != 0) return -1;
+    }
+    uint64_t total = host_time_ns() - start;
+    bound_ms = ms(total);
+    report("erase + program, no verify", total, W25Q64JV_PAGE_SIZE, 0, 0);
+    return check_image();
+}
+
+// Erase the region, program it, then read everything back through a sector buffer
+static int run_erase_program_verify(void) {
+    static uint8_t data[VERIFY_SIZE];
+    if (setup() != 0) return -1;
+    uint64_t start = host_time_ns();
+    for (uint32_t offset = 0; offset < IMAGE_SIZE; offset += W25Q64JV_BLOCK_64KB_SIZE) {
+        if (w25q64jv_block_erase_64KB(&flash, IMAGE_ADDRESS + offset) != 0) return -1;
+    }
+    for (uint32_t offset = 0; offset < IMAGE_SIZE; offset += W25Q64JV_PAGE_SIZE) {
+        if (w25q64jv_page_program(&flash, IMAGE_ADDRESS + offset, &image[offset], W25Q64JV_PAGE_SIZE) != 0) return -1;
+    }
+    uint32_t crc = 0;
+    for (uint32_t offset = 0; offset < IMAGE_SIZE; offset += VERIFY_SIZE) {
+        if (w25q64jv_fast_read(&flash, IMAGE_ADDRESS + offset, data, VERIFY_SIZE) != 0) return -1;
+        if (memcmp(data, &image[offset], VERIFY_SIZE) != 0) return -1;
+        crc = w25q64jv_crc32(crc, data, VERIFY_SIZE);
+    }
+    report("erase, program, read back", host_time_ns() - start, W25Q64JV_PAGE_SIZE + VERIFY_SIZE, 0, crc == image_crc);
+    return 0;
+}
+
+// Chunks of chunk_size arrive every period_ns (0 = as fast as the writer accepts them)
+static int run_ota(uint32_t chunk_size, uint64_t period_ns) {
+    if (setup() != 0) return -1;
+    uint64_t start = host_time_ns();
+    uint64_t next_chunk = start;
+    if (w25q64jv_ota_open(&ota, &flash, IMAGE_ADDRESS, IMAGE_SIZE) != 0) return -1;
+    for (uint32_t offset = 0; offset < IMAGE_SIZE; offset += chunk_size) {
+        while (host_time_ns() < next_chunk) {
+            if (w25q64jv_ota_poll(&ota) != 0) return -1;
+            host_advance_ns(LOOP_NS);
+        }
+        if (w25q64jv_ota_write(&ota, &image[offset], chunk_size) != 0) return -1;
+        next_chunk += period_ns;
+    }
+    uint32_t crc = 0;
+    if (w25q64jv_ota_finalize(&ota, &crc) != 0) return -1;
+    uint64_t total = host_time_ns() - start;
+
+    w25q64jv_ota_stats_t stats;
+    w25q64jv_ota_get_stats(&ota, &stats, 0);
+    char name[32];
+    if (period_ns == 0) {
+        snprintf(name, sizeof(name), "writer, %lu B chunks", (unsigned long)chunk_size);
+    } else {
+        snprintf(name, sizeof(name), "writer, %.0f KB/s link", (chunk_size / 1024.0) / ((double)period_ns / 1e9));
+    }
+    uint32_t ram = sizeof(ota.verify) + sizeof(ota.data);
+    report(name, total, ram, stats.stalls, (crc == image_crc) && (stats.pages == IMAGE_SIZE / W25Q64JV_PAGE_SIZE));
+    return check_image();
+}
+
+int main(void) {
+    for (uint32_t i = 0; i < IMAGE_SIZE; i++) image[i] = (uint8_t)((i >> 9) ^ (i * 151) ^ (i >> 3));
+    image_crc = w25q64jv_crc32(0, image, IMAGE_SIZE);
+
+    printf("%dKB image, SPI at 20MHz\n\n", IMAGE_SIZE / 1024);
+    printf("%-26s %12s %13s %7s %9s %7s %9s\n", "", "total", "rate", "of max", "RAM", "stalls", "verified");
+    if (run_program_only() != 0) {
+        printf("program only run failed\n");
+        return 1;
+    }
+    if (run_erase_program_verify() != 0) {
+        printf("erase / program / verify run failed\n");
+        return 1;
+    }
+    static const uint32_t chunks[] = {64, 1024, 4096};
+    for (uint32_t i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++) {
+        if (run_ota(chunks[i], 0) != 0) {
+            printf("writer run failed\n");
+            return 1;
+        }
+    }
+    static const uint64_t periods[] = {8000000ULL, 4000000ULL, 2500000ULL};
+    for (uint32_t i = 0; i < sizeof(periods) / sizeof(periods[0]); i++) {
+        if (run_ota(1024, periods[i]) != 0) {
+            printf("writer link run failed\n");
+            return 1;
+        }
+    }
+    printf("(of max = erase + program time without verify / total, RAM = page and verify buffers)\n");
+    return 0;
+}
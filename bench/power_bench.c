@@ -0,0 +1,106 @@
+/*
+ * Host benchmark for W25Q64JV deep power-down management against the simulated chip.
+ * A logger reads a 64 byte table and appends a 32 byte record every 100ms for 60s. Reports the time
+ * spent in deep power-down, the wake latency paid and the resulting average idle current for several
+ * idle timeouts.
+ *
+ * cc -O2 -Ihost -IW25Q64JV host/hal_host.c host/sim_w25q64jv.c W25Q64JV/W25Q64JV.c bench/power_bench.c -o power_bench
+ */
+#include <stdio.h>
+#include <string.h>
+#include "main.h"
+#include "sim_w25q64jv.h"
+#include "W25Q64JV.h"
+
+#define RUN_MS 60000
+#define PERIOD_MS 100
+#define LOG_ADDRESS 0x100000
+#define RECORD_SIZE 32
+
+// Datasheet typical currents in uA
+#define STANDBY_CURRENT 10.0
+#define POWER_DOWN_CURRENT 1.0
+
+static sim_w25q64jv_t sim;
+static SPI_HandleTypeDef hspi1;
+static w25q64jv_cfg_t flash;
+
+static int run(uint32_t timeout) {
+    uint8_t table[64];
+    uint8_t record[RECORD_SIZE];
+    uint32_t log_address = LOG_ADDRESS;
+    memset(record, 0x5A, sizeof(record));
+
+    host_reset();
+    host_set_spi_clock(20000000);
+    if (sim_w25q64jv_init(&sim, GPIOA, GPIO_PIN_4) != 0) return -1;
+    if (w25q64jv_config(&flash, &hspi1, GPIOA, GPIO_PIN_4, W25Q64JV_INTERFACE_SPI) != 0) return -1;
+    if (w25q64jv_set_power_down_timeout(&flash, timeout) != 0) return -1;
+
+    uint64_t start = host_time_ns();
+    for (uint32_t ms = 0; ms < RUN_MS; ms++) {
+        if ((ms % PERIOD_MS) == 0) {
+            if (w25q64jv_fast_read(&flash, 0, table, sizeof(table)) != 0) return -1;
+            if (w25q64jv_page_program(&flash, log_address, record, sizeof(record)) != 0) return -1;
+            log_address += RECORD_SIZE;
+        }
+        if (w25q64jv_power_poll(&flash) != 0) return -1;
+        host_advance_ns(1000000);
+    }
+    uint64_t total_ns = host_time_ns() - start;
+
+    w25q64jv_power_stats_t stats;
+    w25q64jv_get_power_stats(&flash, &stats, 0);
+    double down = (double)sim_w25q64jv_powered_down_ns(&sim) / (double)total_ns;
+    double current = (down * POWER_DOWN_CURRENT) + ((1.0 - down) * STANDBY_CURRENT);
+    char name[16];
+    if (timeout == 0) {
+        snprintf(name, sizeof(name), "off");
+    } else {
+        snprintf(name, sizeof(name), "%lums", (unsigned long)timeout);
+    }
+    printf("%-8s %9.1f%% %9.1f%% %8lu %10.1f %10lu %10.2f %8lu\n", name, 100.0 * down,
+           100.0 * (double)stats.powered_down_ms / (double)RUN_MS, (unsigned long)stats.wakes,
+           stats.wakes ? (double)stats.wake_us_total / stats.wakes : 0.0, (unsigned long)stats.wake_us_max, current,
+           (unsigned long)sim.stats.ignored_commands);
+    return 0;
+}
+
+// Waking with the ID read counts as a wake, with its latency, and the part answers afterwards
+static int release_id_check(void) {
+    uint8_t id = 0;
+    uint8_t jedec[3];
+    w25q64jv_power_stats_t stats;
+
+    host_reset();
+    if (sim_w25q64jv_init(&sim, GPIOA, GPIO_PIN_4) != 0) return -1;
+    if (w25q64jv_config(&flash, &hspi1, GPIOA, GPIO_PIN_4, W25Q64JV_INTERFACE_SPI) != 0) return -1;
+    if (w25q64jv_power_down(&flash) != 0) return -1;
+    host_advance_ns(5000000);
+    if (w25q64jv_release_power_down_id(&flash, &id) != 0) return -1;
+    w25q64jv_get_power_stats(&flash, &stats, 0);
+    if ((stats.wakes != 1) || (stats.wake_us_total == 0) || (stats.powered_down_ms < 5)) return -1;
+    if ((w25q64jv_jedec_id(&flash, jedec) != 0) || (jedec[0] != 0xEF)) return -1;
+    printf("release with ID: ID 0x%02X, %lu wake, %lu us\n", id, (unsigned long)stats.wakes,
+           (unsigned long)stats.wake_us_total);
+    return 0;
+}
+
+int main(void) {
+    printf("64 byte read + 32 byte program every %dms for %ds\n\n", PERIOD_MS, RUN_MS / 1000);
+    printf("%-8s %10s %10s %8s %10s %10s %10s %8s\n", "timeout", "down(sim)", "down(drv)", "wakes", "wake avg",
+           "wake max", "idle uA", "ignored");
+    static const uint32_t timeouts[] = {0, 1, 5, 20, 50, 150};
+    for (uint32_t i = 0; i < sizeof(timeouts) / sizeof(timeouts[0]); i++) {
+        if (run(timeouts[i]) != 0) {
+            printf("run failed\n");
+            return 1;
+        }
+    }
+    printf("(wake latency in us, ignored = commands sent during power-down or tRES1)\n");
+    if (release_id_check() != 0) {
+        printf("release with ID check failed\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,354 @@
+/*
+ * Host benchmark for the ICM-42688-P FIFO decode path on recorded traffic. A capture (icm_42688_capture.h) is
+ * played back by host/replay_icm42688 as fast as the driver reads it, through icm_42688_read_fifo one packet at
+ * a time and through icm_42688_read_fifo_batch, and decoded from memory by a reference decoder that follows the
+ * datasheet packet layouts from each header. Reports MB/s of FIFO data and packets/s in host CPU time (the host
+ * bus transport included), SPI bytes per packet, and checks every driver result against the reference decoder.
+ *
+ *   replay_bench                   record 1s of the simulated sensor at 8kHz (packet 3, 2ms polls) and replay it
+ *   replay_bench capture.bin       replay a capture recorded on the target
+ *   replay_bench -w capture.bin    record from the simulation, save the capture and replay it
+ *
+ * cc -O2 -Ihost -IICM-42688-P host/hal_host.c host/sim_icm42688.c host/replay_icm42688.c ICM-42688-P/icm_42688.c \
+ *    ICM-42688-P/icm_42688_capture.c bench/replay_bench.c -o replay_bench
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "main.h"
+#include "sim_icm42688.h"
+#include "replay_icm42688.h"
+#include "icm_42688.h"
+#include "icm_42688_capture.h"
+#include "icm_42688_registers.h"
+
+#define RECORD_NS 1000000000ULL
+#define POLL_NS 2000000ULL
+#define CAPTURE_SIZE (512 * 1024)
+#define BURST_SIZE 2048
+#define MIN_CPU_SECONDS 0.5
+
+static sim_icm42688_t imu_sim;
+static replay_icm42688_t replay;
+static SPI_HandleTypeDef hspi1;
+static icm_42688_cfg_t imu;
+static icm_42688_capture_t capture;
+static uint8_t capture_buffer[CAPTURE_SIZE];
+static uint8_t burst[BURST_SIZE] __attribute__((aligned(32)));
+
+// One decoded packet, as the reference decoder and the driver paths both report it
+typedef struct {
+    uint8_t header;
+    int16_t accel[3];
+    int16_t gyro[3];
+    int16_t temperature;        // 8 bit in packets 1 to 3, 16 bit in packet 4
+    uint16_t timestamp;
+    uint8_t extension[3];       // 20 bit LSBs, packet 4
+} packet_t;
+
+typedef struct {
+    const char* name;
+    uint64_t bytes;
+    uint64_t packets;
+    double seconds;
+    uint64_t spi_bytes;
+    int verified;
+} result_t;
+
+static packet_t* expected;
+static packet_t* decoded;
+static uint32_t packet_count;
+static uint8_t* stream;             // FIFO bytes of every record back to back
+static uint32_t stream_size;
+
+static int16_t get_be16(const uint8_t* data) {
+    return (int16_t)((data[0] << 8) | data[1]);
+}
+
+// Datasheet section 6.1: header bit 7 empty FIFO, 6 accel, 5 gyro, 4 20 bit data. Returns the packet size or -1
+static int reference_decode(const uint8_t* data, uint32_t size, packet_t* packet) {
+    if (size < 1) return -1;
+    uint8_t header = data[0];
+    if (header & 0x80) return -1;
+    uint8_t accel = (header & 0x40) != 0;
+    uint8_t gyro = (header & 0x20) != 0;
+    uint8_t hires = (header & 0x10) != 0;
+    int packet_size = hires ? 20 : ((accel && gyro) ? 16 : ((accel || gyro) ? 8 : -1));
+    if ((packet_size < 0) || ((uint32_t)packet_size > size)) return -1;
+
+    memset(packet, 0, sizeof(*packet));
+    packet->header = header;
+    if (packet_size == 8) {
+        int16_t* xyz = accel ? packet->accel : packet->gyro;
+        for (int i = 0; i < 3; i++) xyz[i] = get_be16(&data[1 + (2 * i)]);
+        packet->temperature = (int8_t)data[7];
+        return packet_size;
+    }
+    for (int i = 0; i < 3; i++) {
+        packet->accel[i] = get_be16(&data[1 + (2 * i)]);
+        packet->gyro[i] = get_be16(&data[7 + (2 * i)]);
+    }
+    if (packet_size == 16) {
+        packet->temperature = (int8_t)data[13];
+        packet->timestamp = (uint16_t)get_be16(&data[14]);
+    } else {
+        packet->temperature = get_be16(&data[13]);
+        packet->timestamp = (uint16_t)get_be16(&data[15]);
+        memcpy(packet->extension, &data[17], 3);
+    }
+    return packet_size;
+}
+
+static int decode_stream(const uint8_t* data, uint32_t size, packet_t* packets, uint32_t max_packets) {
+    uint32_t count = 0;
+    for (uint32_t offset = 0; offset < size;) {
+        if (count >= max_packets) return -1;
+        int packet_size = reference_decode(&data[offset], size - offset, &packets[count++]);
+        if (packet_size < 0) return -1;
+        offset += (uint32_t)packet_size;
+    }
+    return (int)count;
+}
+
+// The driver's output in the same form, data arrives as raw big endian bytes
+static void from_driver(packet_t* packet, uint8_t packet_no, const int8_t* accel, const int8_t* gyro, const int8_t* temp,
+                        const int8_t* time, const int8_t* extension) {
+    memset(packet, 0, sizeof(*packet));
+    for (int i = 0; i < 3; i++) {
+        if (packet_no != 2) packet->accel[i] = get_be16((const uint8_t*)&accel[2 * i]);
+        if (packet_no != 1) packet->gyro[i] = get_be16((const uint8_t*)&gyro[2 * i]);
+    }
+    packet->temperature = (packet_no == 4) ? get_be16((const uint8_t*)temp) : temp[0];
+    if (packet_no >= 3) packet->timestamp = (uint16_t)get_be16((const uint8_t*)time);
+    if (packet_no == 4) memcpy(packet->extension, extension, 3);
+}
+
+static int same_packet(const packet_t* a, const packet_t* b) {
+    return (memcmp(a->accel, b->accel, sizeof(a->accel)) == 0) && (memcmp(a->gyro, b->gyro, sizeof(a->gyro)) == 0) &&
+           (a->temperature == b->temperature) && (a->timestamp == b->timestamp) &&
+           (memcmp(a->extension, b->extension, sizeof(a->extension)) == 0);
+}
+
+static int record(uint32_t* size) {
+    host_reset();
+    host_set_spi_clock(21000000);
+    if (sim_icm42688_init(&imu_sim, GPIOB, GPIO_PIN_0) != 0) return -1;
+    imu_sim.device.hspi = &hspi1;
+    if (icm_42688_config(&imu, &hspi1, GPIOB, GPIO_PIN_0) != 0) return -1;
+    if (icm_42688_configure_device(&imu) != 0) return -1;
+    if (icm_42688_set_accel_odr(&imu, 3) != 0) return -1;
+    if (icm_42688_set_gyro_odr(&imu, 3) != 0) return -1;
+    if (icm_42688_config_fifo_register(&imu, 3) != 0) return -1;
+    if (icm_42688_write_reg(&imu, SIGNAL_PATH_RESET, 0x02) != 0) return -1;
+    if (icm_42688_capture_init(&capture, &imu, capture_buffer, sizeof(capture_buffer)) != 0) return -1;
+
+    uint64_t start = host_time_ns();
+    uint64_t next = start;
+    while ((host_time_ns() - start) < RECORD_NS) {
+        next += POLL_NS;
+        uint16_t burst_size;
+        if (icm_42688_capture_burst(&capture, &imu, burst, sizeof(burst), &burst_size) != 0) return -1;
+        if (host_time_ns() < next) host_advance_ns(next - host_time_ns());
+    }
+    icm_42688_capture_stats_t stats;
+    icm_42688_capture_get_stats(&capture, &stats, 0);
+    if (stats.bursts_dropped != 0) return -1;
+    *size = icm_42688_capture_used(&capture);
+    return 0;
+}
+
+static uint8_t* load(const char* path, uint32_t* size) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) return NULL;
+    uint8_t* data = NULL;
+    long length = -1;
+    if (fseek(file, 0, SEEK_END) == 0) length = ftell(file);
+    if ((length > 0) && (fseek(file, 0, SEEK_SET) == 0)) {
+        data = malloc((size_t)length);
+        if ((data != NULL) && (fread(data, 1, (size_t)length, file) != (size_t)length)) {
+            free(data);
+            data = NULL;
+        }
+    }
+    fclose(file);
+    *size = (uint32_t)length;
+    return data;
+}
+
+static int save(const char* path, const uint8_t* data, uint32_t size) {
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) return -1;
+    int status = (fwrite(data, 1, size, file) == size) ? 0 : -1;
+    fclose(file);
+    return status;
+}
+
+// Describe the capture and build the reference results from it
+static int prepare(const uint8_t* data, uint32_t size) {
+    uint32_t offset = 0, records = 0, first = 0, last = 0, time;
+    uint64_t count_total = 0;
+    uint16_t count, max_count = 0, bytes;
+    const uint8_t* fifo;
+    int status;
+    stream_size = 0;
+    while ((status = replay_icm42688_next(data, size, &offset, &time, &count, &fifo, &bytes)) == 1) {
+        if (records++ == 0) first = time;
+        last = time;
+        count_total += count;
+        if (count > max_count) max_count = count;
+        stream_size += bytes;
+    }
+    if ((status != 0) || (records == 0)) return -1;
+
+    stream = malloc(stream_size ? stream_size : 1);
+    if (stream == NULL) return -1;
+    offset = 0;
+    uint32_t position = 0;
+    while (replay_icm42688_next(data, size, &offset, NULL, NULL, &fifo, &bytes) == 1) {
+        memcpy(&stream[position], fifo, bytes);
+        position += bytes;
+    }
+
+    uint32_t max_packets = (stream_size / 8) + 1;
+    expected = malloc(max_packets * sizeof(packet_t));
+    decoded = malloc(max_packets * sizeof(packet_t));
+    if ((expected == NULL) || (decoded == NULL)) return -1;
+    int packets = decode_stream(stream, stream_size, expected, max_packets);
+    if (packets < 0) {
+        printf("capture holds a packet the reference decoder rejects\n");
+        return -1;
+    }
+    packet_count = (uint32_t)packets;
+
+    double seconds = replay.tick_hz ? ((double)(last - first) / replay.tick_hz) : 0.0;
+    printf("capture: packet %u, %lu records, %lu packets, %lu FIFO bytes over %.3f s, FIFO_COUNT mean %.0f max %u bytes\n\n",
+           data[5], (unsigned long)records, (unsigned long)packet_count, (unsigned long)stream_size, seconds,
+           (double)count_total / records, max_count);
+    return 0;
+}
+
+static int replay_setup(const uint8_t* data, uint32_t size) {
+    host_reset();
+    host_set_spi_clock(21000000);
+    if (replay_icm42688_init(&replay, GPIOB, GPIO_PIN_0, data, size) != 0) return -1;
+    if (icm_42688_config(&imu, &hspi1, GPIOB, GPIO_PIN_0) != 0) return -1;
+    imu.packet_no = replay.packet_no;   // The FIFO as it was set up when the capture was made
+    return 0;
+}
+
+static int replay_done(void) {
+    return (replay.offset >= replay.size) && (replay.remaining == 0);
+}
+
+// FIFO_COUNT, then icm_42688_read_fifo for each packet
+static int pass_read_fifo(uint32_t* packets) {
+    uint8_t packet_size = icm_42688_fifo_packet_size(&imu);
+    *packets = 0;
+    while (!replay_done()) {
+        uint8_t count[2];
+        if (icm_42688_read_reg(&imu, FIFO_COUNTH, &count[0]) != 0) return -1;
+        if (icm_42688_read_reg(&imu, FIFO_COUNTL, &count[1]) != 0) return -1;
+        uint16_t available = (uint16_t)(((count[0] << 8) | count[1]) / packet_size);
+        for (uint16_t i = 0; i < available; i++) {
+            int8_t accel[6], gyro[6], temp[2], time[2], extension[3];
+            if (icm_42688_read_fifo(&imu, gyro, accel, temp, time, extension) != 0) return -1;
+            if (*packets < packet_count) from_driver(&decoded[*packets], imu.packet_no, accel, gyro, temp, time, extension);
+            (*packets)++;
+        }
+    }
+    return 0;
+}
+
+// icm_42688_read_fifo_batch bursts, then the reference decoder on each burst
+static int pass_batch(uint32_t* packets) {
+    *packets = 0;
+    while (!replay_done()) {
+        uint16_t size;
+        if (icm_42688_read_fifo_batch(&imu, burst, sizeof(burst), &size) != 0) return -1;
+        int count = decode_stream(burst, size, &decoded[*packets], packet_count + 1 - *packets);
+        if (count < 0) return -1;
+        *packets += (uint32_t)count;
+    }
+    return 0;
+}
+
+static int pass_reference(uint32_t* packets) {
+    int count = decode_stream(stream, stream_size, decoded, packet_count + 1);
+    if (count < 0) return -1;
+    *packets = (uint32_t)count;
+    return 0;
+}
+
+// Whole passes over the capture until MIN_CPU_SECONDS, checking each pass against the reference
+static int bench(result_t* result, const uint8_t* data, uint32_t size, int (*pass)(uint32_t* packets)) {
+    result->verified = 1;
+    uint32_t passes = 0;
+    while ((result->seconds < MIN_CPU_SECONDS) || (passes == 0)) {
+        if (replay_setup(data, size) != 0) return -1;
+        memset(decoded, 0, packet_count * sizeof(packet_t));
+        uint32_t packets = 0;
+        clock_t begin = clock();
+        if (pass(&packets) != 0) return -1;
+        result->seconds += (double)(clock() - begin) / CLOCKS_PER_SEC;
+        result->spi_bytes += host_spi_bytes();
+        result->packets += packets;
+        result->bytes += stream_size;
+        passes++;
+
+        if ((packets != packet_count) || (replay.stats.underruns != 0)) result->verified = 0;
+        for (uint32_t i = 0; (i < packet_count) && result->verified; i++) {
+            if (!same_packet(&decoded[i], &expected[i])) result->verified = 0;
+        }
+    }
+    return 0;
+}
+
+static void report(const result_t* result) {
+    double seconds = (result->seconds > 0.0) ? result->seconds : 1e-9;
+    printf("%-18s %9.2f MB/s %12.0f pkt/s %9.1f B %9s\n", result->name, (double)result->bytes / seconds / 1e6,
+           (double)result->packets / seconds, result->packets ? ((double)result->spi_bytes / result->packets) : 0.0,
+           result->verified ? "yes" : "no");
+}
+
+int main(int argc, char** argv) {
+    uint8_t* data = capture_buffer;
+    uint32_t size = 0;
+    if ((argc == 2) && (strcmp(argv[1], "-w") != 0)) {
+        data = load(argv[1], &size);
+        if (data == NULL) {
+            printf("cannot read %s\n", argv[1]);
+            return 1;
+        }
+    } else {
+        if (record(&size) != 0) {
+            printf("recording failed\n");
+            return 1;
+        }
+        if ((argc == 3) && (strcmp(argv[1], "-w") == 0) && (save(argv[2], data, size) != 0)) {
+            printf("cannot write %s\n", argv[2]);
+            return 1;
+        }
+    }
+    if (replay_setup(data, size) != 0) {
+        printf("not a capture\n");
+        return 1;
+    }
+    if (prepare(data, size) != 0) return 1;
+
+    static const struct {
+        const char* name;
+        int (*pass)(uint32_t* packets);
+    } paths[] = {{"read_fifo", &pass_read_fifo}, {"read_fifo_batch", &pass_batch}, {"reference (no bus)", &pass_reference}};
+
+    printf("%-18s %14s %18s %11s %9s\n", "decode path", "throughput", "rate", "SPI/packet", "verified");
+    for (uint32_t i = 0; i < (sizeof(paths) / sizeof(paths[0])); i++) {
+        result_t result = {paths[i].name, 0, 0, 0.0, 0, 0};
+        if (bench(&result, data, size, paths[i].pass) != 0) {
+            printf("%s failed\n", paths[i].name);
+            return 1;
+        }
+        report(&result);
+    }
+    return 0;
+}
@@ -0,0 +1,153 @@
+/*
+ * Host benchmark for the W25Q64JV erase / program scheduler against the simulated chip.
+ * A 64 byte table is read every 500us while a 64KB block is erased and reprogrammed. Reports the read
+ * latency and total operation time with plain blocking calls and with the scheduler at several min_run values.
+ *
+ * cc -O2 -Ihost -IW25Q64JV host/hal_host.c host/sim_w25q64jv.c W25Q64JV/W25Q64JV.c \
+ *    W25Q64JV/W25Q64JV_sched.c bench/sched_bench.c -o sched_bench
+ */
+#include <stdio.h>
+#include <string.h>
+#include "main.h"
+#include "sim_w25q64jv.h"
+#include "W25Q64JV.h"
+#include "W25Q64JV_sched.h"
+
+#define TABLE_ADDRESS 0x0000
+#define TABLE_SIZE 64
+#define BLOCK_ADDRESS 0x10000
+#define READ_PERIOD_NS 500000ULL
+#define LOOP_NS 20000ULL
+
+static sim_w25q64jv_t sim;
+static SPI_HandleTypeDef hspi1;
+static w25q64jv_cfg_t flash;
+static w25q64jv_sched_t sched;
+
+static uint8_t table[TABLE_SIZE];
+static uint8_t image[W25Q64JV_BLOCK_64KB_SIZE];
+
+typedef struct {
+    uint32_t reads;
+    uint32_t errors;
+    uint64_t max_ns;
+    uint64_t total_ns;
+} latency_t;
+
+static double ms(uint64_t ns) {
+    return (double)ns / 1000000.0;
+}
+
+static double us(uint64_t ns) {
+    return (double)ns / 1000.0;
+}
+
+static void record(latency_t* latency, uint64_t start, int result, const uint8_t* data) {
+    uint64_t elapsed = host_time_ns() - start;
+    latency->reads++;
+    latency->total_ns += elapsed;
+    if (elapsed > latency->max_ns) latency->max_ns = elapsed;
+    if ((result != 0) || (memcmp(data, table, TABLE_SIZE) != 0)) latency->errors++;
+}
+
+static void report(const char* name, const latency_t* latency, uint64_t total_ns) {
+    printf("%-22s %8.1f ms %8lu %10.1f us %10.1f us %6lu\n", name, ms(total_ns), (unsigned long)latency->reads,
+           us(latency->total_ns / (latency->reads ? latency->reads : 1)), us(latency->max_ns), (unsigned long)latency->errors);
+}
+
+static int setup(void) {
+    host_reset();
+    host_set_spi_clock(20000000);
+    if (sim_w25q64jv_init(&sim, GPIOA, GPIO_PIN_4) != 0) return -1;
+    if (w25q64jv_config(&flash, &hspi1, GPIOA, GPIO_PIN_4, W25Q64JV_INTERFACE_SPI) != 0) return -1;
+    return w25q64jv_page_program(&flash, TABLE_ADDRESS, table, TABLE_SIZE);
+}
+
+static int check_image(void) {
+    static uint8_t data[W25Q64JV_BLOCK_64KB_SIZE];
+    if (w25q64jv_fast_read(&flash, BLOCK_ADDRESS, data, sizeof(data)) != 0) return -1;
+    return (memcmp(data, image, sizeof(data)) == 0) ? 0 : -1;
+}
+
+// Blocking calls: a read arriving during an operation waits for it to finish
+static int run_blocking(void) {
+    latency_t latency = {0};
+    uint8_t data[TABLE_SIZE];
+    if (setup() != 0) return -1;
+
+    uint64_t start = host_time_ns();
+    uint64_t next_read = start + READ_PERIOD_NS;
+    if (w25q64jv_block_erase_64KB(&flash, BLOCK_ADDRESS) != 0) return -1;
+    for (uint32_t page = 0; page < (W25Q64JV_BLOCK_64KB_SIZE / W25Q64JV_PAGE_SIZE); page++) {
+        // Reads that came due while the flash was busy are served now, late
+        while (next_read <= host_time_ns()) {
+            int result = w25q64jv_fast_read(&flash, TABLE_ADDRESS, data, TABLE_SIZE);
+            record(&latency, next_read, result, data);
+            next_read += READ_PERIOD_NS;
+        }
+        uint32_t offset = page * W25Q64JV_PAGE_SIZE;
+        if (w25q64jv_page_program(&flash, BLOCK_ADDRESS + offset, &image[offset], W25Q64JV_PAGE_SIZE) != 0) return -1;
+    }
+    report("blocking", &latency, host_time_ns() - start);
+    return check_image();
+}
+
+static int run_sched(uint32_t min_run) {
+    latency_t latency = {0};
+    uint8_t data[TABLE_SIZE];
+    uint8_t max_depth = 0;
+    if (setup() != 0) return -1;
+    if (w25q64jv_sched_init(&sched, &flash, min_run) != 0) return -1;
+
+    uint64_t start = host_time_ns();
+    uint64_t next_read = start + READ_PERIOD_NS;
+    if (w25q64jv_sched_erase(&sched, BLOCK_ADDRESS, W25Q64JV_BLOCK_64KB_SIZE, NULL, NULL) != 0) return -1;
+    for (uint32_t offset = 0; offset < sizeof(image); offset += sizeof(image) / 4) {
+        if (w25q64jv_sched_program(&sched, BLOCK_ADDRESS + offset, &image[offset], sizeof(image) / 4, NULL, NULL) != 0) return -1;
+    }
+
+    while (w25q64jv_sched_queue_depth(&sched) > 0) {
+        uint8_t depth = w25q64jv_sched_queue_depth(&sched);
+        if (depth > max_depth) max_depth = depth;
+        if (w25q64jv_sched_poll(&sched) != 0) return -1;
+        if (host_time_ns() >= next_read) {
+            uint64_t issued = host_time_ns();
+            int result = w25q64jv_sched_read(&sched, TABLE_ADDRESS, data, TABLE_SIZE);
+            record(&latency, issued, result, data);
+            next_read += READ_PERIOD_NS;
+        } else {
+            host_advance_ns(LOOP_NS);
+        }
+    }
+
+    char name[32];
+    snprintf(name, sizeof(name), "sched min_run %lums", (unsigned long)min_run);
+    report(name, &latency, host_time_ns() - start);
+
+    w25q64jv_sched_stats_t stats;
+    w25q64jv_sched_get_stats(&sched, &stats, 0);
+    printf("%22s suspends %lu, deferred reads %lu, completed %lu, failed %lu, max queue depth %u\n", "",
+           (unsigned long)stats.suspends, (unsigned long)stats.deferred_reads, (unsigned long)stats.completed,
+           (unsigned long)stats.failed, max_depth);
+    return check_image();
+}
+
+int main(void) {
+    for (uint32_t i = 0; i < TABLE_SIZE; i++) table[i] = (uint8_t)(i * 7 + 3);
+    for (uint32_t i = 0; i < sizeof(image); i++) image[i] = (uint8_t)((i >> 8) ^ (i * 13));
+
+    printf("64KB erase + 64KB program, %d byte read every %lluus\n\n", TABLE_SIZE, READ_PERIOD_NS / 1000);
+    printf("%-22s %11s %8s %13s %13s %6s\n", "", "total", "reads", "avg latency", "max latency", "errors");
+    if (run_blocking() != 0) {
+        printf("blocking run failed\n");
+        return 1;
+    }
+    static const uint32_t min_runs[] = {0, 1, 2, 5};
+    for (uint32_t i = 0; i < sizeof(min_runs) / sizeof(min_runs[0]); i++) {
+        if (run_sched(min_runs[i]) != 0) {
+            printf("scheduler run failed\n");
+            return 1;
+        }
+    }
+    return 0;
+}
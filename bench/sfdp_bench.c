@@ -0,0 +1,123 @@
+/*
+ * Host benchmark for SFDP auto-configuration against the simulated chip.
+ * Configures each modelled part from its SFDP table, then compares status polling during erase and
+ * program between continuous polling and the schedule seeded from the SFDP typical times.
+ *
+ * cc -O2 -Ihost -IW25Q64JV host/hal_host.c host/sim_w25q64jv.c W25Q64JV/W25Q64JV.c bench/sfdp_bench.c -o sfdp_bench
+ */
+#include <stdio.h>
+#include <string.h>
+#include "main.h"
+#include "sim_w25q64jv.h"
+#include "W25Q64JV.h"
+
+#define ERASES 8
+#define PROGRAMS 256
+
+static sim_w25q64jv_t sim;
+static SPI_HandleTypeDef hspi1;
+static w25q64jv_cfg_t flash;
+static uint8_t page[W25Q64JV_PAGE_SIZE];
+
+typedef struct {
+    uint64_t bus_bytes;
+    uint64_t late_ns;       // Time from the end of busy to the call returning
+} poll_cost_t;
+
+static double ms(uint64_t ns) {
+    return (double)ns / 1000000.0;
+}
+
+static int setup(uint32_t capacity) {
+    host_reset();
+    host_set_spi_clock(20000000);
+    if (sim_w25q64jv_init(&sim, GPIOA, GPIO_PIN_4) != 0) return -1;
+    if (sim_w25q64jv_set_capacity(&sim, capacity) != 0) return -1;
+    if (w25q64jv_config(&flash, &hspi1, GPIOA, GPIO_PIN_4, W25Q64JV_INTERFACE_SPI) != 0) return -1;
+    return 0;
+}
+
+static void print_params(const char* part) {
+    w25q64jv_params_t* params = &flash.params;
+    printf("%s: %lu bytes, page %u, program %luus typ / %lums max, chip erase %lums typ / %lums max\n", part,
+           (unsigned long)params->capacity, params->page_size, (unsigned long)params->program_typical_us,
+           (unsigned long)params->program_max_ms, (unsigned long)params->chip_erase_typical_ms,
+           (unsigned long)params->chip_erase_max_ms);
+    for (uint8_t i = 0; i < W25Q64JV_ERASE_TYPES; i++) {
+        if (params->erase[i].size == 0) continue;
+        printf("    erase %6lu bytes: opcode 0x%02X, %lums typ / %lums max\n", (unsigned long)params->erase[i].size,
+               params->erase[i].opcode, (unsigned long)params->erase[i].typical_ms, (unsigned long)params->erase[i].max_ms);
+    }
+}
+
+static void add_cost(poll_cost_t* cost, uint64_t bytes_before) {
+    cost->bus_bytes += host_spi_bytes() - bytes_before;
+    cost->late_ns += host_time_ns() - sim.busy_until;
+}
+
+// Continuous polling, the behaviour before the schedule was seeded from SFDP
+static int run_continuous(poll_cost_t* erase_cost, poll_cost_t* program_cost) {
+    for (uint32_t i = 0; i < ERASES; i++) {
+        uint64_t bytes = host_spi_bytes();
+        if (w25q64jv_erase_start(&flash, i * W25Q64JV_SECTOR_SIZE, W25Q64JV_SECTOR_SIZE) != 0) return -1;
+        if (w25q64jv_wait_busy(&flash, flash.params.erase[0].max_ms) != 0) return -1;
+        add_cost(erase_cost, bytes);
+    }
+    for (uint32_t i = 0; i < PROGRAMS; i++) {
+        uint64_t bytes = host_spi_bytes();
+        if (w25q64jv_page_program_start(&flash, i * W25Q64JV_PAGE_SIZE, page, sizeof(page)) != 0) return -1;
+        if (w25q64jv_wait_busy(&flash, flash.params.program_max_ms) != 0) return -1;
+        add_cost(program_cost, bytes);
+    }
+    return 0;
+}
+
+static int run_seeded(poll_cost_t* erase_cost, poll_cost_t* program_cost) {
+    for (uint32_t i = 0; i < ERASES; i++) {
+        uint64_t bytes = host_spi_bytes();
+        if (w25q64jv_sector_erase_4KB(&flash, i * W25Q64JV_SECTOR_SIZE) != 0) return -1;
+        add_cost(erase_cost, bytes);
+    }
+    for (uint32_t i = 0; i < PROGRAMS; i++) {
+        uint64_t bytes = host_spi_bytes();
+        if (w25q64jv_page_program(&flash, i * W25Q64JV_PAGE_SIZE, page, sizeof(page)) != 0) return -1;
+        add_cost(program_cost, bytes);
+    }
+    return 0;
+}
+
+static void report(const char* name, const poll_cost_t* erase_cost, const poll_cost_t* program_cost) {
+    printf("%-12s %12.0f %12.3f %14.0f %12.3f\n", name, (double)erase_cost->bus_bytes / ERASES, ms(erase_cost->late_ns / ERASES),
+           (double)program_cost->bus_bytes / PROGRAMS, ms(program_cost->late_ns / PROGRAMS));
+}
+
+int main(void) {
+    static const uint32_t capacities[] = {4194304, 8388608, 16777216};
+    static const char* parts[] = {"W25Q32JV", "W25Q64JV", "W25Q128JV"};
+    for (uint32_t i = 0; i < sizeof(page); i++) page[i] = (uint8_t)(i * 29);
+
+    for (uint32_t part = 0; part < 3; part++) {
+        if (setup(capacities[part]) != 0) return 1;
+        if ((w25q64jv_configure_device(&flash) != 0) || (w25q64jv_test_comms(&flash) != 0)) {
+            printf("%s: configuration failed\n", parts[part]);
+            return 1;
+        }
+        print_params(parts[part]);
+    }
+
+    printf("\nStatus polling per operation, W25Q64JV, SPI at 20MHz\n");
+    printf("%-12s %12s %12s %14s %12s\n", "", "erase bytes", "erase late", "program bytes", "program late");
+    poll_cost_t erase_cost = {0};
+    poll_cost_t program_cost = {0};
+    if ((setup(8388608) != 0) || (w25q64jv_configure_device(&flash) != 0)) return 1;
+    if (run_continuous(&erase_cost, &program_cost) != 0) return 1;
+    report("continuous", &erase_cost, &program_cost);
+
+    memset(&erase_cost, 0, sizeof(erase_cost));
+    memset(&program_cost, 0, sizeof(program_cost));
+    if ((setup(8388608) != 0) || (w25q64jv_configure_device(&flash) != 0)) return 1;
+    if (run_seeded(&erase_cost, &program_cost) != 0) return 1;
+    report("seeded", &erase_cost, &program_cost);
+    printf("(late = ms from the end of busy to the call returning)\n");
+    return 0;
+}
@@ -0,0 +1,242 @@
+/*
+ * Host benchmark for the header-only C++ drivers (icm_42688.hpp, SN74HC595.hpp, W25Q64JV.hpp) against the C API
+ * on the same simulated devices. For each hot path it reports the simulated cycles (bus time and waits at
+ * SystemCoreClock), the bytes clocked on SPI and the host CPU time per operation, which stands in for the
+ * driver's own overhead since the simulation is the same on both sides.
+ *
+ * cc -O2 -c -Ihost -IICM-42688-P -ISN74HC595 -IW25Q64JV host/hal_host.c host/sim_icm42688.c host/sim_sn74hc595.c \
+ *    host/sim_w25q64jv.c ICM-42688-P/icm_42688.c SN74HC595/SN74HC595.c W25Q64JV/W25Q64JV.c
+ * c++ -O2 -std=c++17 -Ihost -ICPP-POLICIES -IICM-42688-P -ISN74HC595 -IW25Q64JV bench/template_bench.cpp *.o \
+ *    -o template_bench
+ */
+#include <chrono>
+#include <stdio.h>
+#include "main.h"
+#include "icm_42688.hpp"
+#include "SN74HC595.hpp"
+#include "W25Q64JV.hpp"
+
+extern "C" {
+#include "sim_icm42688.h"
+#include "sim_sn74hc595.h"
+#include "sim_w25q64jv.h"
+#include "icm_42688.h"
+#include "SN74HC595.h"
+#include "W25Q64JV.h"
+}
+
+#define IMU_READS 1000
+#define IMU_FIFO_FILL_MS 100
+#define LED_FRAMES 1000
+#define CHAIN_LENGTH 2
+#define READ_SIZE W25Q64JV_BLOCK_64KB_SIZE
+#define READ_PASSES 4
+#define PROGRAM_PAGES 64
+#define C_ADDRESS 0x100000
+#define CPP_ADDRESS 0x200000
+
+SPI_HandleTypeDef hspi1;
+SPI_HandleTypeDef hspi2;
+
+typedef GpioPin<GpioPortB, GPIO_PIN_0> ImuCs;
+typedef GpioPin<GpioPortC, GPIO_PIN_1> LedsLatch;
+typedef GpioPin<GpioPortA, GPIO_PIN_4> FlashCs;
+
+static sim_icm42688_t imu_sim;
+static sim_sn74hc595_t leds_sim;
+static sim_w25q64jv_t flash_sim;
+static icm_42688_cfg_t imu;
+static sn74hc595_cfg_t leds;
+static w25q64jv_cfg_t flash;
+static Icm42688<HalSpi<hspi1>, ImuCs, 3> imu_cpp;
+static Sn74hc595Chain<CHAIN_LENGTH, HalSpi<hspi2>, LedsLatch> leds_cpp;
+static W25q64jv<HalSpi<hspi1>, FlashCs> flash_cpp;
+static uint8_t data[READ_SIZE];
+
+typedef struct {
+    uint32_t cycles;
+    uint64_t bus_bytes;
+    std::chrono::steady_clock::time_point host;
+} sample_t;
+
+typedef struct {
+    uint32_t operations;
+    uint32_t cycles;
+    uint64_t bus_bytes;
+    double host_ns;
+} result_t;
+
+static void begin(sample_t* sample) {
+    sample->bus_bytes = host_spi_bytes();
+    sample->cycles = DWT->CYCCNT;
+    sample->host = std::chrono::steady_clock::now();
+}
+
+static result_t end(const sample_t* sample, uint32_t operations) {
+    result_t result;
+    result.host_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - sample->host).count();
+    result.operations = operations;
+    result.cycles = DWT->CYCCNT - sample->cycles;
+    result.bus_bytes = host_spi_bytes() - sample->bus_bytes;
+    return result;
+}
+
+static void print(const char* name, const result_t& c, const result_t& cpp) {
+    double c_cycles = (double)c.cycles / c.operations;
+    double cpp_cycles = (double)cpp.cycles / cpp.operations;
+    printf("%-16s %10.1f %10.1f %6.1f%% %9.1f %9.1f %9.1f %9.1f\n", name, c_cycles, cpp_cycles,
+           100.0 * (c_cycles - cpp_cycles) / c_cycles, (double)c.bus_bytes / c.operations,
+           (double)cpp.bus_bytes / cpp.operations, c.host_ns / c.operations, cpp.host_ns / cpp.operations);
+}
+
+static int bench_imu(void) {
+    sample_t sample;
+    result_t c, cpp;
+    int16_t xyz[3];
+
+    begin(&sample);
+    for (uint32_t i = 0; i < IMU_READS; i++) {
+        if (icm_42688_read_accel_xyz(&imu, xyz) != 0) return -1;
+    }
+    c = end(&sample, IMU_READS);
+    begin(&sample);
+    for (uint32_t i = 0; i < IMU_READS; i++) {
+        if (imu_cpp.read_accel_xyz(xyz) != 0) return -1;
+    }
+    cpp = end(&sample, IMU_READS);
+    print("accel read", c, cpp);
+
+    // C: FIFO_COUNTH and FIFO_COUNTL then a transfer per packet. C++: one count read and one burst
+    int8_t accel_data[6], gyro_data[6], temp_data[2], time_data[2];
+    uint8_t count[2];
+    if (icm_42688_config_fifo_register(&imu, 3) != 0) return -1;
+    if (icm_42688_write_reg(&imu, SIGNAL_PATH_RESET, 0x02) != 0) return -1;
+    HAL_Delay(IMU_FIFO_FILL_MS);
+    begin(&sample);
+    if (icm_42688_read_reg(&imu, FIFO_COUNTH, &count[0]) != 0) return -1;
+    if (icm_42688_read_reg(&imu, FIFO_COUNTL, &count[1]) != 0) return -1;
+    uint16_t packets = (uint16_t)(((count[0] << 8) | count[1]) / 16);
+    for (uint16_t i = 0; i < packets; i++) {
+        if (icm_42688_read_fifo(&imu, gyro_data, accel_data, temp_data, time_data, NULL) != 0) return -1;
+    }
+    c = end(&sample, packets);
+
+    if (imu_cpp.configure_fifo() != 0) return -1;
+    if (imu_cpp.write_reg(SIGNAL_PATH_RESET, 0x02) != 0) return -1;
+    HAL_Delay(IMU_FIFO_FILL_MS);
+    begin(&sample);
+    uint16_t bytes = 0;
+    if (imu_cpp.fifo_count(&bytes) != 0) return -1;
+    packets = bytes / imu_cpp.packet_size;
+    if (imu_cpp.read_fifo(data, packets) != 0) return -1;
+    decltype(imu_cpp)::sample_t decoded;
+    for (uint16_t i = 0; i < packets; i++) decltype(imu_cpp)::decode(&data[i * imu_cpp.packet_size], &decoded);
+    cpp = end(&sample, packets);
+    print("FIFO packet", c, cpp);
+    return 0;
+}
+
+static int bench_leds(void) {
+    sample_t sample;
+    result_t c, cpp;
+    uint8_t frame[CHAIN_LENGTH];
+
+    begin(&sample);
+    for (uint32_t i = 0; i < LED_FRAMES; i++) {
+        for (uint8_t j = 0; j < CHAIN_LENGTH; j++) {
+            if (sn74hc595_shift_byte(&leds, (uint8_t)(i + j)) != 0) return -1;
+        }
+    }
+    c = end(&sample, LED_FRAMES);
+    uint32_t c_partial = leds_sim.stats.partial_latches;
+
+    begin(&sample);
+    for (uint32_t i = 0; i < LED_FRAMES; i++) {
+        for (uint8_t j = 0; j < CHAIN_LENGTH; j++) frame[j] = (uint8_t)(i + j);
+        if (leds_cpp.write(frame) != 0) return -1;
+    }
+    cpp = end(&sample, LED_FRAMES);
+    print("595 frame", c, cpp);
+    printf("%-16s %10lu %10lu\n", "  partial latches", (unsigned long)c_partial,
+           (unsigned long)(leds_sim.stats.partial_latches - c_partial));
+    return 0;
+}
+
+static int bench_flash(void) {
+    sample_t sample;
+    result_t c, cpp;
+
+    begin(&sample);
+    for (uint32_t i = 0; i < READ_PASSES; i++) {
+        if (w25q64jv_fast_read(&flash, C_ADDRESS, data, READ_SIZE) != 0) return -1;
+    }
+    c = end(&sample, READ_PASSES);
+    begin(&sample);
+    for (uint32_t i = 0; i < READ_PASSES; i++) {
+        if (flash_cpp.fast_read(CPP_ADDRESS, data, READ_SIZE) != 0) return -1;
+    }
+    cpp = end(&sample, READ_PASSES);
+    print("64KB fast read", c, cpp);
+
+    if (w25q64jv_block_erase_64KB(&flash, C_ADDRESS) != 0) return -1;
+    if (flash_cpp.block_erase_64KB(CPP_ADDRESS) != 0) return -1;
+    for (uint32_t i = 0; i < W25Q64JV_PAGE_SIZE; i++) data[i] = (uint8_t)i;
+    begin(&sample);
+    for (uint32_t i = 0; i < PROGRAM_PAGES; i++) {
+        if (w25q64jv_page_program(&flash, C_ADDRESS + (i * W25Q64JV_PAGE_SIZE), data, W25Q64JV_PAGE_SIZE) != 0) return -1;
+    }
+    c = end(&sample, PROGRAM_PAGES);
+    begin(&sample);
+    for (uint32_t i = 0; i < PROGRAM_PAGES; i++) {
+        if (flash_cpp.page_program(CPP_ADDRESS + (i * W25Q64JV_PAGE_SIZE), data, W25Q64JV_PAGE_SIZE) != 0) return -1;
+    }
+    cpp = end(&sample, PROGRAM_PAGES);
+    print("page program", c, cpp);
+
+    // Both copies must hold the same data
+    static uint8_t check[W25Q64JV_PAGE_SIZE];
+    if (flash_cpp.read_data(C_ADDRESS, check, sizeof(check)) != 0) return -1;
+    for (uint32_t i = 0; i < sizeof(check); i++) {
+        if (check[i] != (uint8_t)i) return -1;
+    }
+    return 0;
+}
+
+static int setup(void) {
+    host_reset();
+    host_set_spi_clock(21000000);
+    if (sim_icm42688_init(&imu_sim, GPIOB, GPIO_PIN_0) != 0) return -1;
+    if (sim_sn74hc595_init(&leds_sim, &hspi2, GPIOC, GPIO_PIN_1, CHAIN_LENGTH) != 0) return -1;
+    if (sim_w25q64jv_init(&flash_sim, GPIOA, GPIO_PIN_4) != 0) return -1;
+    imu_sim.device.hspi = &hspi1;
+    flash_sim.device.hspi = &hspi1;
+
+    if (icm_42688_config(&imu, &hspi1, GPIOB, GPIO_PIN_0) != 0) return -1;
+    if (icm_42688_configure_device(&imu) != 0) return -1;
+    if (imu_cpp.set_bank(0) != 0) return -1;
+    if (sn74hc595_config(&leds, &hspi2, GPIOC, GPIO_PIN_1, SN74HC595_SPI_BLOCKING) != 0) return -1;
+    if (w25q64jv_config(&flash, &hspi1, GPIOA, GPIO_PIN_4, W25Q64JV_INTERFACE_SPI) != 0) return -1;
+    return w25q64jv_configure_device(&flash);
+}
+
+int main(void) {
+    if (setup() != 0) {
+        printf("setup failed\n");
+        return 1;
+    }
+    printf("%-16s %10s %10s %7s %9s %9s %9s %9s\n", "per operation", "C cycles", "C++", "saved", "C bytes", "C++",
+           "C host ns", "C++");
+    if (bench_imu() != 0) {
+        printf("ICM-42688-P failed\n");
+        return 1;
+    }
+    if (bench_leds() != 0) {
+        printf("SN74HC595 failed\n");
+        return 1;
+    }
+    if (bench_flash() != 0) {
+        printf("W25Q64JV failed\n");
+        return 1;
+    }
+    return 0;
+}
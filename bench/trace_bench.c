@@ -0,0 +1,158 @@
+/*
+ * Host benchmark for bus tracing. Runs 200ms of a mixed workload on the simulated parts with every driver
+ * traced: the IMU FIFO drained every 1ms plus a register read of the accelerometer, a 2 byte 595 frame every
+ * 1ms on a second bus, and a flash page program every 20ms with 256 byte reads every 5ms. Prints the bus
+ * summary and per operation table and writes trace.json for chrome://tracing or Perfetto.
+ *
+ * cc -O2 -DBUS_TRACE_ENABLE -DBUS_TRACE_DEPTH=65536 -Ihost -IBUS-TRACE -IICM-42688-P -ISN74HC595 -IW25Q64JV \
+ *    host/hal_host.c host/sim_icm42688.c host/sim_sn74hc595.c host/sim_w25q64jv.c host/trace_json.c \
+ *    BUS-TRACE/bus_trace.c ICM-42688-P/icm_42688.c SN74HC595/SN74HC595.c W25Q64JV/W25Q64JV.c \
+ *    bench/trace_bench.c -o trace_bench
+ */
+#include <stdio.h>
+#include <string.h>
+#include "main.h"
+#include "bus_trace.h"
+#include "trace_json.h"
+#include "sim_icm42688.h"
+#include "sim_sn74hc595.h"
+#include "sim_w25q64jv.h"
+#include "icm_42688.h"
+#include "SN74HC595.h"
+#include "W25Q64JV.h"
+
+#ifndef BUS_TRACE_ENABLE
+#error "Build with -DBUS_TRACE_ENABLE"
+#endif
+
+#define RUN_NS 200000000ULL
+#define LOOP_NS 10000ULL
+#define IMU_PERIOD_NS 1000000ULL
+#define FRAME_PERIOD_NS 1000000ULL
+#define READ_PERIOD_NS 5000000ULL
+#define PROGRAM_PERIOD_NS 20000000ULL
+#define LOG_ADDRESS 0x200000
+
+static sim_icm42688_t imu_sim;
+static sim_sn74hc595_t leds_sim;
+static sim_w25q64jv_t flash_sim;
+static SPI_HandleTypeDef hspi1;
+static SPI_HandleTypeDef hspi2;
+static icm_42688_cfg_t imu;
+static sn74hc595_cfg_t leds;
+static w25q64jv_cfg_t flash;
+
+static const char* device_name(uint8_t device) {
+    switch (device) {
+        case BUS_TRACE_ICM42688:
+        return "ICM-42688-P";
+        case BUS_TRACE_SN74HC595:
+        return "SN74HC595";
+        case BUS_TRACE_W25Q64JV:
+        return "W25Q64JV";
+        default:
+        return "?";
+    }
+}
+
+static double us(uint32_t cycles) {
+    return (double)cycles * 1000000.0 / (double)SystemCoreClock;
+}
+
+static int setup(void) {
+    host_reset();
+    host_set_spi_clock(20000000);
+    if (sim_icm42688_init(&imu_sim, GPIOB, GPIO_PIN_0) != 0) return -1;
+    if (sim_w25q64jv_init(&flash_sim, GPIOA, GPIO_PIN_4) != 0) return -1;
+    if (sim_sn74hc595_init(&leds_sim, &hspi2, GPIOC, GPIO_PIN_1, 2) != 0) return -1;
+    imu_sim.device.hspi = &hspi1;
+    flash_sim.device.hspi = &hspi1;
+
+    if (icm_42688_config(&imu, &hspi1, GPIOB, GPIO_PIN_0) != 0) return -1;
+    if (icm_42688_configure_device(&imu) != 0) return -1;
+    if (icm_42688_config_fifo_register(&imu, 3) != 0) return -1;
+    if (w25q64jv_config(&flash, &hspi1, GPIOA, GPIO_PIN_4, W25Q64JV_INTERFACE_SPI) != 0) return -1;
+    if (w25q64jv_configure_device(&flash) != 0) return -1;
+    if (w25q64jv_erase_start(&flash, LOG_ADDRESS, W25Q64JV_BLOCK_64KB_SIZE) != 0) return -1;
+    if (w25q64jv_wait_busy(&flash, 1000) != 0) return -1;
+    return sn74hc595_config(&leds, &hspi2, GPIOC, GPIO_PIN_1, SN74HC595_SPI_BLOCKING);
+}
+
+static int drain_fifo(uint32_t* packets) {
+    uint8_t count[2];
+    int16_t accel[3];
+    int8_t gyro_data[6], accel_data[6], temp_data[2], time_data[2];
+    if (icm_42688_read_accel_xyz(&imu, accel) != 0) return -1;
+    if (icm_42688_read_reg(&imu, 0x2E, &count[0]) != 0) return -1;
+    if (icm_42688_read_reg(&imu, 0x2F, &count[1]) != 0) return -1;
+    uint16_t bytes = (uint16_t)((count[0] << 8) | count[1]);
+    for (uint16_t i = 0; i < bytes / 16; i++) {
+        if (icm_42688_read_fifo(&imu, gyro_data, accel_data, temp_data, time_data, NULL) != 0) return -1;
+        (*packets)++;
+    }
+    return 0;
+}
+
+int main(void) {
+    static uint8_t page[W25Q64JV_PAGE_SIZE];
+    uint8_t data[W25Q64JV_PAGE_SIZE];
+    uint32_t packets = 0;
+    uint32_t frames = 0;
+    uint32_t address = LOG_ADDRESS;
+
+    if (setup() != 0) {
+        printf("setup failed\n");
+        return 1;
+    }
+    bus_trace_init();
+
+    uint64_t start = host_time_ns();
+    uint64_t next_imu = start, next_frame = start, next_read = start, next_program = start;
+    while (host_time_ns() - start < RUN_NS) {
+        uint64_t now = host_time_ns();
+        if (now >= next_imu) {
+            if (drain_fifo(&packets) != 0) return 1;
+            next_imu += IMU_PERIOD_NS;
+        }
+        if (now >= next_frame) {
+            if (sn74hc595_shift_byte(&leds, (uint8_t)frames) != 0) return 1;
+            if (sn74hc595_shift_byte(&leds, (uint8_t)~frames) != 0) return 1;
+            frames++;
+            next_frame += FRAME_PERIOD_NS;
+        }
+        if (now >= next_program) {
+            memset(page, (uint8_t)address, sizeof(page));
+            if (w25q64jv_page_program(&flash, address, page, sizeof(page)) != 0) return 1;
+            address += W25Q64JV_PAGE_SIZE;
+            next_program += PROGRAM_PERIOD_NS;
+        }
+        if (now >= next_read) {
+            if (w25q64jv_fast_read(&flash, LOG_ADDRESS, data, sizeof(data)) != 0) return 1;
+            next_read += READ_PERIOD_NS;
+        }
+        host_advance_ns(LOOP_NS);
+    }
+
+    bus_trace_summary_t summary;
+    bus_trace_op_stats_t ops[BUS_TRACE_MAX_OPS];
+    uint32_t op_count = 0;
+    if (bus_trace_get_stats(&summary, ops, BUS_TRACE_MAX_OPS, &op_count) != 0) return 1;
+
+    printf("%lu records, %lu dropped, %.1f ms window, %.0f transactions/s, %.1f%% utilisation\n",
+           (unsigned long)summary.records, (unsigned long)summary.dropped, us(summary.window_cycles) / 1000.0,
+           summary.transactions_per_second, 100.0 * summary.utilisation);
+    printf("%lu FIFO packets, %lu frames (%.1f Hz latched)\n\n", (unsigned long)packets, (unsigned long)frames,
+           sim_sn74hc595_frame_rate(&leds_sim));
+    printf("%-12s %4s %8s %9s %10s %10s %10s %8s\n", "device", "op", "count", "bytes", "p50 us", "p99 us", "max us",
+           "busy");
+    for (uint32_t i = 0; i < op_count; i++) {
+        printf("%-12s 0x%02X %8lu %9lu %10.2f %10.2f %10.2f %7.2f%%\n", device_name(ops[i].device), ops[i].op,
+               (unsigned long)ops[i].count, (unsigned long)ops[i].bytes, us(ops[i].p50_cycles), us(ops[i].p99_cycles),
+               us(ops[i].max_cycles), 100.0 * (double)ops[i].busy_cycles / (double)summary.window_cycles);
+    }
+
+    int events = host_trace_write_json("trace.json");
+    if (events < 0) return 1;
+    printf("\n%d events written to trace.json\n", events);
+    return 0;
+}
@@ -0,0 +1,169 @@
+/*
+ * Host benchmark for the W25Q64JV write combining buffer against the simulated chip. Appends 16, 32 and 64 byte
+ * records to a log, one page program per record and through the buffer, and reports records/s, page programs
+ * and SPI bytes. Then raises the power fail hook from an interrupt at varying points of a buffered run, with
+ * read backs through the buffer in between, and checks that every record whose write returned 0 is in flash,
+ * and that the hook leaves the page buffered while a DMA transfer is in flight.
+ *
+ * cc -O2 -Ihost -IW25Q64JV host/hal_host.c host/sim_w25q64jv.c W25Q64JV/W25Q64JV.c W25Q64JV/W25Q64JV_wbuf.c \
+ *    bench/wbuf_bench.c -o wbuf_bench
+ */
+#include <stdio.h>
+#include <string.h>
+#include "main.h"
+#include "sim_w25q64jv.h"
+#include "W25Q64JV.h"
+#include "W25Q64JV_wbuf.h"
+
+#define LOG_ADDRESS 0x100000
+#define RECORDS 4096
+#define MAX_RECORD 64
+#define POWER_FAIL_RECORDS 512
+#define POWER_FAIL_POINTS 16
+
+static sim_w25q64jv_t sim;
+static SPI_HandleTypeDef hspi1;
+static w25q64jv_cfg_t flash;
+static w25q64jv_wbuf_t wbuf;
+static uint64_t power_fail_ns;
+static int failures;
+
+static void fill_record(uint8_t* record, uint32_t size, uint32_t index) {
+    for (uint32_t i = 0; i < size; i++) record[i] = (uint8_t)((index * 7U) + i);
+}
+
+static int setup(void) {
+    host_reset();
+    host_set_spi_clock(20000000);
+    if (sim_w25q64jv_init(&sim, GPIOA, GPIO_PIN_4) != 0) return -1;
+    if (w25q64jv_config(&flash, &hspi1, GPIOA, GPIO_PIN_4, W25Q64JV_INTERFACE_SPI) != 0) return -1;
+    return w25q64jv_wbuf_init(&wbuf, &flash, 0);
+}
+
+static int append(uint32_t record_size, uint8_t buffered) {
+    uint8_t record[MAX_RECORD];
+    if (setup() != 0) return -1;
+
+    uint64_t start = host_time_ns();
+    uint64_t bytes = host_spi_bytes();
+    uint32_t address = LOG_ADDRESS;
+    for (uint32_t i = 0; i < RECORDS; i++) {
+        fill_record(record, record_size, i);
+        if (buffered) {
+            if (w25q64jv_wbuf_write(&wbuf, address, record, record_size) != 0) return -1;
+        } else {
+            if (w25q64jv_page_program(&flash, address, record, record_size) != 0) return -1;
+        }
+        address += record_size;
+    }
+    if (buffered && (w25q64jv_wbuf_flush(&wbuf) != 0)) return -1;
+    double seconds = (double)(host_time_ns() - start) / 1e9;
+
+    uint8_t check[MAX_RECORD];
+    for (uint32_t i = 0; i < RECORDS; i++) {
+        fill_record(record, record_size, i);
+        if (w25q64jv_fast_read(&flash, LOG_ADDRESS + (i * record_size), check, record_size) != 0) return -1;
+        if (memcmp(check, record, record_size) != 0) return -1;
+    }
+    printf("%6lu B %-9s %11.0f %10lu %9.1f\n", (unsigned long)record_size, buffered ? "buffered" : "direct",
+           RECORDS / seconds, (unsigned long)sim.stats.programs, (double)(host_spi_bytes() - bytes) / 1024.0);
+    return 0;
+}
+
+static void power_fail_interrupt(void* context) {
+    (void)context;
+    if (!wbuf.power_fail && (host_time_ns() >= power_fail_ns)) w25q64jv_wbuf_power_fail(&wbuf);
+}
+
+// Records accepted before the power fail must all be in flash once the hook has run
+static int power_fail_run(uint64_t after_ns, uint32_t record_size) {
+    uint8_t record[MAX_RECORD];
+    uint8_t check[MAX_RECORD];
+    if (setup() != 0) return -1;
+    power_fail_ns = host_time_ns() + after_ns;
+    host_set_interrupt(&power_fail_interrupt, NULL);
+
+    uint32_t accepted = 0;
+    for (uint32_t i = 0; i < POWER_FAIL_RECORDS; i++) {
+        fill_record(record, record_size, i);
+        if (w25q64jv_wbuf_write(&wbuf, LOG_ADDRESS + (i * record_size), record, record_size) != 0) break;
+        accepted++;
+        if ((i % 8) == 7) {
+            if ((w25q64jv_wbuf_read(&wbuf, LOG_ADDRESS + (i * record_size), check, record_size) != 0) ||
+                (memcmp(check, record, record_size) != 0)) {
+                break;
+            }
+        }
+    }
+    host_set_interrupt(NULL, NULL);
+    if (!wbuf.power_fail) w25q64jv_wbuf_power_fail(&wbuf);
+
+    for (uint32_t i = 0; i < accepted; i++) {
+        fill_record(record, record_size, i);
+        if (w25q64jv_fast_read(&flash, LOG_ADDRESS + (i * record_size), check, record_size) != 0) return -1;
+        if (memcmp(check, record, record_size) != 0) return -1;
+    }
+    return (int)accepted;
+}
+
+// The hook runs from an interrupt and must not start a program over a DMA transfer in flight
+static int power_fail_dma_check(void) {
+    uint8_t record[24];
+    uint8_t check[sizeof(record)];
+    if (setup() != 0) return 0;
+    fill_record(record, sizeof(record), 0);
+    if (w25q64jv_wbuf_write(&wbuf, LOG_ADDRESS, record, sizeof(record)) != 0) return 0;
+
+    flash.dma_active = 1;
+    uint32_t programs = sim.stats.programs;
+    int refused = (w25q64jv_wbuf_power_fail(&wbuf) != 0) && (sim.stats.programs == programs);
+    flash.dma_active = 0;
+
+    // The page is still buffered and goes out once the transfer is over
+    return refused && (w25q64jv_wbuf_write(&wbuf, LOG_ADDRESS, record, sizeof(record)) != 0) &&
+           (w25q64jv_wbuf_flush(&wbuf) == 0) &&
+           (w25q64jv_fast_read(&flash, LOG_ADDRESS, check, sizeof(check)) == 0) &&
+           (memcmp(check, record, sizeof(record)) == 0);
+}
+
+int main(void) {
+    static const uint32_t sizes[] = {16, 32, 64};
+
+    printf("%d records appended at %dMHz SPI\n\n", RECORDS, 20);
+    printf("%8s %-9s %11s %10s %9s\n", "record", "path", "records/s", "programs", "SPI KB");
+    for (uint32_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        if ((append(sizes[i], 0) != 0) || (append(sizes[i], 1) != 0)) {
+            printf("append run failed\n");
+            return 1;
+        }
+    }
+
+    printf("\npower fail during %d buffered 24 byte writes with read backs, %d points:\n", POWER_FAIL_RECORDS,
+           POWER_FAIL_POINTS);
+    uint32_t lost = 0;
+    uint32_t accepted_min = POWER_FAIL_RECORDS;
+    uint32_t accepted_max = 0;
+    for (uint32_t point = 0; point < POWER_FAIL_POINTS; point++) {
+        // Spread over the run and off any page boundary timing
+        int accepted = power_fail_run(((uint64_t)point * 1777777ULL) + 3331ULL, 24);
+        if (accepted < 0) {
+            lost++;
+            continue;
+        }
+        if ((uint32_t)accepted < accepted_min) accepted_min = (uint32_t)accepted;
+        if ((uint32_t)accepted > accepted_max) accepted_max = (uint32_t)accepted;
+    }
+    printf("records accepted before the power fail: %lu to %lu, runs losing accepted data: %lu\n",
+           (unsigned long)accepted_min, (unsigned long)accepted_max, (unsigned long)lost);
+    if (lost) failures++;
+
+    int dma_ok = power_fail_dma_check();
+    printf("power fail during a DMA transfer leaves the page buffered: %s\n", dma_ok ? "ok" : "FAILED");
+    if (!dma_ok) failures++;
+
+    if (failures) {
+        printf("FAILED\n");
+        return 1;
+    }
+    return 0;
+}
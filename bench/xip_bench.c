@@ -0,0 +1,165 @@
+/*
+ * Host check for W25Q64JV memory mapped mode against the simulated chip, using the RAM shadow that stands
+ * in for the QUADSPI mapping. Programs a pattern, enters XIP and reads it back through the returned base,
+ * checks that indirect commands are refused while mapped, then exits, erases and programs a sector and
+ * maps again to see the new contents. Reports the cost of refreshing the shadow on enter. Then sets a 32 byte
+ * burst wrap, which the simulated chip applies to 0xEB reads, and checks that enter and a device reset turn it
+ * off so a read past the wrap boundary is linear again.
+ *
+ * cc -O2 -Ihost -IW25Q64JV host/hal_host.c host/sim_w25q64jv.c W25Q64JV/W25Q64JV.c W25Q64JV/W25Q64JV_xip.c \
+ *    bench/xip_bench.c -o xip_bench
+ */
+#include <stdio.h>
+#include <string.h>
+#include "main.h"
+#include "sim_w25q64jv.h"
+#include "W25Q64JV.h"
+#include "W25Q64JV_xip.h"
+#include "W25Q64JV_registers.h"
+
+#define MAP_SIZE 65536
+#define SECTOR_ADDRESS 0x2000
+#define WRAP_ADDRESS 0x1010
+
+static sim_w25q64jv_t sim;
+static SPI_HandleTypeDef hspi1;
+static w25q64jv_cfg_t flash;
+static uint8_t shadow[MAP_SIZE];
+static uint8_t page[W25Q64JV_PAGE_SIZE];
+
+static int failures;
+
+static void check(const char* name, int passed) {
+    printf("%-40s %s\n", name, passed ? "ok" : "FAILED");
+    if (!passed) failures++;
+}
+
+static uint8_t pattern(uint32_t address, uint8_t seed) {
+    return (uint8_t)((address * 31U) ^ (address >> 8) ^ seed);
+}
+
+static int program_pattern(uint32_t address, uint32_t size, uint8_t seed) {
+    for (uint32_t offset = 0; offset < size; offset += W25Q64JV_PAGE_SIZE) {
+        for (uint32_t i = 0; i < W25Q64JV_PAGE_SIZE; i++) page[i] = pattern(address + offset + i, seed);
+        if (w25q64jv_page_program(&flash, address + offset, page, W25Q64JV_PAGE_SIZE) != 0) return -1;
+    }
+    return 0;
+}
+
+static int matches(const uint8_t* base, uint32_t address, uint32_t size, uint8_t seed) {
+    for (uint32_t i = 0; i < size; i++) {
+        if (base[address + i] != pattern(address + i, seed)) return 0;
+    }
+    return 1;
+}
+
+static int enter(const uint8_t** base, uint64_t* ns, uint64_t* bytes) {
+    uint64_t start = host_time_ns();
+    uint64_t start_bytes = host_spi_bytes();
+    if (w25q64jv_xip_enter(&flash, W25Q64JV_WRAP_NONE, base) != 0) return -1;
+    *ns = host_time_ns() - start;
+    *bytes = host_spi_bytes() - start_bytes;
+    return 0;
+}
+
+// Fast Read Quad I/O sent a byte per clock, the way the simulated chip decodes it, mode bits clear
+static int quad_read(uint32_t address, uint8_t* data, uint16_t size) {
+    uint8_t header[7] = {FAST_READ_QUAD_IO, (uint8_t)(address >> 16), (uint8_t)(address >> 8), (uint8_t)address,
+                         0xFF, 0xFF, 0xFF};
+    HAL_GPIO_WritePin(GPIOA, GPIO_PIN_4, GPIO_PIN_RESET);
+    HAL_StatusTypeDef status = HAL_SPI_Transmit(&hspi1, header, sizeof(header), HAL_MAX_DELAY);
+    if (status == HAL_OK) status = HAL_SPI_Receive(&hspi1, data, size, HAL_MAX_DELAY);
+    HAL_GPIO_WritePin(GPIOA, GPIO_PIN_4, GPIO_PIN_SET);
+    return (status == HAL_OK) ? 0 : -1;
+}
+
+// Reads of 64 bytes from 16 bytes into a 32 byte line, linear or wrapped back to the start of the line
+static int quad_read_matches(uint8_t wrapped) {
+    uint8_t data[64];
+    if (quad_read(WRAP_ADDRESS, data, sizeof(data)) != 0) return 0;
+    for (uint32_t i = 0; i < sizeof(data); i++) {
+        uint32_t address = WRAP_ADDRESS + i;
+        if (wrapped) address = (WRAP_ADDRESS & ~31U) | (address & 31U);
+        if (data[i] != pattern(address, 0x00)) return 0;
+    }
+    return 1;
+}
+
+static void wrap_checks(void) {
+    const uint8_t* base = NULL;
+    uint64_t ns;
+    uint64_t bytes;
+
+    check("32 byte wrap set on the chip", (w25q64jv_set_burst_with_wrap(&flash, W25Q64JV_WRAP_32) == 0) &&
+          (sim.wrap == 32));
+    check("0xEB read past the line wraps", quad_read_matches(1));
+    check("enter turns wrapping off", (enter(&base, &ns, &bytes) == 0) && (sim.wrap == 0) &&
+          (flash.xip_wrap == W25Q64JV_WRAP_NONE));
+    check("exit", w25q64jv_xip_exit(&flash) == 0);
+    check("0xEB read past the line is linear", quad_read_matches(0));
+
+    check("wrap set again", (w25q64jv_set_burst_with_wrap(&flash, W25Q64JV_WRAP_32) == 0) && (sim.wrap == 32));
+    check("reset turns wrapping off", (w25q64jv_reset_device(&flash) == 0) && (sim.wrap == 0) &&
+          (flash.xip_wrap == W25Q64JV_WRAP_NONE));
+    check("0xEB read after the reset is linear", quad_read_matches(0));
+}
+
+int main(void) {
+    const uint8_t* base = NULL;
+    uint64_t ns;
+    uint64_t bytes;
+    uint8_t data[16];
+    uint8_t id[3];
+    uint8_t busy;
+
+    host_reset();
+    host_set_spi_clock(20000000);
+    if ((sim_w25q64jv_init(&sim, GPIOA, GPIO_PIN_4) != 0) ||
+        (w25q64jv_config(&flash, &hspi1, GPIOA, GPIO_PIN_4, W25Q64JV_INTERFACE_SPI) != 0) ||
+        (program_pattern(0, MAP_SIZE, 0x00) != 0)) {
+        printf("setup failed\n");
+        return 1;
+    }
+
+    check("enter before a shadow is set refused", w25q64jv_xip_enter(&flash, W25Q64JV_WRAP_NONE, &base) != 0);
+    check("shadow larger than the part refused",
+          w25q64jv_xip_set_shadow(&flash, shadow, flash.params.capacity + 1) != 0);
+    check("set shadow", w25q64jv_xip_set_shadow(&flash, shadow, sizeof(shadow)) == 0);
+    check("enter with a 32 byte wrap refused", w25q64jv_xip_enter(&flash, W25Q64JV_WRAP_32, &base) != 0);
+    check("enter", enter(&base, &ns, &bytes) == 0);
+    check("base is the shadow", base == shadow);
+    check("mapped contents match the flash", (base != NULL) && matches(base, 0, MAP_SIZE, 0x00));
+    printf("%-40s %.2f ms, %llu SPI bytes\n", "shadow refresh on enter", (double)ns / 1000000.0,
+           (unsigned long long)bytes);
+
+    uint64_t commands = host_spi_bytes();
+    check("second enter refused", w25q64jv_xip_enter(&flash, W25Q64JV_WRAP_NONE, &base) != 0);
+    check("wrap change refused", w25q64jv_set_burst_with_wrap(&flash, W25Q64JV_WRAP_64) != 0);
+    check("shadow change refused", w25q64jv_xip_set_shadow(&flash, shadow, sizeof(shadow)) != 0);
+    check("fast read refused", w25q64jv_fast_read(&flash, 0, data, sizeof(data)) != 0);
+    check("JEDEC ID refused", w25q64jv_jedec_id(&flash, id) != 0);
+    check("status poll refused", w25q64jv_busy(&flash, &busy) != 0);
+    check("sector erase refused", w25q64jv_sector_erase_4KB(&flash, SECTOR_ADDRESS) != 0);
+    check("page program refused", w25q64jv_page_program(&flash, SECTOR_ADDRESS, page, sizeof(page)) != 0);
+    check("nothing sent while mapped", host_spi_bytes() == commands);
+
+    check("exit", w25q64jv_xip_exit(&flash) == 0);
+    check("sector erase after exit", w25q64jv_sector_erase_4KB(&flash, SECTOR_ADDRESS) == 0);
+    check("program after exit", program_pattern(SECTOR_ADDRESS, W25Q64JV_SECTOR_SIZE, 0xA5) == 0);
+    check("enter again", enter(&base, &ns, &bytes) == 0);
+    check("mapped sector shows the new data", matches(base, SECTOR_ADDRESS, W25Q64JV_SECTOR_SIZE, 0xA5));
+    check("rest of the mapping unchanged", matches(base, 0, SECTOR_ADDRESS, 0x00) &&
+          matches(base, SECTOR_ADDRESS + W25Q64JV_SECTOR_SIZE, MAP_SIZE - SECTOR_ADDRESS - W25Q64JV_SECTOR_SIZE, 0x00));
+    check("exit", w25q64jv_xip_exit(&flash) == 0);
+    check("indirect read after exit", (w25q64jv_fast_read(&flash, SECTOR_ADDRESS, data, sizeof(data)) == 0) &&
+          (data[0] == pattern(SECTOR_ADDRESS, 0xA5)));
+
+    wrap_checks();
+
+    if (failures) {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}
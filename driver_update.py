@@ -1,129 +1,268 @@
-import sys
+import argparse
+import hashlib
+import json
 import os
 import shutil
-from git import Repo
+import subprocess
+import sys
 
-# Supported drivers
-drivers = ("ICM-42688-P", "SN74HC595")
+# Supported drivers and shared modules, one folder each
+drivers = ("ICM-42688-P", "SN74HC595", "W25Q64JV", "IMU-LOGGER", "SPI-BUS", "BUS-TRACE", "CPP-POLICIES")
 
-if __name__ == "__main__":
-    if len(sys.argv) < 3:
-        print("Usage: py driver_update.py <project_directory> <driver_1> <driver_2>...")
-        sys.exit(1)
+# Folders a driver includes from, copied along with it
+driver_dependencies = {
+    "ICM-42688-P": ("CPP-POLICIES",),
+    "SN74HC595": ("CPP-POLICIES",),
+    "W25Q64JV": ("CPP-POLICIES",),
+    "IMU-LOGGER": ("ICM-42688-P", "W25Q64JV"),
+}
 
-    project_path = os.path.abspath(sys.argv[1])
-    drivers_path = os.path.join(project_path, "Drivers")
-    core_path = os.path.join(project_path, "Core")
-    src_path = os.path.join(core_path, "Src")
-    inc_path = os.path.join(core_path, "Inc")
+# Modules that change the driver structures when present, defined for every driver source
+driver_definitions = {"SPI-BUS": "SPI_BUS_ENABLE", "BUS-TRACE": "BUS_TRACE_ENABLE"}
 
-    # Parse requested new drivers
-    new_drivers = []
-    for arg in sys.argv[2:]:
-        arg = arg.upper()
-        if arg in drivers:
-            new_drivers.append(arg)
+driver_url = "https://github.com/AaroSnid/stm32-drivers.git"
+default_cache = os.path.join(os.path.expanduser("~"), ".cache", "stm32-drivers")
 
-    if not new_drivers:
-        print("Warning: No valid drivers requested")
-        sys.exit(2)
+manifest_name = ".driver_manifest.json"
+cmake_name = "drivers.cmake"
+cmake_target = "stm32_drivers"
+
+
+def file_hash(path):
+    digest = hashlib.sha256()
+    with open(path, "rb") as f:
+        for block in iter(lambda: f.read(65536), b""):
+            digest.update(block)
+    return digest.hexdigest()
+
+
+def has_drivers(path):
+    return any(os.path.isdir(os.path.join(path, d)) for d in drivers)
+
+
+def git(args):
+    try:
+        subprocess.run(["git"] + args, check=True)
+    except (OSError, subprocess.CalledProcessError) as e:
+        print(f"git {' '.join(args)} failed: {e}")
+        return False
+    return True
+
+
+def resolve_source(args):
+    """Driver checkout to copy from: --source, the checkout holding this script, or the clone in the cache"""
+    if args.source:
+        source = os.path.abspath(args.source)
+        if not has_drivers(source):
+            print(f"Error: no drivers found in {source}")
+            sys.exit(3)
+        return source
+
+    script_dir = os.path.dirname(os.path.abspath(__file__))
+    if not args.cache_only and has_drivers(script_dir):
+        return script_dir
+
+    cache = os.path.abspath(args.cache)
+    if os.path.isdir(os.path.join(cache, ".git")):
+        if args.offline:
+            print(f"Using cached driver repository {cache}")
+        else:
+            print(f"Updating cached driver repository {cache}")
+            if not git(["-C", cache, "pull", "--ff-only", "--quiet"]):
+                print("  Update failed, using the cached copy")
+    elif args.offline:
+        print(f"Error: offline and no cached driver repository in {cache}")
+        sys.exit(3)
     else:
-        print(f"Processing {len(new_drivers)} driver(s): {', '.join(new_drivers)}")
+        print(f"Cloning driver repository into {cache}...")
+        os.makedirs(os.path.dirname(cache), exist_ok=True)
+        if not git(["clone", "--depth", "1", "--quiet", args.url, cache]):
+            sys.exit(3)
+    return cache
+
 
-    # Clone driver repository
-    driver_repo_path = os.path.join(project_path, "drivers_repo")
-    driver_url = "https://github.com/AaroSnid/stm32-drivers.git"
+def source_files(driver_path):
+    files = []
+    for root, dirs, names in os.walk(driver_path):
+        dirs[:] = sorted(d for d in dirs if not d.startswith("."))
+        for name in sorted(names):
+            if not name.startswith("."):
+                files.append(os.path.relpath(os.path.join(root, name), driver_path).replace(os.sep, "/"))
+    return files
 
-    if os.path.exists(driver_repo_path):
-        shutil.rmtree(driver_repo_path)
 
-    print("Cloning driver repository...")
-    Repo.clone_from(driver_url, driver_repo_path)
+def load_manifest(drivers_path):
+    try:
+        with open(os.path.join(drivers_path, manifest_name)) as f:
+            return json.load(f)
+    except (OSError, ValueError):
+        return {}
 
-    # repo_drivers_path = os.path.join(driver_repo_path, "Drivers")
-    repo_drivers_path = driver_repo_path
 
-    cmake_src = []
-    cmake_inc = []
+def write_if_changed(path, text, dry_run):
+    """Leave the file and its timestamp alone when the content is the same, so nothing rebuilds"""
+    if os.path.exists(path):
+        with open(path) as f:
+            if f.read() == text:
+                return False
+    if not dry_run:
+        with open(path, "w") as f:
+            f.write(text)
+    return True
 
-    # Add requested drivers
-    for driver in new_drivers:
-        print(f"Processing driver: {driver}")
 
-        repo_driver_path = os.path.join(driver_repo_path, driver)
-        target_driver_dir = os.path.join(drivers_path, driver)
+def update_driver(source, drivers_path, driver, manifest, dry_run):
+    """Copy new and changed files, remove files the driver no longer has. Returns the number of files touched"""
+    source_path = os.path.join(source, driver)
+    target_path = os.path.join(drivers_path, driver)
+    old_files = manifest.get(driver, {})
+    new_files = {}
+    changes = 0
 
-        if not os.path.exists(repo_driver_path):
-            print(f"  Driver {driver} not found in repository")
+    if not os.path.isdir(target_path):
+        print(f"  Adding new folder driver {driver}")
+    for name in source_files(source_path):
+        digest = file_hash(os.path.join(source_path, name))
+        new_files[name] = digest
+        target = os.path.join(target_path, name)
+        if os.path.exists(target) and (file_hash(target) == digest):
             continue
 
-        # Folder-based driver
-        if os.path.isdir(repo_driver_path):
-            if os.path.exists(target_driver_dir):
-                print(f"  Updating existing folder driver {driver}")
-                shutil.rmtree(target_driver_dir)
-            else:
-                print(f"  Adding new folder driver {driver}")
+        print(f"    {'Updating' if os.path.exists(target) else 'Adding'} {driver}/{name}")
+        changes += 1
+        if not dry_run:
+            os.makedirs(os.path.dirname(target), exist_ok=True)
+            shutil.copyfile(os.path.join(source_path, name), target)     # New mtime, the build sees the change
 
-            shutil.copytree(repo_driver_path, target_driver_dir)
-            for root, _, files in os.walk(target_driver_dir):
-                for f in files:
-                    if f.endswith(".c") or f.endswith(".cpp"):
-                        cmake_src.append(os.path.join(root, f))
+    # Only files this script copied are removed, anything added by hand stays
+    for name in sorted(set(old_files) - set(new_files)):
+        target = os.path.join(target_path, name)
+        if os.path.exists(target):
+            print(f"    Removing {driver}/{name}")
+            changes += 1
+            if not dry_run:
+                os.remove(target)
 
-            cmake_inc.append(target_driver_dir)
+    manifest[driver] = new_files
+    return changes
 
-        # Flat C/H driver
-        else:
-            print(f"  Updating flat driver files for {driver}")
 
-            repo_files = [
-                f for f in os.listdir(repo_driver_path)
-                if f.endswith((".c", ".h"))
-            ]
+def cmake_fragment(manifest):
+    present = [d for d in drivers if d in manifest]
+    lines = [
+        "# Generated by driver_update.py, changes are overwritten",
+        f"# include() this file and link {cmake_target} to the application target",
+        "",
+        f"if(NOT TARGET {cmake_target})",
+        f"    add_library({cmake_target} INTERFACE)",
+        "endif()",
+        "",
+        f"target_sources({cmake_target} INTERFACE",
+    ]
+    for driver in present:
+        for name in sorted(manifest[driver]):
+            if name.endswith((".c", ".cpp")):
+                lines.append(f"    ${{CMAKE_CURRENT_LIST_DIR}}/{driver}/{name}")
+    lines.append(")")
+    lines.append("")
+    lines.append(f"target_include_directories({cmake_target} INTERFACE")
+    for driver in present:
+        lines.append(f"    ${{CMAKE_CURRENT_LIST_DIR}}/{driver}")
+    lines.append(")")
 
-            # Remove old driver files only
-            for fname in repo_files:
-                if fname.endswith(".c"):
-                    target = os.path.join(src_path, fname)
-                else:
-                    target = os.path.join(inc_path, fname)
+    definitions = [driver_definitions[d] for d in present if d in driver_definitions]
+    if definitions:
+        lines.append("")
+        lines.append(f"target_compile_definitions({cmake_target} INTERFACE {' '.join(definitions)})")
+    return "\n".join(lines) + "\n"
 
-                if os.path.exists(target):
-                    print(f"    Removing {target}")
-                    os.remove(target)
 
-            # Copy new files
-            for fname in repo_files:
-                src = os.path.join(repo_driver_path, fname)
+def update_project(source, project, requested, dry_run):
+    project_path = os.path.abspath(project)
+    drivers_path = os.path.join(project_path, "Drivers")
+    print(f"\nProject {project_path}")
+    if not os.path.isdir(project_path):
+        print("  Project directory not found, skipped")
+        return False
 
-                if fname.endswith(".c"):
-                    dst = os.path.join(src_path, fname)
-                    shutil.copy2(src, dst)
-                    cmake_src.append(os.path.join(src_path, fname))
+    manifest = load_manifest(drivers_path)
+    changes = 0
+    for driver in requested:
+        if not os.path.isdir(os.path.join(source, driver)):
+            print(f"  Driver {driver} not found in {source}")
+            continue
+        changes += update_driver(source, drivers_path, driver, manifest, dry_run)
 
-                else:
-                    dst = os.path.join(inc_path, fname)
-                    shutil.copy2(src, dst)
-                    cmake_inc.append(inc_path)
+    if changes == 0:
+        print("  Drivers up to date")
+    if not dry_run:
+        os.makedirs(drivers_path, exist_ok=True)
+        write_if_changed(os.path.join(drivers_path, manifest_name), json.dumps(manifest, indent=2, sort_keys=True) + "\n", dry_run)
+    cmake_path = os.path.join(drivers_path, cmake_name)
+    if write_if_changed(cmake_path, cmake_fragment(manifest), dry_run):
+        print(f"  {'Would write' if dry_run else 'Wrote'} {cmake_path}")
+    return True
 
 
-    # Cleanup
-    print("Removing temporary driver repository")
-    try:
-        shutil.rmtree(driver_repo_path)
-    except:
-        print("Unable to remove drivers_repo folder, please remove manually") 
-
-    # Output CMake hints
-    print("\nIf using CMake, make sure these paths are included:\n")
-
-    if cmake_inc:
-        print("Include directories:")
-        for d in sorted(set(cmake_inc)):
-            print(f"  {d}")
-
-    if cmake_src:
-        print("\nSource directories:")
-        for d in sorted(set(cmake_src)):
-            print(f"  {d}")
\ No newline at end of file
+def parse_args():
+    parser = argparse.ArgumentParser(
+        description="Copy drivers into STM32 projects, touching only files that changed",
+        usage="py driver_update.py [options] <project_directory> <driver_1> <driver_2>...\n"
+              "       py driver_update.py [options] -p <project> -p <project>... <driver_1>...")
+    parser.add_argument("names", nargs="*", help="Project directory (unless -p is used) followed by drivers, or 'all'")
+    parser.add_argument("-p", "--project", action="append", default=[], help="Project to update, repeat for a batch")
+    parser.add_argument("--projects-file", help="File with one project directory per line")
+    parser.add_argument("--source", help="Local driver checkout to copy from")
+    parser.add_argument("--url", default=driver_url, help="Repository to clone into the cache")
+    parser.add_argument("--cache", default=default_cache, help="Clone kept between runs")
+    parser.add_argument("--cache-only", action="store_true", help="Use the cache even when run from a driver checkout")
+    parser.add_argument("--offline", action="store_true", help="Never touch the network, use the cache as it is")
+    parser.add_argument("--dry-run", action="store_true", help="Report what would change")
+    return parser.parse_args()
+
+
+if __name__ == "__main__":
+    args = parse_args()
+
+    projects = list(args.project)
+    if args.projects_file:
+        with open(args.projects_file) as f:
+            projects += [line.strip() for line in f if line.strip() and not line.startswith("#")]
+    names = list(args.names)
+    if not projects and names:
+        projects.append(names.pop(0))
+    if not projects or not names:
+        print("Usage: py driver_update.py <project_directory> <driver_1> <driver_2>...")
+        sys.exit(1)
+
+    # Parse requested drivers
+    new_drivers = []
+    for arg in names:
+        if arg.lower() == "all":
+            new_drivers = list(drivers)
+            break
+        match = [d for d in drivers if d.upper() == arg.upper()]
+        if match and match[0] not in new_drivers:
+            new_drivers.append(match[0])
+    # Appended folders are visited by the same loop, so dependencies of dependencies come too
+    for driver in new_drivers:
+        for dependency in driver_dependencies.get(driver, ()):
+            if dependency not in new_drivers:
+                new_drivers.append(dependency)
+
+    if not new_drivers:
+        print("Warning: No valid drivers requested")
+        sys.exit(2)
+    else:
+        print(f"Processing {len(new_drivers)} driver(s): {', '.join(new_drivers)}")
+
+    source = resolve_source(args)
+    print(f"Driver source: {source}")
+
+    failed = 0
+    for project in projects:
+        if not update_project(source, project, new_drivers, args.dry_run):
+            failed += 1
+
+    print(f"\nIf using CMake: include(Drivers/{cmake_name}) and target_link_libraries(<target> {cmake_target})")
+    sys.exit(4 if failed else 0)
@@ -0,0 +1,196 @@
+#include "main.h"
+#include <string.h>
+
+#define MAX_DEVICES 8
+#define SPI_PCLK 84000000           // APB2, SPI1 on an F4 at 168MHz
+#define SPI_INIT_NS 2000            // HAL_SPI_Init on an already initialised peripheral
+
+GPIO_TypeDef host_gpio[4];
+uint32_t SystemCoreClock = 168000000;
+
+static host_device_t* devices[MAX_DEVICES];
+static uint32_t device_count = 0;
+static uint64_t time_ns = 0;
+static uint64_t spi_bytes = 0;
+static uint32_t spi_clock = 20000000;
+static DWT_Type dwt;
+static CoreDebug_Type core_debug;
+static void (*interrupt_handler)(void* context) = NULL;
+static void* interrupt_context = NULL;
+static uint8_t in_interrupt = 0;
+static uint32_t spi_inits = 0;
+
+static void run_interrupt(void) {
+    if ((interrupt_handler == NULL) || in_interrupt) return;
+    in_interrupt = 1;
+    interrupt_handler(interrupt_context);
+    in_interrupt = 0;
+}
+
+int host_attach_device(host_device_t* device) {
+    if (!device) return -1;
+    if (device_count >= MAX_DEVICES) return -1;
+    devices[device_count++] = device;
+    if (!device->shared) device->cs_port->ODR |= device->cs_pin;    // CS idles high
+    return 0;
+}
+
+void host_reset(void) {
+    device_count = 0;
+    time_ns = 0;
+    spi_bytes = 0;
+    spi_inits = 0;
+    interrupt_handler = NULL;
+    interrupt_context = NULL;
+    memset(host_gpio, 0, sizeof(host_gpio));
+    memset(&dwt, 0, sizeof(dwt));
+    memset(&core_debug, 0, sizeof(core_debug));
+}
+
+void host_set_spi_clock(uint32_t hz) {
+    if (hz != 0) spi_clock = hz;
+}
+
+uint64_t host_time_ns(void) {
+    return time_ns;
+}
+
+void host_advance_ns(uint64_t ns) {
+    time_ns += ns;
+    run_interrupt();
+}
+
+uint64_t host_spi_bytes(void) {
+    return spi_bytes;
+}
+
+void host_set_interrupt(void (*handler)(void* context), void* context) {
+    interrupt_handler = handler;
+    interrupt_context = context;
+}
+
+uint32_t host_spi_inits(void) {
+    return spi_inits;
+}
+
+void HAL_GPIO_WritePin(GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState) {
+    uint32_t previous = GPIOx->ODR;
+    if (PinState == GPIO_PIN_SET) {
+        GPIOx->ODR |= GPIO_Pin;
+    } else {
+        GPIOx->ODR &= ~(uint32_t)GPIO_Pin;
+    }
+    if (previous == GPIOx->ODR) return;
+
+    for (uint32_t i = 0; i < device_count; i++) {
+        if ((devices[i]->cs_port == GPIOx) && (devices[i]->cs_pin & GPIO_Pin)) {
+            devices[i]->select(devices[i]->context, PinState == GPIO_PIN_RESET);
+        }
+    }
+}
+
+static HAL_StatusTypeDef spi_exchange(SPI_HandleTypeDef* hspi, const uint8_t* tx_data, uint8_t* rx_data, uint16_t size) {
+    for (uint32_t i = 0; i < device_count; i++) {
+        if ((devices[i]->hspi != NULL) && (devices[i]->hspi != hspi)) continue;
+        if (devices[i]->shared || ((devices[i]->cs_port->ODR & devices[i]->cs_pin) == 0)) {
+            devices[i]->transfer(devices[i]->context, tx_data, rx_data, size);
+        }
+    }
+    uint32_t clock = (hspi && hspi->host_clock) ? hspi->host_clock : spi_clock;
+    spi_bytes += size;
+    time_ns += ((uint64_t)size * 8 * 1000000000ULL) / clock;
+    run_interrupt();
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_Init(SPI_HandleTypeDef* hspi) {
+    if (!hspi) return HAL_ERROR;
+    hspi->host_clock = SPI_PCLK >> ((hspi->Init.BaudRatePrescaler >> 3) + 1);
+    spi_inits++;
+    time_ns += SPI_INIT_NS;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_Transmit(SPI_HandleTypeDef* hspi, uint8_t* pData, uint16_t Size, uint32_t Timeout) {
+    (void)Timeout;
+    return spi_exchange(hspi, pData, NULL, Size);
+}
+
+HAL_StatusTypeDef HAL_SPI_Receive(SPI_HandleTypeDef* hspi, uint8_t* pData, uint16_t Size, uint32_t Timeout) {
+    (void)Timeout;
+    memset(pData, 0xFF, Size);
+    return spi_exchange(hspi, NULL, pData, Size);
+}
+
+HAL_StatusTypeDef HAL_SPI_TransmitReceive(SPI_HandleTypeDef* hspi, uint8_t* pTxData, uint8_t* pRxData, uint16_t Size, uint32_t Timeout) {
+    (void)Timeout;
+    return spi_exchange(hspi, pTxData, pRxData, Size);
+}
+
+// Interrupt and DMA transfers complete immediately and call the completion callback before returning
+HAL_StatusTypeDef HAL_SPI_Transmit_IT(SPI_HandleTypeDef* hspi, uint8_t* pData, uint16_t Size) {
+    HAL_StatusTypeDef status = spi_exchange(hspi, pData, NULL, Size);
+    HAL_SPI_TxCpltCallback(hspi);
+    return status;
+}
+
+HAL_StatusTypeDef HAL_SPI_Transmit_DMA(SPI_HandleTypeDef* hspi, uint8_t* pData, uint16_t Size) {
+    HAL_StatusTypeDef status = spi_exchange(hspi, pData, NULL, Size);
+    HAL_SPI_TxCpltCallback(hspi);
+    return status;
+}
+
+HAL_StatusTypeDef HAL_SPI_Receive_DMA(SPI_HandleTypeDef* hspi, uint8_t* pData, uint16_t Size) {
+    memset(pData, 0xFF, Size);
+    HAL_StatusTypeDef status = spi_exchange(hspi, NULL, pData, Size);
+    HAL_SPI_RxCpltCallback(hspi);
+    return status;
+}
+
+HAL_StatusTypeDef HAL_SPI_TransmitReceive_DMA(SPI_HandleTypeDef* hspi, uint8_t* pTxData, uint8_t* pRxData, uint16_t Size) {
+    HAL_StatusTypeDef status = spi_exchange(hspi, pTxData, pRxData, Size);
+    HAL_SPI_TxRxCpltCallback(hspi);
+    return status;
+}
+
+// Nothing is ever left in flight, the bytes were already exchanged
+HAL_StatusTypeDef HAL_SPI_Abort(SPI_HandleTypeDef* hspi) {
+    if (!hspi) return HAL_ERROR;
+    return HAL_OK;
+}
+
+__attribute__((weak)) void HAL_SPI_TxCpltCallback(SPI_HandleTypeDef* hspi) {
+    (void)hspi;
+}
+
+__attribute__((weak)) void HAL_SPI_RxCpltCallback(SPI_HandleTypeDef* hspi) {
+    (void)hspi;
+}
+
+__attribute__((weak)) void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef* hspi) {
+    (void)hspi;
+}
+
+void HAL_Delay(uint32_t Delay) {
+    time_ns += (uint64_t)Delay * 1000000ULL;
+    run_interrupt();
+}
+
+uint32_t HAL_GetTick(void) {
+    // Polling loops that only read the tick still make progress
+    time_ns += 100;
+    return (uint32_t)(time_ns / 1000000ULL);
+}
+
+DWT_Type* host_dwt(void) {
+    // Like HAL_GetTick, loops that only read the counter still make progress
+    time_ns += 10;
+    if (dwt.CTRL & DWT_CTRL_CYCCNTENA_Msk) {
+        dwt.CYCCNT = (uint32_t)((time_ns * (SystemCoreClock / 1000000U)) / 1000U);
+    }
+    return &dwt;
+}
+
+CoreDebug_Type* host_core_debug(void) {
+    return &core_debug;
+}
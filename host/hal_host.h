@@ -0,0 +1,72 @@
+#ifndef HAL_HOST_H_
+#define HAL_HOST_H_
+
+#include <stdint.h>
+
+// Device behind a chip select pin. select is called on CS edges (1 when the pin goes low), transfer exchanges
+// bytes while selected. A device without a chip select (shared) sees every byte on its bus and cs_pin is only
+// watched for edges, e.g. the latch of a 595 chain
+typedef struct {
+    GPIO_TypeDef* cs_port;
+    uint16_t cs_pin;
+    SPI_HandleTypeDef* hspi;    // Bus the device sits on, NULL for every bus
+    uint8_t shared;
+    void (*select)(void* context, uint8_t selected);
+    void (*transfer)(void* context, const uint8_t* tx_data, uint8_t* rx_data, uint32_t size);
+    void* context;
+} host_device_t;
+
+/**
+ * @brief Attach a simulated device to a chip select pin (active low, driven high here) or, for a shared device,
+ * to a pin that is only watched
+ *
+ * @param device        Device description, must stay valid
+ *
+ * @return 0 or -1
+ */
+int host_attach_device(host_device_t* device);
+
+/**
+ * @brief Remove all attached devices and reset the virtual clock to 0
+ */
+void host_reset(void);
+
+/**
+ * @brief Set the simulated SPI clock used to charge transfer time to the virtual clock
+ *
+ * @param hz            SPI clock in Hz
+ */
+void host_set_spi_clock(uint32_t hz);
+
+/**
+ * @brief Current virtual time in ns
+ */
+uint64_t host_time_ns(void);
+
+/**
+ * @brief Advance the virtual clock
+ *
+ * @param ns            Time to add in ns
+ */
+void host_advance_ns(uint64_t ns);
+
+/**
+ * @brief Number of bytes clocked on the SPI bus since host_reset
+ */
+uint64_t host_spi_bytes(void);
+
+/**
+ * @brief Install a function called each time the virtual clock moves (SPI transfers, delays, host_advance_ns),
+ * standing in for an interrupt taken while the CPU waits. Not called again while it is running
+ *
+ * @param handler       Interrupt function, NULL to remove
+ * @param context       Passed to the handler
+ */
+void host_set_interrupt(void (*handler)(void* context), void* context);
+
+/**
+ * @brief Number of HAL_SPI_Init calls since host_reset, each one charged as a peripheral reconfiguration
+ */
+uint32_t host_spi_inits(void);
+
+#endif /* HAL_HOST_H_ */
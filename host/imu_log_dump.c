@@ -0,0 +1,72 @@
+/*
+ * Decode an IMU-LOGGER flash dump (e.g. read out with w25q64jv_fast_read, or written by logger_bench) to CSV on
+ * stdout: time in timestamp ticks, accel XYZ, gyro XYZ, temperature, all raw LSB. Decoding stops at the first
+ * erased page. Corrupt blocks, sequence gaps and lost samples are reported on stderr.
+ *
+ * cc -O2 -IIMU-LOGGER -IW25Q64JV IMU-LOGGER/imu_log_block.c W25Q64JV/W25Q64JV_crc.c host/imu_log_dump.c -o imu_log_dump
+ * ./imu_log_dump log.bin [offset] > log.csv
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "imu_log_block.h"
+
+static int erased(const uint8_t* block) {
+    for (uint32_t i = 0; i < IMU_LOG_BLOCK_SIZE; i++) {
+        if (block[i] != 0xFF) return 0;
+    }
+    return 1;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <flash dump> [offset]\n", argv[0]);
+        return 1;
+    }
+    FILE* file = fopen(argv[1], "rb");
+    if (file == NULL) {
+        fprintf(stderr, "cannot open %s\n", argv[1]);
+        return 1;
+    }
+    long offset = (argc > 2) ? strtol(argv[2], NULL, 0) : 0;
+    if (fseek(file, offset, SEEK_SET) != 0) {
+        fprintf(stderr, "cannot seek to %ld\n", offset);
+        fclose(file);
+        return 1;
+    }
+
+    static uint8_t block[IMU_LOG_BLOCK_SIZE];
+    static imu_log_sample_t samples[IMU_LOG_BLOCK_MAX_SAMPLES];
+    uint32_t blocks = 0, bad = 0, samples_total = 0, lost = 0;
+    uint32_t expected = 0;
+    printf("time,accel_x,accel_y,accel_z,gyro_x,gyro_y,gyro_z,temperature\n");
+    while (fread(block, 1, sizeof(block), file) == sizeof(block)) {
+        if (erased(block)) break;
+        imu_log_block_info_t info;
+        int count = imu_log_block_decode(block, &info, samples, IMU_LOG_BLOCK_MAX_SAMPLES);
+        if (count < 0) {
+            fprintf(stderr, "block at 0x%lx: corrupt, skipped\n", offset + ((long)(blocks + bad) * IMU_LOG_BLOCK_SIZE));
+            bad++;
+            continue;
+        }
+        if ((blocks > 0) && (info.sequence != expected)) {
+            fprintf(stderr, "block %lu: sequence jumps from %lu\n", (unsigned long)info.sequence, (unsigned long)expected);
+        }
+        if (info.lost) fprintf(stderr, "block %lu: %u samples lost before it\n", (unsigned long)info.sequence, info.lost);
+        expected = info.sequence + 1;
+        lost += info.lost;
+        blocks++;
+        samples_total += (uint32_t)count;
+
+        for (int i = 0; i < count; i++) {
+            const imu_log_sample_t* s = &samples[i];
+            printf("%lu,%d,%d,%d,%d,%d,%d,%d\n", (unsigned long)s->time, s->accel[0], s->accel[1], s->accel[2],
+                   s->gyro[0], s->gyro[1], s->gyro[2], s->temperature);
+        }
+    }
+    fclose(file);
+    fprintf(stderr, "%lu blocks, %lu samples (%.2f bytes each), %lu corrupt blocks, %lu samples lost\n",
+            (unsigned long)blocks, (unsigned long)samples_total,
+            samples_total ? ((double)blocks * IMU_LOG_BLOCK_SIZE / samples_total) : 0.0, (unsigned long)bad,
+            (unsigned long)lost);
+    return bad ? 2 : 0;
+}
@@ -0,0 +1,126 @@
+#ifndef HOST_MAIN_H_
+#define HOST_MAIN_H_
+
+/*
+ * Host stand-in for the CubeMX generated main.h. Provides the subset of the STM32 HAL the drivers use,
+ * backed by a virtual clock and simulated devices attached to chip select pins (see hal_host.c)
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    HAL_OK = 0x00,
+    HAL_ERROR = 0x01,
+    HAL_BUSY = 0x02,
+    HAL_TIMEOUT = 0x03
+} HAL_StatusTypeDef;
+
+typedef enum {
+    GPIO_PIN_RESET = 0,
+    GPIO_PIN_SET
+} GPIO_PinState;
+
+typedef struct {
+    uint32_t ODR;
+} GPIO_TypeDef;
+
+typedef struct {
+    uint32_t CLKPolarity;
+    uint32_t CLKPhase;
+    uint32_t BaudRatePrescaler;
+} SPI_InitTypeDef;
+
+typedef struct {
+    uint32_t id;
+    SPI_InitTypeDef Init;
+    uint32_t host_clock;        // Set by HAL_SPI_Init from the prescaler, 0 uses host_set_spi_clock
+} SPI_HandleTypeDef;
+
+#define SPI_POLARITY_LOW 0x00000000U
+#define SPI_POLARITY_HIGH 0x00000002U
+#define SPI_PHASE_1EDGE 0x00000000U
+#define SPI_PHASE_2EDGE 0x00000001U
+#define SPI_BAUDRATEPRESCALER_2 0x00000000U
+#define SPI_BAUDRATEPRESCALER_4 0x00000008U
+#define SPI_BAUDRATEPRESCALER_8 0x00000010U
+#define SPI_BAUDRATEPRESCALER_16 0x00000018U
+#define SPI_BAUDRATEPRESCALER_32 0x00000020U
+#define SPI_BAUDRATEPRESCALER_64 0x00000028U
+#define SPI_BAUDRATEPRESCALER_128 0x00000030U
+#define SPI_BAUDRATEPRESCALER_256 0x00000038U
+
+#define HAL_MAX_DELAY 0xFFFFFFFFU
+
+#define GPIO_PIN_0 ((uint16_t)0x0001)
+#define GPIO_PIN_1 ((uint16_t)0x0002)
+#define GPIO_PIN_2 ((uint16_t)0x0004)
+#define GPIO_PIN_3 ((uint16_t)0x0008)
+#define GPIO_PIN_4 ((uint16_t)0x0010)
+#define GPIO_PIN_5 ((uint16_t)0x0020)
+#define GPIO_PIN_6 ((uint16_t)0x0040)
+#define GPIO_PIN_7 ((uint16_t)0x0080)
+#define GPIO_PIN_8 ((uint16_t)0x0100)
+#define GPIO_PIN_9 ((uint16_t)0x0200)
+#define GPIO_PIN_10 ((uint16_t)0x0400)
+#define GPIO_PIN_11 ((uint16_t)0x0800)
+#define GPIO_PIN_12 ((uint16_t)0x1000)
+#define GPIO_PIN_13 ((uint16_t)0x2000)
+#define GPIO_PIN_14 ((uint16_t)0x4000)
+#define GPIO_PIN_15 ((uint16_t)0x8000)
+
+extern GPIO_TypeDef host_gpio[4];
+#define GPIOA (&host_gpio[0])
+#define GPIOB (&host_gpio[1])
+#define GPIOC (&host_gpio[2])
+#define GPIOD (&host_gpio[3])
+
+void HAL_GPIO_WritePin(GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState);
+
+HAL_StatusTypeDef HAL_SPI_Init(SPI_HandleTypeDef* hspi);
+HAL_StatusTypeDef HAL_SPI_Transmit(SPI_HandleTypeDef* hspi, uint8_t* pData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_SPI_Receive(SPI_HandleTypeDef* hspi, uint8_t* pData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_SPI_TransmitReceive(SPI_HandleTypeDef* hspi, uint8_t* pTxData, uint8_t* pRxData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_SPI_Transmit_IT(SPI_HandleTypeDef* hspi, uint8_t* pData, uint16_t Size);
+HAL_StatusTypeDef HAL_SPI_Transmit_DMA(SPI_HandleTypeDef* hspi, uint8_t* pData, uint16_t Size);
+HAL_StatusTypeDef HAL_SPI_Receive_DMA(SPI_HandleTypeDef* hspi, uint8_t* pData, uint16_t Size);
+HAL_StatusTypeDef HAL_SPI_TransmitReceive_DMA(SPI_HandleTypeDef* hspi, uint8_t* pTxData, uint8_t* pRxData, uint16_t Size);
+HAL_StatusTypeDef HAL_SPI_Abort(SPI_HandleTypeDef* hspi);
+void HAL_SPI_TxCpltCallback(SPI_HandleTypeDef* hspi);
+void HAL_SPI_RxCpltCallback(SPI_HandleTypeDef* hspi);
+void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef* hspi);
+
+void HAL_Delay(uint32_t Delay);
+uint32_t HAL_GetTick(void);
+
+// Cortex-M cycle counter, CYCCNT follows the virtual clock at SystemCoreClock
+typedef struct {
+    volatile uint32_t CTRL;
+    volatile uint32_t CYCCNT;
+} DWT_Type;
+
+typedef struct {
+    volatile uint32_t DEMCR;
+} CoreDebug_Type;
+
+#define DWT_CTRL_CYCCNTENA_Msk (1UL)
+#define CoreDebug_DEMCR_TRCENA_Msk (1UL << 24)
+
+DWT_Type* host_dwt(void);
+CoreDebug_Type* host_core_debug(void);
+#define DWT (host_dwt())
+#define CoreDebug (host_core_debug())
+
+extern uint32_t SystemCoreClock;
+
+#include "hal_host.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HOST_MAIN_H_ */
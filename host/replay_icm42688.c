@@ -0,0 +1,139 @@
+#include "replay_icm42688.h"
+#include "icm_42688_capture.h"
+#include "icm_42688_registers.h"
+#include <string.h>
+
+#define WHO_AM_I_VALUE 0x47
+
+static uint16_t get_le16(const uint8_t* data) {
+    return (uint16_t)(data[0] | (data[1] << 8));
+}
+
+static uint32_t get_le32(const uint8_t* data) {
+    return (uint32_t)get_le16(data) | ((uint32_t)get_le16(&data[2]) << 16);
+}
+
+int replay_icm42688_next(const uint8_t* capture, uint32_t size, uint32_t* offset, uint32_t* time, uint16_t* fifo_count,
+                         const uint8_t** data, uint16_t* data_size) {
+    if ((capture == NULL) || (offset == NULL) || (data == NULL) || (data_size == NULL)) return -1;
+    if (*offset < ICM_42688_CAPTURE_HEADER_SIZE) *offset = ICM_42688_CAPTURE_HEADER_SIZE;
+    if (*offset >= size) return 0;
+    if ((size - *offset) < ICM_42688_CAPTURE_RECORD_SIZE) return -1;
+
+    const uint8_t* record = &capture[*offset];
+    uint16_t bytes = get_le16(&record[6]);
+    if ((size - *offset - ICM_42688_CAPTURE_RECORD_SIZE) < bytes) return -1;
+    if (time != NULL) *time = get_le32(&record[0]);
+    if (fifo_count != NULL) *fifo_count = get_le16(&record[4]);
+    *data = &record[ICM_42688_CAPTURE_RECORD_SIZE];
+    *data_size = bytes;
+    *offset += ICM_42688_CAPTURE_RECORD_SIZE + bytes;
+    return 1;
+}
+
+// Next record into the FIFO, from the start again when looping
+static void load_record(replay_icm42688_t* replay) {
+    int status = replay_icm42688_next(replay->capture, replay->size, &replay->offset, &replay->record_time,
+                                      &replay->record_fifo_count, &replay->data, &replay->remaining);
+    if ((status == 0) && replay->loop && (replay->stats.records > 0)) {
+        replay->offset = 0;
+        replay->stats.passes++;
+        status = replay_icm42688_next(replay->capture, replay->size, &replay->offset, &replay->record_time,
+                                      &replay->record_fifo_count, &replay->data, &replay->remaining);
+    }
+    if (status != 1) {
+        replay->remaining = 0;
+        return;
+    }
+    replay->stats.records++;
+}
+
+static uint8_t read_register(replay_icm42688_t* replay, uint8_t address) {
+    if (address == REG_BANK_SEL) return replay->bank;
+    if (replay->bank != 0) return 0;
+
+    switch (address) {
+        case FIFO_COUNTH:
+        if (replay->remaining == 0) load_record(replay);
+        return (uint8_t)(replay->remaining >> 8);
+        case FIFO_COUNTL:
+        return (uint8_t)replay->remaining;
+        case FIFO_DATA:
+        if (replay->remaining == 0) {
+            replay->stats.underruns++;
+            return 0xFF;
+        }
+        replay->remaining--;
+        replay->stats.fifo_bytes_read++;
+        return *replay->data++;
+        case WHO_AM_I:
+        return WHO_AM_I_VALUE;
+        default:
+        return 0;
+    }
+}
+
+static void device_select(void* context, uint8_t selected) {
+    replay_icm42688_t* replay = (replay_icm42688_t*)context;
+    (void)selected;
+    replay->position = 0;
+}
+
+// Same framing as the model: R/W and address, then data with the address incrementing except on FIFO_DATA
+static void transfer(void* context, const uint8_t* tx_data, uint8_t* rx_data, uint32_t size) {
+    replay_icm42688_t* replay = (replay_icm42688_t*)context;
+    for (uint32_t i = 0; i < size; i++) {
+        uint8_t in = tx_data ? tx_data[i] : 0xFF;
+        uint8_t out = 0xFF;
+        if (replay->position++ == 0) {
+            replay->read = (in & 0x80) != 0;
+            replay->address = in & 0x7F;
+        } else {
+            if (replay->read) {
+                out = read_register(replay, replay->address);
+            } else if (replay->address == REG_BANK_SEL) {
+                replay->bank = in & 0x07;
+            }
+            if ((replay->bank != 0) || (replay->address != FIFO_DATA)) replay->address = (replay->address + 1) & 0x7F;
+        }
+        if (rx_data != NULL) rx_data[i] = out;
+    }
+}
+
+void replay_icm42688_rewind(replay_icm42688_t* replay) {
+    if (!replay) return;
+    replay->offset = 0;
+    replay->data = NULL;
+    replay->remaining = 0;
+    replay->record_time = 0;
+    replay->record_fifo_count = 0;
+    memset(&replay->stats, 0, sizeof(replay->stats));
+}
+
+int replay_icm42688_init(replay_icm42688_t* replay, GPIO_TypeDef* cs_port, uint16_t cs_pin, const uint8_t* capture, uint32_t size) {
+    if (!replay) return -1;
+    if ((capture == NULL) || (size < ICM_42688_CAPTURE_HEADER_SIZE)) return -1;
+    if (get_le32(&capture[0]) != ICM_42688_CAPTURE_MAGIC) return -1;
+    if (capture[4] != ICM_42688_CAPTURE_VERSION) return -1;
+
+    // Walk the records once so a truncated capture is caught here rather than mid replay
+    uint32_t offset = 0;
+    const uint8_t* data;
+    uint16_t data_size;
+    int status;
+    while ((status = replay_icm42688_next(capture, size, &offset, NULL, NULL, &data, &data_size)) == 1) {
+    }
+    if (status != 0) return -1;
+
+    memset(replay, 0, sizeof(*replay));
+    replay->capture = capture;
+    replay->size = size;
+    replay->packet_no = capture[5];
+    replay->tick_hz = get_le32(&capture[8]);
+    replay->device.cs_port = cs_port;
+    replay->device.cs_pin = cs_pin;
+    replay->device.select = &device_select;
+    replay->device.transfer = &transfer;
+    replay->device.context = replay;
+    return host_attach_device(&replay->device);
+}
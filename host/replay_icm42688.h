@@ -0,0 +1,79 @@
+#ifndef REPLAY_ICM42688_H_
+#define REPLAY_ICM42688_H_
+
+#include "main.h"
+#include <stdint.h>
+
+/*
+ * Plays an ICM-42688-P FIFO capture (ICM-42688-P/icm_42688_capture.h) back through the SPI bus in place of the
+ * sensor model. Reading FIFO_COUNTH once the previous burst has been read out loads the next record, FIFO_COUNT
+ * then reports its bytes and FIFO_DATA returns them. Records are served as fast as they are read, their times
+ * are only reported. Register writes are accepted and ignored apart from REG_BANK_SEL, FIFO_COUNT is big endian.
+ */
+
+typedef struct {
+    uint32_t records;
+    uint64_t fifo_bytes_read;
+    uint32_t underruns;             // FIFO_DATA read with no bytes left in the record
+    uint32_t passes;                // Times the capture ran out and started over
+} replay_icm42688_stats_t;
+
+typedef struct {
+    host_device_t device;
+    const uint8_t* capture;
+    uint32_t size;
+    uint8_t packet_no;              // From the capture header
+    uint32_t tick_hz;
+    uint8_t loop;                   // Start over at the end instead of reporting an empty FIFO
+
+    uint32_t offset;                // Next record
+    const uint8_t* data;            // Rest of the record being read
+    uint16_t remaining;
+    uint32_t record_time;           // Time and FIFO_COUNT the record was captured with
+    uint16_t record_fifo_count;
+
+    uint8_t bank;
+    uint32_t position;
+    uint8_t read;
+    uint8_t address;
+
+    replay_icm42688_stats_t stats;
+} replay_icm42688_t;
+
+/**
+ * @brief Check a capture and attach the replay device to a chip select pin
+ *
+ * @param replay        Replay structure
+ * @param cs_port       Chip select port
+ * @param cs_pin        Chip select pin
+ * @param capture       Capture, header and records, must stay valid
+ * @param size          Bytes in capture
+ *
+ * @return 0 or -1 (not a capture, unknown version or a truncated record)
+ */
+int replay_icm42688_init(replay_icm42688_t* replay, GPIO_TypeDef* cs_port, uint16_t cs_pin, const uint8_t* capture, uint32_t size);
+
+/**
+ * @brief Go back to the first record and clear the counters
+ *
+ * @param replay        Replay structure
+ */
+void replay_icm42688_rewind(replay_icm42688_t* replay);
+
+/**
+ * @brief Step through the records of a capture without the bus, e.g. for a reference decode
+ *
+ * @param capture       Capture, header and records
+ * @param size          Bytes in capture
+ * @param offset        Record offset, 0 for the first record, advanced past the record returned
+ * @param time          Return data, record time in ticks (may be NULL)
+ * @param fifo_count    Return data, FIFO_COUNT when captured (may be NULL)
+ * @param data          Return data, the record's FIFO bytes
+ * @param data_size     Return data, bytes at data
+ *
+ * @return 1 for a record, 0 at the end, -1 for a damaged capture
+ */
+int replay_icm42688_next(const uint8_t* capture, uint32_t size, uint32_t* offset, uint32_t* time, uint16_t* fifo_count,
+                         const uint8_t** data, uint16_t* data_size);
+
+#endif /* REPLAY_ICM42688_H_ */
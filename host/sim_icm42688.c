@@ -0,0 +1,419 @@
+#include "sim_icm42688.h"
+#include "icm_42688_registers.h"
+#include <string.h>
+
+#define WHO_AM_I_VALUE 0x47
+
+// INT_STATUS bits, cleared on read
+#define INT_STATUS_DATA_RDY 0x08
+#define INT_STATUS_FIFO_THS 0x04
+#define INT_STATUS_FIFO_FULL 0x02
+
+// INT_STATUS2 / INT_SOURCE1 wake on motion bits, X Y Z
+#define INT_STATUS2_WOM 0x07
+
+// SMD_CONFIG: SMD_MODE 01 is wake on motion, WOM_MODE compares with the previous sample instead of the first
+#define SMD_CONFIG_MODE_MASK 0x03
+#define SMD_CONFIG_MODE_WOM 0x01
+#define SMD_CONFIG_WOM_PREVIOUS 0x04
+
+#define SIGNAL_PATH_RESET_TMST_STROBE 0x04
+#define SIGNAL_PATH_RESET_FIFO_FLUSH 0x02
+
+#define TMST_CONFIG_TO_REGS_EN 0x10
+#define TMST_CONFIG_RES 0x08
+
+// RTC_MODE in INTF_CONFIG1, PIN9_FUNCTION CLKIN in INTF_CONFIG5 (bank 1)
+#define INTF_CONFIG1_RTC_MODE 0x04
+#define INTF_CONFIG5_PIN9_MASK 0x06
+#define INTF_CONFIG5_PIN9_CLKIN 0x04
+
+#define INTF_CONFIG0_FIFO_COUNT_REC 0x40
+#define INTF_CONFIG0_FIFO_COUNT_ENDIAN 0x20
+
+// FIFO_CONFIG1 enables
+#define FIFO_ACCEL_EN 0x01
+#define FIFO_GYRO_EN 0x02
+#define FIFO_HIRES_EN 0x10
+
+// Sample period in ns for ODR codes 1 (32kHz) to 15 (500Hz)
+static const uint64_t odr_period[16] = {0, 31250, 62500, 125000, 250000, 500000, 1000000, 5000000, 10000000,
+                                        20000000, 40000000, 80000000, 160000000, 320000000, 640000000, 2000000};
+
+// Datasheet reset values of the registers the drivers touch, everything else resets to 0
+static void reset_registers(sim_icm42688_t* sim) {
+    memset(sim->registers, 0, sizeof(sim->registers));
+    uint8_t* bank0 = sim->registers[0];
+    bank0[DRIVE_CONFIG] = 0x05;
+    bank0[INTF_CONFIG0] = 0x30;
+    bank0[INTF_CONFIG1] = 0x91;
+    bank0[GYRO_CONFIG0] = 0x06;
+    bank0[ACCEL_CONFIG0] = 0x06;
+    bank0[GYRO_CONFIG1] = 0x16;
+    bank0[GYRO_ACCEL_CONFIG0] = 0x11;
+    bank0[ACCEL_CONFIG1] = 0x0D;
+    bank0[TMST_CONFIG] = 0x23;
+    bank0[APEX_CONFIG0] = 0x82;
+    bank0[FSYNC_CONFIG] = 0x10;
+    bank0[INT_CONFIG1] = 0x10;
+    bank0[INT_SOURCE0] = 0x10;
+    bank0[FIFO_CONFIG2] = 0x00;
+    bank0[WHO_AM_I] = WHO_AM_I_VALUE;
+    sim->registers[1][INTF_CONFIG4] = 0x83;
+    sim->registers[1][INTF_CONFIG6] = 0x5F;
+    sim->registers[3][CLKDIV] = 0x1F;
+    sim->bank = 0;
+    sim->fifo_head = 0;
+    sim->fifo_count = 0;
+}
+
+static uint8_t packet_size(uint8_t fifo_config1) {
+    if (fifo_config1 & FIFO_HIRES_EN) return 20;
+    if ((fifo_config1 & FIFO_ACCEL_EN) && (fifo_config1 & FIFO_GYRO_EN)) return 16;
+    if (fifo_config1 & (FIFO_ACCEL_EN | FIFO_GYRO_EN)) return 8;
+    return 0;
+}
+
+// Time in the current PWR_MGMT0 modes up to now
+static void account_power(sim_icm42688_t* sim) {
+    uint64_t now = host_time_ns();
+    uint64_t elapsed = now - sim->power_ns;
+    uint8_t power = sim->registers[0][PWR_MGMT0];
+    if ((power & 0x03) == 2) sim->stats.accel_lp_ns += elapsed;
+    if ((power & 0x03) == 3) sim->stats.accel_ln_ns += elapsed;
+    if (((power >> 2) & 0x03) == 3) sim->stats.gyro_ln_ns += elapsed;
+    sim->power_ns = now;
+}
+
+// Host time to sensor time with the clock in use since clock_ns
+static uint64_t sensor_time(sim_icm42688_t* sim, uint64_t time_ns) {
+    int64_t elapsed = (int64_t)(time_ns - sim->clock_ns);
+    return sim->sensor_ns + (uint64_t)(elapsed + (elapsed * sim->clock_ppm / 1000000));
+}
+
+// Timer in TMST_RES units
+static uint32_t sensor_timer(sim_icm42688_t* sim, uint64_t time_ns) {
+    return (uint32_t)(sensor_time(sim, time_ns) / ((sim->registers[0][TMST_CONFIG] & TMST_CONFIG_RES) ? 16000 : 1000));
+}
+
+static void update_clock(sim_icm42688_t* sim) {
+    int32_t ppm = sim->internal_ppm;
+    uint8_t clkin = (sim->registers[1][INTF_CONFIG5] & INTF_CONFIG5_PIN9_MASK) == INTF_CONFIG5_PIN9_CLKIN;
+    if (clkin && (sim->registers[0][INTF_CONFIG1] & INTF_CONFIG1_RTC_MODE)) ppm = sim->clkin_ppm;
+    uint64_t now = host_time_ns();
+    sim->sensor_ns = sensor_time(sim, now);
+    sim->clock_ns = now;
+    sim->clock_ppm = ppm;
+}
+
+// Sensors run at the faster of the enabled ODRs, accel in low power or low noise, gyro in low noise
+static void update_rate(sim_icm42688_t* sim) {
+    uint8_t* bank0 = sim->registers[0];
+    update_clock(sim);
+    uint8_t accel_mode = bank0[PWR_MGMT0] & 0x03;
+    uint8_t gyro_mode = (bank0[PWR_MGMT0] >> 2) & 0x03;
+    uint64_t period = 0;
+    if (accel_mode >= 2) period = odr_period[bank0[ACCEL_CONFIG0] & 0x0F];
+    if (gyro_mode == 3) {
+        uint64_t gyro_period = odr_period[bank0[GYRO_CONFIG0] & 0x0F];
+        if ((period == 0) || ((gyro_period != 0) && (gyro_period < period))) period = gyro_period;
+    }
+    period = period * 1000000 / (uint64_t)(1000000 + sim->clock_ppm);
+    if ((period != 0) && (sim->sample_period == 0)) sim->next_sample = host_time_ns() + period;
+    sim->sample_period = period;
+    sim->packet_size = packet_size(bank0[FIFO_CONFIG1]);
+}
+
+static void default_source(sim_icm42688_t* sim, int16_t* accel, int16_t* gyro) {
+    for (int i = 0; i < 3; i++) {
+        sim->noise = (sim->noise * 1103515245U) + 12345U;
+        accel[i] = (int16_t)(((sim->noise >> 16) & 0x7) - 4);
+        sim->noise = (sim->noise * 1103515245U) + 12345U;
+        gyro[i] = (int16_t)(((sim->noise >> 16) & 0x7) - 4);
+    }
+    accel[2] += 2048;   // 1g at the reset full scale of 16g
+}
+
+static void put_be16(uint8_t* data, int16_t value) {
+    data[0] = (uint8_t)((uint16_t)value >> 8);
+    data[1] = (uint8_t)value;
+}
+
+static void fifo_push(sim_icm42688_t* sim, const uint8_t* packet, uint8_t size) {
+    uint8_t mode = sim->registers[0][FIFO_CONFIG] >> 6;
+    if ((sim->fifo_count + size) > SIM_ICM42688_FIFO_SIZE) {
+        sim->registers[0][INT_STATUS] |= INT_STATUS_FIFO_FULL;
+        sim->stats.packets_lost++;
+        uint16_t lost = (uint16_t)(sim->registers[0][FIFO_LOST_PKT0] | (sim->registers[0][FIFO_LOST_PKT1] << 8)) + 1;
+        sim->registers[0][FIFO_LOST_PKT0] = (uint8_t)lost;
+        sim->registers[0][FIFO_LOST_PKT1] = (uint8_t)(lost >> 8);
+        if (mode != 1) return;     // Stop-on-full keeps the old data
+
+        // Stream mode overwrites the oldest packet
+        sim->fifo_head = (sim->fifo_head + size) % SIM_ICM42688_FIFO_SIZE;
+        sim->fifo_count -= size;
+    }
+    for (uint8_t i = 0; i < size; i++) {
+        sim->fifo[(sim->fifo_head + sim->fifo_count + i) % SIM_ICM42688_FIFO_SIZE] = packet[i];
+    }
+    sim->fifo_count += size;
+    sim->stats.packets++;
+
+    uint16_t threshold = (uint16_t)(sim->registers[0][FIFO_CONFIG2] | ((sim->registers[0][FIFO_CONFIG3] & 0x0F) << 8));
+    uint16_t level = sim->fifo_count;
+    if (sim->registers[0][INTF_CONFIG0] & INTF_CONFIG0_FIFO_COUNT_REC) level /= size;
+    if ((threshold != 0) && (level >= threshold)) sim->registers[0][INT_STATUS] |= INT_STATUS_FIFO_THS;
+}
+
+// Any axis further than its ACCEL_WOM_x_THR (1g / 256 steps) from the reference sets its INT_STATUS2 flag
+static void wake_on_motion(sim_icm42688_t* sim, const int16_t* accel) {
+    uint8_t* bank0 = sim->registers[0];
+    if ((bank0[SMD_CONFIG] & SMD_CONFIG_MODE_MASK) != SMD_CONFIG_MODE_WOM) return;
+    if (sim->wom_valid) {
+        int32_t lsb_per_g = 2048 << ((bank0[ACCEL_CONFIG0] >> 5) & 0x03);
+        uint8_t flags = 0;
+        for (int i = 0; i < 3; i++) {
+            int32_t threshold = (int32_t)sim->registers[4][ACCEL_WOM_X_THR + i] * lsb_per_g / 256;
+            int32_t change = (int32_t)accel[i] - sim->wom_reference[i];
+            if ((change > threshold) || (change < -threshold)) flags |= (uint8_t)(1 << i);
+        }
+        if (flags) {
+            bank0[INT_STATUS2] |= flags;
+            sim->stats.wom_events++;
+        }
+    }
+    if (!sim->wom_valid || (bank0[SMD_CONFIG] & SMD_CONFIG_WOM_PREVIOUS)) {
+        memcpy(sim->wom_reference, accel, sizeof(sim->wom_reference));
+        sim->wom_valid = 1;
+    }
+}
+
+static void sample(sim_icm42688_t* sim, uint64_t time_ns) {
+    int16_t accel[3];
+    int16_t gyro[3];
+    if (sim->source != NULL) {
+        sim->source(sim->source_context, time_ns, accel, gyro);
+    } else {
+        default_source(sim, accel, gyro);
+    }
+    sim->stats.samples++;
+
+    // A sensor that is off reads -32768
+    uint8_t* bank0 = sim->registers[0];
+    if ((bank0[PWR_MGMT0] & 0x03) < 2) accel[0] = accel[1] = accel[2] = INT16_MIN;
+    if (((bank0[PWR_MGMT0] >> 2) & 0x03) != 3) gyro[0] = gyro[1] = gyro[2] = INT16_MIN;
+    if ((bank0[PWR_MGMT0] & 0x03) >= 2) wake_on_motion(sim, accel);
+
+    for (int i = 0; i < 3; i++) {
+        put_be16(&bank0[ACCEL_DATA_X1 + (2 * i)], accel[i]);
+        put_be16(&bank0[GYRO_DATA_X1 + (2 * i)], gyro[i]);
+    }
+    bank0[INT_STATUS] |= INT_STATUS_DATA_RDY;
+    if (((bank0[FIFO_CONFIG] >> 6) == 0) || (sim->packet_size == 0)) return;
+
+    // Packet 1 / 2: header, accel or gyro, temp. Packet 3: header, accel, gyro, temp, timestamp.
+    // Packet 4 adds a second temperature byte and the 20-bit extension bytes. Temperature reads 25C
+    uint8_t packet[20] = {0};
+    uint16_t timestamp = (uint16_t)sensor_timer(sim, time_ns);
+    uint8_t fifo_config1 = bank0[FIFO_CONFIG1];
+    if (sim->packet_size == 8) {
+        packet[0] = (fifo_config1 & FIFO_ACCEL_EN) ? 0x40 : 0x20;
+        const int16_t* data = (fifo_config1 & FIFO_ACCEL_EN) ? accel : gyro;
+        for (int i = 0; i < 3; i++) put_be16(&packet[1 + (2 * i)], data[i]);
+    } else {
+        packet[0] = (sim->packet_size == 20) ? 0x78 : 0x68;
+        for (int i = 0; i < 3; i++) {
+            put_be16(&packet[1 + (2 * i)], accel[i]);
+            put_be16(&packet[7 + (2 * i)], gyro[i]);
+        }
+        uint8_t timestamp_index = (sim->packet_size == 20) ? 15 : 14;
+        packet[timestamp_index] = (uint8_t)(timestamp >> 8);
+        packet[timestamp_index + 1] = (uint8_t)timestamp;
+    }
+    uint8_t threshold = bank0[INT_STATUS] & INT_STATUS_FIFO_THS;
+    fifo_push(sim, packet, sim->packet_size);
+    if (!threshold && (bank0[INT_STATUS] & INT_STATUS_FIFO_THS)) sim->fifo_ths_ns = time_ns;
+}
+
+void sim_icm42688_update(sim_icm42688_t* sim) {
+    if (!sim) return;
+    account_power(sim);
+    if (sim->sample_period == 0) return;
+    uint64_t now = host_time_ns();
+    while (sim->next_sample <= now) {
+        sample(sim, sim->next_sample);
+        sim->next_sample += sim->sample_period;
+    }
+}
+
+static uint8_t fifo_pop(sim_icm42688_t* sim) {
+    if (sim->fifo_count == 0) return 0xFF;
+    uint8_t data = sim->fifo[sim->fifo_head];
+    sim->fifo_head = (sim->fifo_head + 1) % SIM_ICM42688_FIFO_SIZE;
+    sim->fifo_count--;
+    sim->stats.fifo_bytes_read++;
+    return data;
+}
+
+static uint8_t fifo_count_byte(sim_icm42688_t* sim, uint8_t high) {
+    uint16_t count = sim->fifo_count;
+    if ((sim->registers[0][INTF_CONFIG0] & INTF_CONFIG0_FIFO_COUNT_REC) && (sim->packet_size != 0)) count /= sim->packet_size;
+    // FIFO_COUNTH holds the high byte unless little endian counts are selected
+    if (!(sim->registers[0][INTF_CONFIG0] & INTF_CONFIG0_FIFO_COUNT_ENDIAN)) high = !high;
+    return high ? (uint8_t)(count >> 8) : (uint8_t)count;
+}
+
+static uint8_t read_register(sim_icm42688_t* sim, uint8_t address) {
+    sim->stats.register_reads++;
+    if (address == REG_BANK_SEL) return sim->bank;
+    if (sim->bank != 0) return sim->registers[sim->bank][address];
+
+    uint8_t data = sim->registers[0][address];
+    switch (address) {
+        case FIFO_DATA:
+        return fifo_pop(sim);
+        case FIFO_COUNTH:
+        return fifo_count_byte(sim, 1);
+        case FIFO_COUNTL:
+        return fifo_count_byte(sim, 0);
+        case INT_STATUS:
+        case INT_STATUS2:
+        case INT_STATUS3:
+        sim->registers[0][address] = 0;
+        return data;
+        default:
+        return data;
+    }
+}
+
+static void write_register(sim_icm42688_t* sim, uint8_t address, uint8_t data) {
+    sim->stats.register_writes++;
+    if (address == REG_BANK_SEL) {
+        sim->bank = (uint8_t)((data & 0x07) % SIM_ICM42688_BANKS);
+        return;
+    }
+    if (sim->bank != 0) {
+        sim->registers[sim->bank][address] = data;
+        if ((sim->bank == 1) && (address == INTF_CONFIG5)) update_rate(sim);
+        return;
+    }
+
+    switch (address) {
+        case DEVICE_CONFIG:
+        if (data & 0x01) {
+            account_power(sim);
+            reset_registers(sim);
+            sim->wom_valid = 0;
+            sim->stats.resets++;
+            update_rate(sim);
+            return;
+        }
+        break;
+        case SIGNAL_PATH_RESET:
+        if (data & SIGNAL_PATH_RESET_FIFO_FLUSH) {
+            sim->fifo_head = 0;
+            sim->fifo_count = 0;
+        }
+        if ((data & SIGNAL_PATH_RESET_TMST_STROBE) && (sim->registers[0][TMST_CONFIG] & TMST_CONFIG_TO_REGS_EN)) {
+            uint32_t timestamp = sensor_timer(sim, host_time_ns()) & 0xFFFFF;
+            sim->registers[1][TMSTVAL0] = (uint8_t)timestamp;
+            sim->registers[1][TMSTVAL1] = (uint8_t)(timestamp >> 8);
+            sim->registers[1][TMSTVAL2] = (uint8_t)(timestamp >> 16);
+        }
+        data &= ~(SIGNAL_PATH_RESET_FIFO_FLUSH | SIGNAL_PATH_RESET_TMST_STROBE);
+        break;
+        case WHO_AM_I:
+        case INT_STATUS:
+        case INT_STATUS2:
+        case INT_STATUS3:
+        case FIFO_COUNTH:
+        case FIFO_COUNTL:
+        case FIFO_DATA:
+        return;     // Read only
+        default:
+        break;
+    }
+    if (address == PWR_MGMT0) account_power(sim);
+    if (address == SMD_CONFIG) sim->wom_valid = 0;
+    sim->registers[0][address] = data;
+    if ((address == PWR_MGMT0) || (address == ACCEL_CONFIG0) || (address == GYRO_CONFIG0) || (address == FIFO_CONFIG1) ||
+        (address == INTF_CONFIG1)) {
+        update_rate(sim);
+    }
+}
+
+static void device_select(void* context, uint8_t selected) {
+    sim_icm42688_t* sim = (sim_icm42688_t*)context;
+    sim->selected = selected;
+    sim->position = 0;
+    if (selected) sim_icm42688_update(sim);
+}
+
+// The first byte is R/W and the address, then the address increments for each data byte except on FIFO_DATA
+static uint8_t exchange(sim_icm42688_t* sim, uint8_t in) {
+    if (sim->position++ == 0) {
+        sim->read = (in & 0x80) != 0;
+        sim->address = in & 0x7F;
+        return 0xFF;
+    }
+    uint8_t out = 0xFF;
+    if (sim->read) {
+        out = read_register(sim, sim->address);
+    } else {
+        write_register(sim, sim->address, in);
+    }
+    if ((sim->bank != 0) || (sim->address != FIFO_DATA)) sim->address = (sim->address + 1) & 0x7F;
+    return out;
+}
+
+static void transfer(void* context, const uint8_t* tx_data, uint8_t* rx_data, uint32_t size) {
+    sim_icm42688_t* sim = (sim_icm42688_t*)context;
+    for (uint32_t i = 0; i < size; i++) {
+        uint8_t out = exchange(sim, tx_data ? tx_data[i] : 0xFF);
+        if (rx_data != NULL) rx_data[i] = out;
+    }
+}
+
+int sim_icm42688_init(sim_icm42688_t* sim, GPIO_TypeDef* cs_port, uint16_t cs_pin) {
+    if (!sim) return -1;
+    memset(sim, 0, sizeof(*sim));
+    reset_registers(sim);
+    sim->noise = 1;
+    sim->power_ns = host_time_ns();
+    sim->sensor_ns = sim->power_ns;
+    sim->clock_ns = sim->power_ns;
+    sim->device.cs_port = cs_port;
+    sim->device.cs_pin = cs_pin;
+    sim->device.select = &device_select;
+    sim->device.transfer = &transfer;
+    sim->device.context = sim;
+    return host_attach_device(&sim->device);
+}
+
+int sim_icm42688_set_source(sim_icm42688_t* sim, sim_icm42688_source source, void* context) {
+    if (!sim) return -1;
+    sim->source = source;
+    sim->source_context = context;
+    return 0;
+}
+
+int sim_icm42688_set_clock_ppm(sim_icm42688_t* sim, int32_t internal_ppm, int32_t clkin_ppm) {
+    if (!sim) return -1;
+    sim_icm42688_update(sim);
+    sim->internal_ppm = internal_ppm;
+    sim->clkin_ppm = clkin_ppm;
+    update_rate(sim);
+    return 0;
+}
+
+uint8_t sim_icm42688_int1(sim_icm42688_t* sim) {
+    if (!sim) return 0;
+    sim_icm42688_update(sim);
+    uint8_t enabled = sim->registers[0][INT_SOURCE0];
+    uint8_t status = sim->registers[0][INT_STATUS];
+    if ((enabled & 0x08) && (status & INT_STATUS_DATA_RDY)) return 1;
+    if ((enabled & 0x04) && (status & INT_STATUS_FIFO_THS)) return 1;
+    if ((enabled & 0x02) && (status & INT_STATUS_FIFO_FULL)) return 1;
+    if (sim->registers[0][INT_SOURCE1] & sim->registers[0][INT_STATUS2] & INT_STATUS2_WOM) return 1;
+    return 0;
+}
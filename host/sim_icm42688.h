@@ -0,0 +1,112 @@
+#ifndef SIM_ICM42688_H_
+#define SIM_ICM42688_H_
+
+#include "main.h"
+#include <stdint.h>
+
+#define SIM_ICM42688_BANKS 5
+#define SIM_ICM42688_FIFO_SIZE 2048
+
+// Called for every sample at the output data rate, fills accel and gyro (XYZ, raw LSB)
+typedef void (*sim_icm42688_source)(void* context, uint64_t time_ns, int16_t* accel, int16_t* gyro);
+
+typedef struct {
+    uint64_t register_reads;
+    uint64_t register_writes;
+    uint64_t fifo_bytes_read;
+    uint32_t samples;
+    uint32_t packets;
+    uint32_t packets_lost;          // FIFO full, dropped (stop-on-full) or overwritten (stream)
+    uint32_t resets;
+    uint32_t wom_events;            // Samples that raised a wake on motion flag
+    uint64_t accel_lp_ns;           // Time in each power mode (PWR_MGMT0), up to the last update
+    uint64_t accel_ln_ns;
+    uint64_t gyro_ln_ns;
+} sim_icm42688_stats_t;
+
+typedef struct {
+    host_device_t device;
+    uint8_t registers[SIM_ICM42688_BANKS][128];
+    uint8_t bank;
+    uint8_t fifo[SIM_ICM42688_FIFO_SIZE];
+    uint16_t fifo_head;
+    uint16_t fifo_count;
+    uint8_t packet_size;
+    uint64_t sample_period;         // 0 while both sensors are off
+    uint64_t next_sample;
+    uint64_t fifo_ths_ns;           // Sample time that last raised FIFO_THS from clear
+    sim_icm42688_source source;
+    void* source_context;
+    uint32_t noise;
+    int16_t wom_reference[3];       // Sample wake on motion compares against
+    uint8_t wom_valid;
+    uint64_t power_ns;              // Power mode time counted up to here
+    int32_t internal_ppm;           // Clock error of the internal oscillator and of CLKIN, against host time
+    int32_t clkin_ppm;
+    int32_t clock_ppm;              // Clock in use
+    uint64_t sensor_ns;             // Sensor time, on its own clock, at clock_ns host time
+    uint64_t clock_ns;
+
+    // Transaction in progress, decoded byte by byte while CS is low
+    uint8_t selected;
+    uint32_t position;
+    uint8_t read;
+    uint8_t address;
+
+    sim_icm42688_stats_t stats;
+} sim_icm42688_t;
+
+/**
+ * @brief Create an ICM-42688-P model with reset register values and attach it to a chip select pin. Samples are
+ * generated against the virtual clock at the configured ODR into the data registers and the 2KB FIFO
+ *
+ * @param sim           Model structure
+ * @param cs_port       Chip select port
+ * @param cs_pin        Chip select pin
+ *
+ * @return 0 or -1
+ */
+int sim_icm42688_init(sim_icm42688_t* sim, GPIO_TypeDef* cs_port, uint16_t cs_pin);
+
+/**
+ * @brief Replace the default signal (1g on Z plus a few LSB of noise) with a custom one
+ *
+ * @param sim           Model structure
+ * @param source        Sample function, NULL for the default
+ * @param context       Passed to the sample function
+ *
+ * @return 0 or -1
+ */
+int sim_icm42688_set_source(sim_icm42688_t* sim, sim_icm42688_source source, void* context);
+
+/**
+ * @brief Set the clock errors. The internal oscillator runs the sensor unless RTC_MODE (INTF_CONFIG1) is set with
+ * pin 9 as CLKIN (INTF_CONFIG5), then CLKIN does. Sample rate, FIFO timestamps and TMSTVAL follow the clock in use
+ *
+ * @param sim           Model structure
+ * @param internal_ppm  Internal oscillator error, positive runs fast
+ * @param clkin_ppm     CLKIN error
+ *
+ * @return 0 or -1
+ */
+int sim_icm42688_set_clock_ppm(sim_icm42688_t* sim, int32_t internal_ppm, int32_t clkin_ppm);
+
+/**
+ * @brief Generate the samples due up to the current virtual time. Runs on every chip select, call it before
+ * looking at the model state directly
+ *
+ * @param sim           Model structure
+ */
+void sim_icm42688_update(sim_icm42688_t* sim);
+
+/**
+ * @brief Level of INT1: set while an interrupt status bit enabled in INT_SOURCE0 or INT_SOURCE1 (wake on
+ * motion) is pending
+ *
+ * @param sim           Model structure
+ *
+ * @return 1 asserted, 0 not
+ */
+uint8_t sim_icm42688_int1(sim_icm42688_t* sim);
+
+#endif /* SIM_ICM42688_H_ */
@@ -0,0 +1,60 @@
+#include "sim_sn74hc595.h"
+#include <string.h>
+
+// RCLK watched through the chip select hook, selected is 1 when the pin goes low
+static void rclk_edge(void* context, uint8_t low) {
+    sim_sn74hc595_t* sim = (sim_sn74hc595_t*)context;
+    if (low) return;
+
+    uint64_t now = host_time_ns();
+    memcpy(sim->outputs, sim->shift, sim->chain_length);
+    if (sim->shifted_since_latch != sim->chain_length) sim->stats.partial_latches++;
+    sim->shifted_since_latch = 0;
+
+    if (sim->stats.latches == 0) {
+        sim->stats.first_latch_ns = now;
+    } else {
+        uint64_t interval = now - sim->stats.last_latch_ns;
+        if ((sim->stats.min_latch_interval_ns == 0) || (interval < sim->stats.min_latch_interval_ns)) {
+            sim->stats.min_latch_interval_ns = interval;
+        }
+    }
+    sim->stats.last_latch_ns = now;
+    sim->stats.latches++;
+}
+
+// Each byte enters the first register and pushes the others one place down the chain, QH' of the last is lost
+static void transfer(void* context, const uint8_t* tx_data, uint8_t* rx_data, uint32_t size) {
+    sim_sn74hc595_t* sim = (sim_sn74hc595_t*)context;
+    (void)rx_data;
+    for (uint32_t i = 0; i < size; i++) {
+        memmove(&sim->shift[1], &sim->shift[0], sim->chain_length - 1);
+        sim->shift[0] = tx_data ? tx_data[i] : 0xFF;
+    }
+    sim->shifted_since_latch += size;
+    sim->stats.bytes_shifted += size;
+}
+
+int sim_sn74hc595_init(sim_sn74hc595_t* sim, SPI_HandleTypeDef* hspi, GPIO_TypeDef* rclk_port, uint16_t rclk_pin,
+                       uint8_t chain_length) {
+    if (!sim) return -1;
+    if ((chain_length == 0) || (chain_length > SIM_SN74HC595_MAX_CHAIN)) return -1;
+    memset(sim, 0, sizeof(*sim));
+    sim->chain_length = chain_length;
+    sim->device.cs_port = rclk_port;
+    sim->device.cs_pin = rclk_pin;
+    sim->device.hspi = hspi;
+    sim->device.shared = 1;
+    sim->device.select = &rclk_edge;
+    sim->device.transfer = &transfer;
+    sim->device.context = sim;
+    return host_attach_device(&sim->device);
+}
+
+double sim_sn74hc595_frame_rate(sim_sn74hc595_t* sim) {
+    if (!sim) return 0.0;
+    if (sim->stats.latches < 2) return 0.0;
+    uint64_t span = sim->stats.last_latch_ns - sim->stats.first_latch_ns;
+    if (span == 0) return 0.0;
+    return (double)(sim->stats.latches - 1) * 1e9 / (double)span;
+}
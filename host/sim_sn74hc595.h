@@ -0,0 +1,51 @@
+#ifndef SIM_SN74HC595_H_
+#define SIM_SN74HC595_H_
+
+#include "main.h"
+#include <stdint.h>
+
+#define SIM_SN74HC595_MAX_CHAIN 16
+
+typedef struct {
+    uint64_t bytes_shifted;
+    uint32_t latches;
+    uint32_t partial_latches;       // Latched after fewer or more bytes than the chain length
+    uint64_t first_latch_ns;
+    uint64_t last_latch_ns;
+    uint64_t min_latch_interval_ns;
+} sim_sn74hc595_stats_t;
+
+typedef struct {
+    host_device_t device;
+    uint8_t chain_length;
+    uint8_t shift[SIM_SN74HC595_MAX_CHAIN];     // [0] is the register nearest the MCU
+    uint8_t outputs[SIM_SN74HC595_MAX_CHAIN];
+    uint32_t shifted_since_latch;
+    sim_sn74hc595_stats_t stats;
+} sim_sn74hc595_t;
+
+/**
+ * @brief Create a chain of 74HC595 shift registers on an SPI bus. The chain has no chip select: every byte
+ * clocked on the bus shifts in, and the outputs update on the rising edge of RCLK
+ *
+ * @param sim           Model structure
+ * @param hspi          SPI bus feeding SER / SRCLK
+ * @param rclk_port     Latch port
+ * @param rclk_pin      Latch pin
+ * @param chain_length  Number of registers, 1 to SIM_SN74HC595_MAX_CHAIN
+ *
+ * @return 0 or -1
+ */
+int sim_sn74hc595_init(sim_sn74hc595_t* sim, SPI_HandleTypeDef* hspi, GPIO_TypeDef* rclk_port, uint16_t rclk_pin,
+                       uint8_t chain_length);
+
+/**
+ * @brief Frames latched per second between the first and the last latch
+ *
+ * @param sim           Model structure
+ *
+ * @return Frame rate in Hz, 0 with fewer than two latches
+ */
+double sim_sn74hc595_frame_rate(sim_sn74hc595_t* sim);
+
+#endif /* SIM_SN74HC595_H_ */
@@ -0,0 +1,357 @@
+#include "sim_w25q64jv.h"
+#include "W25Q64JV_registers.h"
+#include <string.h>
+
+// Datasheet typical times in ns
+#define T_BYTE_FIRST 30000ULL
+#define T_BYTE_NEXT 2500ULL
+#define T_PAGE_PROGRAM 400000ULL
+#define T_STATUS_WRITE 10000000ULL
+#define T_SECTOR_ERASE 45000000ULL
+#define T_BLOCK_ERASE_32KB 120000000ULL
+#define T_BLOCK_ERASE_64KB 150000000ULL
+#define T_CHIP_ERASE_PER_MB 2500000000ULL
+#define T_SUSPEND 20000ULL
+#define T_RELEASE_POWER_DOWN 3000ULL
+#define T_RELEASE_POWER_DOWN_ID 1800ULL
+
+static const uint8_t unique_id[8] = {0xD2, 0x64, 0x38, 0x1C, 0x47, 0x2A, 0x13, 0x5F};
+
+static void put_dword(uint8_t* data, uint32_t value) {
+    data[0] = (uint8_t)value;
+    data[1] = (uint8_t)(value >> 8);
+    data[2] = (uint8_t)(value >> 16);
+    data[3] = (uint8_t)(value >> 24);
+}
+
+// JESD216B header and basic parameter table, typical times rounded up to the SFDP units
+static void build_sfdp(sim_w25q64jv_t* sim) {
+    uint8_t* sfdp = sim->sfdp;
+    memset(sfdp, 0xFF, SIM_W25Q64JV_SFDP_SIZE);
+    put_dword(&sfdp[0x00], 0x50444653);         // "SFDP"
+    put_dword(&sfdp[0x04], 0xFF000106);         // Rev 1.6, one parameter header
+    put_dword(&sfdp[0x08], 0x10010600);         // Basic table rev 1.6, 16 DWORDs
+    put_dword(&sfdp[0x0C], 0xFF000080);         // at 0x80
+
+    uint8_t* table = &sfdp[0x80];
+    put_dword(&table[0], 0xFFF120E5);           // 4KB erase 0x20, 1-1-2, 1-2-2, 1-4-4 and 1-1-4 reads
+    put_dword(&table[4], (sim->capacity * 8) - 1);
+    put_dword(&table[8], 0x6B08EB44);           // 1-4-4 0xEB 4 dummy + 2 mode clocks, 1-1-4 0x6B 8 dummy
+    put_dword(&table[12], 0xBB803B08);          // 1-1-2 0x3B 8 dummy, 1-2-2 0xBB 4 mode clocks
+    put_dword(&table[16], 0xFFFFFFEE);          // No 2-2-2 / 4-4-4
+    put_dword(&table[20], 0x0000FFFF);
+    put_dword(&table[24], 0x0000FFFF);
+    put_dword(&table[28], 0x520F200C);          // 4KB 0x20, 32KB 0x52
+    put_dword(&table[32], 0x0000D810);          // 64KB 0xD8
+
+    // Erase typical 48ms, 128ms and 160ms (16ms units), max = 14 x typical
+    put_dword(&table[36], 6 | ((0x20UL | 2) << 4) | ((0x20UL | 7) << 11) | ((0x20UL | 9) << 18));
+
+    // Page 256 bytes, program 448us typical, max 8 x typical, first byte 32us, next byte 3us,
+    // chip erase 2.5s per MB in 4s units
+    uint32_t chip_units = (uint32_t)((T_CHIP_ERASE_PER_MB * (sim->capacity / 1048576) + 3999999999ULL) / 4000000000ULL);
+    put_dword(&table[40], 3 | (8UL << 4) | ((0x20UL | 6) << 8) | ((0x10UL | 3) << 14) | (2UL << 19) | ((0x40UL | (chip_units - 1)) << 24));
+    put_dword(&table[44], 0xEC1F0A3F);          // Suspend / resume supported
+    put_dword(&table[48], 0x757A757A);          // Suspend 0x75, resume 0x7A
+    put_dword(&table[52], 0xFFFFF7A3);
+    put_dword(&table[56], 0xFF509F00);          // QE is SR2 bit 1
+    put_dword(&table[60], 0xFFFFF0E8);
+}
+
+static uint8_t jedec_id(sim_w25q64jv_t* sim, uint32_t index) {
+    if (index == 0) return 0xEF;
+    if (index == 1) return 0x40;
+
+    // Capacity ID is log2 of the size in bytes
+    uint8_t capacity_id = 0;
+    while ((1UL << capacity_id) < sim->capacity) capacity_id++;
+    return capacity_id;
+}
+
+// 0x15 / 0x16 / 0x17 for the 4 / 8 / 16MB parts
+static uint8_t device_id(sim_w25q64jv_t* sim) {
+    return (uint8_t)(0x15 + ((sim->capacity / 4194304) / 2));
+}
+
+static uint8_t busy(sim_w25q64jv_t* sim) {
+    return host_time_ns() < sim->busy_until;
+}
+
+static void start_busy(sim_w25q64jv_t* sim, uint64_t duration, uint8_t suspendable) {
+    sim->busy_until = host_time_ns() + duration;
+    sim->suspendable = suspendable;
+    sim->stats.busy_ns += duration;
+}
+
+static uint8_t address_bytes(uint8_t opcode) {
+    switch (opcode) {
+        case READ_DATA:
+        case FAST_READ:
+        case PAGE_PROGRAM:
+        case SECTOR_ERASE_4KB:
+        case BLOCK_ERASE_32KB:
+        case BLOCK_ERASE_64KB:
+        case MANUFACTURER_DEVICE_ID:
+        case READ_SFDP_REGISTER:
+        case FAST_READ_QUAD_IO:
+        return 3;
+        default:
+        return 0;
+    }
+}
+
+static uint8_t dummy_bytes(uint8_t opcode) {
+    switch (opcode) {
+        case FAST_READ:
+        case READ_SFDP_REGISTER:
+        return 1;
+        case RELEASE_POWER_DOWN:
+        return 3;
+        case READ_UNIQUE_ID:
+        return 4;
+        case FAST_READ_QUAD_IO:     // Lines are not modelled: the mode byte and 4 dummy clocks as 2 bytes
+        case SET_BURST_WITH_WRAP:   // 24 dummy bits before the wrap bits
+        return 3;
+        default:
+        return 0;
+    }
+}
+
+static void erase(sim_w25q64jv_t* sim, uint32_t size, uint64_t duration) {
+    uint32_t start = sim->address & ~(size - 1);
+    memset(&sim->memory[start], 0xFF, size);
+    for (uint32_t i = start / 4096; i < (start + size) / 4096; i++) sim->sector_erases[i]++;
+    sim->stats.erases++;
+    start_busy(sim, duration, 1);
+}
+
+// Program and erase start on the rising edge of CS, like the real part
+static void execute(sim_w25q64jv_t* sim) {
+    uint8_t write_enabled = sim->status[0] & SR1_WEL;
+    uint32_t header = 1 + address_bytes(sim->opcode);
+
+    // Reset Device only follows Enable Reset directly
+    uint8_t reset_enabled = sim->reset_enabled;
+    sim->reset_enabled = 0;
+
+    switch (sim->opcode) {
+        case ENABLE_RESET:
+        if (sim->position == 1) sim->reset_enabled = 1;
+        return;
+        case RESET_DEVICE:
+        if ((sim->position != 1) || !reset_enabled || busy(sim)) return;
+        sim->status[0] &= ~SR1_WEL;
+        sim->wrap = 0;
+        return;
+        case SET_BURST_WITH_WRAP:
+        if (sim->position != 5) return;
+        // W4 = 1 turns wrapping off, W6:W5 select 8/16/32/64 bytes
+        sim->wrap = (sim->pending_wrap & 0x10) ? 0 : (8U << ((sim->pending_wrap >> 5) & 0x03));
+        return;
+        case WRITE_ENABLE:
+        if (sim->position == 1) sim->status[0] |= SR1_WEL;
+        return;
+        case WRITE_DISABLE:
+        sim->status[0] &= ~SR1_WEL;
+        return;
+        case POWER_DOWN:
+        if ((sim->position != 1) || busy(sim)) return;
+        sim->powered_down = 1;
+        sim->power_down_start = host_time_ns();
+        sim->stats.power_downs++;
+        return;
+        case RELEASE_POWER_DOWN:
+        if (!sim->powered_down) return;
+        sim->powered_down = 0;
+        sim->stats.powered_down_ns += host_time_ns() - sim->power_down_start;
+        // tRES2 when the device ID was clocked out, tRES1 otherwise
+        sim->release_until = host_time_ns() + ((sim->position > 4) ? T_RELEASE_POWER_DOWN_ID : T_RELEASE_POWER_DOWN);
+        return;
+        case ERASE_PROGRAM_SUSPEND:
+        // Accepted during a sector, block or page operation, the array is readable after tSUS
+        if ((sim->position != 1) || !busy(sim) || !sim->suspendable || (sim->status[1] & SR2_SUS)) return;
+        sim->suspended_remaining = sim->busy_until - host_time_ns();
+        sim->busy_until = host_time_ns() + T_SUSPEND;
+        sim->suspendable = 0;
+        sim->status[1] |= SR2_SUS;
+        sim->stats.suspends++;
+        return;
+        case ERASE_PROGRAM_RESUME:
+        if ((sim->position != 1) || busy(sim) || !(sim->status[1] & SR2_SUS)) return;
+        sim->busy_until = host_time_ns() + sim->suspended_remaining;
+        sim->suspendable = 1;
+        sim->status[1] &= ~SR2_SUS;
+        return;
+        case PAGE_PROGRAM:
+        if (!write_enabled || (sim->position <= header)) break;
+        for (uint16_t i = 0; i < sim->program_size; i++) {
+            uint32_t target = (sim->address & ~0xFFU) | ((sim->address + i) & 0xFF);
+            sim->memory[target] &= sim->program_data[i];
+        }
+        sim->stats.programs++;
+        sim->stats.bytes_programmed += sim->program_size;
+        {
+            uint64_t duration = T_BYTE_FIRST + (T_BYTE_NEXT * (sim->program_size - 1));
+            start_busy(sim, (duration > T_PAGE_PROGRAM) ? T_PAGE_PROGRAM : duration, 1);
+        }
+        break;
+        case SECTOR_ERASE_4KB:
+        if (!write_enabled || (sim->position != header) || (sim->status[1] & SR2_SUS)) break;
+        erase(sim, 4096, T_SECTOR_ERASE);
+        break;
+        case BLOCK_ERASE_32KB:
+        if (!write_enabled || (sim->position != header) || (sim->status[1] & SR2_SUS)) break;
+        erase(sim, 32768, T_BLOCK_ERASE_32KB);
+        break;
+        case BLOCK_ERASE_64KB:
+        if (!write_enabled || (sim->position != header) || (sim->status[1] & SR2_SUS)) break;
+        erase(sim, 65536, T_BLOCK_ERASE_64KB);
+        break;
+        case CHIP_ERASE:
+        case 0x60:
+        if (!write_enabled || (sim->position != 1) || (sim->status[1] & SR2_SUS)) break;
+        sim->address = 0;
+        erase(sim, sim->capacity, T_CHIP_ERASE_PER_MB * (sim->capacity / 1048576));
+        break;
+        case WRITE_STATUS_REGISTER_1:
+        case WRITE_STATUS_REGISTER_2:
+        case WRITE_STATUS_REGISTER_3:
+        if (!write_enabled || (sim->position != 2)) break;
+        {
+            uint8_t reg = (sim->opcode == WRITE_STATUS_REGISTER_1) ? 0 : (sim->opcode == WRITE_STATUS_REGISTER_2) ? 1 : 2;
+            sim->status[reg] = (reg == 0) ? (uint8_t)(sim->pending_status & 0xFC) : sim->pending_status;
+        }
+        start_busy(sim, T_STATUS_WRITE, 0);
+        break;
+        default:
+        return;
+    }
+    // Any program, erase or status write attempt clears the write enable latch
+    sim->status[0] &= ~SR1_WEL;
+}
+
+static void device_select(void* context, uint8_t selected) {
+    sim_w25q64jv_t* sim = (sim_w25q64jv_t*)context;
+    if (selected) {
+        sim->selected = 1;
+        sim->position = 0;
+        sim->address = 0;
+        sim->program_size = 0;
+    } else if (sim->selected) {
+        sim->selected = 0;
+        if (sim->position > 0) execute(sim);
+    }
+}
+
+static uint8_t exchange(sim_w25q64jv_t* sim, uint8_t in) {
+    uint32_t index = sim->position++;
+    if (index == 0) {
+        sim->opcode = in;
+        // In deep power-down, and for tRES1 after release, only release power-down is decoded
+        if ((sim->powered_down || (host_time_ns() < sim->release_until)) && (in != RELEASE_POWER_DOWN)) {
+            sim->opcode = 0x00;
+            sim->stats.ignored_commands++;
+            return 0xFF;
+        }
+        // While busy only the status registers and suspend answer
+        if (busy(sim) && (in != READ_STATUS_REGISTER_1) && (in != READ_STATUS_REGISTER_2) && (in != READ_STATUS_REGISTER_3) &&
+            (in != ERASE_PROGRAM_SUSPEND)) {
+            sim->opcode = 0x00;
+        }
+        return 0xFF;
+    }
+
+    uint32_t header = 1 + address_bytes(sim->opcode);
+    if (index < header) {
+        sim->address = (sim->address << 8) | in;
+        return 0xFF;
+    }
+    if (index < (header + dummy_bytes(sim->opcode))) return 0xFF;
+    uint32_t data_index = index - header - dummy_bytes(sim->opcode);
+
+    switch (sim->opcode) {
+        case READ_STATUS_REGISTER_1:
+        return (uint8_t)((sim->status[0] & ~SR1_BUSY) | (busy(sim) ? SR1_BUSY : 0));
+        case READ_STATUS_REGISTER_2:
+        return sim->status[1];
+        case READ_STATUS_REGISTER_3:
+        return sim->status[2];
+        case READ_DATA:
+        case FAST_READ:
+        sim->stats.bytes_read++;
+        return sim->memory[(sim->address + data_index) % sim->capacity];
+        case FAST_READ_QUAD_IO:
+        sim->stats.bytes_read++;
+        if (sim->wrap == 0) return sim->memory[(sim->address + data_index) % sim->capacity];
+        // Wraps at the end of the aligned wrap length, the next bytes come from its start
+        return sim->memory[((sim->address & ~(sim->wrap - 1)) | ((sim->address + data_index) & (sim->wrap - 1))) % sim->capacity];
+        case SET_BURST_WITH_WRAP:
+        sim->pending_wrap = in;
+        return 0xFF;
+        case PAGE_PROGRAM:
+        // Only the last 256 bytes clocked in are kept
+        if (sim->program_size < sizeof(sim->program_data)) {
+            sim->program_data[sim->program_size++] = in;
+        } else {
+            memmove(sim->program_data, &sim->program_data[1], sizeof(sim->program_data) - 1);
+            sim->program_data[sizeof(sim->program_data) - 1] = in;
+            sim->address++;
+        }
+        return 0xFF;
+        case WRITE_STATUS_REGISTER_1:
+        case WRITE_STATUS_REGISTER_2:
+        case WRITE_STATUS_REGISTER_3:
+        sim->pending_status = in;
+        return 0xFF;
+        case JEDEC_ID:
+        return jedec_id(sim, data_index % 3);
+        case MANUFACTURER_DEVICE_ID:
+        return (data_index % 2) ? device_id(sim) : 0xEF;
+        case RELEASE_POWER_DOWN:
+        return device_id(sim);
+        case READ_SFDP_REGISTER:
+        return sim->sfdp[(sim->address + data_index) % SIM_W25Q64JV_SFDP_SIZE];
+        case READ_UNIQUE_ID:
+        return unique_id[data_index % 8];
+        default:
+        return 0xFF;
+    }
+}
+
+static void transfer(void* context, const uint8_t* tx_data, uint8_t* rx_data, uint32_t size) {
+    sim_w25q64jv_t* sim = (sim_w25q64jv_t*)context;
+    for (uint32_t i = 0; i < size; i++) {
+        uint8_t out = exchange(sim, tx_data ? tx_data[i] : 0xFF);
+        if (rx_data != NULL) rx_data[i] = out;
+    }
+}
+
+int sim_w25q64jv_init(sim_w25q64jv_t* sim, GPIO_TypeDef* cs_port, uint16_t cs_pin) {
+    if (!sim) return -1;
+    memset(sim, 0, sizeof(*sim));
+    memset(sim->memory, 0xFF, sizeof(sim->memory));
+    sim->capacity = 8388608;
+    build_sfdp(sim);
+    sim->device.cs_port = cs_port;
+    sim->device.cs_pin = cs_pin;
+    sim->device.select = &device_select;
+    sim->device.transfer = &transfer;
+    sim->device.context = sim;
+    return host_attach_device(&sim->device);
+}
+
+int sim_w25q64jv_set_capacity(sim_w25q64jv_t* sim, uint32_t capacity) {
+    if (!sim) return -1;
+    if ((capacity != 4194304) && (capacity != 8388608) && (capacity != 16777216)) return -1;
+    sim->capacity = capacity;
+    memset(sim->memory, 0xFF, sizeof(sim->memory));
+    build_sfdp(sim);
+    return 0;
+}
+
+uint64_t sim_w25q64jv_powered_down_ns(sim_w25q64jv_t* sim) {
+    if (!sim) return 0;
+    uint64_t total = sim->stats.powered_down_ns;
+    if (sim->powered_down) total += host_time_ns() - sim->power_down_start;
+    return total;
+}
@@ -0,0 +1,85 @@
+#ifndef SIM_W25Q64JV_H_
+#define SIM_W25Q64JV_H_
+
+#include "main.h"
+#include <stdint.h>
+
+// Largest part modelled (W25Q128JV), the default is the 8MB W25Q64JV
+#define SIM_W25Q64JV_MAX_CAPACITY 16777216
+#define SIM_W25Q64JV_SECTORS (SIM_W25Q64JV_MAX_CAPACITY / 4096)
+#define SIM_W25Q64JV_SFDP_SIZE 256
+
+typedef struct {
+    uint64_t bytes_read;
+    uint64_t bytes_programmed;
+    uint32_t programs;
+    uint32_t erases;
+    uint32_t suspends;
+    uint32_t power_downs;
+    uint32_t ignored_commands;     // Sent during deep power-down or tRES1
+    uint64_t busy_ns;
+    uint64_t powered_down_ns;
+} sim_w25q64jv_stats_t;
+
+typedef struct {
+    host_device_t device;
+    uint8_t memory[SIM_W25Q64JV_MAX_CAPACITY];
+    uint32_t capacity;
+    uint8_t sfdp[SIM_W25Q64JV_SFDP_SIZE];
+    uint32_t sector_erases[SIM_W25Q64JV_SECTORS];
+    uint8_t status[3];
+    uint64_t busy_until;
+    uint64_t suspended_remaining;
+    uint8_t suspendable;
+    uint8_t powered_down;
+    uint64_t power_down_start;
+    uint64_t release_until;
+    uint32_t wrap;                  // Set Burst with Wrap length for 0xEB reads, 0 when off
+    uint8_t reset_enabled;
+
+    // Command in progress, decoded byte by byte while CS is low
+    uint8_t selected;
+    uint8_t opcode;
+    uint32_t position;
+    uint32_t address;
+    uint8_t program_data[256];
+    uint16_t program_size;
+    uint8_t pending_status;
+    uint8_t pending_wrap;
+
+    sim_w25q64jv_stats_t stats;
+} sim_w25q64jv_t;
+
+/**
+ * @brief Create a blank (erased) W25Q64JV model and attach it to a chip select pin. Busy times use the
+ * datasheet typical values against the virtual clock
+ *
+ * @param sim           Model structure, large (16MB), place in static memory
+ * @param cs_port       Chip select port
+ * @param cs_pin        Chip select pin
+ *
+ * @return 0 or -1
+ */
+int sim_w25q64jv_init(sim_w25q64jv_t* sim, GPIO_TypeDef* cs_port, uint16_t cs_pin);
+
+/**
+ * @brief Model a different member of the family: 4194304 (W25Q32JV), 8388608 (W25Q64JV) or 16777216 (W25Q128JV).
+ * Sets the JEDEC capacity ID, the SFDP density and the chip erase time, and erases the array
+ *
+ * @param sim           Model structure
+ * @param capacity      Size in bytes
+ *
+ * @return 0 or -1
+ */
+int sim_w25q64jv_set_capacity(sim_w25q64jv_t* sim, uint32_t capacity);
+
+/**
+ * @brief Total time spent in deep power-down, including a power-down in progress
+ *
+ * @param sim           Model structure
+ *
+ * @return Time in ns
+ */
+uint64_t sim_w25q64jv_powered_down_ns(sim_w25q64jv_t* sim);
+
+#endif /* SIM_W25Q64JV_H_ */
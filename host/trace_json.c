@@ -0,0 +1,55 @@
+#include "trace_json.h"
+#include "main.h"
+#include "bus_trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+static const char* device_name(uint8_t device) {
+    switch (device) {
+        case BUS_TRACE_ICM42688:
+        return "ICM-42688-P";
+        case BUS_TRACE_SN74HC595:
+        return "SN74HC595";
+        case BUS_TRACE_W25Q64JV:
+        return "W25Q64JV";
+        default:
+        return "unknown";
+    }
+}
+
+static double cycles_to_us(int64_t cycles) {
+    return (double)cycles * 1000000.0 / (double)SystemCoreClock;
+}
+
+int host_trace_write_json(const char* path) {
+    if (!path) return -1;
+    bus_trace_record_t* records = malloc(sizeof(bus_trace_record_t) * BUS_TRACE_DEPTH);
+    if (!records) return -1;
+    uint32_t count = bus_trace_read(records, BUS_TRACE_DEPTH);
+
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        free(records);
+        return -1;
+    }
+    fprintf(file, "{\"traceEvents\":[\n");
+    for (uint8_t device = BUS_TRACE_ICM42688; device <= BUS_TRACE_W25Q64JV; device++) {
+        fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                (device == BUS_TRACE_ICM42688) ? "" : ",\n", device, device_name(device));
+    }
+
+    // Records are in completion order, the 32 bit counter is unwrapped from the signed difference to the previous
+    // start (a DMA read or an interrupted call can start before the record ahead of it)
+    int64_t start = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (i > 0) start += (int32_t)(records[i].start - records[i - 1].start);
+        fprintf(file, ",\n{\"name\":\"0x%02X\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u,"
+                      "\"args\":{\"bytes\":%u,\"cs_us\":%.3f}}",
+                records[i].op, cycles_to_us(start), cycles_to_us(records[i].end - records[i].start), records[i].device,
+                records[i].bytes, cycles_to_us(records[i].cs_cycles));
+    }
+    fprintf(file, "\n]}\n");
+    fclose(file);
+    free(records);
+    return (int)count;
+}
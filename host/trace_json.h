@@ -0,0 +1,16 @@
+#ifndef TRACE_JSON_H_
+#define TRACE_JSON_H_
+
+#include <stdint.h>
+
+/**
+ * @brief Write the bus trace ring as Chrome trace JSON (chrome://tracing, Perfetto). One complete event per
+ * transaction, one thread per device, cycle counts unwrapped and converted with SystemCoreClock
+ *
+ * @param path          Output file
+ *
+ * @return Number of events written or -1
+ */
+int host_trace_write_json(const char* path);
+
+#endif /* TRACE_JSON_H_ */